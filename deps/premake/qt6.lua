@@ -4,18 +4,11 @@ qt6 = {
     binPath = path.join(dependencies.basePath, "qt6/bin"),          -- Path to Qt6 binaries (DLLs)
 }
 
-function qt6.run_moc() -- func for qt moc headers needing moc processing with the correct path
-    
-    local headers = {
-        "source/patcher/patching/patcher.hpp",
-        "source/patcher/patching/apk_patcher.hpp",
-        "source/patcher/patching/ipa_patcher.hpp",
-        "source/patcher/main/MainWindow.hpp"
-        -- Add moc headers as needed
-    }
+function qt6.run_moc(headers, output_dir) -- func for qt moc headers needing moc processing with the correct path
+    -- headers: the project's Q_OBJECT headers, output_dir: where their _moc.cpp files go
 
     -- output dir for the generated moc files
-    local build_output_dir = path.getabsolute("build/src/server/gui/tabs")
+    local build_output_dir = path.getabsolute(output_dir)
 
     -- check build dir
     os.mkdir(build_output_dir)
@@ -62,6 +55,28 @@ function qt6.import()
     qt6.copyDlls()    -- Copy necessary Qt DLLs
 end
 
+-- Func to import QtCore alone, for the engine and its DLL, which must not see the GUI modules
+function qt6.importCore()
+    includedirs {
+        qt6.includePath,
+        path.join(qt6.includePath, "QtCore"),
+    }
+
+    libdirs { qt6.libPath }
+
+    filter "configurations:Debug"
+        libdirs { path.join(qt6.libPath, "debug") }
+        links { "Qt6Cored.lib" }
+
+    filter "configurations:Release"
+        libdirs { path.join(qt6.libPath, "release") }
+        links { "Qt6Core.lib" }
+
+    filter {}
+
+    qt6.systemLinks()
+end
+
 -- Func to set Qt dirs
 function qt6.includes()
     includedirs {
@@ -69,7 +84,7 @@ function qt6.includes()
         path.join(qt6.includePath, "QtCore"),    
         path.join(qt6.includePath, "QtGui"),     
         path.join(qt6.includePath, "QtWidgets"), 
-	path.join(qt6.includePath, "QtNNetwork"), 
+	path.join(qt6.includePath, "QtNetwork"), 
     }
 end
 
@@ -97,6 +112,13 @@ function qt6.links()
 
         }
 
+    filter {}
+
+    qt6.systemLinks()
+end
+
+-- Func to link what the Qt libraries need from the system
+function qt6.systemLinks()
     filter "system:windows"
         links { 
             "Winmm",   
@@ -0,0 +1,36 @@
+zlib = {
+    -- include/zlib.h and lib/<name>.lib, a zlib or zlib-ng build in compatibility mode
+    basePath = path.join(dependencies.basePath, "zlib"),
+    libName = "zlib",
+}
+
+function zlib.import()
+    zlib.includes()
+    zlib.links()
+end
+
+function zlib.includes()
+    includedirs {
+        path.join(zlib.basePath, "include")
+    }
+    -- offers the "zlib" deflate backend next to the built-in one
+    defines {"UTILS_WITH_ZLIB"}
+end
+
+function zlib.links()
+    libdirs {
+        path.join(zlib.basePath, "lib")
+    }
+    links {zlib.libName}
+end
+
+-- only with --with-zlib, the built-in deflate needs nothing
+if _OPTIONS["with-zlib"] then
+    if _OPTIONS["with-zlib"] ~= "" then
+        zlib.basePath = _OPTIONS["with-zlib"]
+    end
+    if _OPTIONS["zlib-lib"] then
+        zlib.libName = _OPTIONS["zlib-lib"]
+    end
+    table.insert(dependencies, zlib)
+end
@@ -19,6 +19,19 @@ function dependencies.imports()
 	end
 end
 
+-- Same as imports, with Qt limited to QtCore
+function dependencies.importsCore()
+	for i, proj in pairs(dependencies) do
+		if type(i) == 'number' then
+			if proj == qt6 then
+				qt6.importCore()
+			else
+				proj.import()
+			end
+		end
+	end
+end
+
 function dependencies.projects()
     for i, proj in pairs(dependencies) do
         if type(i) == 'number' and proj.project then  -- Check if 'project' function exists
@@ -39,6 +52,18 @@ newoption {
 	description = "Enable development builds of the client."
 }
 
+newoption {
+	trigger = "with-zlib",
+	description = "Optional, link zlib (or zlib-ng in compat mode) for the zlib deflate backend; PATH holds include/ and lib/, deps/zlib by default.",
+	value = "PATH"
+}
+
+newoption {
+	trigger = "zlib-lib",
+	description = "Optional, library name for --with-zlib, zlib by default (e.g. zlibstatic or zlib-ng).",
+	value = "NAME"
+}
+
 dependencies.load()
 
 -- Define the main project 
@@ -109,6 +134,54 @@ project "utilities"
 	dependencies.imports()
 	
 	
+-- Define the engine project, the patch pipeline on QtCore alone
+project "engine"
+	kind "StaticLib"
+	language "C++"
+	cppdialect "C++20"
+
+	pchheader "std_include.hpp"
+	pchsource "source/patcher/engine/std_include.cpp"
+
+	-- engine first, so "std_include.hpp" is the engine's and not the GUI one
+	includedirs {"./source/patcher/engine", "./source/patcher", "./source/utilities", "build/src/"}
+
+	files {
+		"./source/patcher/patching/**.hpp",
+		"./source/patcher/patching/**.cpp",
+		"./source/patcher/engine/std_include.hpp",
+		"./source/patcher/engine/std_include.cpp",
+		"build/src/engine/**.cpp"
+	}
+
+	links {"utilities"}
+
+	qt6.run_moc({
+		"source/patcher/patching/patcher.hpp",
+		"source/patcher/patching/apk_patcher.hpp",
+		"source/patcher/patching/ipa_patcher.hpp"
+	}, "build/src/engine")
+
+	dependencies.importsCore()
+
+
+-- Define the C API project, the engine as a DLL for hosts that are not Qt applications
+project "tsto_engine"
+	kind "SharedLib"
+	language "C++"
+	cppdialect "C++20"
+
+	defines {"TSTO_ENGINE_BUILD"}
+
+	includedirs {"./source/patcher/engine", "./source/patcher", "./source/utilities"}
+
+	files {"./source/patcher/engine/tsto_engine.h", "./source/patcher/engine/tsto_engine.cpp"}
+
+	links {"engine", "utilities"}
+
+	dependencies.importsCore()
+
+
 -- Define the server project
 project "patcher"
     kind "WindowedApp"
@@ -140,7 +213,16 @@ project "patcher"
         "build/src/**.cpp"
     }
 
+    -- the pipeline comes from the engine library
+    removefiles
+    {
+        "./source/patcher/patching/**.cpp",
+        "./source/patcher/engine/**",
+        "build/src/engine/**.cpp"
+    }
+
     links {
+        "engine",
         "utilities",  -- Links with utilities
 
     }
@@ -155,7 +237,11 @@ project "patcher"
     filter {}
 	
 	
-	qt6.run_moc()  -- Func to run moc NEEDED this builds the moc file (moc is in qt.lua)
+	qt6.run_moc({
+		"source/patcher/main/MainWindow.hpp",
+		"source/patcher/main/watchdog.hpp",
+		"source/patcher/daemon/inbox.hpp"
+	}, "build/src/server/gui/tabs")  -- Func to run moc NEEDED this builds the moc file (moc is in qt.lua)
 
 	
     dependencies.imports()
@@ -0,0 +1,484 @@
+#include "std_include.hpp"
+#include "artifact_generator.hpp"
+#include "zip.hpp"
+#include <QtCore/QCryptographicHash>
+
+namespace Bench {
+
+namespace {
+
+const QByteArray kDlcUrl = "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/";
+const QByteArray kGameUrl = "https://prod.simpsons-ea.com";
+const QByteArray kDirectorUrl = "https://syn-dir.sn.eamobile.com";
+
+void put8(QByteArray& out, quint8 v) { out.append(static_cast<char>(v)); }
+
+void put16(QByteArray& out, quint16 v)
+{
+    put8(out, v & 0xFF);
+    put8(out, v >> 8);
+}
+
+void put32(QByteArray& out, quint32 v)
+{
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+}
+
+void set32(QByteArray& out, int offset, quint32 v)
+{
+    for (int i = 0; i < 4; i++) {
+        out[offset + i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+void putUleb128(QByteArray& out, quint32 v)
+{
+    do {
+        quint8 b = v & 0x7F;
+        v >>= 7;
+        if (v) {
+            b |= 0x80;
+        }
+        put8(out, b);
+    } while (v);
+}
+
+void align(QByteArray& out, int alignment)
+{
+    while (out.size() % alignment) {
+        put8(out, 0);
+    }
+}
+
+// Deterministic filler so generated artifacts are identical between runs and machines
+QByteArray filler(qint64 size, quint32 seed)
+{
+    QByteArray out(size, Qt::Uninitialized);
+    quint32 x = seed ? seed : 0x9E3779B9u;
+    for (qint64 i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        out[i] = static_cast<char>(x & 0xFF);
+    }
+    return out;
+}
+
+void embed(QByteArray& blob, qint64 offset, const QByteArray& str)
+{
+    QByteArray terminated = str + '\0';
+    if (offset + terminated.size() <= blob.size()) {
+        blob.replace(offset, terminated.size(), terminated);
+    }
+}
+
+quint32 adler32(const char* data, qint64 size)
+{
+    quint32 a = 1, b = 0;
+    for (qint64 i = 0; i < size; i++) {
+        a = (a + static_cast<quint8>(data[i])) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+}
+
+ArtifactGenerator::ArtifactGenerator(const GeneratorOptions& options)
+    : options_(options)
+{
+}
+
+QByteArray ArtifactGenerator::buildDex() const
+{
+    const int classCount = qMax(1, options_.classCount);
+    const QByteArray objectType = "Ljava/lang/Object;";
+    const QByteArray stringType = "Ljava/lang/String;";
+    const QByteArray fieldName = "VALUE";
+    const QList<QByteArray> urls = {kGameUrl, kDirectorUrl, kDlcUrl};
+
+    // each class carries one static final String, every 25th one holds a server URL
+    QList<QByteArray> classTypes;
+    QList<QByteArray> classValues;
+    for (int i = 0; i < classCount; i++) {
+        classTypes.append(QString("Lcom/ea/simpsons/gen/Class%1;").arg(i, 6, 10, QChar('0')).toUtf8());
+        classValues.append(i % 25 == 0 ? urls[(i / 25) % urls.size()]
+                                       : QString("asset/bundle_%1").arg(i, 6, 10, QChar('0')).toUtf8());
+    }
+
+    QList<QByteArray> strings = classTypes + classValues;
+    strings << objectType << stringType << fieldName;
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+
+    auto stringIndex = [&](const QByteArray& s) {
+        return static_cast<quint32>(std::lower_bound(strings.begin(), strings.end(), s) - strings.begin());
+    };
+
+    QList<QByteArray> types = classTypes;
+    types << objectType << stringType;
+    std::sort(types.begin(), types.end());
+
+    auto typeIndex = [&](const QByteArray& s) {
+        return static_cast<quint32>(std::lower_bound(types.begin(), types.end(), s) - types.begin());
+    };
+
+    // zero padded names keep the class descriptors sorted, so field ids and class defs
+    // can simply follow generation order
+
+    const int headerSize = 0x70;
+    const int stringIdsOff = headerSize;
+    const int typeIdsOff = stringIdsOff + strings.size() * 4;
+    const int fieldIdsOff = typeIdsOff + types.size() * 4;
+    const int classDefsOff = fieldIdsOff + classTypes.size() * 8;
+    const int dataOff = classDefsOff + classTypes.size() * 32;
+
+    QByteArray data;
+    QList<quint32> stringDataOffsets;
+    for (const auto& s : strings) {
+        stringDataOffsets.append(dataOff + data.size());
+        putUleb128(data, s.size());
+        data.append(s);
+        put8(data, 0);
+    }
+
+    const int classDataOff = dataOff + data.size();
+    QList<quint32> classDataOffsets;
+    for (int i = 0; i < classTypes.size(); i++) {
+        classDataOffsets.append(dataOff + data.size());
+        putUleb128(data, 1);
+        putUleb128(data, 0);
+        putUleb128(data, 0);
+        putUleb128(data, 0);
+        putUleb128(data, i);
+        putUleb128(data, 0x19);
+    }
+
+    const int encodedArrayOff = dataOff + data.size();
+    QList<quint32> staticValueOffsets;
+    for (const auto& value : classValues) {
+        staticValueOffsets.append(dataOff + data.size());
+        putUleb128(data, 1);
+        put8(data, (3 << 5) | 0x17);
+        put32(data, stringIndex(value));
+    }
+
+    align(data, 4);
+    const int mapOff = dataOff + data.size();
+
+    struct MapItem { quint16 type; quint32 size; quint32 offset; };
+    QList<MapItem> map = {
+        {0x0000, 1, 0},
+        {0x0001, static_cast<quint32>(strings.size()), static_cast<quint32>(stringIdsOff)},
+        {0x0002, static_cast<quint32>(types.size()), static_cast<quint32>(typeIdsOff)},
+        {0x0004, static_cast<quint32>(classTypes.size()), static_cast<quint32>(fieldIdsOff)},
+        {0x0006, static_cast<quint32>(classTypes.size()), static_cast<quint32>(classDefsOff)},
+        {0x2002, static_cast<quint32>(strings.size()), static_cast<quint32>(dataOff)},
+        {0x2000, static_cast<quint32>(classTypes.size()), static_cast<quint32>(classDataOff)},
+        {0x2005, static_cast<quint32>(classTypes.size()), static_cast<quint32>(encodedArrayOff)},
+        {0x1000, 1, static_cast<quint32>(mapOff)},
+    };
+    put32(data, map.size());
+    for (const auto& item : map) {
+        put16(data, item.type);
+        put16(data, 0);
+        put32(data, item.size);
+        put32(data, item.offset);
+    }
+
+    QByteArray dex;
+    dex.append("dex\n035\0", 8);
+    dex.append(QByteArray(24, '\0'));
+    const int fileSize = dataOff + data.size();
+    put32(dex, fileSize);
+    put32(dex, headerSize);
+    put32(dex, 0x12345678);
+    put32(dex, 0);
+    put32(dex, 0);
+    put32(dex, mapOff);
+    put32(dex, strings.size());
+    put32(dex, stringIdsOff);
+    put32(dex, types.size());
+    put32(dex, typeIdsOff);
+    put32(dex, 0);
+    put32(dex, 0);
+    put32(dex, classTypes.size());
+    put32(dex, fieldIdsOff);
+    put32(dex, 0);
+    put32(dex, 0);
+    put32(dex, classTypes.size());
+    put32(dex, classDefsOff);
+    put32(dex, fileSize - dataOff);
+    put32(dex, dataOff);
+
+    for (quint32 offset : stringDataOffsets) {
+        put32(dex, offset);
+    }
+    for (const auto& type : types) {
+        put32(dex, stringIndex(type));
+    }
+    for (const auto& cls : classTypes) {
+        put16(dex, typeIndex(cls));
+        put16(dex, typeIndex(stringType));
+        put32(dex, stringIndex(fieldName));
+    }
+    for (int i = 0; i < classTypes.size(); i++) {
+        put32(dex, typeIndex(classTypes[i]));
+        put32(dex, 0x0001);
+        put32(dex, typeIndex(objectType));
+        put32(dex, 0);
+        put32(dex, 0xFFFFFFFF);
+        put32(dex, 0);
+        put32(dex, classDataOffsets[i]);
+        put32(dex, staticValueOffsets[i]);
+    }
+    dex.append(data);
+
+    QByteArray signature = QCryptographicHash::hash(QByteArrayView(dex).sliced(32), QCryptographicHash::Sha1);
+    dex.replace(12, 20, signature);
+    set32(dex, 8, adler32(dex.constData() + 12, dex.size() - 12));
+    return dex;
+}
+
+QByteArray ArtifactGenerator::buildManifest() const
+{
+    // resource-id attribute names must lead the pool, in resource map order
+    const QStringList strings = {
+        "versionCode", "versionName", "name", "value",
+        "android", "http://schemas.android.com/apk/res/android", "manifest", "package",
+        options_.packageName, options_.versionName, "application", "meta-data",
+        "com.ea.nimble.director.url", QString::fromUtf8(kDirectorUrl),
+    };
+    const QList<quint32> resourceIds = {0x0101021b, 0x0101021c, 0x01010003, 0x01010024};
+    const quint32 none = 0xFFFFFFFF;
+    const quint32 ns = 5;
+
+    QByteArray stringData;
+    QList<quint32> stringOffsets;
+    for (const auto& s : strings) {
+        stringOffsets.append(stringData.size());
+        put16(stringData, s.size());
+        for (QChar c : s) {
+            put16(stringData, c.unicode());
+        }
+        put16(stringData, 0);
+    }
+    align(stringData, 4);
+
+    QByteArray pool;
+    const quint32 poolHeaderSize = 0x1C;
+    const quint32 stringsStart = poolHeaderSize + strings.size() * 4;
+    put16(pool, 0x0001);
+    put16(pool, poolHeaderSize);
+    put32(pool, stringsStart + stringData.size());
+    put32(pool, strings.size());
+    put32(pool, 0);
+    put32(pool, 0);
+    put32(pool, stringsStart);
+    put32(pool, 0);
+    for (quint32 offset : stringOffsets) {
+        put32(pool, offset);
+    }
+    pool.append(stringData);
+
+    QByteArray resourceMap;
+    put16(resourceMap, 0x0180);
+    put16(resourceMap, 8);
+    put32(resourceMap, 8 + resourceIds.size() * 4);
+    for (quint32 id : resourceIds) {
+        put32(resourceMap, id);
+    }
+
+    struct Attribute { quint32 ns; quint32 name; quint32 raw; quint8 type; quint32 data; };
+    QByteArray nodes;
+    int line = 1;
+
+    auto namespaceNode = [&](quint16 type) {
+        put16(nodes, type);
+        put16(nodes, 0x10);
+        put32(nodes, 0x18);
+        put32(nodes, line++);
+        put32(nodes, none);
+        put32(nodes, 4);
+        put32(nodes, ns);
+    };
+    auto startElement = [&](quint32 name, const QList<Attribute>& attributes) {
+        put16(nodes, 0x0102);
+        put16(nodes, 0x10);
+        put32(nodes, 0x24 + attributes.size() * 0x14);
+        put32(nodes, line++);
+        put32(nodes, none);
+        put32(nodes, none);
+        put32(nodes, name);
+        put16(nodes, 0x14);
+        put16(nodes, 0x14);
+        put16(nodes, attributes.size());
+        put16(nodes, 0);
+        put16(nodes, 0);
+        put16(nodes, 0);
+        for (const auto& attr : attributes) {
+            put32(nodes, attr.ns);
+            put32(nodes, attr.name);
+            put32(nodes, attr.raw);
+            put16(nodes, 8);
+            put8(nodes, 0);
+            put8(nodes, attr.type);
+            put32(nodes, attr.data);
+        }
+    };
+    auto endElement = [&](quint32 name) {
+        put16(nodes, 0x0103);
+        put16(nodes, 0x10);
+        put32(nodes, 0x18);
+        put32(nodes, line++);
+        put32(nodes, none);
+        put32(nodes, none);
+        put32(nodes, name);
+    };
+
+    namespaceNode(0x0100);
+    startElement(6, {
+        {ns, 0, none, 0x10, static_cast<quint32>(options_.versionCode)},
+        {ns, 1, 9, 0x03, 9},
+        {none, 7, 8, 0x03, 8},
+    });
+    startElement(10, {});
+    startElement(11, {
+        {ns, 2, 12, 0x03, 12},
+        {ns, 3, 13, 0x03, 13},
+    });
+    endElement(11);
+    endElement(10);
+    endElement(6);
+    namespaceNode(0x0101);
+
+    QByteArray xml;
+    put16(xml, 0x0003);
+    put16(xml, 8);
+    put32(xml, 8 + pool.size() + resourceMap.size() + nodes.size());
+    xml.append(pool);
+    xml.append(resourceMap);
+    xml.append(nodes);
+    return xml;
+}
+
+QByteArray ArtifactGenerator::buildNativeLib(const QString& abi) const
+{
+    const bool is64 = abi.contains("64");
+    QByteArray lib = filler(qMax<qint64>(options_.nativeLibSize, 4096), is64 ? 0x454C4636 : 0x454C4633);
+
+    QByteArray header;
+    header.append("\x7f" "ELF", 4);
+    put8(header, is64 ? 2 : 1);
+    put8(header, 1);
+    put8(header, 1);
+    header.append(QByteArray(9, '\0'));
+    put16(header, 3);
+    put16(header, is64 ? 183 : 40);
+    put32(header, 1);
+    lib.replace(0, header.size(), header);
+
+    // the real libscorpio carries the DLC URL more than once
+    embed(lib, lib.size() / 3, kDlcUrl);
+    embed(lib, (lib.size() / 3) * 2, kDlcUrl);
+    return lib;
+}
+
+QByteArray ArtifactGenerator::buildExecutable() const
+{
+    QByteArray binary = filler(qMax<qint64>(options_.executableSize, 4096), 0x4D414348);
+
+    QByteArray header;
+    put32(header, 0xFEEDFACF);
+    put32(header, 0x0100000C);
+    put32(header, 0);
+    put32(header, 2);
+    put32(header, 0);
+    put32(header, 0);
+    put32(header, 0);
+    put32(header, 0);
+    binary.replace(0, header.size(), header);
+
+    embed(binary, binary.size() / 4, kDlcUrl);
+    embed(binary, binary.size() / 2, kDirectorUrl);
+    embed(binary, (binary.size() / 4) * 3, kGameUrl);
+    return binary;
+}
+
+QByteArray ArtifactGenerator::buildInfoPlist() const
+{
+    QString plist;
+    plist += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    plist += "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n";
+    plist += "<plist version=\"1.0\">\n<dict>\n";
+    auto addString = [&](const QString& key, const QString& value) {
+        plist += QString("\t<key>%1</key>\n\t<string>%2</string>\n").arg(key, value);
+    };
+    addString("CFBundleExecutable", options_.appName);
+    addString("CFBundleIdentifier", "com.ea.simpsonssocial.inc2");
+    addString("CFBundleName", options_.appName);
+    addString("CFBundleShortVersionString", options_.versionName);
+    addString("CFBundleVersion", options_.versionName);
+    addString("DLCLocation", QString::fromUtf8(kDlcUrl));
+    addString("MayhemServerURL", QString::fromUtf8(kGameUrl));
+    plist += "</dict>\n</plist>\n";
+    return plist.toUtf8();
+}
+
+bool ArtifactGenerator::generateAPK(const QString& path, QString* errorMessage) const
+{
+    QString assets = QString("game_server=%1\ndirector=%2\ndlc=%3\n")
+        .arg(QString::fromUtf8(kGameUrl), QString::fromUtf8(kDirectorUrl), QString::fromUtf8(kDlcUrl));
+
+    utils::zip::Writer writer;
+    if (!writer.open(QDir::toNativeSeparators(path).toStdString())) {
+        if (errorMessage) *errorMessage = "Could not create " + path;
+        return false;
+    }
+
+    auto add = [&writer](const QString& name, const QByteArray& data) {
+        return writer.addStored(name.toStdString(), data.constData(), data.size());
+    };
+
+    bool ok = add("AndroidManifest.xml", buildManifest())
+        && add("classes.dex", buildDex())
+        && add("assets/servers.txt", assets.toUtf8());
+
+    for (const auto& abi : options_.abis) {
+        if (!ok) break;
+        ok = add(QString("lib/%1/libscorpio.so").arg(abi), buildNativeLib(abi));
+    }
+
+    ok = writer.close() && ok;
+    if (!ok && errorMessage) {
+        *errorMessage = "Failed to write " + path;
+    }
+    return ok;
+}
+
+bool ArtifactGenerator::generateIPA(const QString& path, QString* errorMessage) const
+{
+    const QString appDir = QString("Payload/%1.app/").arg(options_.appName);
+
+    utils::zip::Writer writer;
+    if (!writer.open(QDir::toNativeSeparators(path).toStdString())) {
+        if (errorMessage) *errorMessage = "Could not create " + path;
+        return false;
+    }
+
+    auto add = [&writer](const QString& name, const QByteArray& data) {
+        return writer.addStored(name.toStdString(), data.constData(), data.size());
+    };
+
+    bool ok = add(appDir + "Info.plist", buildInfoPlist())
+        && add(appDir + options_.appName, buildExecutable());
+
+    ok = writer.close() && ok;
+    if (!ok && errorMessage) {
+        *errorMessage = "Failed to write " + path;
+    }
+    return ok;
+}
+
+}
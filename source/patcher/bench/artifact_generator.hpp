@@ -0,0 +1,37 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Bench {
+
+struct GeneratorOptions {
+    int classCount = 2000;
+    qint64 nativeLibSize = 8 * 1024 * 1024;
+    qint64 executableSize = 32 * 1024 * 1024;
+    QStringList abis = {"arm64-v8a", "armeabi-v7a"};
+    QString appName = "TappedOut";
+    QString packageName = "com.ea.game.simpsons4_row";
+    QString versionName = "4.69.5";
+    int versionCode = 4695;
+};
+
+// Builds fake but structurally valid game artifacts (dex, AXML manifest, ELF and Mach-O
+// shaped binaries) carrying the same URLs as the real builds, so the patch pipeline can
+// be measured without shipping the game.
+class ArtifactGenerator {
+public:
+    explicit ArtifactGenerator(const GeneratorOptions& options = GeneratorOptions());
+
+    bool generateAPK(const QString& path, QString* errorMessage = nullptr) const;
+    bool generateIPA(const QString& path, QString* errorMessage = nullptr) const;
+
+private:
+    QByteArray buildDex() const;
+    QByteArray buildManifest() const;
+    QByteArray buildNativeLib(const QString& abi) const;
+    QByteArray buildExecutable() const;
+    QByteArray buildInfoPlist() const;
+
+    GeneratorOptions options_;
+};
+
+}
@@ -0,0 +1,244 @@
+#include "std_include.hpp"
+#include "bench.hpp"
+#include "patching/patcher.hpp"
+#include "deflate.hpp"
+#include "zip.hpp"
+
+namespace Bench {
+
+namespace {
+
+struct RunResult {
+    bool success = true;
+    QString errorMessage;
+    QList<QPair<QString, qint64>> stages;
+    qint64 totalMs = 0;
+};
+
+qint64 percentile(QList<qint64> values, double p)
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    int rank = static_cast<int>(std::ceil(p * values.size())) - 1;
+    return values[qBound(0, rank, static_cast<int>(values.size()) - 1)];
+}
+
+RunResult runOnce(Patcher::AppPatcher& patcher, const QString& artifact, bool isApk, const BenchOptions& options)
+{
+    RunResult result;
+    QElapsedTimer timer;
+    QString currentStage;
+    qint64 stageStart = 0;
+
+    // every status change marks a stage boundary
+    auto progressConnection = QObject::connect(&patcher, &Patcher::AppPatcher::progressUpdated,
+        [&](int, const QString& status) {
+            if (status == currentStage) {
+                return;
+            }
+            qint64 now = timer.elapsed();
+            if (!currentStage.isEmpty()) {
+                result.stages.append({currentStage, now - stageStart});
+            }
+            currentStage = status;
+            stageStart = now;
+        });
+    auto errorConnection = QObject::connect(&patcher, &Patcher::AppPatcher::error,
+        [&](const QString& message) {
+            result.success = false;
+            result.errorMessage = message;
+        });
+
+    timer.start();
+    const int jobId = isApk ? patcher.patchAPK(artifact, options.gameServerUrl, options.dlcServerUrl)
+                            : patcher.patchIPA(artifact, options.gameServerUrl, options.dlcServerUrl);
+    patcher.waitForJob(jobId);
+    result.totalMs = timer.elapsed();
+    if (!currentStage.isEmpty()) {
+        result.stages.append({currentStage, result.totalMs - stageStart});
+    }
+
+    QObject::disconnect(progressConnection);
+    QObject::disconnect(errorConnection);
+    return result;
+}
+
+bool benchArtifact(const QString& label, const QString& artifact, bool isApk,
+                   const BenchOptions& options, QTextStream& out, QJsonArray& report)
+{
+    Patcher::AppPatcher patcher;
+    QStringList stageOrder;
+    QMap<QString, QList<qint64>> samples;
+    QList<qint64> totals;
+
+    for (int run = 1; run <= options.runs; run++) {
+        RunResult result = runOnce(patcher, artifact, isApk, options);
+        if (!result.success) {
+            out << label << " run " << run << " failed: " << result.errorMessage << Qt::endl;
+            return false;
+        }
+
+        for (const auto& stage : result.stages) {
+            if (!stageOrder.contains(stage.first)) {
+                stageOrder.append(stage.first);
+            }
+            samples[stage.first].append(stage.second);
+        }
+        totals.append(result.totalMs);
+        out << label << " run " << run << "/" << options.runs << ": " << result.totalMs << " ms" << Qt::endl;
+    }
+
+    out << Qt::endl << "=== " << label << " (" << options.runs << " runs) ===" << Qt::endl;
+    out << QString("%1 %2 %3").arg("Stage", -40).arg("p50 ms", 10).arg("p95 ms", 10) << Qt::endl;
+
+    QJsonArray stages;
+    auto addRow = [&](const QString& name, const QList<qint64>& values) {
+        qint64 p50 = percentile(values, 0.50);
+        qint64 p95 = percentile(values, 0.95);
+        out << QString("%1 %2 %3").arg(name, -40).arg(p50, 10).arg(p95, 10) << Qt::endl;
+
+        QJsonObject row;
+        row["stage"] = name;
+        row["p50_ms"] = p50;
+        row["p95_ms"] = p95;
+        stages.append(row);
+    };
+
+    for (const auto& stage : stageOrder) {
+        addRow(stage, samples[stage]);
+    }
+    addRow("Total", totals);
+    out << Qt::endl;
+
+    QJsonObject entry;
+    entry["artifact"] = label;
+    entry["runs"] = options.runs;
+    entry["stages"] = stages;
+    report.append(entry);
+    return true;
+}
+
+// Packs the synthetic IPA tree with every backend, at a few levels, on one core and on all
+bool benchCompression(const QString& artifact, const BenchOptions& options, QTextStream& out, QJsonArray& report)
+{
+    const QString root = QDir(options.workDir).absoluteFilePath("zip-tree");
+    const QString output = QDir(options.workDir).absoluteFilePath("zip-bench.zip");
+    QDir(root).removeRecursively();
+    if (!utils::zip::extractAll(QDir::toNativeSeparators(artifact).toStdString(), QDir::toNativeSeparators(root).toStdString())) {
+        out << "ERROR: Could not extract " << artifact << Qt::endl;
+        return false;
+    }
+
+    const unsigned cores = qMax(1u, std::thread::hardware_concurrency());
+    out << Qt::endl << "=== Deflate (" << options.runs << " runs) ===" << Qt::endl;
+    out << QString("%1 %2 %3 %4 %5").arg("Backend", -12).arg("Level", 6).arg("Threads", 8).arg("p50 ms", 10).arg("Ratio", 8) << Qt::endl;
+
+    bool success = true;
+    for (const auto& backend : utils::deflateBackends()) {
+        // partial timings would read as valid results, a backend that failed once gets no rows
+        bool failed = false;
+        for (int level : {1, 6, 9}) {
+            for (unsigned threads : {1u, cores}) {
+                if (failed) {
+                    break;
+                }
+                utils::DeflateOptions deflate;
+                deflate.backend = backend;
+                deflate.level = level;
+                deflate.threads = threads;
+
+                QList<qint64> times;
+                utils::zip::PackStats stats;
+                for (int run = 0; run < options.runs && !failed; run++) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    std::string errorMessage;
+                    if (!utils::zip::packDirectory(root.toStdString(), output.toStdString(), deflate, &stats, {}, &errorMessage)) {
+                        out << "ERROR: packing with " << QString::fromStdString(backend) << " failed: "
+                            << QString::fromStdString(errorMessage) << ", skipping it" << Qt::endl;
+                        success = false;
+                        failed = true;
+                    } else {
+                        times.append(timer.elapsed());
+                    }
+                }
+                if (failed) {
+                    break;
+                }
+
+                const qint64 p50 = percentile(times, 0.50);
+                const double ratio = stats.inputBytes > 0 ? static_cast<double>(stats.outputBytes) / stats.inputBytes : 1.0;
+                out << QString("%1 %2 %3 %4 %5").arg(QString::fromStdString(backend), -12).arg(level, 6).arg(threads, 8)
+                    .arg(p50, 10).arg(ratio, 8, 'f', 3) << Qt::endl;
+
+                QJsonObject row;
+                row["artifact"] = "deflate";
+                row["backend"] = QString::fromStdString(backend);
+                row["level"] = level;
+                row["threads"] = static_cast<int>(threads);
+                row["p50_ms"] = p50;
+                row["input_bytes"] = static_cast<qint64>(stats.inputBytes);
+                row["output_bytes"] = static_cast<qint64>(stats.outputBytes);
+                report.append(row);
+            }
+        }
+    }
+    out << Qt::endl;
+
+    QFile::remove(output);
+    QDir(root).removeRecursively();
+    return success;
+}
+
+}
+
+int runBench(const BenchOptions& options, QTextStream& out)
+{
+    QDir().mkpath(options.workDir);
+    ArtifactGenerator generator(options.generator);
+    QJsonArray report;
+    bool success = true;
+
+    if (options.type == "apk" || options.type == "both") {
+        QString apkPath = QDir(options.workDir).absoluteFilePath("bench.apk");
+        QString errorMessage;
+        out << "Generating synthetic APK (" << options.generator.classCount << " classes)..." << Qt::endl;
+        if (!generator.generateAPK(apkPath, &errorMessage)) {
+            out << "ERROR: " << errorMessage << Qt::endl;
+            return 1;
+        }
+        success = benchArtifact("APK", apkPath, true, options, out, report) && success;
+    }
+
+    if (options.type == "ipa" || options.type == "both" || options.type == "zip") {
+        QString ipaPath = QDir(options.workDir).absoluteFilePath("bench.ipa");
+        QString errorMessage;
+        out << "Generating synthetic IPA..." << Qt::endl;
+        if (!generator.generateIPA(ipaPath, &errorMessage)) {
+            out << "ERROR: " << errorMessage << Qt::endl;
+            return 1;
+        }
+        if (options.type == "zip") {
+            success = benchCompression(ipaPath, options, out, report) && success;
+        } else {
+            success = benchArtifact("IPA", ipaPath, false, options, out, report) && success;
+        }
+    }
+
+    if (!options.jsonOutput.isEmpty()) {
+        QFile file(options.jsonOutput);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            file.write(QJsonDocument(report).toJson());
+            file.close();
+            out << "Results written to " << options.jsonOutput << Qt::endl;
+        } else {
+            out << "WARNING: Could not write " << options.jsonOutput << Qt::endl;
+        }
+    }
+
+    return success ? 0 : 1;
+}
+
+}
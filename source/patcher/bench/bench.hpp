@@ -0,0 +1,21 @@
+#pragma once
+#include "std_include.hpp"
+#include "artifact_generator.hpp"
+
+namespace Bench {
+
+struct BenchOptions {
+    QString type = "both";
+    int runs = 5;
+    QString workDir = "bench";
+    QString gameServerUrl = "http://127.0.0.1:80";
+    QString dlcServerUrl = "http://127.0.0.1:8080";
+    QString jsonOutput;
+    GeneratorOptions generator;
+};
+
+// Generates synthetic artifacts and runs them through AppPatcher, reporting p50/p95
+// wall time for each stage the pipeline announces through progressUpdated.
+int runBench(const BenchOptions& options, QTextStream& out);
+
+}
@@ -0,0 +1,125 @@
+#include "std_include.hpp"
+#include "client.hpp"
+#include <QtCore/QSaveFile>
+#include <QtNetwork/QLocalSocket>
+
+namespace Daemon {
+
+QString Response::error() const
+{
+    if (!errorMessage.isEmpty()) {
+        return errorMessage;
+    }
+    const QString message = json()["error"].toString();
+    return message.isEmpty() ? QString("daemon answered %1").arg(status) : message;
+}
+
+Client::Client(const QString& socketName)
+    : socketName_(socketName)
+{
+}
+
+bool Client::isRunning(int timeoutMs) const
+{
+    QLocalSocket socket;
+    socket.connectToServer(socketName_);
+    return socket.waitForConnected(timeoutMs);
+}
+
+Response Client::request(const QByteArray& method, const QString& path, const QJsonObject& body) const
+{
+    const QByteArray data = body.isEmpty() ? QByteArray() : QJsonDocument(body).toJson(QJsonDocument::Compact);
+    return send(method, path, data, nullptr);
+}
+
+Response Client::stream(const QString& path, const std::function<void(const QByteArray& data)>& onData) const
+{
+    return send("GET", path, QByteArray(), onData);
+}
+
+Response Client::download(const QString& path, const QString& filePath) const
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        Response response;
+        response.errorMessage = "Could not write " + filePath + ": " + file.errorString();
+        return response;
+    }
+
+    Response response = send("GET", path, QByteArray(), [&file](const QByteArray& data) {
+        if (file.write(data) != data.size()) {
+            file.cancelWriting();
+        }
+    });
+    if (!response.ok()) {
+        // a cut off transfer must not replace the file with part of the artifact
+        file.cancelWriting();
+    } else if (!file.commit()) {
+        response.errorMessage = "Could not write " + filePath + ": " + file.errorString();
+        response.status = 0;
+    }
+    return response;
+}
+
+Response Client::send(const QByteArray& method, const QString& path, const QByteArray& body,
+                      const std::function<void(const QByteArray& data)>& onData) const
+{
+    Response response;
+    QLocalSocket socket;
+    socket.connectToServer(socketName_);
+    if (!socket.waitForConnected(1000)) {
+        response.errorMessage = "No daemon on " + socketName_ + ": " + socket.errorString();
+        return response;
+    }
+
+    QByteArray head = method + " " + path.toUtf8() + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (!body.isEmpty()) {
+        head += "Content-Type: application/json\r\nContent-Length: " + QByteArray::number(body.size()) + "\r\n";
+    }
+    head += "Connection: close\r\n\r\n";
+    socket.write(head + body);
+    socket.flush();
+
+    // the daemon closes the connection once the response is complete
+    QByteArray header;
+    bool headerDone = false;
+    // -1 for event streams, which have no length
+    qint64 expected = -1;
+    qint64 received = 0;
+    while (socket.bytesAvailable() > 0 || socket.waitForReadyRead(-1)) {
+        QByteArray data = socket.readAll();
+        if (!headerDone) {
+            header += data;
+            const qsizetype end = header.indexOf("\r\n\r\n");
+            if (end < 0) {
+                continue;
+            }
+            response.status = header.left(header.indexOf("\r\n")).split(' ').value(1).toInt();
+            for (const auto& line : header.left(end).split('\n')) {
+                const qsizetype colon = line.indexOf(':');
+                if (colon > 0 && line.left(colon).trimmed().toLower() == "content-length") {
+                    expected = line.mid(colon + 1).trimmed().toLongLong();
+                }
+            }
+            data = header.mid(end + 4);
+            headerDone = true;
+        }
+        received += data.size();
+        if (onData && response.ok()) {
+            onData(data);
+        } else {
+            response.body += data;
+        }
+    }
+
+    if (!headerDone) {
+        response.status = 0;
+        response.errorMessage = "The daemon closed the connection: " + socket.errorString();
+    } else if (expected >= 0 && received != expected) {
+        response.status = 0;
+        response.errorMessage = QString("The connection closed after %1 of %2 bytes").arg(received).arg(expected);
+    }
+    return response;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Daemon {
+
+struct Response {
+    // 0 when the daemon could not be reached
+    int status = 0;
+    QByteArray body;
+    QString errorMessage;
+
+    bool ok() const { return status >= 200 && status < 300; }
+    QJsonObject json() const { return QJsonDocument::fromJson(body).object(); }
+    // errorMessage, or the daemon's own "error" field
+    QString error() const;
+};
+
+// Blocking client for the daemon's local socket, one connection per request
+class Client {
+public:
+    explicit Client(const QString& socketName = "tsto_patcher");
+
+    bool isRunning(int timeoutMs = 500) const;
+
+    Response request(const QByteArray& method, const QString& path, const QJsonObject& body = QJsonObject()) const;
+    // Hands a successful body over as it arrives instead of collecting it
+    Response stream(const QString& path, const std::function<void(const QByteArray& data)>& onData) const;
+    // Saves a successful body to filePath, leaving nothing behind on failure
+    Response download(const QString& path, const QString& filePath) const;
+
+private:
+    Response send(const QByteArray& method, const QString& path, const QByteArray& body,
+                  const std::function<void(const QByteArray& data)>& onData) const;
+
+    QString socketName_;
+};
+
+}
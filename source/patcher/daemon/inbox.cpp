@@ -0,0 +1,142 @@
+#include "std_include.hpp"
+#include "inbox.hpp"
+#include "patching/patcher.hpp"
+#include "patching/checkpoint.hpp"
+#include <QtCore/QFileSystemWatcher>
+
+namespace Daemon {
+
+namespace {
+
+// a file still being copied keeps changing, it is only picked up after this long without
+constexpr int settleMs = 2000;
+// writes to a file that already exists do not change the directory, and a copy that stalls for
+// longer than settleMs has been hashed part-way; the whole directory is rescanned this often
+constexpr int rescanMs = 10 * 1000;
+
+struct FileIdentity {
+    qint64 size = 0;
+    QDateTime lastModified;
+
+    bool operator==(const FileIdentity& other) const { return size == other.size && lastModified == other.lastModified; }
+};
+
+}
+
+class InboxPrivate {
+public:
+    Inbox* q;
+    Patcher::AppPatcher& patcher;
+    QString directory;
+    QFileSystemWatcher watcher;
+    QTimer settle;
+    QTimer rescan;
+    QMap<QString, FileIdentity> seen;
+    QSet<QString> hashing;
+    // content hash to the first file that had it
+    QMap<QByteArray, QString> builds;
+    // hashing a build takes a while, the daemon keeps answering meanwhile
+    QThreadPool pool;
+
+    InboxPrivate(Inbox* inbox, Patcher::AppPatcher& appPatcher, const QString& dir)
+        : q(inbox)
+        , patcher(appPatcher)
+        , directory(QDir(dir).absolutePath())
+    {
+        pool.setMaxThreadCount(1);
+        settle.setSingleShot(true);
+        settle.setInterval(settleMs);
+        rescan.setInterval(rescanMs);
+    }
+
+    void scan();
+    void hashed(const QString& path, const FileIdentity& identity, const QByteArray& hash);
+};
+
+void InboxPrivate::scan()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    bool unsettled = false;
+    for (const QFileInfo& info : QDir(directory).entryInfoList(QDir::Files)) {
+        const QString suffix = info.suffix().toLower();
+        if (suffix != "apk" && suffix != "ipa") {
+            continue;
+        }
+
+        // a seen file whose size or time changed was still being written, it is hashed again
+        const QString path = info.absoluteFilePath();
+        const FileIdentity identity{info.size(), info.lastModified()};
+        if (hashing.contains(path) || (seen.contains(path) && seen[path] == identity)) {
+            continue;
+        }
+        if (info.lastModified().msecsTo(now) < settleMs) {
+            unsettled = true;
+            continue;
+        }
+
+        hashing.insert(path);
+        pool.start([this, path, identity]() {
+            const QByteArray hash = Patcher::Checkpoint::hashFile(path);
+            QMetaObject::invokeMethod(q, [this, path, identity, hash]() {
+                hashed(path, identity, hash);
+            }, Qt::QueuedConnection);
+        });
+    }
+
+    if (unsettled) {
+        settle.start();
+    }
+}
+
+void InboxPrivate::hashed(const QString& path, const FileIdentity& identity, const QByteArray& hash)
+{
+    hashing.remove(path);
+    if (hash.isEmpty()) {
+        // gone or still locked by whoever is writing it, the next change brings it back
+        return;
+    }
+    seen.insert(path, identity);
+
+    const QString fileName = QFileInfo(path).fileName();
+    if (builds.contains(hash)) {
+        if (builds[hash] != path) {
+            emit q->log(fileName + " has the same contents as " + QFileInfo(builds[hash]).fileName() + ", not prepared again");
+        }
+        return;
+    }
+
+    builds.insert(hash, path);
+    const int jobId = patcher.prepare(path);
+    emit q->log(QString("New build %1 (%2), preparing it as job %3").arg(fileName, QString::fromLatin1(hash.left(16))).arg(jobId));
+}
+
+Inbox::Inbox(Patcher::AppPatcher& patcher, const QString& directory, QObject* parent)
+    : QObject(parent)
+    , d(new InboxPrivate(this, patcher, directory))
+{
+    connect(&d->watcher, &QFileSystemWatcher::directoryChanged, this, [this]() { d->settle.start(); });
+    connect(&d->settle, &QTimer::timeout, this, [this]() { d->scan(); });
+    connect(&d->rescan, &QTimer::timeout, this, [this]() { d->scan(); });
+}
+
+Inbox::~Inbox()
+{
+    d->pool.waitForDone();
+    delete d;
+}
+
+bool Inbox::start(QString* errorMessage)
+{
+    if (!QDir().mkpath(d->directory) || !d->watcher.addPath(d->directory)) {
+        if (errorMessage) {
+            *errorMessage = "Could not watch " + d->directory;
+        }
+        return false;
+    }
+    emit log("Watching " + d->directory + " for new builds");
+    d->scan();
+    d->rescan.start();
+    return true;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+class AppPatcher;
+}
+
+namespace Daemon {
+
+class InboxPrivate;
+
+// Watches a directory for new APK/IPA builds and prepares each distinct one as soon as it has
+// finished landing, so the first patch request for a new build finds it scanned and decoded.
+// Files with the same contents as one already seen are only reported.
+class Inbox : public QObject {
+    Q_OBJECT
+
+public:
+    Inbox(Patcher::AppPatcher& patcher, const QString& directory, QObject* parent = nullptr);
+    virtual ~Inbox();
+
+    // Prepares what is already there, then keeps watching
+    bool start(QString* errorMessage = nullptr);
+
+signals:
+    void log(const QString& message);
+
+private:
+    InboxPrivate* d;
+    Q_DISABLE_COPY(Inbox)
+};
+
+}
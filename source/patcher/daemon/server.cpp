@@ -0,0 +1,659 @@
+#include "std_include.hpp"
+#include "server.hpp"
+#include "inbox.hpp"
+#include "patching/patcher.hpp"
+#include "patching/verification.hpp"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QUrlQuery>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+namespace Daemon {
+
+namespace {
+
+constexpr qsizetype maxHeaderSize = 64 * 1024;
+constexpr qint64 maxJsonBody = 1024 * 1024;
+constexpr qint64 transferChunk = 1024 * 1024;
+
+QByteArray reasonPhrase(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 202:
+        return "Accepted";
+    case 400:
+        return "Bad Request";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 409:
+        return "Conflict";
+    case 411:
+        return "Length Required";
+    case 413:
+        return "Payload Too Large";
+    case 431:
+        return "Request Header Fields Too Large";
+    }
+    return "Internal Server Error";
+}
+
+QJsonObject jobToJson(const Patcher::PatchJob& job)
+{
+    QJsonObject object;
+    object["id"] = job.id;
+    object["path"] = job.path;
+    object["gameServerUrl"] = job.gameServerUrl;
+    object["dlcServerUrl"] = job.dlcServerUrl;
+    object["priority"] = job.priority;
+    if (job.prepareOnly) {
+        object["prepareOnly"] = true;
+    }
+    if (!job.identifier.isEmpty()) {
+        object["identifier"] = job.identifier;
+        object["version"] = job.version;
+    }
+    object["state"] = Patcher::toString(job.state);
+    object["progress"] = job.progress;
+    object["status"] = job.status;
+    object["queuedAt"] = job.queuedAt.toString(Qt::ISODate);
+    if (job.startedAt.isValid()) {
+        object["startedAt"] = job.startedAt.toString(Qt::ISODate);
+    }
+    if (job.finishedAt.isValid()) {
+        object["finishedAt"] = job.finishedAt.toString(Qt::ISODate);
+    }
+    if (!job.errorMessage.isEmpty()) {
+        object["error"] = job.errorMessage;
+    }
+    if (job.state == Patcher::JobState::Succeeded) {
+        object["artifact"] = QString("/jobs/%1/artifact").arg(job.id);
+    }
+    return object;
+}
+
+bool isArtifactName(const QString& path)
+{
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    return suffix == "apk" || suffix == "ipa";
+}
+
+}
+
+struct Connection {
+    QIODevice* socket = nullptr;
+    std::function<void()> disconnect;
+    // the localhost port, which a web page can reach as well
+    bool tcp = false;
+
+    QByteArray buffer;
+    bool headerDone = false;
+    // set once a response started, the rest of the request is ignored
+    bool responded = false;
+    QByteArray method;
+    QString path;
+    QUrlQuery query;
+    QMap<QByteArray, QByteArray> headers;
+    qint64 remaining = 0;
+    QByteArray body;
+
+    // uploads go straight to disk and are hashed on the way
+    std::unique_ptr<QTemporaryFile> upload;
+    QCryptographicHash uploadHash{QCryptographicHash::Sha256};
+
+    int watchedJob = 0;
+    std::unique_ptr<QFile> download;
+};
+
+class ServerPrivate {
+public:
+    Patcher::AppPatcher& patcher;
+    ServerOptions options;
+    QLocalServer localServer;
+    QTcpServer tcpServer;
+    QMap<QIODevice*, std::shared_ptr<Connection>> connections;
+    // declared last so its connections go first
+    QObject context;
+
+    ServerPrivate(Patcher::AppPatcher& appPatcher, const ServerOptions& serverOptions);
+
+    bool listen(QString* errorMessage);
+    void accept(QIODevice* socket, std::function<void()> disconnect, bool tcp);
+    void drop(QIODevice* socket);
+
+    void read(Connection& connection);
+    bool parseHeader(Connection& connection);
+    bool isLocalHost(const QByteArray& host) const;
+    void dispatch(Connection& connection);
+
+    void submit(Connection& connection);
+    bool storeUpload(Connection& connection, QString* path);
+    void watch(Connection& connection, const Patcher::PatchJob& job);
+    void sendFile(Connection& connection, const QString& path);
+    void pumpDownload(Connection& connection);
+    void sendEvent(int jobId, const QJsonObject& event, bool last = false);
+    void pruneJobs();
+
+    void writeHead(Connection& connection, int status, const QByteArray& contentType, qint64 length,
+                   const QByteArray& extraHeaders = QByteArray());
+    void respond(Connection& connection, int status, const QJsonDocument& body);
+    void respondError(Connection& connection, int status, const QString& message);
+};
+
+ServerPrivate::ServerPrivate(Patcher::AppPatcher& appPatcher, const ServerOptions& serverOptions)
+    : patcher(appPatcher)
+    , options(serverOptions)
+{
+    // clients may send the same build with other URLs, a shared output name would mix them up
+    patcher.setOutputRoot(options.outputDir);
+
+    QObject::connect(&localServer, &QLocalServer::newConnection, &context, [this]() {
+        while (QLocalSocket* socket = localServer.nextPendingConnection()) {
+            QObject::connect(socket, &QLocalSocket::disconnected, &context, [this, socket]() { drop(socket); });
+            accept(socket, [socket]() { socket->disconnectFromServer(); }, false);
+        }
+    });
+    QObject::connect(&tcpServer, &QTcpServer::newConnection, &context, [this]() {
+        while (QTcpSocket* socket = tcpServer.nextPendingConnection()) {
+            QObject::connect(socket, &QTcpSocket::disconnected, &context, [this, socket]() { drop(socket); });
+            accept(socket, [socket]() { socket->disconnectFromHost(); }, true);
+        }
+    });
+
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobProgress, &context, [this](int jobId, int progress, const QString& status) {
+        sendEvent(jobId, {{"event", "progress"}, {"id", jobId}, {"progress", progress}, {"status", status}});
+    });
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobLog, &context, [this](int jobId, const QString& message) {
+        sendEvent(jobId, {{"event", "log"}, {"id", jobId}, {"message", message}});
+    });
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobStateChanged, &context, [this](int jobId, Patcher::JobState) {
+        const Patcher::PatchJob job = patcher.job(jobId);
+        sendEvent(jobId, {{"event", "state"}, {"id", jobId}, {"job", jobToJson(job)}}, job.isFinished());
+        if (job.isFinished()) {
+            pruneJobs();
+        }
+    });
+}
+
+bool ServerPrivate::listen(QString* errorMessage)
+{
+    // a live daemon answers on the socket, anything else left there is from one that crashed
+    QLocalSocket probe;
+    probe.connectToServer(options.socketName);
+    if (probe.waitForConnected(500)) {
+        if (errorMessage) {
+            *errorMessage = "Another daemon is already listening on " + options.socketName;
+        }
+        return false;
+    }
+    QLocalServer::removeServer(options.socketName);
+
+    localServer.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!localServer.listen(options.socketName)) {
+        if (errorMessage) {
+            *errorMessage = "Could not listen on " + options.socketName + ": " + localServer.errorString();
+        }
+        return false;
+    }
+
+    if (options.httpPort != 0 && !tcpServer.listen(QHostAddress::LocalHost, options.httpPort)) {
+        if (errorMessage) {
+            *errorMessage = QString("Could not listen on 127.0.0.1:%1: %2").arg(options.httpPort).arg(tcpServer.errorString());
+        }
+        localServer.close();
+        return false;
+    }
+    return true;
+}
+
+void ServerPrivate::accept(QIODevice* socket, std::function<void()> disconnect, bool tcp)
+{
+    auto connection = std::make_shared<Connection>();
+    connection->socket = socket;
+    connection->disconnect = std::move(disconnect);
+    connection->tcp = tcp;
+    connections.insert(socket, connection);
+
+    // the copies keep the connection alive when responding drops it
+    QObject::connect(socket, &QIODevice::readyRead, &context, [this, socket]() {
+        if (const auto connection = connections.value(socket)) {
+            read(*connection);
+        }
+    });
+    QObject::connect(socket, &QIODevice::bytesWritten, &context, [this, socket]() {
+        const auto connection = connections.value(socket);
+        if (connection && connection->download) {
+            pumpDownload(*connection);
+        }
+    });
+    read(*connection);
+}
+
+void ServerPrivate::drop(QIODevice* socket)
+{
+    connections.remove(socket);
+    socket->deleteLater();
+}
+
+void ServerPrivate::read(Connection& connection)
+{
+    while (connection.socket->bytesAvailable() > 0) {
+        QByteArray data = connection.socket->read(transferChunk);
+        if (connection.responded) {
+            continue;
+        }
+
+        if (!connection.headerDone) {
+            connection.buffer += data;
+            const qsizetype end = connection.buffer.indexOf("\r\n\r\n");
+            if (end < 0) {
+                if (connection.buffer.size() > maxHeaderSize) {
+                    respondError(connection, 431, "Request header too large");
+                }
+                continue;
+            }
+            data = connection.buffer.mid(end + 4);
+            connection.buffer.truncate(end);
+            if (!parseHeader(connection)) {
+                continue;
+            }
+            connection.headerDone = true;
+        }
+
+        const QByteArray chunk = data.left(connection.remaining);
+        connection.remaining -= chunk.size();
+        if (connection.upload) {
+            connection.uploadHash.addData(chunk);
+            if (connection.upload->write(chunk) != chunk.size()) {
+                respondError(connection, 500, "Could not store the upload: " + connection.upload->errorString());
+                continue;
+            }
+        } else {
+            connection.body += chunk;
+        }
+
+        if (connection.remaining == 0) {
+            dispatch(connection);
+        }
+    }
+}
+
+bool ServerPrivate::parseHeader(Connection& connection)
+{
+    const QList<QByteArray> lines = connection.buffer.split('\n');
+    const QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    if (requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/1.")) {
+        respondError(connection, 400, "Malformed request line");
+        return false;
+    }
+
+    connection.method = requestLine[0];
+    const QUrl url(QString::fromUtf8(requestLine[1]));
+    connection.path = url.path();
+    connection.query = QUrlQuery(url);
+    for (qsizetype i = 1; i < lines.size(); i++) {
+        const qsizetype colon = lines[i].indexOf(':');
+        if (colon > 0) {
+            connection.headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+        }
+    }
+    connection.buffer.clear();
+
+    // a web page can reach the port too, under its own name through DNS rebinding; browsers
+    // leave Origin off same-origin requests, but Host always carries the name the page used
+    if (connection.tcp && !isLocalHost(connection.headers.value("host"))) {
+        respondError(connection, 403, "Requests must be addressed to localhost");
+        return false;
+    }
+    if (connection.headers.contains("origin")) {
+        respondError(connection, 403, "Browser requests are not accepted");
+        return false;
+    }
+    if (connection.headers.contains("transfer-encoding")) {
+        respondError(connection, 411, "Send the body with a Content-Length");
+        return false;
+    }
+
+    bool ok = true;
+    connection.remaining = connection.headers.value("content-length", "0").toLongLong(&ok);
+    if (!ok || connection.remaining < 0) {
+        respondError(connection, 400, "Invalid Content-Length");
+        return false;
+    }
+
+    const bool json = connection.headers.value("content-type").startsWith("application/json");
+    if (connection.method == "POST" && connection.path == "/jobs" && !json && connection.remaining > 0) {
+        if (!isArtifactName(connection.query.queryItemValue("name"))) {
+            respondError(connection, 400, "Uploads need ?name= ending in .apk or .ipa");
+            return false;
+        }
+        QDir().mkpath(options.uploadDir);
+        connection.upload = std::make_unique<QTemporaryFile>(QDir(options.uploadDir).filePath("upload-XXXXXX.part"));
+        if (!connection.upload->open()) {
+            respondError(connection, 500, "Could not store the upload: " + connection.upload->errorString());
+            return false;
+        }
+    } else if (connection.remaining > maxJsonBody) {
+        respondError(connection, 413, "Request body too large");
+        return false;
+    }
+    return true;
+}
+
+bool ServerPrivate::isLocalHost(const QByteArray& host) const
+{
+    const QByteArray port = ":" + QByteArray::number(tcpServer.serverPort());
+    const QByteArray name = host.toLower();
+    return name == "localhost" + port || name == "127.0.0.1" + port || name == "[::1]" + port;
+}
+
+void ServerPrivate::dispatch(Connection& connection)
+{
+    const QStringList parts = connection.path.split('/', Qt::SkipEmptyParts);
+    const QByteArray& method = connection.method;
+
+    if (parts == QStringList{"status"} && method == "GET") {
+        QJsonObject status;
+        QJsonObject states;
+        for (const auto& job : patcher.jobs()) {
+            const QString state = Patcher::toString(job.state);
+            states[state] = states[state].toInt() + 1;
+        }
+        status["jobs"] = states;
+        status["idle"] = patcher.isIdle();
+        status["maxConcurrentJobs"] = patcher.maxConcurrentJobs();
+        status["socket"] = localServer.fullServerName();
+        status["httpPort"] = tcpServer.isListening() ? tcpServer.serverPort() : 0;
+        respond(connection, 200, QJsonDocument(status));
+        return;
+    }
+
+    if (parts.value(0) != "jobs") {
+        respondError(connection, 404, "No such endpoint: " + connection.path);
+        return;
+    }
+
+    if (parts.size() == 1) {
+        if (method == "GET") {
+            QJsonArray jobs;
+            for (const auto& job : patcher.jobs()) {
+                jobs.append(jobToJson(job));
+            }
+            respond(connection, 200, QJsonDocument(jobs));
+        } else if (method == "POST") {
+            submit(connection);
+        } else {
+            respondError(connection, 405, "Use GET or POST on /jobs");
+        }
+        return;
+    }
+
+    bool ok = false;
+    const Patcher::PatchJob job = patcher.job(parts[1].toInt(&ok));
+    if (!ok || job.id == 0 || parts.size() > 3) {
+        respondError(connection, 404, "No such job: " + connection.path);
+        return;
+    }
+
+    const QString action = parts.value(2);
+    if (action.isEmpty() && method == "GET") {
+        respond(connection, 200, QJsonDocument(jobToJson(job)));
+    } else if (action.isEmpty() && method == "DELETE") {
+        patcher.cancel(job.id);
+        respond(connection, 200, QJsonDocument(jobToJson(patcher.job(job.id))));
+    } else if (action == "events" && method == "GET") {
+        watch(connection, job);
+    } else if ((action == "artifact" || action == "manifest") && method == "GET") {
+        if (job.state != Patcher::JobState::Succeeded) {
+            respondError(connection, 409, "Job " + QString::number(job.id) + " is " + Patcher::toString(job.state));
+            return;
+        }
+        const QString artifact = job.outputPath();
+        sendFile(connection, action == "artifact" ? artifact : Patcher::Verifier::manifestPath(artifact));
+    } else {
+        respondError(connection, 405, "Unsupported request: " + QString::fromLatin1(method) + " " + connection.path);
+    }
+}
+
+void ServerPrivate::submit(Connection& connection)
+{
+    QString path;
+    QString gameServerUrl;
+    QString dlcServerUrl;
+    QString priority;
+
+    if (connection.upload) {
+        if (!storeUpload(connection, &path)) {
+            return;
+        }
+        gameServerUrl = connection.query.queryItemValue("game");
+        dlcServerUrl = connection.query.queryItemValue("dlc");
+        priority = connection.query.queryItemValue("priority");
+    } else {
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(connection.body, &parseError);
+        if (!document.isObject()) {
+            respondError(connection, 400, "Expected a JSON object: " + parseError.errorString());
+            return;
+        }
+        const QJsonObject request = document.object();
+        path = request["path"].toString();
+        gameServerUrl = request["gameServerUrl"].toString();
+        dlcServerUrl = request["dlcServerUrl"].toString();
+        priority = request["priority"].toString();
+
+        // the daemon has its own working directory
+        if (QDir::isRelativePath(path) || !QFileInfo(path).isFile()) {
+            respondError(connection, 400, "path must be an existing absolute path: " + path);
+            return;
+        }
+    }
+
+    if (!isArtifactName(path)) {
+        respondError(connection, 400, "Only .apk and .ipa files can be patched");
+        return;
+    }
+    if (gameServerUrl.isEmpty() || dlcServerUrl.isEmpty()) {
+        respondError(connection, 400, "Both the game and the DLC server URL are required");
+        return;
+    }
+
+    const int jobId = patcher.enqueue(path, gameServerUrl, dlcServerUrl, Patcher::JobPriority::fromName(priority));
+    respond(connection, 202, QJsonDocument(jobToJson(patcher.job(jobId))));
+}
+
+bool ServerPrivate::storeUpload(Connection& connection, QString* path)
+{
+    const QString suffix = QFileInfo(connection.query.queryItemValue("name")).suffix().toLower();
+    const QString name = QString::fromLatin1(connection.uploadHash.result().toHex().left(16)) + "." + suffix;
+    *path = QDir(options.uploadDir).absoluteFilePath(name);
+
+    connection.upload->close();
+    if (QFile::exists(*path)) {
+        // same bytes as an earlier upload; its file keeps the identity of its workspace
+        connection.upload.reset();
+        return true;
+    }
+    connection.upload->setAutoRemove(false);
+    if (!connection.upload->rename(*path)) {
+        connection.upload->remove();
+        respondError(connection, 500, "Could not store the upload: " + connection.upload->errorString());
+        return false;
+    }
+    connection.upload.reset();
+    return true;
+}
+
+void ServerPrivate::watch(Connection& connection, const Patcher::PatchJob& job)
+{
+    writeHead(connection, 200, "application/x-ndjson", -1);
+    const QJsonObject snapshot{{"event", "state"}, {"id", job.id}, {"job", jobToJson(job)}};
+    connection.socket->write(QJsonDocument(snapshot).toJson(QJsonDocument::Compact) + "\n");
+    if (job.isFinished()) {
+        connection.disconnect();
+        return;
+    }
+    connection.watchedJob = job.id;
+}
+
+void ServerPrivate::sendFile(Connection& connection, const QString& path)
+{
+    auto file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly)) {
+        respondError(connection, 404, "Could not open " + QFileInfo(path).fileName() + ": " + file->errorString());
+        return;
+    }
+
+    const QByteArray disposition = "Content-Disposition: attachment; filename=\"" + QFileInfo(path).fileName().toUtf8() + "\"\r\n";
+    writeHead(connection, 200, path.endsWith(".json") ? "application/json" : "application/octet-stream", file->size(), disposition);
+    connection.download = std::move(file);
+    pumpDownload(connection);
+}
+
+void ServerPrivate::pumpDownload(Connection& connection)
+{
+    // a few chunks in flight keeps the socket busy without loading the artifact into memory
+    while (connection.socket->bytesToWrite() < 4 * transferChunk && !connection.download->atEnd()) {
+        const QByteArray chunk = connection.download->read(transferChunk);
+        if (chunk.isEmpty()) {
+            break;
+        }
+        connection.socket->write(chunk);
+    }
+    if (connection.download->atEnd()) {
+        connection.download.reset();
+        connection.disconnect();
+    }
+}
+
+void ServerPrivate::sendEvent(int jobId, const QJsonObject& event, bool last)
+{
+    const QByteArray line = QJsonDocument(event).toJson(QJsonDocument::Compact) + "\n";
+    // copied, a disconnect may drop entries while this runs
+    const auto watchers = connections.values();
+    for (const auto& connection : watchers) {
+        if (connection->watchedJob != jobId) {
+            continue;
+        }
+        connection->socket->write(line);
+        if (last) {
+            connection->watchedJob = 0;
+            connection->disconnect();
+        }
+    }
+}
+
+void ServerPrivate::pruneJobs()
+{
+    // a long-running daemon would otherwise keep every job and its artifact forever
+    const QString outputRoot = QDir(options.outputDir).absolutePath();
+    for (const auto& job : patcher.pruneFinished(options.keepFinishedJobs)) {
+        QDir folder = QFileInfo(job.outputPath()).absoluteDir();
+        if (folder.absolutePath().startsWith(outputRoot + "/")) {
+            folder.removeRecursively();
+        }
+    }
+}
+
+void ServerPrivate::writeHead(Connection& connection, int status, const QByteArray& contentType, qint64 length,
+                              const QByteArray& extraHeaders)
+{
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + " " + reasonPhrase(status) + "\r\n";
+    head += "Content-Type: " + contentType + "\r\n";
+    if (length >= 0) {
+        head += "Content-Length: " + QByteArray::number(length) + "\r\n";
+    }
+    head += extraHeaders;
+    head += "Connection: close\r\n\r\n";
+    connection.socket->write(head);
+    connection.responded = true;
+}
+
+void ServerPrivate::respond(Connection& connection, int status, const QJsonDocument& body)
+{
+    const QByteArray data = body.toJson(QJsonDocument::Compact) + "\n";
+    writeHead(connection, status, "application/json", data.size());
+    connection.socket->write(data);
+    connection.disconnect();
+}
+
+void ServerPrivate::respondError(Connection& connection, int status, const QString& message)
+{
+    respond(connection, status, QJsonDocument(QJsonObject{{"error", message}}));
+}
+
+Server::Server(Patcher::AppPatcher& patcher, const ServerOptions& options)
+    : d(new ServerPrivate(patcher, options))
+{
+}
+
+Server::~Server()
+{
+    close();
+    delete d;
+}
+
+bool Server::listen(QString* errorMessage)
+{
+    return d->listen(errorMessage);
+}
+
+void Server::close()
+{
+    d->localServer.close();
+    d->tcpServer.close();
+}
+
+int runDaemon(Patcher::AppPatcher& patcher, const ServerOptions& options, QTextStream& out)
+{
+    // resolved once here, every job after that finds the toolchain already checked
+    out << "Checking toolchain..." << Qt::endl;
+    if (!patcher.checkDependencies()) {
+        out << "WARNING: the toolchain is incomplete, APK jobs will fail until it is fixed" << Qt::endl;
+    }
+
+    Server server(patcher, options);
+    QString errorMessage;
+    if (!server.listen(&errorMessage)) {
+        out << "ERROR: " << errorMessage << Qt::endl;
+        return 1;
+    }
+
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobStateChanged, [&](int jobId, Patcher::JobState state) {
+        const Patcher::PatchJob job = patcher.job(jobId);
+        out << "[job " << jobId << "] " << Patcher::toString(state) << ": " << job.path;
+        if (state == Patcher::JobState::Failed && !job.errorMessage.isEmpty()) {
+            out << " (" << job.errorMessage << ")";
+        }
+        out << Qt::endl;
+    });
+
+    std::unique_ptr<Inbox> inbox;
+    if (!options.inboxDir.isEmpty()) {
+        inbox = std::make_unique<Inbox>(patcher, options.inboxDir);
+        QObject::connect(inbox.get(), &Inbox::log, [&out](const QString& message) {
+            out << message << Qt::endl;
+        });
+        if (!inbox->start(&errorMessage)) {
+            out << "ERROR: " << errorMessage << Qt::endl;
+            return 1;
+        }
+    }
+
+    out << "Listening on " << options.socketName;
+    if (options.httpPort != 0) {
+        out << " and http://127.0.0.1:" << options.httpPort;
+    }
+    out << ", " << patcher.maxConcurrentJobs() << " job(s) at a time" << Qt::endl;
+    return QCoreApplication::exec();
+}
+
+}
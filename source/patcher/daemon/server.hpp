@@ -0,0 +1,56 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+class AppPatcher;
+}
+
+namespace Daemon {
+
+class ServerPrivate;
+
+struct ServerOptions {
+    // a named pipe on Windows, a UNIX socket elsewhere
+    QString socketName = "tsto_patcher";
+    // localhost only, 0 leaves HTTP off
+    quint16 httpPort = 8765;
+    // uploads are kept under their content hash, so a repeat upload finds its warm workspace
+    QString uploadDir = "daemon/uploads";
+    // every job writes its artifact and manifest to <outputDir>/<job id>/
+    QString outputDir = "daemon/outputs";
+    // finished jobs the API still lists, older ones are dropped along with their outputs
+    int keepFinishedJobs = 200;
+    // new builds dropped here are prepared before anyone asks for them, empty for none
+    QString inboxDir;
+};
+
+// Resident front end for one AppPatcher. The local socket and the localhost port speak the
+// same small HTTP API, one request per connection; the port only answers requests addressed
+// to localhost:
+//
+//   GET    /status               queue and toolchain
+//   GET    /jobs                 every job
+//   POST   /jobs                 JSON {path, gameServerUrl, dlcServerUrl, priority}, or the APK/IPA
+//                                itself as the body with ?name=&game=&dlc=&priority=
+//   GET    /jobs/<id>            one job
+//   GET    /jobs/<id>/events     newline-delimited JSON progress, log and state events until it finishes
+//   GET    /jobs/<id>/artifact   the patched file once the job succeeded
+//   GET    /jobs/<id>/manifest   its verification manifest
+//   DELETE /jobs/<id>            cancel
+class Server {
+public:
+    explicit Server(Patcher::AppPatcher& patcher, const ServerOptions& options = ServerOptions());
+    ~Server();
+
+    bool listen(QString* errorMessage = nullptr);
+    void close();
+
+private:
+    ServerPrivate* d;
+    Q_DISABLE_COPY(Server)
+};
+
+// Serves until the process is stopped
+int runDaemon(Patcher::AppPatcher& patcher, const ServerOptions& options, QTextStream& out);
+
+}
@@ -0,0 +1 @@
+#include <std_include.hpp>
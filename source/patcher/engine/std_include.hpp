@@ -0,0 +1,64 @@
+#pragma once
+
+// The engine builds against QtCore alone: no Windows headers, no widgets, so it can be
+// linked into hosts that are not GUI applications.
+
+#pragma warning(push)
+#pragma warning(disable: 4100)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4244)
+#pragma warning(disable: 4458)
+#pragma warning(disable: 4702)
+#pragma warning(disable: 4996)
+#pragma warning(disable: 5054)
+#pragma warning(disable: 26451)
+#pragma warning(disable: 26495)
+#pragma warning(disable: 26812)
+
+#include <map>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <utility>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <unordered_set>
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QProcess>
+#include <QtCore/QFile>
+#include <QtCore/QDir>
+#include <QtCore/QDebug>
+#include <QtCore/QDirIterator>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QVariant>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QList>
+#include <QtCore/QByteArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonValue>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QDateTime>
+#include <QtCore/QTextStream>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QEventLoop>
+#include <QtCore/QTimer>
+
+#pragma warning(pop)
+#pragma warning(disable: 4100)
+
+using namespace std::literals;
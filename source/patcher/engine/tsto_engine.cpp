@@ -0,0 +1,243 @@
+#include "std_include.hpp"
+#include "tsto_engine.h"
+#include "patching/apk_patcher.hpp"
+#include "patching/ipa_patcher.hpp"
+#include "patching/census.hpp"
+#include "patching/probe.hpp"
+#include "patching/patcher.hpp"
+#include "zip.hpp"
+#include <QtCore/QTemporaryDir>
+#include <cstddef>
+#include <cstring>
+
+struct tsto_artifact {
+    QString path;
+    QByteArray platform;
+    QByteArray census;
+    QByteArray info;
+    QByteArray outputPath;
+    QByteArray lastError;
+
+    // guards the two below, tsto_artifact_cancel comes from another thread
+    std::mutex mutex;
+    std::function<void()> cancel;
+    bool cancelled = false;
+};
+
+namespace {
+
+// QProcess and the thread pools want an application object, a host without one gets it here
+void ensureApplication()
+{
+    static std::once_flag once;
+    std::call_once(once, []() {
+        if (!QCoreApplication::instance()) {
+            static int argc = 1;
+            static char name[] = "tsto_engine";
+            static char* argv[] = {name, nullptr};
+            new QCoreApplication(argc, argv);
+        }
+    });
+}
+
+// fields past the caller's struct_size were added later and keep their defaults
+tsto_patch_config effectiveConfig(const tsto_patch_config* config)
+{
+    tsto_patch_config effective;
+    tsto_patch_config_init(&effective);
+    std::memcpy(&effective, config, std::min<size_t>(config->struct_size, sizeof(effective)));
+    effective.struct_size = sizeof(effective);
+    return effective;
+}
+
+}
+
+extern "C" {
+
+int tsto_engine_api_version(void)
+{
+    return TSTO_ENGINE_API_VERSION;
+}
+
+void tsto_patch_config_init(tsto_patch_config* config)
+{
+    if (!config) {
+        return;
+    }
+    std::memset(config, 0, sizeof(*config));
+    config->struct_size = sizeof(*config);
+    config->extract_native_libs = 1;
+    config->zip_level = 6;
+}
+
+tsto_status tsto_artifact_open(const char* path, tsto_artifact** artifact)
+{
+    if (!artifact) {
+        return TSTO_ERROR_ARGUMENT;
+    }
+    *artifact = nullptr;
+    if (!path) {
+        return TSTO_ERROR_ARGUMENT;
+    }
+
+    const QString filePath = QFileInfo(QString::fromUtf8(path)).absoluteFilePath();
+    const QByteArray platform = QFileInfo(filePath).suffix().toLower().toUtf8();
+    if (platform != "apk" && platform != "ipa") {
+        return TSTO_ERROR_ARGUMENT;
+    }
+    utils::zip::Reader reader;
+    if (!reader.open(QDir::toNativeSeparators(filePath).toStdString())) {
+        return TSTO_ERROR_OPEN;
+    }
+
+    *artifact = new tsto_artifact;
+    (*artifact)->path = filePath;
+    (*artifact)->platform = platform;
+    return TSTO_OK;
+}
+
+void tsto_artifact_close(tsto_artifact* artifact)
+{
+    delete artifact;
+}
+
+const char* tsto_artifact_platform(const tsto_artifact* artifact)
+{
+    return artifact ? artifact->platform.constData() : nullptr;
+}
+
+const char* tsto_artifact_census_json(tsto_artifact* artifact)
+{
+    if (!artifact) {
+        return nullptr;
+    }
+    if (artifact->census.isEmpty()) {
+        const Patcher::CensusReport report = Patcher::Census::scan(artifact->path);
+        if (!report.success) {
+            artifact->lastError = report.errorMessage.toUtf8();
+            return nullptr;
+        }
+        artifact->census = QJsonDocument(report.toJson()).toJson(QJsonDocument::Compact);
+    }
+    return artifact->census.constData();
+}
+
+const char* tsto_artifact_info_json(tsto_artifact* artifact)
+{
+    if (!artifact) {
+        return nullptr;
+    }
+    if (artifact->info.isEmpty()) {
+        const Patcher::ArtifactInfo info = Patcher::Probe::read(artifact->path);
+        if (!info.success) {
+            artifact->lastError = info.errorMessage.toUtf8();
+            return nullptr;
+        }
+        artifact->info = QJsonDocument(info.toJson()).toJson(QJsonDocument::Compact);
+    }
+    return artifact->info.constData();
+}
+
+tsto_status tsto_artifact_patch(tsto_artifact* artifact, const tsto_patch_config* config)
+{
+    if (!artifact || !config || config->struct_size < offsetof(tsto_patch_config, workspace_dir)) {
+        return TSTO_ERROR_ARGUMENT;
+    }
+    const tsto_patch_config effective = effectiveConfig(config);
+    artifact->outputPath.clear();
+    artifact->lastError.clear();
+    if (!effective.game_server_url || !effective.dlc_server_url) {
+        artifact->lastError = "Both the game and the DLC server URL are required";
+        return TSTO_ERROR_ARGUMENT;
+    }
+    ensureApplication();
+
+    QTemporaryDir temporary;
+    const QString workspace = effective.workspace_dir ? QString::fromUtf8(effective.workspace_dir) : temporary.path();
+    if ((!effective.workspace_dir && !temporary.isValid()) || !QDir().mkpath(workspace)) {
+        artifact->lastError = "Could not create a workspace";
+        return TSTO_ERROR_PATCH;
+    }
+    const QStringList archs = effective.keep_archs ? QString::fromUtf8(effective.keep_archs).split(',', Qt::SkipEmptyParts) : QStringList();
+    const QString gameServerUrl = QString::fromUtf8(effective.game_server_url);
+    const QString dlcServerUrl = QString::fromUtf8(effective.dlc_server_url);
+
+    {
+        std::lock_guard<std::mutex> lock(artifact->mutex);
+        artifact->cancelled = false;
+    }
+
+    bool success = false;
+    auto run = [&](auto& patcher, auto patch) {
+        using T = std::decay_t<decltype(patcher)>;
+        patcher.setWorkspace(workspace);
+        patcher.setArchFilter(archs);
+        patcher.setReproducible(effective.reproducible != 0);
+        // the patcher lives on this thread, so the callbacks run right here
+        QObject::connect(&patcher, &T::progressUpdated, [&effective](int progress, const QString& status) {
+            if (effective.on_progress) {
+                effective.on_progress(effective.user, progress, status.toUtf8().constData());
+            }
+        });
+        QObject::connect(&patcher, &T::log, [&effective](const QString& message) {
+            if (effective.on_log) {
+                effective.on_log(effective.user, message.toUtf8().constData());
+            }
+        });
+        QObject::connect(&patcher, &T::error, [artifact](const QString& message) {
+            artifact->lastError = message.toUtf8();
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(artifact->mutex);
+            artifact->cancel = [&patcher]() { patcher.cancel(); };
+        }
+        success = (patcher.*patch)(artifact->path, gameServerUrl, dlcServerUrl);
+        std::lock_guard<std::mutex> lock(artifact->mutex);
+        artifact->cancel = nullptr;
+    };
+
+    if (artifact->platform == "ipa") {
+        Patcher::IPAPatcher patcher;
+        patcher.setCompression(effective.zip_level);
+        run(patcher, &Patcher::IPAPatcher::patchIPA);
+    } else {
+        Patcher::APKPatcher patcher;
+        patcher.setExtractNativeLibs(effective.extract_native_libs != 0);
+        run(patcher, &Patcher::APKPatcher::patchAPK);
+    }
+
+    if (!success) {
+        std::lock_guard<std::mutex> lock(artifact->mutex);
+        return artifact->cancelled ? TSTO_ERROR_CANCELLED : TSTO_ERROR_PATCH;
+    }
+
+    Patcher::PatchJob job;
+    job.path = artifact->path;
+    artifact->outputPath = QDir::current().absoluteFilePath(job.outputPath()).toUtf8();
+    return TSTO_OK;
+}
+
+void tsto_artifact_cancel(tsto_artifact* artifact)
+{
+    if (!artifact) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(artifact->mutex);
+    artifact->cancelled = true;
+    if (artifact->cancel) {
+        artifact->cancel();
+    }
+}
+
+const char* tsto_artifact_output_path(const tsto_artifact* artifact)
+{
+    return artifact && !artifact->outputPath.isEmpty() ? artifact->outputPath.constData() : nullptr;
+}
+
+const char* tsto_artifact_last_error(const tsto_artifact* artifact)
+{
+    return artifact ? artifact->lastError.constData() : nullptr;
+}
+
+}
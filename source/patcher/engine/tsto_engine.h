@@ -0,0 +1,96 @@
+#ifndef TSTO_ENGINE_H
+#define TSTO_ENGINE_H
+
+/*
+ * Plain C interface to the patch engine, for hosts that are not Qt applications.
+ *
+ * Strings are UTF-8. Calls on one artifact must not overlap, except tsto_artifact_cancel,
+ * which may be called from any thread. Callbacks run on the thread that called
+ * tsto_artifact_patch. The engine looks for sdktools/ in the current directory and
+ * writes the patched file there, like the patcher itself.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#if defined(TSTO_ENGINE_BUILD)
+#define TSTO_API __declspec(dllexport)
+#else
+#define TSTO_API __declspec(dllimport)
+#endif
+#else
+#define TSTO_API __attribute__((visibility("default")))
+#endif
+
+/* bumped on every incompatible change; fields are only ever appended to tsto_patch_config */
+#define TSTO_ENGINE_API_VERSION 1
+
+typedef struct tsto_artifact tsto_artifact;
+
+typedef enum tsto_status {
+    TSTO_OK = 0,
+    TSTO_ERROR_ARGUMENT = 1,
+    TSTO_ERROR_OPEN = 2,
+    TSTO_ERROR_PATCH = 3,
+    TSTO_ERROR_CANCELLED = 4
+} tsto_status;
+
+typedef void (*tsto_progress_fn)(void* user, int percent, const char* status);
+typedef void (*tsto_log_fn)(void* user, const char* message);
+
+typedef struct tsto_patch_config {
+    /* sizeof(tsto_patch_config) as the caller knows it, set by tsto_patch_config_init */
+    uint32_t struct_size;
+    const char* game_server_url;
+    const char* dlc_server_url;
+    /* scratch directory; NULL uses a temporary one that is removed afterwards */
+    const char* workspace_dir;
+    /* comma separated architectures to keep ("arm64,armv7"); NULL keeps every one */
+    const char* keep_archs;
+    /* APK: 0 stores native libraries uncompressed and aligned */
+    int extract_native_libs;
+    /* IPA: deflate level 0-9 */
+    int zip_level;
+    /* byte-identical output for identical inputs */
+    int reproducible;
+    tsto_progress_fn on_progress;
+    tsto_log_fn on_log;
+    void* user;
+} tsto_patch_config;
+
+TSTO_API int tsto_engine_api_version(void);
+
+/* Defaults: extract native libraries, level 6, not reproducible, no callbacks */
+TSTO_API void tsto_patch_config_init(tsto_patch_config* config);
+
+/* Checks that path is a readable APK or IPA; *artifact is NULL on failure */
+TSTO_API tsto_status tsto_artifact_open(const char* path, tsto_artifact** artifact);
+TSTO_API void tsto_artifact_close(tsto_artifact* artifact);
+
+/* "apk" or "ipa" */
+TSTO_API const char* tsto_artifact_platform(const tsto_artifact* artifact);
+/* Every known URL in the artifact as census JSON, computed on first use; NULL on failure.
+   Valid until the artifact is closed. */
+TSTO_API const char* tsto_artifact_census_json(tsto_artifact* artifact);
+/* Package or bundle id, version, executable and ABIs as JSON, read from the manifest or
+   Info.plist in milliseconds; NULL on failure. Valid until the artifact is closed. */
+TSTO_API const char* tsto_artifact_info_json(tsto_artifact* artifact);
+
+/* Runs the whole pipeline, blocking until it finishes */
+TSTO_API tsto_status tsto_artifact_patch(tsto_artifact* artifact, const tsto_patch_config* config);
+TSTO_API void tsto_artifact_cancel(tsto_artifact* artifact);
+
+/* Absolute path of the patched file once tsto_artifact_patch succeeded, otherwise NULL */
+TSTO_API const char* tsto_artifact_output_path(const tsto_artifact* artifact);
+/* Message of the last failure, empty if there was none */
+TSTO_API const char* tsto_artifact_last_error(const tsto_artifact* artifact);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
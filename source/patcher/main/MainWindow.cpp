@@ -6,6 +6,7 @@
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
     , patcher(new Patcher::AppPatcher(this))
+    , watchdog(new StallWatchdog(this))
 {
     setupUi();
 
@@ -18,6 +19,12 @@ MainWindow::MainWindow(QWidget* parent)
     connect(patcher, &Patcher::AppPatcher::progressUpdated, this, &MainWindow::onProgressUpdated);
     connect(patcher, &Patcher::AppPatcher::log, this, &MainWindow::onLogMessage);
     connect(patcher, &Patcher::AppPatcher::error, this, &MainWindow::onError);
+    connect(patcher, &Patcher::AppPatcher::jobFinished, this, &MainWindow::onJobFinished);
+
+    auto* diagnosticsTimer = new QTimer(this);
+    connect(diagnosticsTimer, &QTimer::timeout, this, &MainWindow::updateDiagnostics);
+    diagnosticsTimer->start(1000);
+    watchdog->start();
 }
 
 MainWindow::~MainWindow() = default;
@@ -77,11 +84,22 @@ void MainWindow::setupUi()
     progressLayout->addWidget(statusLabel);
     mainLayout->addWidget(progressGroup);
 
+    // Diagnostics group
+    auto* diagnosticsGroup = new QGroupBox("Diagnostics", this);
+    auto* diagnosticsLayout = new QVBoxLayout(diagnosticsGroup);
+    diagnosticsLabel = new QLabel(this);
+    diagnosticsLabel->setObjectName("diagnosticsLabel");
+    diagnosticsLabel->setWordWrap(true);
+    diagnosticsLayout->addWidget(diagnosticsLabel);
+    mainLayout->addWidget(diagnosticsGroup);
+
     // Button layout
     auto* buttonLayout = new QHBoxLayout();
     checkDependenciesButton = new QPushButton("Check Dependencies", this);
+    dryRunButton = new QPushButton("Dry Run", this);
     patchButton = new QPushButton("Patch File", this);
     buttonLayout->addWidget(checkDependenciesButton);
+    buttonLayout->addWidget(dryRunButton);
     buttonLayout->addWidget(patchButton);
     mainLayout->addLayout(buttonLayout);
 
@@ -101,6 +119,7 @@ void MainWindow::setupUi()
 
     connect(browseButton, &QPushButton::clicked, this, &MainWindow::onBrowseClicked);
     connect(patchButton, &QPushButton::clicked, this, &MainWindow::onPatchClicked);
+    connect(dryRunButton, &QPushButton::clicked, this, &MainWindow::onDryRunClicked);
     connect(checkDependenciesButton, &QPushButton::clicked, this, &MainWindow::onCheckDependenciesClicked);
     connect(darkModeButton, &QPushButton::clicked, this, &MainWindow::onDarkModeToggled);
     connect(creditsButton, &QPushButton::clicked, this, &MainWindow::onCreditsClicked);
@@ -218,6 +237,8 @@ void MainWindow::onPatchClicked()
     consoleOutput->clear();
     progressBar->setValue(0);
     statusLabel->setText("Starting patch process...");
+    watchdog->reset();
+    watchdog->setStage("Starting patch process");
     patchButton->setEnabled(false);
     checkDependenciesButton->setEnabled(false);
 
@@ -233,6 +254,19 @@ void MainWindow::onPatchClicked()
     }
 }
 
+void MainWindow::onDryRunClicked()
+{
+    QString filePath = filePathEdit->text();
+    if (filePath.isEmpty() || !QFile::exists(filePath)) {
+        QMessageBox::warning(this, "Error", "Please select an existing APK or IPA file");
+        return;
+    }
+
+    consoleOutput->clear();
+    progressBar->setValue(0);
+    patcher->dryRun(filePath, gameServerEdit->text(), dlcServerEdit->text());
+}
+
 void MainWindow::onCheckDependenciesClicked()
 {
     consoleOutput->clear();
@@ -240,17 +274,20 @@ void MainWindow::onCheckDependenciesClicked()
     statusLabel->setText("Checking dependencies...");
     patchButton->setEnabled(false);
     checkDependenciesButton->setEnabled(false);
+    watchdog->setStage("Checking dependencies");
 
     if (patcher->checkDependencies()) {
         patchButton->setEnabled(true);
     }
     checkDependenciesButton->setEnabled(true);
+    watchdog->setStage(QString());
 }
 
 void MainWindow::onProgressUpdated(int progress, const QString& status)
 {
     progressBar->setValue(progress);
     statusLabel->setText(status);
+    watchdog->setStage(status);
 
     if (progress == 100) {
         patchButton->setEnabled(true);
@@ -269,3 +306,25 @@ void MainWindow::onError(const QString& message)
     patchButton->setEnabled(true);
     checkDependenciesButton->setEnabled(true);
 }
+
+void MainWindow::onJobFinished(int jobId, bool success)
+{
+    const ResponsivenessReport report = watchdog->report();
+    consoleOutput->append(report.summary());
+    // the worst few are enough to point at the culprit
+    QList<UiStall> stalls = report.stalls;
+    std::sort(stalls.begin(), stalls.end(), [](const UiStall& a, const UiStall& b) {
+        return a.durationMs > b.durationMs;
+    });
+    for (int i = 0; i < std::min<int>(5, stalls.size()); ++i) {
+        consoleOutput->append(QString("  %1 ms during \"%2\" at %3")
+            .arg(stalls[i].durationMs).arg(stalls[i].stage).arg(stalls[i].at.toString("HH:mm:ss.zzz")));
+    }
+    watchdog->setStage(QString());
+    updateDiagnostics();
+}
+
+void MainWindow::updateDiagnostics()
+{
+    diagnosticsLabel->setText(watchdog->report().summary());
+}
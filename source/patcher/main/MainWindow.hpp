@@ -7,6 +7,7 @@
 #include <QtWidgets/QTextEdit>
 #include <QtWidgets/QLabel>
 #include "patching/patcher.hpp"
+#include "watchdog.hpp"
 
 class MainWindow : public QMainWindow
 {
@@ -19,10 +20,12 @@ public:
 private slots:
     void onBrowseClicked();
     void onPatchClicked();
+    void onDryRunClicked();
     void onCheckDependenciesClicked();
     void onProgressUpdated(int progress, const QString& status);
     void onLogMessage(const QString& message);
     void onError(const QString& message);
+    void onJobFinished(int jobId, bool success);
     void onDarkModeToggled();
     void onCreditsClicked();
 
@@ -30,19 +33,23 @@ private:
     void setupUi();
     void applyTheme(bool darkMode);
     void showCreditsDialog();
+    void updateDiagnostics();
 
     QLineEdit* filePathEdit;
     QLineEdit* gameServerEdit;
     QLineEdit* dlcServerEdit;
     QPushButton* browseButton;
     QPushButton* patchButton;
+    QPushButton* dryRunButton;
     QPushButton* checkDependenciesButton;
     QPushButton* darkModeButton;
     QPushButton* creditsButton;
     QProgressBar* progressBar;
     QTextEdit* consoleOutput;
     QLabel* statusLabel;
+    QLabel* diagnosticsLabel;
     
     Patcher::AppPatcher* patcher;
+    StallWatchdog* watchdog;
     bool isDarkMode = false;
 };
@@ -0,0 +1,334 @@
+#include "std_include.hpp"
+#include "cli.hpp"
+#include "bench/bench.hpp"
+#include "patching/census.hpp"
+#include "patching/probe.hpp"
+#include "patching/recipe.hpp"
+#include "patching/patcher.hpp"
+#include "daemon/client.hpp"
+#include "daemon/server.hpp"
+#include "spool/spool.hpp"
+#include "deflate.hpp"
+
+namespace Cli {
+
+namespace {
+
+const QStringList headlessSwitches = {
+    "--bench",
+    "--generate",
+    "--scan",
+    "--export-recipe",
+    "--patch",
+    "--daemon",
+    "--spool-worker",
+};
+
+// Everything that shapes the jobs of one patcher, shared by --patch and --daemon
+struct PatcherSettings {
+    int jobs = 0;
+    qint64 maxMemory = 0;
+    qint64 maxDisk = 0;
+    bool extractNativeLibs = true;
+    QStringList archs;
+    int zipLevel = 6;
+    QString zipBackend;
+    bool reproducible = false;
+    // -1 keeps the default policy
+    qint64 workspaceBudget = -1;
+
+    void apply(Patcher::AppPatcher& patcher) const
+    {
+        if (jobs > 0) {
+            patcher.setMaxConcurrentJobs(jobs);
+        }
+        patcher.setResourceBudget(maxMemory, maxDisk);
+        patcher.setExtractNativeLibs(extractNativeLibs);
+        patcher.setArchFilter(archs);
+        patcher.setCompression(zipLevel, zipBackend);
+        patcher.setReproducible(reproducible);
+        if (workspaceBudget >= 0) {
+            Patcher::WorkspacePolicy policy;
+            policy.budgetBytes = workspaceBudget;
+            patcher.setWorkspacePolicy(policy);
+        }
+    }
+};
+
+int runPatch(const QStringList& files, const PatcherSettings& settings, const QString& priorityName,
+             const QString& gameServerUrl, const QString& dlcServerUrl, QTextStream& out)
+{
+    if (files.isEmpty()) {
+        out << "ERROR: --patch needs at least one APK or IPA" << Qt::endl;
+        return 1;
+    }
+
+    const int priority = Patcher::JobPriority::fromName(priorityName);
+    Patcher::AppPatcher patcher;
+    settings.apply(patcher);
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobStateChanged, [&](int jobId, Patcher::JobState state) {
+        const Patcher::PatchJob job = patcher.job(jobId);
+        out << "[job " << jobId << "] " << Patcher::toString(state) << ": " << job.path;
+        if (state == Patcher::JobState::Failed && !job.errorMessage.isEmpty()) {
+            out << " (" << job.errorMessage << ")";
+        }
+        out << Qt::endl;
+    });
+
+    out << "Patching " << files.size() << " artifact(s), " << patcher.maxConcurrentJobs() << " at a time" << Qt::endl;
+    for (const auto& file : files) {
+        patcher.enqueue(file, gameServerUrl, dlcServerUrl, priority);
+    }
+    patcher.waitForIdle();
+
+    int failed = 0;
+    for (const auto& job : patcher.jobs()) {
+        if (job.state != Patcher::JobState::Succeeded) {
+            failed++;
+        }
+    }
+    out << (files.size() - failed) << " succeeded, " << failed << " failed" << Qt::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+// Hands the files to a running daemon and fetches the results into the working directory
+int runRemote(const QStringList& files, const QString& socketName, const QString& priorityName,
+              const QString& gameServerUrl, const QString& dlcServerUrl, QTextStream& out)
+{
+    if (files.isEmpty()) {
+        out << "ERROR: --patch needs at least one APK or IPA" << Qt::endl;
+        return 1;
+    }
+
+    const Daemon::Client client(socketName);
+    QList<QPair<int, QString>> submitted;
+    int failed = 0;
+    for (const auto& file : files) {
+        const QJsonObject request{{"path", QFileInfo(file).absoluteFilePath()}, {"gameServerUrl", gameServerUrl},
+                                  {"dlcServerUrl", dlcServerUrl}, {"priority", priorityName}};
+        const Daemon::Response response = client.request("POST", "/jobs", request);
+        if (!response.ok()) {
+            out << "ERROR: " << file << ": " << response.error() << Qt::endl;
+            failed++;
+            continue;
+        }
+        submitted.append({response.json()["id"].toInt(), file});
+    }
+
+    for (const auto& [jobId, file] : submitted) {
+        QJsonObject job;
+        QByteArray pending;
+        const QString jobPath = QString("/jobs/%1").arg(jobId);
+        const Daemon::Response events = client.stream(jobPath + "/events", [&](const QByteArray& data) {
+            pending += data;
+            qsizetype newline;
+            while ((newline = pending.indexOf('\n')) >= 0) {
+                const QJsonObject event = QJsonDocument::fromJson(pending.left(newline)).object();
+                pending.remove(0, newline + 1);
+                if (event["event"].toString() != "state") {
+                    continue;
+                }
+                job = event["job"].toObject();
+                out << "[job " << jobId << "] " << job["state"].toString() << ": " << file;
+                if (job.contains("error")) {
+                    out << " (" << job["error"].toString() << ")";
+                }
+                out << Qt::endl;
+            }
+        });
+        if (!events.ok()) {
+            out << "ERROR: " << file << ": " << events.error() << Qt::endl;
+        }
+
+        if (job["state"].toString() != Patcher::toString(Patcher::JobState::Succeeded)) {
+            failed++;
+            continue;
+        }
+
+        Patcher::PatchJob local;
+        local.path = file;
+        const Daemon::Response artifact = client.download(jobPath + "/artifact", local.outputPath());
+        const Daemon::Response manifest = client.download(jobPath + "/manifest", local.outputPath() + ".manifest.json");
+        if (!artifact.ok() || !manifest.ok()) {
+            out << "ERROR: " << file << ": " << (artifact.ok() ? manifest : artifact).error() << Qt::endl;
+            failed++;
+            continue;
+        }
+        out << "Saved " << local.outputPath() << Qt::endl;
+    }
+
+    out << (files.size() - failed) << " succeeded, " << failed << " failed" << Qt::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+QString backendNames()
+{
+    QStringList names;
+    for (const auto& name : utils::deflateBackends()) {
+        names.append(QString::fromStdString(name));
+    }
+    return names.join(", ");
+}
+
+}
+
+bool isHeadless(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (headlessSwitches.contains(QString::fromLocal8Bit(argv[i]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int run(QCoreApplication& app)
+{
+    QTextStream out(stdout);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("TSTO Patcher");
+    parser.addHelpOption();
+
+    QCommandLineOption benchOption("bench", "Generate synthetic artifacts and benchmark the patch pipeline.");
+    QCommandLineOption generateOption("generate", "Only generate synthetic artifacts into the bench directory.");
+    QCommandLineOption scanOption("scan", "Report every known URL in an APK/IPA as JSON, without decoding it.", "file");
+    QCommandLineOption probeOption("probe", "Report the package or bundle id, version and ABIs of an APK/IPA as JSON, read straight from the archive.", "file");
+    QCommandLineOption exportRecipeOption("export-recipe", "Write the built-in patch recipe to a file, as a starting point for recipes/tsto.json.", "file");
+    QCommandLineOption patchOption("patch", "Patch every APK/IPA given as argument, several at a time.");
+    QCommandLineOption jobsOption("jobs", "Number of artifacts patched concurrently.", "count");
+    QCommandLineOption priorityOption("priority", "Job priority: bulk, normal or hotfix.", "priority", "normal");
+    QCommandLineOption maxMemoryOption("max-memory", "Memory the concurrent jobs may use together, in MiB. Defaults to 80% of RAM.", "mib", "0");
+    QCommandLineOption maxDiskOption("max-disk", "Scratch disk the concurrent jobs may use together, in MiB. Defaults to 90% of the free space.", "mib", "0");
+    QCommandLineOption workspaceBudgetOption("workspace-budget", "Disk the kept APK workspaces may use together, in MiB; the least recently used are deleted first. 0 for no limit.", "mib", "20480");
+    QCommandLineOption storedLibsOption("no-extract-native-libs", "Store native libraries uncompressed and 16 KiB aligned, loaded straight from the APK.");
+    QCommandLineOption keepArchOption("keep-arch", "Comma separated architectures to keep (arm64, armv7, ...); other APK ABIs and Mach-O slices are removed.", "archs");
+    QCommandLineOption zipLevelOption("zip-level", "Deflate level for repacked IPAs, 0 (store) to 9 (smallest).", "level", "6");
+    QCommandLineOption zipBackendOption("zip-backend", "Deflate implementation for repacked IPAs: " + backendNames() + ".", "name", "builtin");
+    QCommandLineOption daemonOption("daemon", "Stay resident and take patch jobs on a local socket and a localhost HTTP port.");
+    QCommandLineOption remoteOption("remote", "With --patch, hand the files to a running --daemon instead of patching here.");
+    QCommandLineOption socketOption("socket", "Local socket name of the daemon.", "name", "tsto_patcher");
+    QCommandLineOption httpPortOption("http-port", "Localhost HTTP port of the daemon, 0 for none.", "port", "8765");
+    QCommandLineOption inboxOption("inbox", "With --daemon, prepare every new APK/IPA dropped in this directory ahead of patch requests.", "dir");
+    QCommandLineOption spoolOption("spool", "Shared spool directory: --patch submits to it and waits, --spool-worker takes jobs from it.", "dir", "spool");
+    QCommandLineOption spoolWorkerOption("spool-worker", "Work as a build node on the --spool directory.");
+    QCommandLineOption spoolDrainOption("spool-drain", "With --spool-worker, exit once nothing is left to claim.");
+    QCommandLineOption reproducibleOption("reproducible", "Produce byte-identical outputs for identical inputs (normalized zips, deterministic signing).");
+    QCommandLineOption typeOption("bench-type", "Artifacts to benchmark: apk, ipa, both, or zip to compare the deflate backends.", "type", "both");
+    QCommandLineOption runsOption("bench-runs", "Number of runs per artifact.", "count", "5");
+    QCommandLineOption classesOption("bench-classes", "Number of classes in the synthetic dex.", "count", "2000");
+    QCommandLineOption libSizeOption("bench-lib-size", "Size of each synthetic libscorpio.so in MiB.", "mib", "8");
+    QCommandLineOption exeSizeOption("bench-exe-size", "Size of the synthetic IPA executable in MiB.", "mib", "32");
+    QCommandLineOption dirOption("bench-dir", "Directory for the generated artifacts.", "dir", "bench");
+    QCommandLineOption jsonOption("bench-json", "Write the results as JSON to this file.", "file");
+    QCommandLineOption gameUrlOption("game-url", "Game server URL.", "url", "http://127.0.0.1:80");
+    QCommandLineOption dlcUrlOption("dlc-url", "DLC server URL.", "url", "http://127.0.0.1:8080");
+
+    parser.addOptions({benchOption, generateOption, scanOption, probeOption, exportRecipeOption, patchOption, jobsOption, priorityOption, maxMemoryOption, maxDiskOption, workspaceBudgetOption, storedLibsOption, keepArchOption, zipLevelOption, zipBackendOption, reproducibleOption, daemonOption, remoteOption, socketOption, httpPortOption, inboxOption, spoolOption, spoolWorkerOption, spoolDrainOption, typeOption, runsOption, classesOption, libSizeOption,
+                       exeSizeOption, dirOption, jsonOption, gameUrlOption, dlcUrlOption});
+    parser.addPositionalArgument("files", "Artifacts to patch with --patch.", "[files...]");
+    parser.process(app);
+
+    Bench::BenchOptions options;
+    options.type = parser.value(typeOption).toLower();
+    options.runs = qMax(1, parser.value(runsOption).toInt());
+    options.workDir = parser.value(dirOption);
+    options.jsonOutput = parser.value(jsonOption);
+    options.gameServerUrl = parser.value(gameUrlOption);
+    options.dlcServerUrl = parser.value(dlcUrlOption);
+    options.generator.classCount = qMax(1, parser.value(classesOption).toInt());
+    options.generator.nativeLibSize = parser.value(libSizeOption).toLongLong() * 1024 * 1024;
+    options.generator.executableSize = parser.value(exeSizeOption).toLongLong() * 1024 * 1024;
+
+    if (parser.isSet(scanOption)) {
+        Patcher::CensusReport report = Patcher::Census::scan(parser.value(scanOption));
+        out << QJsonDocument(report.toJson()).toJson();
+        return report.success ? 0 : 1;
+    }
+
+    if (parser.isSet(probeOption)) {
+        Patcher::ArtifactInfo info = Patcher::Probe::read(parser.value(probeOption));
+        out << QJsonDocument(info.toJson()).toJson();
+        return info.success ? 0 : 1;
+    }
+
+    if (parser.isSet(exportRecipeOption)) {
+        QFile file(parser.value(exportRecipeOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            out << "ERROR: Could not write " << file.fileName() << Qt::endl;
+            return 1;
+        }
+        file.write(Patcher::Recipe::builtinJson());
+        out << "Recipe written to " << file.fileName() << Qt::endl;
+        return 0;
+    }
+
+    PatcherSettings settings;
+    settings.jobs = parser.value(jobsOption).toInt();
+    settings.maxMemory = parser.value(maxMemoryOption).toLongLong() * 1024 * 1024;
+    settings.maxDisk = parser.value(maxDiskOption).toLongLong() * 1024 * 1024;
+    if (parser.isSet(workspaceBudgetOption)) {
+        settings.workspaceBudget = parser.value(workspaceBudgetOption).toLongLong() * 1024 * 1024;
+    }
+    settings.extractNativeLibs = !parser.isSet(storedLibsOption);
+    settings.archs = parser.value(keepArchOption).split(',', Qt::SkipEmptyParts);
+    settings.zipLevel = parser.value(zipLevelOption).toInt();
+    settings.zipBackend = parser.value(zipBackendOption);
+    settings.reproducible = parser.isSet(reproducibleOption);
+
+    if (parser.isSet(patchOption) && parser.isSet(remoteOption)) {
+        return runRemote(parser.positionalArguments(), parser.value(socketOption), parser.value(priorityOption),
+                         options.gameServerUrl, options.dlcServerUrl, out);
+    }
+
+    if (parser.isSet(patchOption) && parser.isSet(spoolOption)) {
+        return Spool::runSubmit(parser.value(spoolOption), parser.positionalArguments(),
+                                Patcher::JobPriority::fromName(parser.value(priorityOption)),
+                                options.gameServerUrl, options.dlcServerUrl, out);
+    }
+
+    if (parser.isSet(patchOption)) {
+        return runPatch(parser.positionalArguments(), settings, parser.value(priorityOption),
+                        options.gameServerUrl, options.dlcServerUrl, out);
+    }
+
+    if (parser.isSet(spoolWorkerOption)) {
+        Patcher::AppPatcher patcher;
+        settings.apply(patcher);
+        return Spool::runWorker(patcher, parser.value(spoolOption), parser.isSet(spoolDrainOption), out);
+    }
+
+    if (parser.isSet(daemonOption)) {
+        Patcher::AppPatcher patcher;
+        settings.apply(patcher);
+        patcher.setKeepWorkspaces(true);
+        Daemon::ServerOptions serverOptions;
+        serverOptions.socketName = parser.value(socketOption);
+        serverOptions.httpPort = static_cast<quint16>(parser.value(httpPortOption).toUInt());
+        serverOptions.inboxDir = parser.value(inboxOption);
+        return Daemon::runDaemon(patcher, serverOptions, out);
+    }
+
+    if (parser.isSet(generateOption)) {
+        QDir().mkpath(options.workDir);
+        Bench::ArtifactGenerator generator(options.generator);
+        QString errorMessage;
+        QString apkPath = QDir(options.workDir).absoluteFilePath("bench.apk");
+        QString ipaPath = QDir(options.workDir).absoluteFilePath("bench.ipa");
+        if (!generator.generateAPK(apkPath, &errorMessage) || !generator.generateIPA(ipaPath, &errorMessage)) {
+            out << "ERROR: " << errorMessage << Qt::endl;
+            return 1;
+        }
+        out << "Generated " << apkPath << " and " << ipaPath << Qt::endl;
+        return 0;
+    }
+
+    if (parser.isSet(benchOption)) {
+        return Bench::runBench(options, out);
+    }
+
+    parser.showHelp(1);
+    return 1;
+}
+
+}
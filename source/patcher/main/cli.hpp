@@ -0,0 +1,9 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Cli {
+    // True when the command line asks for a headless mode instead of the GUI
+    bool isHeadless(int argc, char** argv);
+
+    int run(QCoreApplication& app);
+}
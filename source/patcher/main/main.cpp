@@ -1,5 +1,6 @@
 #include "std_include.hpp"
 #include "MainWindow.hpp"
+#include "cli.hpp"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -7,6 +8,17 @@
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     int argc = __argc;
     char** argv = __argv;
+
+    if (Cli::isHeadless(argc, argv)) {
+        // windowed app has no console of its own, borrow the one we were started from
+        if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+            freopen("CONOUT$", "w", stdout);
+            freopen("CONOUT$", "w", stderr);
+        }
+        QCoreApplication app(argc, argv);
+        return Cli::run(app);
+    }
+
     QApplication app(argc, argv);
     MainWindow window;
     window.show();
@@ -14,6 +26,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 }
 #else
 int main(int argc, char *argv[]) {
+    if (Cli::isHeadless(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return Cli::run(app);
+    }
+
     QApplication app(argc, argv);
     MainWindow window;
     window.show();
@@ -0,0 +1,166 @@
+#include "std_include.hpp"
+#include "watchdog.hpp"
+
+namespace {
+
+// about five minutes of heartbeats, older ones are overwritten
+constexpr size_t maxSamples = 30000;
+constexpr int maxStalls = 1000;
+
+qint64 percentile(std::vector<qint64> values, double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    const size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+}
+
+class StallWatchdogPrivate {
+public:
+    StallWatchdog* q;
+    int intervalMs;
+    int thresholdMs;
+    QTimer timer;
+    QElapsedTimer clock;
+    qint64 lastTick = 0;
+    QString stage;
+    // the first stage entered since the last heartbeat, a handler that blocks usually announces
+    // its stage first and moves on before the loop gets to run again
+    QString enteredStage;
+
+    std::vector<qint64> latencies;
+    size_t next = 0;
+    QList<UiStall> stalls;
+
+    StallWatchdogPrivate(StallWatchdog* q, int intervalMs, int thresholdMs)
+        : q(q), intervalMs(intervalMs), thresholdMs(thresholdMs)
+    {
+    }
+
+    void tick()
+    {
+        const qint64 now = clock.elapsed();
+        const qint64 latency = std::max<qint64>(0, now - lastTick - intervalMs);
+        const QString active = enteredStage.isEmpty() ? stage : enteredStage;
+        const QString stalledStage = active.isEmpty() ? QStringLiteral("idle") : active;
+        enteredStage.clear();
+        lastTick = now;
+
+        if (latencies.size() < maxSamples) {
+            latencies.push_back(latency);
+        } else {
+            latencies[next] = latency;
+            next = (next + 1) % maxSamples;
+        }
+
+        if (latency >= thresholdMs) {
+            if (stalls.size() < maxStalls) {
+                stalls.append({QDateTime::currentDateTime().addMSecs(-latency), latency, stalledStage});
+            }
+            emit q->stalled(latency, stalledStage);
+        }
+    }
+};
+
+StallWatchdog::StallWatchdog(QObject* parent, int intervalMs, int thresholdMs)
+    : QObject(parent)
+    , d(new StallWatchdogPrivate(this, intervalMs, thresholdMs))
+{
+    d->timer.setTimerType(Qt::PreciseTimer);
+    d->timer.setInterval(intervalMs);
+    connect(&d->timer, &QTimer::timeout, this, [this]() { d->tick(); });
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    delete d;
+}
+
+void StallWatchdog::start()
+{
+    d->clock.start();
+    d->lastTick = 0;
+    d->timer.start();
+}
+
+void StallWatchdog::setStage(const QString& stage)
+{
+    if (d->enteredStage.isEmpty()) {
+        d->enteredStage = stage;
+    }
+    d->stage = stage;
+}
+
+ResponsivenessReport StallWatchdog::report() const
+{
+    ResponsivenessReport report;
+    report.samples = static_cast<int>(d->latencies.size());
+    report.thresholdMs = d->thresholdMs;
+    report.p50Ms = percentile(d->latencies, 0.50);
+    report.p99Ms = percentile(d->latencies, 0.99);
+    report.worstMs = d->latencies.empty() ? 0 : *std::max_element(d->latencies.begin(), d->latencies.end());
+    report.stalls = d->stalls;
+    return report;
+}
+
+void StallWatchdog::reset()
+{
+    d->latencies.clear();
+    d->next = 0;
+    d->stalls.clear();
+    d->lastTick = d->clock.isValid() ? d->clock.elapsed() : 0;
+}
+
+QMap<QString, int> ResponsivenessReport::stallsByStage() const
+{
+    QMap<QString, int> counts;
+    for (const UiStall& stall : stalls) {
+        counts[stall.stage]++;
+    }
+    return counts;
+}
+
+QString ResponsivenessReport::summary() const
+{
+    QString text = QString("UI latency p50 %1 ms, p99 %2 ms, worst %3 ms; %4 stall(s) over %5 ms")
+        .arg(p50Ms).arg(p99Ms).arg(worstMs).arg(stalls.size()).arg(thresholdMs);
+    if (!stalls.isEmpty()) {
+        QStringList stages;
+        const QMap<QString, int> counts = stallsByStage();
+        for (auto it = counts.constBegin(); it != counts.constEnd(); ++it) {
+            stages << QString("%1 x%2").arg(it.key()).arg(it.value());
+        }
+        text += " (" + stages.join(", ") + ")";
+    }
+    return text;
+}
+
+QJsonObject ResponsivenessReport::toJson() const
+{
+    QJsonArray stallArray;
+    for (const UiStall& stall : stalls) {
+        stallArray.append(QJsonObject{
+            {"at", stall.at.toString(Qt::ISODateWithMs)},
+            {"durationMs", stall.durationMs},
+            {"stage", stall.stage}
+        });
+    }
+    QJsonObject byStage;
+    const QMap<QString, int> counts = stallsByStage();
+    for (auto it = counts.constBegin(); it != counts.constEnd(); ++it) {
+        byStage[it.key()] = it.value();
+    }
+    return QJsonObject{
+        {"samples", samples},
+        {"thresholdMs", thresholdMs},
+        {"p50Ms", p50Ms},
+        {"p99Ms", p99Ms},
+        {"worstMs", worstMs},
+        {"stallsByStage", byStage},
+        {"stalls", stallArray}
+    };
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "std_include.hpp"
+
+class StallWatchdogPrivate;
+
+struct UiStall {
+    QDateTime at;
+    qint64 durationMs = 0;
+    QString stage;
+};
+
+struct ResponsivenessReport {
+    int samples = 0;
+    qint64 thresholdMs = 0;
+    qint64 p50Ms = 0;
+    qint64 p99Ms = 0;
+    qint64 worstMs = 0;
+    QList<UiStall> stalls;
+
+    QMap<QString, int> stallsByStage() const;
+    QString summary() const;
+    QJsonObject toJson() const;
+};
+
+// Measures how late the main thread serves a heartbeat timer. Whatever keeps the event loop busy
+// longer than the threshold, a synchronous call or a flood of log appends, counts as a stall and
+// is recorded with the pipeline stage that was active when it began.
+class StallWatchdog : public QObject {
+    Q_OBJECT
+
+public:
+    StallWatchdog(QObject* parent = nullptr, int intervalMs = 10, int thresholdMs = 50);
+    virtual ~StallWatchdog();
+
+    void start();
+    void setStage(const QString& stage);
+
+    // Everything measured since the last reset
+    ResponsivenessReport report() const;
+    void reset();
+
+signals:
+    void stalled(qint64 durationMs, const QString& stage);
+
+private:
+    StallWatchdogPrivate* d;
+    Q_DISABLE_COPY(StallWatchdog)
+};
@@ -0,0 +1,171 @@
+#include "std_include.hpp"
+#include "admission.hpp"
+#include "utils.hpp"
+#include <QtCore/QSaveFile>
+#include <QtCore/QStorageInfo>
+
+namespace Patcher {
+
+namespace {
+
+constexpr int kHistorySize = 20;
+constexpr qint64 kMiB = 1024 * 1024;
+
+struct Model {
+    qint64 baseMemory;
+    double memoryPerInputByte;
+    double diskPerInputByte;
+};
+
+// apktool holds a JVM with the whole resource table and expands the dex into smali many
+// times the APK size; an IPA is copied, extracted and compressed again
+const QMap<QString, Model> kDefaultModels = {
+    {"apk", {1024 * kMiB, 4.0, 14.0}},
+    {"ipa", {256 * kMiB, 1.5, 3.5}},
+};
+
+}
+
+ResourceEstimate& ResourceEstimate::operator+=(const ResourceEstimate& other)
+{
+    memoryBytes += other.memoryBytes;
+    diskBytes += other.diskBytes;
+    return *this;
+}
+
+AdmissionController::AdmissionController(const QString& historyPath)
+    : historyPath_(historyPath)
+{
+    loadHistory();
+    refreshDiskBaseline();
+}
+
+void AdmissionController::setBudget(qint64 memoryBytes, qint64 diskBytes)
+{
+    memoryBudget_ = memoryBytes;
+    diskBudget_ = diskBytes;
+}
+
+ResourceEstimate AdmissionController::budget() const
+{
+    ResourceEstimate result;
+    result.memoryBytes = memoryBudget_ > 0 ? memoryBudget_ : static_cast<qint64>(utils::physicalMemory() * 0.8);
+    result.diskBytes = diskBudget_ > 0 ? diskBudget_ : static_cast<qint64>(diskBaseline_ * 0.9);
+    return result;
+}
+
+void AdmissionController::refreshDiskBaseline()
+{
+    QDir().mkpath("workspaces");
+    QStorageInfo storage(QDir("workspaces").absolutePath());
+    diskBaseline_ = storage.isValid() ? storage.bytesAvailable() : 0;
+}
+
+QString AdmissionController::typeOf(const QString& path)
+{
+    return QFileInfo(path).suffix().compare("ipa", Qt::CaseInsensitive) == 0 ? "ipa" : "apk";
+}
+
+ResourceEstimate AdmissionController::estimate(const QString& path) const
+{
+    const QString type = typeOf(path);
+    const qint64 inputSize = QFileInfo(path).size();
+    const Model model = kDefaultModels.value(type);
+
+    ResourceEstimate result;
+    result.memoryBytes = model.baseMemory + static_cast<qint64>(inputSize * model.memoryPerInputByte);
+    result.diskBytes = static_cast<qint64>(inputSize * model.diskPerInputByte);
+
+    // once there is history, the worst recorded ratio (plus margin) replaces the model
+    const QList<Sample> samples = history_.value(type);
+    if (!samples.isEmpty() && inputSize > 0) {
+        double memoryRatio = 0;
+        double diskRatio = 0;
+        for (const auto& sample : samples) {
+            if (sample.inputSize <= 0) {
+                continue;
+            }
+            memoryRatio = qMax(memoryRatio, static_cast<double>(sample.memoryBytes) / sample.inputSize);
+            diskRatio = qMax(diskRatio, static_cast<double>(sample.diskBytes) / sample.inputSize);
+        }
+        if (memoryRatio > 0) {
+            result.memoryBytes = static_cast<qint64>(inputSize * memoryRatio * 1.15);
+        }
+        if (diskRatio > 0) {
+            result.diskBytes = static_cast<qint64>(inputSize * diskRatio * 1.15);
+        }
+    }
+    return result;
+}
+
+QString AdmissionController::checkAdmission(const ResourceEstimate& job, const ResourceEstimate& running) const
+{
+    const ResourceEstimate limits = budget();
+    if (limits.memoryBytes > 0 && running.memoryBytes + job.memoryBytes > limits.memoryBytes) {
+        return QString("Waiting for memory (needs %1 MB, %2 of %3 MB reserved)")
+            .arg(job.memoryBytes / kMiB).arg(running.memoryBytes / kMiB).arg(limits.memoryBytes / kMiB);
+    }
+    if (limits.diskBytes > 0 && running.diskBytes + job.diskBytes > limits.diskBytes) {
+        return QString("Waiting for disk space (needs %1 MB, %2 of %3 MB reserved)")
+            .arg(job.diskBytes / kMiB).arg(running.diskBytes / kMiB).arg(limits.diskBytes / kMiB);
+    }
+    return QString();
+}
+
+void AdmissionController::recordRun(const QString& path, qint64 inputSize, const ResourceEstimate& observed)
+{
+    if (inputSize <= 0) {
+        return;
+    }
+    QList<Sample>& samples = history_[typeOf(path)];
+    samples.append({inputSize, observed.memoryBytes, observed.diskBytes});
+    while (samples.size() > kHistorySize) {
+        samples.removeFirst();
+    }
+    saveHistory();
+}
+
+void AdmissionController::loadHistory()
+{
+    QFile file(historyPath_);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto it = root.begin(); it != root.end(); ++it) {
+        QList<Sample> samples;
+        for (const auto& value : it.value().toArray()) {
+            QJsonObject obj = value.toObject();
+            samples.append({static_cast<qint64>(obj["input"].toDouble()),
+                            static_cast<qint64>(obj["memory"].toDouble()),
+                            static_cast<qint64>(obj["disk"].toDouble())});
+        }
+        history_.insert(it.key(), samples);
+    }
+}
+
+void AdmissionController::saveHistory() const
+{
+    QJsonObject root;
+    for (auto it = history_.begin(); it != history_.end(); ++it) {
+        QJsonArray samples;
+        for (const auto& sample : it.value()) {
+            QJsonObject obj;
+            obj["input"] = sample.inputSize;
+            obj["memory"] = sample.memoryBytes;
+            obj["disk"] = sample.diskBytes;
+            samples.append(obj);
+        }
+        root[it.key()] = samples;
+    }
+
+    QDir().mkpath(QFileInfo(historyPath_).absolutePath());
+    QSaveFile file(historyPath_);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
+
+}
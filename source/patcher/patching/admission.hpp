@@ -0,0 +1,50 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+struct ResourceEstimate {
+    qint64 memoryBytes = 0;
+    qint64 diskBytes = 0;
+
+    ResourceEstimate& operator+=(const ResourceEstimate& other);
+};
+
+// Decides whether a job may start given what the running ones are expected to use.
+// Estimates start from per-type ratios of the input size and follow the recorded runs.
+class AdmissionController {
+public:
+    explicit AdmissionController(const QString& historyPath = "cache/job_history.json");
+
+    // 0 means derived from the machine: 80% of physical memory, 90% of the free workspace disk
+    void setBudget(qint64 memoryBytes, qint64 diskBytes);
+    ResourceEstimate budget() const;
+
+    ResourceEstimate estimate(const QString& path) const;
+    // Empty when the job fits next to the running ones, otherwise what it is waiting for
+    QString checkAdmission(const ResourceEstimate& job, const ResourceEstimate& running) const;
+
+    void recordRun(const QString& path, qint64 inputSize, const ResourceEstimate& observed);
+
+    // Free space is sampled while nothing runs, so running jobs' scratch data is not counted twice
+    void refreshDiskBaseline();
+
+private:
+    struct Sample {
+        qint64 inputSize = 0;
+        qint64 memoryBytes = 0;
+        qint64 diskBytes = 0;
+    };
+
+    static QString typeOf(const QString& path);
+    void loadHistory();
+    void saveHistory() const;
+
+    QString historyPath_;
+    qint64 memoryBudget_ = 0;
+    qint64 diskBudget_ = 0;
+    qint64 diskBaseline_ = 0;
+    QMap<QString, QList<Sample>> history_;
+};
+
+}
@@ -1,5 +1,16 @@
 #include "std_include.hpp"
 #include "apk_patcher.hpp"
+#include "census.hpp"
+#include "patch_site_db.hpp"
+#include "recipe.hpp"
+#include "patch_passes.hpp"
+#include "checkpoint.hpp"
+#include "pruning.hpp"
+#include "verification.hpp"
+#include "probe.hpp"
+#include "workspace_gc.hpp"
+#include "utils.hpp"
+#include "zip.hpp"
 #include <QtCore/QProcess>
 #include <QtCore/QFile>
 #include <QtCore/QDir>
@@ -15,12 +26,49 @@ struct APKPatcherPrivate {
     APKPatcher* q;
     QString gameServerUrl;
     QString dlcServerUrl;
+    CompiledRecipe recipe;
+    PatchSiteDatabase& siteDatabase = PatchSiteDatabase::shared();
+    QMap<QString, QByteArray> entryHashes;
+    QString workspace = ".";
+    QString output;
+    std::atomic<bool> cancelled{false};
+    qint64 peakToolMemory = 0;
+    bool extractNativeLibs = true;
+    bool reproducible = false;
+    ArchFilter archFilter;
+    // resources are left compiled by the decode and patched in their string pools
+    bool compiledResources = false;
 
     explicit APKPatcherPrivate(APKPatcher* patcher) : q(patcher) {}
 
-    bool decompileApp(const QString& inputFile);
-    bool recompileApp(const QString& inputFile);
-    bool replaceUrls(const QString& gameServerUrl, const QString& dlcServerUrl);
+    QString workPath(const QString& name) const { return QDir(workspace).filePath(name); }
+    // the job's output path when one was given, <name>-patched.apk in the working directory otherwise
+    QString outputPath(const QString& inputFile) const
+    {
+        return output.isEmpty() ? QFileInfo(inputFile).baseName() + "-patched.apk" : output;
+    }
+    static QStringList stages() { return {"decode", "rewrite", "build", "sign"}; }
+    static QByteArray toolInputs() { return QDir("sdktools/apktool").entryList({"*.jar"}).value(0).toUtf8(); }
+    QByteArray decodeInputs() const { return toolInputs() + (compiledResources ? "|compiled-resources" : ""); }
+    void chooseDecodeMode(const Recipe& source);
+    bool checkCancelled();
+    void sampleToolMemory(const QProcess& process);
+
+    QProcessEnvironment javaEnvironment();
+    bool decompileApp(const QString& inputFile, PassStream* stream = nullptr);
+    bool keepNativeLibsStored();
+    bool buildApp();
+    QString findKeystore();
+    QString findApksigner() const;
+    bool jarsign(const QString& apkPath, const QString& keystorePath, const QProcessEnvironment& env);
+    bool normalizeApp(const QString& apkPath);
+    bool signApp(const QString& inputFile);
+    bool alignApp(const QString& apkPath);
+    bool signSchemeV2(const QString& apkPath, const QString& keystorePath, const QProcessEnvironment& env);
+    bool verifyApp(const QString& inputFile);
+    bool pruneApp();
+    bool replaceUrls(const PassManager& passes, PassStream* stream = nullptr);
+    bool prepareAPK(const QString& apkPath);
     bool patchAPK(const QString& apkPath, const QString& newGameServerUrl, const QString& newDlcServerUrl);
 };
 
@@ -37,6 +85,13 @@ APKPatcher::~APKPatcher()
 
 bool APKPatcher::checkDependencies()
 {
+    // the toolchain does not move while the process runs, one good check covers every later job
+    static std::atomic<bool> verified = false;
+    if (verified) {
+        emit log("Dependencies already verified");
+        return true;
+    }
+
     emit progressUpdated(0, "Checking dependencies...");
     emit log("Checking for required dependencies...");
 
@@ -210,157 +265,185 @@ bool APKPatcher::checkDependencies()
         emit log("jarsigner found in PATH");
     }
 
+    verified = true;
     emit progressUpdated(100, "Dependencies verified successfully!");
     emit log("All dependencies verified successfully!");
     return true;
 }
 
-bool APKPatcherPrivate::replaceUrls(const QString& gameServerUrl, const QString& dlcServerUrl)
+void APKPatcher::setWorkspace(const QString& dir)
 {
-    q->emit log("\n=== URL Replacement Summary ===");
-    q->emit log("Game Server URL: " + gameServerUrl);
-    q->emit log("DLC Server URL: " + dlcServerUrl);
-    
-    QStringList textExtensions = {".xml", ".smali", ".txt"};
-    QMap<QString, QString> replacements;
-    replacements["https://prod.simpsons-ea.com"] = gameServerUrl;
-    replacements["https://syn-dir.sn.eamobile.com"] = gameServerUrl;
+    d->workspace = dir;
+}
 
+void APKPatcher::setOutputPath(const QString& path)
+{
+    d->output = path;
+}
 
-    q->emit log("\nSearching for URLs to replace:");
-    for (auto it = replacements.begin(); it != replacements.end(); ++it) {
-        q->emit log("  " + it.key() + " -> " + it.value());
-    }
+void APKPatcher::setExtractNativeLibs(bool extract)
+{
+    d->extractNativeLibs = extract;
+}
 
-    QDirIterator it("tappedout", QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        QString filePath = it.next();
-        
-        bool isTextFile = false;
-        for (const auto& ext : textExtensions) {
-            if (filePath.endsWith(ext)) {
-                isTextFile = true;
-                break;
-            }
-        }
-        
-        if (!isTextFile) continue;
+void APKPatcher::setReproducible(bool reproducible)
+{
+    d->reproducible = reproducible;
+}
 
-        QFile file(filePath);
-        if (!file.open(QIODevice::ReadWrite | QIODevice::Text)) {
-            q->emit log("WARNING: Could not open file: " + filePath);
-            continue;
-        }
+void APKPatcher::setArchFilter(const QStringList& archs)
+{
+    d->archFilter = ArchFilter(archs);
+}
 
-        QString content = file.readAll();
-        bool modified = false;
+void APKPatcher::cancel()
+{
+    d->cancelled = true;
+}
 
-        for (auto it = replacements.begin(); it != replacements.end(); ++it) {
-            if (content.contains(it.key())) {
-                content.replace(it.key(), it.value());
-                q->emit log("Replaced '" + it.key() + "' with '" + it.value() + "' in " + filePath);
-                modified = true;
-            }
-        }
+qint64 APKPatcher::peakToolMemory() const
+{
+    return d->peakToolMemory;
+}
 
-        if (modified) {
-            file.seek(0);
-            file.write(content.toUtf8());
-            file.resize(file.pos());
-        }
-        
-        file.close();
+void APKPatcherPrivate::sampleToolMemory(const QProcess& process)
+{
+    if (process.processId() > 0) {
+        peakToolMemory = qMax(peakToolMemory, static_cast<qint64>(utils::peakProcessMemory(process.processId())));
     }
+}
 
-    q->emit log("\n=== Binary Patching Summary ===");
-    q->emit log("Starting binary patching for DLC URL...");
-
-    QByteArray originalUrl = "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/";
-    q->emit log("Original DLC URL length: " + QString::number(originalUrl.length()) + " bytes");
-
-    QString newUrl = dlcServerUrl.trimmed();
-    if (newUrl.endsWith('/')) {
-        newUrl.chop(1);
+bool APKPatcherPrivate::checkCancelled()
+{
+    if (!cancelled) {
+        return false;
     }
-    newUrl += "/static/";
-    QByteArray newUrlBytes = newUrl.toUtf8();
-    q->emit log("New DLC URL: " + newUrl);
-    q->emit log("New DLC URL length: " + QString::number(newUrlBytes.length()) + " bytes");
+    q->emit log("Patching cancelled");
+    q->emit error("Patching cancelled");
+    return true;
+}
 
-    // Pad with "./" pairs if needed
-    int paddingNeeded = originalUrl.length() - newUrlBytes.length();
-    if (paddingNeeded > 0) {
-        q->emit log("Adding " + QString::number(paddingNeeded) + " bytes of padding");
-        while (newUrlBytes.length() < originalUrl.length() - 1) {
-            newUrlBytes.append("./");
-        }
-        if (newUrlBytes.length() < originalUrl.length()) {
-            newUrlBytes.append('/');
+// A rewrite target that covers resources.arsc can patch every resource in place, so apktool
+// skips the resource decode and the aapt2 rebuild. Storing native libraries still needs the
+// manifest as text.
+void APKPatcherPrivate::chooseDecodeMode(const Recipe& source)
+{
+    compiledResources = false;
+    for (const auto& target : source.targets) {
+        const bool forApk = target.platforms.isEmpty() || target.platforms.contains("apk");
+        if (forApk && !target.inPlace && target.files.contains("resources.arsc")) {
+            compiledResources = extractNativeLibs;
         }
-        q->emit log("Final padded URL: " + QString::fromUtf8(newUrlBytes));
-        q->emit log("Final URL length: " + QString::number(newUrlBytes.length()) + " bytes");
-    } else if (paddingNeeded < 0) {
-        q->emit log("ERROR: New URL is too long by " + QString::number(-paddingNeeded) + " bytes");
-        q->emit error("New DLC URL is too long");
-        return false;
     }
+}
 
-    QDirIterator soIt("tappedout", {"*.so"}, QDir::Files, QDirIterator::Subdirectories);
-    while (soIt.hasNext()) {
-        QString filePath = soIt.next();
-        q->emit log("Processing .so file: " + filePath);
+bool APKPatcher::preflight(const QString& apkPath, const QString& gameServerUrl, const QString& dlcServerUrl, bool listSites)
+{
+    Recipe recipe;
+    QString recipeSource;
+    QString recipeError;
+    if (!Recipe::load(recipe, &recipeSource, &recipeError) ||
+        !d->recipe.compile(recipe, "apk", CompiledRecipe::variables(gameServerUrl, dlcServerUrl), &recipeError)) {
+        emit log("ERROR: " + recipeError);
+        emit error(recipeError);
+        return false;
+    }
+    emit log("Using patch recipe: " + recipeSource);
+    d->chooseDecodeMode(recipe);
+
+    emit log("Scanning APK for patch sites...");
+    CensusReport report = Census::scan(apkPath, d->recipe.patterns());
+    if (!report.success) {
+        emit log("ERROR: " + report.errorMessage);
+        emit error("Could not scan APK: " + report.errorMessage);
+        return false;
+    }
 
-        QFile file(filePath);
-        if (!file.open(QIODevice::ReadWrite)) {
-            q->emit log("WARNING: Could not open .so file: " + filePath);
-            continue;
+    emit log(report.summary());
+    if (listSites) {
+        for (const auto& site : report.sites) {
+            emit log("  " + site.toString());
         }
+    }
 
-        QByteArray content = file.readAll();
-        int offset = content.indexOf(originalUrl);
+    d->entryHashes = report.entryHashes;
+    d->siteDatabase.recordCensus(report);
+    if (!d->siteDatabase.save()) {
+        emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
+    }
 
-        if (offset >= 0) {
-            q->emit log("Found DLC URL at offset " + QString::number(offset));
-            q->emit log("Replacing with padded URL...");
-            
-            content.replace(offset, originalUrl.length(), newUrlBytes);
-            file.seek(0);
-            file.write(content);
-            q->emit log("Successfully patched DLC URL");
-        } else {
-            q->emit log("DLC URL not found in this file");
+    QStringList problems = Census::checkReplacements(report, d->recipe.inPlaceReplacements());
+    if (!problems.isEmpty()) {
+        for (const auto& problem : problems) {
+            emit log("ERROR: " + problem);
         }
-        
-        file.close();
+        emit error("New URL is too long: " + problems.first());
+        return false;
     }
-
     return true;
 }
 
-bool APKPatcherPrivate::decompileApp(const QString& inputFile)
+bool APKPatcherPrivate::pruneApp()
 {
-    q->emit log("Starting decompilation...");
-    q->emit log("Current directory: " + QDir::currentPath());
-    q->emit log("Input APK: " + inputFile);
+    if (archFilter.isEmpty()) {
+        return true;
+    }
 
-    // Check if input file exists
-    if (!QFile::exists(inputFile)) {
-        q->emit log("ERROR: Input APK not found: " + inputFile);
-        q->emit error("Input APK not found");
+    // dropped ABIs go before the rewrite, so none of their libraries gets patched
+    PruneResult result = pruneAbis(workPath("tappedout"), archFilter);
+    if (!result.success) {
+        q->emit log("ERROR: " + result.errorMessage);
+        q->emit error(result.errorMessage);
         return false;
     }
+    for (const auto& removed : result.removed) {
+        q->emit log("Removed " + removed);
+    }
+    q->emit log(QString("Kept ABIs for %1, %2 MB of native libraries removed")
+        .arg(archFilter.archs().join(", "))
+        .arg(result.bytesSaved / (1024 * 1024)));
+    return true;
+}
 
-    QDir().mkdir("tappedout");
+bool APKPatcherPrivate::replaceUrls(const PassManager& passes, PassStream* stream)
+{
+    q->emit log("\n=== URL Replacement Summary ===");
+    q->emit log("Game Server URL: " + gameServerUrl);
+    q->emit log("DLC Server URL: " + dlcServerUrl);
 
-    QProcess process;
-    process.setWorkingDirectory(QDir::currentPath());
-    process.setProgram("java");
-    QDir apktoolDir("sdktools/apktool");
-    QString apktoolJar = apktoolDir.absoluteFilePath(apktoolDir.entryList({"*.jar"}).first());
-    process.setArguments({"-jar", apktoolJar, "d", inputFile, "-f", "-o", "tappedout"});
+    q->emit log("\nSearching for URLs to replace:");
+    for (const auto& target : recipe.targets()) {
+        q->emit log("  " + QString::fromUtf8(target.match) + " -> " + QString::fromUtf8(recipe.replacement(target.id)) +
+                    (target.inPlace ? " (in place)" : ""));
+    }
+
+    // when the decode streamed files into the passes, only the catch-up is left to do
+    PassManagerResult result = stream ? stream->finish() : passes.run(workPath("tappedout"));
 
+    for (const auto& line : result.log) {
+        q->emit log(line);
+    }
+    for (const auto& problem : result.errors) {
+        q->emit log("WARNING: " + problem);
+    }
+    q->emit log(QString("Visited %1 files, patched %2 text, %3 compiled resource and %4 native files in %5 ms")
+        .arg(result.filesVisited)
+        .arg(result.changed.value("text"))
+        .arg(result.changed.value("resources"))
+        .arg(result.changed.value("elf"))
+        .arg(result.elapsedMs));
+
+    if (!siteDatabase.save()) {
+        q->emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
+    }
+
+    return true;
+}
+
+QProcessEnvironment APKPatcherPrivate::javaEnvironment()
+{
     QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-    
+
     QByteArray javaHomeBytes = qgetenv("JAVA_HOME");
     QString javaHome = QString::fromLocal8Bit(javaHomeBytes);
     if (javaHome.isEmpty()) {
@@ -386,15 +469,45 @@ bool APKPatcherPrivate::decompileApp(const QString& inputFile)
             }
         }
     }
-    
-    env.insert("SOURCE_OUTPUT", "./tappedout");
+    return env;
+}
+
+bool APKPatcherPrivate::decompileApp(const QString& inputFile, PassStream* stream)
+{
+    q->emit log("Starting decompilation...");
+    q->emit log("Current directory: " + QDir::currentPath());
+    q->emit log("Input APK: " + inputFile);
+
+    // Check if input file exists
+    if (!QFile::exists(inputFile)) {
+        q->emit log("ERROR: Input APK not found: " + inputFile);
+        q->emit error("Input APK not found");
+        return false;
+    }
+
+    WorkspaceCollector::instance().discard(workPath("tappedout"));
+    QDir().mkpath(workPath("tappedout"));
+
+    QProcess process;
+    process.setWorkingDirectory(QDir::currentPath());
+    process.setProgram("java");
+    QDir apktoolDir("sdktools/apktool");
+    QString apktoolJar = apktoolDir.absoluteFilePath(apktoolDir.entryList({"*.jar"}).first());
+    QStringList arguments = {"-jar", apktoolJar, "d", inputFile, "-f", "-o", workPath("tappedout")};
+    if (compiledResources) {
+        arguments.append("--no-res");
+    }
+    process.setArguments(arguments);
+
+    QProcessEnvironment env = javaEnvironment();
+    env.insert("SOURCE_OUTPUT", workPath("tappedout"));
     env.insert("APK_FILE", inputFile);
     env.insert("DLC_URL", dlcServerUrl);
     env.insert("GAMESERVER_URL", gameServerUrl);
     env.insert("DIRECTOR_URL", gameServerUrl);
     process.setProcessEnvironment(env);
 
-    q->emit log("\nExecuting command: java -jar " + apktoolJar + " d " + inputFile + " -f -o tappedout");
+    q->emit log("\nExecuting command: java " + arguments.join(' '));
     
     process.setProcessChannelMode(QProcess::MergedChannels);
     process.start();
@@ -406,7 +519,17 @@ bool APKPatcherPrivate::decompileApp(const QString& inputFile)
         return false;
     }
 
+    if (stream) {
+        stream->start();
+    }
+
     while (process.state() != QProcess::NotRunning) {
+        if (cancelled) {
+            process.kill();
+            process.waitForFinished();
+            return !checkCancelled();
+        }
+        sampleToolMemory(process);
         if (process.waitForReadyRead(1000)) {
             QString output = QString::fromUtf8(process.readAll()).trimmed();
             if (!output.isEmpty()) {
@@ -429,45 +552,69 @@ bool APKPatcherPrivate::decompileApp(const QString& inputFile)
     return true;
 }
 
-bool APKPatcherPrivate::recompileApp(const QString& inputFile)
+bool APKPatcherPrivate::keepNativeLibsStored()
+{
+    // the manifest flag is only valid when every .so is stored, so apktool must not compress them
+    QFile manifestFile(workPath("tappedout/AndroidManifest.xml"));
+    if (!manifestFile.open(QIODevice::ReadOnly)) {
+        q->emit error("Could not read AndroidManifest.xml");
+        return false;
+    }
+    QString manifest = QString::fromUtf8(manifestFile.readAll());
+    manifestFile.close();
+
+    static const QRegularExpression flag(R"(android:extractNativeLibs="[^"]*")");
+    if (manifest.contains(flag)) {
+        manifest.replace(flag, R"(android:extractNativeLibs="false")");
+    } else {
+        manifest.replace(QRegularExpression("<application\\b"), R"(<application android:extractNativeLibs="false")");
+    }
+
+    QFile ymlFile(workPath("tappedout/apktool.yml"));
+    if (!ymlFile.open(QIODevice::ReadOnly)) {
+        q->emit error("Could not read apktool.yml");
+        return false;
+    }
+    QString yml = QString::fromUtf8(ymlFile.readAll());
+    ymlFile.close();
+
+    static const QRegularExpression storedSo("^- so$", QRegularExpression::MultilineOption);
+    if (!yml.contains(storedSo)) {
+        static const QRegularExpression doNotCompress("^doNotCompress:\\s*$", QRegularExpression::MultilineOption);
+        QRegularExpressionMatch match = doNotCompress.match(yml);
+        if (match.hasMatch()) {
+            yml.insert(match.capturedEnd(), "\n- so");
+        } else {
+            yml += "doNotCompress:\n- so\n";
+        }
+    }
+
+    if (!manifestFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || manifestFile.write(manifest.toUtf8()) < 0 ||
+        !ymlFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || ymlFile.write(yml.toUtf8()) < 0) {
+        q->emit error("Could not update the manifest for uncompressed native libraries");
+        return false;
+    }
+    q->emit log("Native libraries will be stored uncompressed and loaded from the APK (extractNativeLibs=false)");
+    return true;
+}
+
+bool APKPatcherPrivate::buildApp()
 {
     q->emit log("Starting APK recompilation...");
 
+    if (!extractNativeLibs && !keepNativeLibsStored()) {
+        return false;
+    }
+
     QProcess buildProcess;
     buildProcess.setWorkingDirectory(QDir::currentPath());
     buildProcess.setProgram("java");
     QDir apktoolDir("sdktools/apktool");
     QString apktoolJar = apktoolDir.absoluteFilePath(apktoolDir.entryList({"*.jar"}).first());
-    buildProcess.setArguments({"-jar", apktoolJar, "b", "tappedout", "-o", "unsigned.apk"});
-    
-    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-    
-    QByteArray javaHomeBytes = qgetenv("JAVA_HOME");
-    QString javaHome = QString::fromLocal8Bit(javaHomeBytes);
-    if (javaHome.isEmpty()) {
-        QProcess javaPathProcess;
-        javaPathProcess.start("where", QStringList() << "java");
-        if (javaPathProcess.waitForFinished()) {
-            QString javaPath = QString::fromUtf8(javaPathProcess.readAllStandardOutput()).trimmed();
-            if (!javaPath.isEmpty()) {
-                QFileInfo javaFileInfo(javaPath.split("\n").first());
-                QString javaBinDir = javaFileInfo.absolutePath();
-                QString possibleJavaHome = QDir(javaBinDir).absolutePath();
-                
-                if (possibleJavaHome.endsWith("bin", Qt::CaseInsensitive)) {
-                    possibleJavaHome = QDir(possibleJavaHome).absolutePath() + "/..";
-                    possibleJavaHome = QDir(possibleJavaHome).canonicalPath();
-                    
-                    q->emit log("Temporarily setting JAVA_HOME to: " + possibleJavaHome);
-                    env.insert("JAVA_HOME", possibleJavaHome);
-                    
-                    QString path = env.value("PATH");
-                    env.insert("PATH", javaBinDir + ";" + path);
-                }
-            }
-        }
-    }
+    const QString unsignedApk = workPath("unsigned.apk");
+    buildProcess.setArguments({"-jar", apktoolJar, "b", workPath("tappedout"), "-o", unsignedApk});
     
+    QProcessEnvironment env = javaEnvironment();
     buildProcess.setProcessEnvironment(env);
     buildProcess.setProcessChannelMode(QProcess::MergedChannels);
     buildProcess.start();
@@ -478,6 +625,12 @@ bool APKPatcherPrivate::recompileApp(const QString& inputFile)
     }
 
     while (buildProcess.state() != QProcess::NotRunning) {
+        if (cancelled) {
+            buildProcess.kill();
+            buildProcess.waitForFinished();
+            return !checkCancelled();
+        }
+        sampleToolMemory(buildProcess);
         if (buildProcess.waitForReadyRead(1000)) {
             QString output = QString::fromUtf8(buildProcess.readAll()).trimmed();
             if (!output.isEmpty()) {
@@ -491,10 +644,37 @@ bool APKPatcherPrivate::recompileApp(const QString& inputFile)
         q->emit error("APK build failed");
         return false;
     }
+    return true;
+}
 
-    QFileInfo fi(inputFile);
-    QString outputName = fi.baseName() + "-patched.apk";
+QString APKPatcherPrivate::findKeystore()
+{
+    QString keystorePath = "sdktools/debug.keystore";
+    if (!QFile::exists(keystorePath)) {
+        q->emit log("WARNING: debug.keystore not found at: " + keystorePath);
+        
+        if (QFile::exists("debug.keystore")) {
+            keystorePath = "debug.keystore";
+            q->emit log("Found debug.keystore in current directory");
+        } else {
+            q->emit error("debug.keystore not found");
+            return QString();
+        }
+    }
+    
+    q->emit log("Using keystore: " + keystorePath);
+    return keystorePath;
+}
+
+QString APKPatcherPrivate::findApksigner() const
+{
+    QDir sdktools("sdktools");
+    const QStringList jars = sdktools.entryList({"apksigner*.jar"});
+    return jars.isEmpty() ? QString() : sdktools.absoluteFilePath(jars.first());
+}
 
+bool APKPatcherPrivate::jarsign(const QString& apkPath, const QString& keystorePath, const QProcessEnvironment& env)
+{
     q->emit log("Signing APK...");
     QProcess signProcess;
     signProcess.setWorkingDirectory(QDir::currentPath());
@@ -588,26 +768,12 @@ bool APKPatcherPrivate::recompileApp(const QString& inputFile)
     
     signProcess.setProgram(jarsignerPath);
     
-    QString keystorePath = "sdktools/debug.keystore";
-    if (!QFile::exists(keystorePath)) {
-        q->emit log("WARNING: debug.keystore not found at: " + keystorePath);
-        
-        if (QFile::exists("debug.keystore")) {
-            keystorePath = "debug.keystore";
-            q->emit log("Found debug.keystore in current directory");
-        } else {
-            q->emit error("debug.keystore not found");
-            return false;
-        }
-    }
-    
-    q->emit log("Using keystore: " + keystorePath);
     signProcess.setArguments({
         "-verbose",
         "-keystore", keystorePath,
         "-storepass", "android",
         "-keypass", "android",
-        "unsigned.apk",
+        apkPath,
         "androiddebugkey"
     });
 
@@ -619,12 +785,18 @@ bool APKPatcherPrivate::recompileApp(const QString& inputFile)
         QString errorMsg = "Failed to start APK signing process: " + signProcess.errorString();
         q->emit log("ERROR: " + errorMsg);
         q->emit log("Command attempted: " + jarsignerPath + " -verbose -keystore " + keystorePath + 
-                   " -storepass android -keypass android unsigned.apk androiddebugkey");
+                   " -storepass android -keypass android " + apkPath + " androiddebugkey");
         q->emit error(errorMsg);
         return false;
     }
 
     while (signProcess.state() != QProcess::NotRunning) {
+        if (cancelled) {
+            signProcess.kill();
+            signProcess.waitForFinished();
+            return !checkCancelled();
+        }
+        sampleToolMemory(signProcess);
         if (signProcess.waitForReadyRead(1000)) {
             QString output = QString::fromUtf8(signProcess.readAll()).trimmed();
             if (!output.isEmpty()) {
@@ -638,22 +810,263 @@ bool APKPatcherPrivate::recompileApp(const QString& inputFile)
         q->emit error("APK signing failed");
         return false;
     }
+    return true;
+}
 
-    if (QFile::exists(outputName)) {
-        QFile::remove(outputName);
+bool APKPatcherPrivate::normalizeApp(const QString& apkPath)
+{
+    const QString normalizedApk = workPath("normalized.apk");
+    if (!utils::zip::normalize(QDir::toNativeSeparators(apkPath).toStdString(), QDir::toNativeSeparators(normalizedApk).toStdString())) {
+        QFile::remove(normalizedApk);
+        q->emit error("APK normalization failed");
+        return false;
+    }
+    if (!QFile::remove(apkPath) || !QFile::rename(normalizedApk, apkPath)) {
+        q->emit error("Failed to replace APK with its normalized copy");
+        return false;
+    }
+    return true;
+}
+
+bool APKPatcherPrivate::signApp(const QString& inputFile)
+{
+    const QString outputName = outputPath(inputFile);
+    const QString unsignedApk = workPath("unsigned.apk");
+    const QString signedApk = workPath("signed.apk");
+    const QProcessEnvironment env = javaEnvironment();
+
+    const QString keystorePath = findKeystore();
+    if (keystorePath.isEmpty()) {
+        return false;
+    }
+
+    // signed on a copy: unsigned.apk stays as the build checkpoint recorded it, so an interrupted
+    // or repeated sign starts again from the unsigned build
+    QFile::remove(signedApk);
+    if (utils::copyFile(QDir::toNativeSeparators(unsignedApk).toStdWString(),
+                        QDir::toNativeSeparators(signedApk).toStdWString()) == utils::CopyMethod::Failed) {
+        q->emit error("Failed to copy the built APK for signing");
+        return false;
     }
-    if (!QFile::rename("unsigned.apk", outputName)) {
-        if (!QFile::copy("unsigned.apk", outputName)) {
-            q->emit error("Failed to rename signed APK to output");
+
+    // sorted entries, fixed times and no extra fields: the bytes only depend on names and contents
+    if (reproducible) {
+        q->emit log("Normalizing APK for a reproducible build...");
+        if (!normalizeApp(signedApk)) {
             return false;
         }
-        QFile::remove("unsigned.apk");
+    }
+
+    // apksigner signs v1 itself, and a jarsigner signature would be dropped by it anyway
+    if (!findApksigner().isEmpty()) {
+        q->emit log("apksigner found, it signs every scheme and jarsigner is skipped");
+    } else {
+        if (!jarsign(signedApk, keystorePath, env)) {
+            return false;
+        }
+        if (reproducible) {
+            q->emit log("WARNING: without sdktools/apksigner*.jar the jarsigner signature carries the signing time, the APK is not byte-reproducible");
+            if (!normalizeApp(signedApk)) {
+                return false;
+            }
+        }
+    }
+
+    // jarsigner only adds entries, the v1 signature survives the alignment; apksigner comes after
+    // it and is told to keep the layout
+    if (!alignApp(signedApk) || !signSchemeV2(signedApk, keystorePath, env)) {
+        return false;
+    }
+
+    QDir().mkpath(QFileInfo(outputName).absolutePath());
+    if (QFile::exists(outputName)) {
+        QFile::remove(outputName);
+    }
+    utils::CopyMethod method;
+    if (!utils::moveFile(QDir::toNativeSeparators(signedApk).toStdWString(), QDir::toNativeSeparators(outputName).toStdWString(), &method)) {
+        q->emit error("Failed to move signed APK to output");
+        return false;
+    }
+    if (method != utils::CopyMethod::Renamed) {
+        q->emit log(QString("Signed APK moved to %1 by %2").arg(outputName, utils::toString(method)));
     }
 
     q->emit log("APK recompilation and signing completed successfully");
     return true;
 }
 
+bool APKPatcherPrivate::alignApp(const QString& apkPath)
+{
+    q->emit log("Aligning APK...");
+    const QString alignedApk = workPath("aligned.apk");
+    if (!utils::zip::align(QDir::toNativeSeparators(apkPath).toStdString(), QDir::toNativeSeparators(alignedApk).toStdString())) {
+        QFile::remove(alignedApk);
+        q->emit error("APK alignment failed");
+        return false;
+    }
+    if (!QFile::remove(apkPath) || !QFile::rename(alignedApk, apkPath)) {
+        q->emit error("Failed to replace APK with its aligned copy");
+        return false;
+    }
+    q->emit log("Stored entries aligned to 4 bytes, native libraries to 16 KiB");
+    return true;
+}
+
+bool APKPatcherPrivate::signSchemeV2(const QString& apkPath, const QString& keystorePath, const QProcessEnvironment& env)
+{
+    // apksigner is optional; without it the APK keeps the v1 signature from jarsigner
+    const QString apksignerJar = findApksigner();
+    if (apksignerJar.isEmpty()) {
+        q->emit log("apksigner not found in sdktools, skipping v2/v3 signing");
+        return true;
+    }
+
+    q->emit log("Signing APK with apksigner, signature schemes v1, v2 and v3...");
+    QProcess process;
+    process.setWorkingDirectory(QDir::currentPath());
+    process.setProgram("java");
+    process.setArguments({"-jar", apksignerJar, "sign",
+                          "--ks", keystorePath,
+                          "--ks-pass", "pass:android",
+                          "--key-pass", "pass:android",
+                          "--ks-key-alias", "androiddebugkey",
+                          "--v1-signing-enabled", "true",
+                          "--v2-signing-enabled", "true",
+                          "--v3-signing-enabled", "true",
+                          // without it apksigner lays the archive out again, native libraries on 4 KiB
+                          "--alignment-preserved", "true",
+                          apkPath});
+    process.setProcessEnvironment(env);
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start();
+
+    if (!process.waitForStarted(30000)) {
+        q->emit error("Failed to start apksigner: " + process.errorString());
+        return false;
+    }
+
+    while (process.state() != QProcess::NotRunning) {
+        if (cancelled) {
+            process.kill();
+            process.waitForFinished();
+            return !checkCancelled();
+        }
+        sampleToolMemory(process);
+        if (process.waitForReadyRead(1000)) {
+            QString output = QString::fromUtf8(process.readAll()).trimmed();
+            if (!output.isEmpty()) {
+                q->emit log(output);
+            }
+        }
+    }
+
+    process.waitForFinished();
+    if (process.exitCode() != 0) {
+        q->emit error("apksigner failed");
+        return false;
+    }
+    return true;
+}
+
+bool APKPatcherPrivate::verifyApp(const QString& inputFile)
+{
+    const QString artifact = outputPath(inputFile);
+    q->emit log("Verifying " + artifact + "...");
+    const VerificationReport report = Verifier::verify(artifact, "apk", Verifier::originalUrls(recipe));
+    for (const auto& leftover : report.leftovers) {
+        q->emit log("Original URL left: " + leftover);
+    }
+    for (const auto& member : report.corruptMembers) {
+        q->emit log("Corrupt member: " + member);
+    }
+    for (const auto& problem : report.signatureProblems) {
+        q->emit log("Signature problem: " + problem);
+    }
+    if (!report.success) {
+        QFile::remove(Verifier::manifestPath(artifact));
+        q->emit error("Verification failed: " + report.errorMessage);
+        return false;
+    }
+    q->emit log(report.summary() + QString(" (%1 ms)").arg(report.elapsedMs));
+    if (!utils::zip::isAligned(QDir::toNativeSeparators(artifact).toStdString())) {
+        QFile::remove(Verifier::manifestPath(artifact));
+        q->emit error("Verification failed: stored entries or native libraries of " + artifact + " are not aligned");
+        return false;
+    }
+
+    QJsonObject build;
+    build["source"] = QFileInfo(inputFile).fileName();
+    build["gameServerUrl"] = gameServerUrl;
+    build["dlcServerUrl"] = dlcServerUrl;
+    build["recipe"] = QString::fromLatin1(recipe.fingerprint());
+    build["archs"] = QJsonArray::fromStringList(archFilter.archs());
+    build["reproducible"] = reproducible;
+    const ArtifactInfo info = Probe::read(inputFile);
+    if (info.success) {
+        build["identifier"] = info.identifier;
+        build["versionName"] = info.versionName;
+        build["versionCode"] = info.versionCode;
+    }
+    QString errorMessage;
+    if (!Verifier::writeManifest(report, build, &errorMessage)) {
+        q->emit error(errorMessage);
+        return false;
+    }
+    q->emit log("Manifest written to " + Verifier::manifestPath(artifact));
+    return true;
+}
+
+bool APKPatcherPrivate::prepareAPK(const QString& apkPath)
+{
+    q->emit log("Preparing " + apkPath + " ahead of any patch request...");
+    if (!q->checkDependencies()) {
+        return false;
+    }
+
+    // every known URL, whatever the recipe replaces, like the patch-site database itself
+    q->emit progressUpdated(10, "Scanning APK...");
+    const CensusReport report = Census::scan(apkPath);
+    if (!report.success) {
+        q->emit log("ERROR: " + report.errorMessage);
+        q->emit error("Could not scan APK: " + report.errorMessage);
+        return false;
+    }
+    q->emit log(report.summary());
+    siteDatabase.recordCensus(report);
+    if (!siteDatabase.save()) {
+        q->emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
+    }
+
+    if (checkCancelled()) {
+        return false;
+    }
+
+    Recipe source;
+    QString recipeError;
+    if (!Recipe::load(source, nullptr, &recipeError)) {
+        q->emit error(recipeError);
+        return false;
+    }
+    chooseDecodeMode(source);
+
+    Checkpoint checkpoint(workPath(Checkpoint::fileName()), stages());
+    checkpoint.open(Checkpoint::hashFile(apkPath));
+    if (checkpoint.isComplete("decode", decodeInputs()) && QFile::exists(workPath("tappedout/apktool.yml")) &&
+        checkpoint.startedWith("rewrite").isEmpty()) {
+        q->emit log("Already prepared in " + workPath("tappedout"));
+        return true;
+    }
+
+    q->emit progressUpdated(20, "Decompiling APK...");
+    checkpoint.begin("decode", decodeInputs());
+    if (!decompileApp(apkPath)) {
+        return false;
+    }
+    checkpoint.complete("decode");
+    q->emit log("Prepared " + workPath("tappedout") + ", patching it only has to rewrite and rebuild");
+    return true;
+}
+
 bool APKPatcherPrivate::patchAPK(const QString& apkPath, const QString& newGameServerUrl, const QString& newDlcServerUrl)
 {
     bool success = true;
@@ -670,43 +1083,118 @@ bool APKPatcherPrivate::patchAPK(const QString& apkPath, const QString& newGameS
     }
 
     if (success) {
-        q->emit progressUpdated(20, "Decompiling APK...");
-        if (!decompileApp(apkPath)) {
+        q->emit progressUpdated(10, "Scanning APK...");
+        if (!q->preflight(apkPath, gameServerUrl, dlcServerUrl)) {
             success = false;
         }
     }
 
+    if (success && checkCancelled()) {
+        success = false;
+    }
+
+    // every stage leaves a checkpoint, so a retry in the same workspace resumes after the last one done
+    Checkpoint checkpoint(workPath(Checkpoint::fileName()), stages());
+    const QByteArray toolInputs = this->toolInputs();
+    const QByteArray decodeInputs = this->decodeInputs();
+    const QByteArray buildInputs = toolInputs + (extractNativeLibs ? "" : "|stored-native-libs");
+    const QByteArray rewriteInputs = recipe.fingerprint() + "|" + archFilter.archs().join(',').toUtf8();
     if (success) {
-        q->emit progressUpdated(50, "Replacing URLs...");
-        if (!replaceUrls(gameServerUrl, dlcServerUrl)) {
-            success = false;
+        checkpoint.open(Checkpoint::hashFile(apkPath));
+    }
+
+    // a single parallel walk of tappedout feeds both the text rewrite and the .so patch
+    PassManager passes;
+    passes.addPass(std::make_unique<TextRewritePass>(recipe));
+    passes.addPass(std::make_unique<ResourcePoolPass>(recipe));
+    passes.addPass(std::make_unique<NativePatchPass>("elf", QStringList{"elf"}, recipe, siteDatabase, entryHashes));
+    std::unique_ptr<PassStream> stream;
+
+    if (success) {
+        // a rewrite for other URLs leaves nothing to match, so tappedout has to be decoded again
+        const QByteArray rewrittenWith = checkpoint.startedWith("rewrite");
+        if (checkpoint.isComplete("decode", decodeInputs) && QFile::exists(workPath("tappedout/apktool.yml")) &&
+            (rewrittenWith.isEmpty() || rewrittenWith == rewriteInputs)) {
+            q->emit log("Resuming: APK already decompiled in " + workPath("tappedout"));
+        } else {
+            q->emit progressUpdated(20, "Decompiling APK...");
+            // smali is rewritten while apktool is still writing it; resources and libraries
+            // are left to the catch-up pass, apktool may revisit them before it exits
+            stream = std::make_unique<PassStream>(passes, workPath("tappedout"), [](const QString& memberPath) {
+                return memberPath.startsWith("smali");
+            });
+            checkpoint.begin("decode", decodeInputs);
+            checkpoint.begin("rewrite", rewriteInputs);
+            success = decompileApp(apkPath, stream.get());
+            if (success) {
+                checkpoint.complete("decode");
+            }
         }
     }
 
+    if (success && checkCancelled()) {
+        success = false;
+    }
+
     if (success) {
-        q->emit progressUpdated(80, "Recompiling APK...");
-        if (!recompileApp(apkPath)) {
-            success = false;
+        if (checkpoint.isComplete("rewrite", rewriteInputs)) {
+            q->emit log("Resuming: URLs already replaced");
+        } else {
+            q->emit progressUpdated(50, "Replacing URLs...");
+            if (!stream) {
+                checkpoint.begin("rewrite", rewriteInputs);
+            }
+            success = pruneApp() && replaceUrls(passes, stream.get());
+            if (success) {
+                checkpoint.complete("rewrite");
+            }
+        }
+    }
+
+    if (success && checkCancelled()) {
+        success = false;
+    }
+
+    if (success) {
+        if (checkpoint.isComplete("build", buildInputs) && QFile::exists(workPath("unsigned.apk"))) {
+            q->emit log("Resuming: APK already rebuilt");
+        } else {
+            q->emit progressUpdated(70, "Recompiling APK...");
+            checkpoint.begin("build", buildInputs);
+            success = buildApp();
+            if (success) {
+                checkpoint.complete("build");
+            }
+        }
+    }
+
+    if (success && checkCancelled()) {
+        success = false;
+    }
+
+    if (success) {
+        q->emit progressUpdated(90, "Signing APK...");
+        checkpoint.begin("sign", QByteArray());
+        success = signApp(apkPath);
+        if (success) {
+            checkpoint.complete("sign");
         }
     }
 
+    if (success) {
+        q->emit progressUpdated(95, "Verifying APK...");
+        success = verifyApp(apkPath);
+    }
+
     if (success) {
         q->emit progressUpdated(100, "APK patched successfully!");
         q->emit log("\n=== Final URL Summary ===");
         q->emit log("Game Server URL: " + gameServerUrl);
-        QString finalDlcUrl = dlcServerUrl.trimmed();
-        if (finalDlcUrl.endsWith('/')) {
-            finalDlcUrl.chop(1);
-        }
-        finalDlcUrl += "/static/";
-        QByteArray paddedUrl = finalDlcUrl.toUtf8();
-        while (paddedUrl.length() < 89 - 1) {  
-            paddedUrl.append("./");
-        }
-        if (paddedUrl.length() < 89) {
-            paddedUrl.append('/');
+        for (const auto& target : recipe.targets()) {
+            if (target.inPlace) {
+                q->emit log(target.id + " (with padding): " + QString::fromUtf8(recipe.replacement(target.id)));
+            }
         }
-        q->emit log("DLC Server URL (with padding): " + QString::fromUtf8(paddedUrl));
         q->emit log("\nAPK patched successfully!");
     } else {
         q->emit progressUpdated(100, "Failed to patch APK");
@@ -714,13 +1202,21 @@ bool APKPatcherPrivate::patchAPK(const QString& apkPath, const QString& newGameS
     return success;
 }
 
-void APKPatcher::patchAPK(const QString& apkPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+bool APKPatcher::prepareAPK(const QString& apkPath)
+{
+    const bool success = d->prepareAPK(apkPath);
+    emit progressUpdated(100, success ? "APK prepared" : "Failed to prepare APK");
+    return success;
+}
+
+bool APKPatcher::patchAPK(const QString& apkPath, const QString& gameServerUrl, const QString& dlcServerUrl)
 {
     if (d->patchAPK(apkPath, gameServerUrl, dlcServerUrl)) {
         emit progressUpdated(100, "APK patched successfully!");
-    } else {
-        emit progressUpdated(100, "Failed to patch APK");
+        return true;
     }
+    emit progressUpdated(100, "Failed to patch APK");
+    return false;
 }
 
 } 
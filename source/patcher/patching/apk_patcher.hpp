@@ -15,7 +15,32 @@ public:
     virtual ~APKPatcher();
 
     bool checkDependencies();
-    void patchAPK(const QString& apkPath,
+    // Directory holding tappedout and the intermediate APK, the current directory by default
+    void setWorkspace(const QString& dir);
+    // Where the patched artifact and its manifest go, <name>-patched.<suffix> in the working
+    // directory by default; jobs that may run side by side need their own
+    void setOutputPath(const QString& path);
+    // false stores lib/**/*.so uncompressed and page aligned, and sets extractNativeLibs="false"
+    // so devices map them from the APK instead of extracting them at install
+    void setExtractNativeLibs(bool extract);
+    // Byte-identical output for identical inputs: the built APK is normalized and, when apksigner
+    // is available, signed by it alone, since jarsigner embeds the signing time
+    void setReproducible(bool reproducible);
+    // Architectures to keep ("arm64" or "arm64-v8a"), the other lib/<abi> are dropped; empty keeps all
+    void setArchFilter(const QStringList& archs);
+    // Safe from any thread, stops the running tool and fails the patch at the next stage
+    void cancel();
+    // Largest resident size seen for the external tools (apktool, jarsigner, PowerShell)
+    qint64 peakToolMemory() const;
+    // Census of the APK and length check of the planned replacements, before any decoding
+    bool preflight(const QString& apkPath,
+        const QString& gameServerUrl,
+        const QString& dlcServerUrl,
+        bool listSites = false);
+    // The work every target shares: census, patch-site indexing and the decode, left in the
+    // workspace so a later patchAPK of the same file there starts at the URL rewrite
+    bool prepareAPK(const QString& apkPath);
+    bool patchAPK(const QString& apkPath,
         const QString& gameServerUrl = QString(),
         const QString& dlcServerUrl = QString());
 
@@ -0,0 +1,288 @@
+#include "std_include.hpp"
+#include "census.hpp"
+#include "zip.hpp"
+#include "pattern_matcher.hpp"
+#include <QtCore/QCryptographicHash>
+#include <cstring>
+
+namespace Patcher {
+
+namespace {
+
+// media never carries the endpoints, so these members are not even inflated
+const QStringList kSkippedSuffixes = {
+    ".png", ".jpg", ".jpeg", ".webp", ".gif", ".ogg", ".mp3", ".wav", ".m4a", ".aac",
+    ".caf", ".mp4", ".ttf", ".otf", ".pvr", ".ktx", ".astc", ".car",
+};
+
+const QStringList kTextSuffixes = {
+    ".xml", ".txt", ".json", ".smali", ".js", ".html", ".htm", ".properties", ".cfg",
+    ".ini", ".conf", ".strings", ".yml",
+};
+
+quint32 readLe32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<quint32>(p[3]) << 24);
+}
+
+quint32 readBe32(const uint8_t* p)
+{
+    return (static_cast<quint32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool isFixedSize(const QString& kind)
+{
+    // native binaries are patched in place, everything else is rewritten after decoding
+    return kind == "elf" || kind == "macho";
+}
+
+}
+
+QString PatchSite::toString() const
+{
+    return QString("%1 @ %2 [%3, %4] %5 (max %6)")
+        .arg(entry)
+        .arg(offset)
+        .arg(kind, encoding)
+        .arg(QString::fromUtf8(pattern))
+        .arg(maxReplacementLength < 0 ? QString("unlimited") : QString::number(maxReplacementLength));
+}
+
+QString CensusReport::summary() const
+{
+    return QString("Found %1 patch sites in %2 of %3 entries (%4 MB scanned in %5 ms)")
+        .arg(sites.size())
+        .arg(entriesScanned)
+        .arg(entriesTotal)
+        .arg(bytesScanned / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(elapsedMs);
+}
+
+QJsonObject CensusReport::toJson() const
+{
+    QJsonArray siteArray;
+    for (const auto& site : sites) {
+        QJsonObject obj;
+        obj["entry"] = site.entry;
+        obj["offset"] = site.offset;
+        obj["url"] = QString::fromUtf8(site.pattern);
+        obj["encoding"] = site.encoding;
+        obj["kind"] = site.kind;
+        obj["maxReplacementLength"] = site.maxReplacementLength;
+        siteArray.append(obj);
+    }
+
+    QJsonObject obj;
+    obj["artifact"] = artifactPath;
+    obj["success"] = success;
+    if (!errorMessage.isEmpty()) {
+        obj["error"] = errorMessage;
+    }
+    obj["entriesTotal"] = entriesTotal;
+    obj["entriesScanned"] = entriesScanned;
+    obj["bytesScanned"] = bytesScanned;
+    obj["elapsedMs"] = elapsedMs;
+    obj["sites"] = siteArray;
+    return obj;
+}
+
+QByteArray Census::toUtf16Le(const QByteArray& ascii)
+{
+    QByteArray out;
+    out.reserve(ascii.size() * 2);
+    for (char c : ascii) {
+        out.append(c);
+        out.append('\0');
+    }
+    return out;
+}
+
+QString Census::sniffKind(const QString& name, const uint8_t* data, size_t size)
+{
+    if (size >= 4) {
+        if (std::memcmp(data, "dex\n", 4) == 0) return "dex";
+        if (std::memcmp(data, "\x7f" "ELF", 4) == 0) return "elf";
+
+        const quint32 magic = readLe32(data);
+        if (magic == 0xFEEDFACE || magic == 0xFEEDFACF || magic == 0xCEFAEDFE || magic == 0xCFFAEDFE) {
+            return "macho";
+        }
+        // a Java class starts with the same CAFEBABE, followed by its version (45 and up) where a
+        // universal binary has its slice count; file(1) tells them apart the same way
+        if (magic == 0xBEBAFECA && size >= 8) {
+            const quint32 slices = readBe32(data + 4);
+            if (slices >= 1 && slices <= 20) {
+                return "macho";
+            }
+        }
+        if (magic == 0x00080003) return "axml";
+        if (magic == 0x000C0002) return "arsc";
+    }
+    if (size >= 6 && std::memcmp(data, "bplist", 6) == 0) return "plist";
+
+    const QString lower = name.toLower();
+    if (lower.endsWith(".plist")) return "plist";
+    for (const auto& suffix : kTextSuffixes) {
+        if (lower.endsWith(suffix)) return "text";
+    }
+    return QString();
+}
+
+CensusReport Census::scan(const QString& artifactPath, const QList<QByteArray>& patterns)
+{
+    CensusReport report;
+    report.artifactPath = artifactPath;
+    QElapsedTimer timer;
+    timer.start();
+
+    utils::zip::Reader reader;
+    if (!reader.open(QDir::toNativeSeparators(artifactPath).toStdString())) {
+        report.errorMessage = "Not a readable ZIP archive: " + artifactPath;
+        return report;
+    }
+    report.entriesTotal = static_cast<int>(reader.entries().size());
+
+    // one automaton for every pattern in both encodings, matched in a single pass per member
+    utils::PatternMatcher matcher;
+    QList<QPair<int, QString>> patternInfo;
+    for (int i = 0; i < patterns.size(); i++) {
+        matcher.addPattern(patterns[i].toStdString());
+        patternInfo.append({i, "utf-8"});
+        matcher.addPattern(toUtf16Le(patterns[i]).toStdString());
+        patternInfo.append({i, "utf-16le"});
+    }
+    matcher.compile();
+
+    std::vector<const utils::zip::Entry*> candidates;
+    for (const auto& entry : reader.entries()) {
+        if (entry.isDirectory()) {
+            continue;
+        }
+        const QString lower = QString::fromStdString(entry.name).toLower();
+        bool skipped = false;
+        for (const auto& suffix : kSkippedSuffixes) {
+            if (lower.endsWith(suffix)) {
+                skipped = true;
+                break;
+            }
+        }
+        if (!skipped) {
+            candidates.push_back(&entry);
+        }
+    }
+
+    std::mutex mutex;
+    std::atomic<size_t> next{0};
+    bool readFailed = false;
+
+    auto worker = [&]() {
+        QList<PatchSite> localSites;
+        QMap<QString, QByteArray> localHashes;
+        int localScanned = 0;
+        qint64 localBytes = 0;
+
+        for (size_t i = next++; i < candidates.size(); i = next++) {
+            const auto& entry = *candidates[i];
+            const QString name = QString::fromStdString(entry.name);
+            QString kind;
+            bool sniffed = false;
+            int32_t state = 0;
+            uint64_t position = 0;
+            std::unique_ptr<QCryptographicHash> hash;
+
+            bool complete = reader.read(entry, [&](const uint8_t* data, size_t size) {
+                if (!sniffed) {
+                    sniffed = true;
+                    kind = sniffKind(name, data, size);
+                    if (kind.isEmpty()) {
+                        return false;
+                    }
+                    if (isFixedSize(kind)) {
+                        hash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha256);
+                    }
+                }
+                if (hash) {
+                    hash->addData(QByteArrayView(reinterpret_cast<const char*>(data), static_cast<qsizetype>(size)));
+                }
+                state = matcher.feed(state, data, size, position, [&](size_t pattern, uint64_t offset) {
+                    const auto& info = patternInfo[static_cast<int>(pattern)];
+                    PatchSite site;
+                    site.entry = name;
+                    site.offset = static_cast<qint64>(offset);
+                    site.pattern = patterns[info.first];
+                    site.encoding = info.second;
+                    site.kind = kind;
+                    site.maxReplacementLength = isFixedSize(kind) ? static_cast<int>(site.pattern.size()) : -1;
+                    localSites.append(site);
+                });
+                position += size;
+                return true;
+            });
+
+            if (!kind.isEmpty()) {
+                localScanned++;
+                localBytes += static_cast<qint64>(position);
+                if (complete && hash) {
+                    localHashes.insert(name, hash->result().toHex());
+                }
+                if (!complete) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    readFailed = true;
+                    report.errorMessage = "Corrupt archive member: " + name;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        report.sites.append(localSites);
+        report.entryHashes.insert(localHashes);
+        report.entriesScanned += localScanned;
+        report.bytesScanned += localBytes;
+    };
+
+    const size_t threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, qMax<size_t>(1, candidates.size()));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::sort(report.sites.begin(), report.sites.end(), [](const PatchSite& a, const PatchSite& b) {
+        return a.entry != b.entry ? a.entry < b.entry : a.offset < b.offset;
+    });
+
+    report.success = !readFailed;
+    report.elapsedMs = timer.elapsed();
+    return report;
+}
+
+QStringList Census::checkReplacements(const CensusReport& report, const QMap<QByteArray, QByteArray>& replacements)
+{
+    QStringList problems;
+    QSet<QString> reported;
+    for (const auto& site : report.sites) {
+        if (site.maxReplacementLength < 0 || site.encoding != "utf-8" || !replacements.contains(site.pattern)) {
+            continue;
+        }
+        const QByteArray& replacement = replacements[site.pattern];
+        if (replacement.size() <= site.maxReplacementLength) {
+            continue;
+        }
+        QString problem = QString("'%1' is %2 bytes but %3 only has room for %4 bytes in place of '%5'")
+            .arg(QString::fromUtf8(replacement))
+            .arg(replacement.size())
+            .arg(site.entry)
+            .arg(site.maxReplacementLength)
+            .arg(QString::fromUtf8(site.pattern));
+        if (!reported.contains(problem)) {
+            reported.insert(problem);
+            problems.append(problem);
+        }
+    }
+    return problems;
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "std_include.hpp"
+#include "known_urls.hpp"
+
+namespace Patcher {
+
+struct PatchSite {
+    QString entry;
+    qint64 offset = 0;
+    QByteArray pattern;
+    QString encoding;
+    QString kind;
+    // -1 when the member is rewritten freely, otherwise the bytes available in place
+    int maxReplacementLength = -1;
+
+    QString toString() const;
+};
+
+struct CensusReport {
+    QString artifactPath;
+    bool success = false;
+    QString errorMessage;
+    int entriesTotal = 0;
+    int entriesScanned = 0;
+    qint64 bytesScanned = 0;
+    qint64 elapsedMs = 0;
+    QList<PatchSite> sites;
+    // hex SHA-256 of every native binary, the key of the patch-site database
+    QMap<QString, QByteArray> entryHashes;
+
+    QString summary() const;
+    QJsonObject toJson() const;
+};
+
+// Streams an APK/IPA straight from the ZIP and reports every known URL occurrence,
+// without decoding or extracting anything to disk.
+class Census {
+public:
+    static CensusReport scan(const QString& artifactPath, const QList<QByteArray>& patterns = KnownUrls::all());
+
+    // Checks the planned replacement of each pattern against the in-place sites that must hold it
+    static QStringList checkReplacements(const CensusReport& report, const QMap<QByteArray, QByteArray>& replacements);
+
+    // Member kind (dex, elf, macho, axml, arsc, plist, text) from its name and first bytes, empty if unknown
+    static QString sniffKind(const QString& name, const uint8_t* data, size_t size);
+    // How the URLs sit in Java/Objective-C string tables next to their UTF-8 form
+    static QByteArray toUtf16Le(const QByteArray& ascii);
+};
+
+}
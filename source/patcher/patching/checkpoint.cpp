@@ -0,0 +1,99 @@
+#include "std_include.hpp"
+#include "checkpoint.hpp"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QSaveFile>
+
+namespace Patcher {
+
+Checkpoint::Checkpoint(const QString& path, const QStringList& stages)
+    : path_(path)
+    , stages_(stages)
+{
+}
+
+QByteArray Checkpoint::hashFile(const QString& filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(&file);
+    return hash.result().toHex();
+}
+
+void Checkpoint::open(const QByteArray& inputHash)
+{
+    inputHash_ = inputHash;
+    records_.clear();
+
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root["input"].toString().toLatin1() != inputHash_) {
+        return;
+    }
+
+    QJsonObject stages = root["stages"].toObject();
+    for (auto it = stages.begin(); it != stages.end(); ++it) {
+        QJsonObject obj = it.value().toObject();
+        StageRecord record;
+        record.inputs = obj["inputs"].toString().toUtf8();
+        record.complete = obj["complete"].toBool();
+        records_.insert(it.key(), record);
+    }
+}
+
+bool Checkpoint::isComplete(const QString& stage, const QByteArray& inputs) const
+{
+    auto it = records_.constFind(stage);
+    return it != records_.constEnd() && it->complete && it->inputs == inputs;
+}
+
+QByteArray Checkpoint::startedWith(const QString& stage) const
+{
+    return records_.value(stage).inputs;
+}
+
+void Checkpoint::begin(const QString& stage, const QByteArray& inputs)
+{
+    for (int i = stages_.indexOf(stage); i >= 0 && i < stages_.size(); i++) {
+        records_.remove(stages_[i]);
+    }
+    records_.insert(stage, {inputs, false});
+    save();
+}
+
+void Checkpoint::complete(const QString& stage)
+{
+    records_[stage].complete = true;
+    save();
+}
+
+bool Checkpoint::save() const
+{
+    QJsonObject stages;
+    for (auto it = records_.begin(); it != records_.end(); ++it) {
+        QJsonObject obj;
+        obj["inputs"] = QString::fromUtf8(it->inputs);
+        obj["complete"] = it->complete;
+        stages[it.key()] = obj;
+    }
+
+    QJsonObject root;
+    root["input"] = QString::fromLatin1(inputHash_);
+    root["stages"] = stages;
+
+    QDir().mkpath(QFileInfo(path_).absolutePath());
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+// Durable record of which pipeline stages finished in a workspace, and with which inputs.
+// Stages are ordered: starting one drops the records of every later stage.
+class Checkpoint {
+public:
+    Checkpoint(const QString& path, const QStringList& stages);
+
+    static QString fileName() { return "checkpoint.json"; }
+    static QByteArray hashFile(const QString& filePath);
+
+    // Loads the record; anything recorded for another input is discarded
+    void open(const QByteArray& inputHash);
+
+    bool isComplete(const QString& stage, const QByteArray& inputs) const;
+    // Inputs a stage was last started with, empty if it never was
+    QByteArray startedWith(const QString& stage) const;
+
+    // Written through immediately; a checkpoint that cannot be saved only costs a resume
+    void begin(const QString& stage, const QByteArray& inputs);
+    void complete(const QString& stage);
+
+private:
+    struct StageRecord {
+        QByteArray inputs;
+        bool complete = false;
+    };
+
+    bool save() const;
+
+    QString path_;
+    QStringList stages_;
+    QByteArray inputHash_;
+    QMap<QString, StageRecord> records_;
+};
+
+}
@@ -1,23 +1,73 @@
 #include "std_include.hpp"
 #include "ipa_patcher.hpp"
+#include "census.hpp"
+#include "patch_site_db.hpp"
+#include "recipe.hpp"
+#include "patch_passes.hpp"
+#include "pruning.hpp"
+#include "verification.hpp"
+#include "probe.hpp"
+#include "workspace_gc.hpp"
+#include "utils.hpp"
+#include "zip.hpp"
 #include <filesystem>
 
 
 namespace Patcher {
 
+namespace {
+
+// innermost .app, .framework or .appex folder holding the member
+QString bundleOf(const QString& memberPath)
+{
+    QStringList parts = memberPath.split('/');
+    parts.removeLast();
+    while (!parts.isEmpty()) {
+        const QString& last = parts.last();
+        if (last.endsWith(".app") || last.endsWith(".framework") || last.endsWith(".appex")) {
+            break;
+        }
+        parts.removeLast();
+    }
+    return parts.join('/');
+}
+
+}
+
 class IPAPatcherPrivate {
 public:
     IPAPatcher* q;
     QString gameServerUrl;
     QString dlcServerUrl;
+    CompiledRecipe recipe;
+    PatchSiteDatabase& siteDatabase = PatchSiteDatabase::shared();
+    QMap<QString, QByteArray> entryHashes;
+    QString workspace = ".";
+    QString output;
+    std::atomic<bool> cancelled{false};
+    qint64 peakToolMemory = 0;
+    ArchFilter archFilter;
+    int compressionLevel = 6;
+    QString compressionBackend = "builtin";
+    bool reproducible = false;
 
     explicit IPAPatcherPrivate(IPAPatcher* patcher) : q(patcher) {}
 
+    QString workPath(const QString& name) const { return QDir(workspace).filePath(name); }
+    // the job's output path when one was given, <name>-patched.ipa in the working directory otherwise
+    QString outputPath(const QString& inputFile) const
+    {
+        return output.isEmpty() ? QFileInfo(inputFile).baseName() + "-patched.ipa" : output;
+    }
+    QString tempZipPath() const;
+    bool checkCancelled();
+
     bool decompileApp(const QString& inputFile);
     bool recompileApp(const QString& inputFile);
-    bool replaceUrls(const QString& gameServerUrl, const QString& dlcServerUrl);
-    bool updatePlist(const QString& plistPath);
-    bool updateBinary(const QString& binaryPath);
+    bool verifyApp(const QString& inputFile);
+    QString findAppBundle();
+    bool thinApp();
+    bool replaceUrls(const QString& appPath);
     bool patchIPA(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl);
 };
 
@@ -37,243 +87,146 @@ bool IPAPatcher::checkDependencies()
     emit progressUpdated(0, "Checking dependencies...");
     emit log("Checking for required dependencies...");
 
-    QProcess powershellCheck;
-    powershellCheck.start("powershell", {"-Command", "echo 'PowerShell check'"});
-    
-    if (!powershellCheck.waitForStarted(5000)) {
-        emit error("PowerShell not found or could not be started");
-        emit log("ERROR: PowerShell not found or could not be started");
-        return false;
-    }
-    
-    if (!powershellCheck.waitForFinished(5000)) {
-        powershellCheck.kill();
-        emit error("PowerShell check timed out");
-        emit log("ERROR: PowerShell check timed out");
-        return false;
-    }
-    
-    if (powershellCheck.exitCode() != 0) {
-        emit error("PowerShell check failed with exit code: " + QString::number(powershellCheck.exitCode()));
-        emit log("ERROR: PowerShell check failed with exit code: " + QString::number(powershellCheck.exitCode()));
-        return false;
-    }
-    
-    emit log("PowerShell check passed successfully");
+    // extraction and packing are native, nothing outside the patcher is needed
     emit progressUpdated(100, "Dependencies verified successfully!");
     emit log("All dependencies verified successfully!");
     return true;
 }
 
-bool IPAPatcherPrivate::updatePlist(const QString& plistPath)
+void IPAPatcher::setWorkspace(const QString& dir)
 {
-    q->emit log("Updating Info.plist...");
+    d->workspace = dir;
+}
 
-    QFile file(plistPath);
-    if (!file.open(QIODevice::ReadWrite | QIODevice::Text)) {
-        q->emit error("Failed to open Info.plist");
-        return false;
-    }
+void IPAPatcher::setOutputPath(const QString& path)
+{
+    d->output = path;
+}
 
-    QString content = file.readAll();
+void IPAPatcher::setArchFilter(const QStringList& archs)
+{
+    d->archFilter = ArchFilter(archs);
+}
 
-    QRegularExpression serverRegex("<key>MayhemServerURL</key>\\s*<string>(.*?)</string>", QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatch serverMatch = serverRegex.match(content);
-    
-    QString newServerUrl = gameServerUrl.trimmed();
-    if (newServerUrl.endsWith('/')) {
-        newServerUrl.chop(1);
-    }
-    
-    if (serverMatch.hasMatch()) {
-        content.replace(serverMatch.captured(0), 
-            QString("<key>MayhemServerURL</key><string>%1</string>").arg(newServerUrl));
-        q->emit log("Updated MayhemServerURL: " + newServerUrl);
-    } else {
-        q->emit log("Key 'MayhemServerURL' not found.");
-        
-        QRegularExpression versionRegex("<key>CFBundleVersion</key>\\s*<string>(.*?)</string>");
-        QRegularExpressionMatch versionMatch = versionRegex.match(content);
-        if (versionMatch.hasMatch()) {
-            QString insertText = versionMatch.captured(0) + 
-                QString("\n\t<key>MayhemServerURL</key>\n\t<string>%1</string>").arg(newServerUrl);
-            content.replace(versionMatch.captured(0), insertText);
-            q->emit log("Added MayhemServerURL: " + newServerUrl);
-        }
-    }
+void IPAPatcher::setCompression(int level, const QString& backend)
+{
+    d->compressionLevel = qBound(0, level, 9);
+    d->compressionBackend = backend;
+}
 
-    QRegularExpression dlcRegex("<key>DLCLocation</key>\\s*<string>(.*?)</string>", QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatch dlcMatch = dlcRegex.match(content);
-    
-    QString newDlcUrl = dlcServerUrl.trimmed();
-    if (newDlcUrl.endsWith('/')) {
-        newDlcUrl.chop(1);
-    }
-    newDlcUrl += "/static/";
-    
-    if (dlcMatch.hasMatch()) {
-        content.replace(dlcMatch.captured(0), 
-            QString("<key>DLCLocation</key><string>%1</string>").arg(newDlcUrl));
-        q->emit log("Updated DLCLocation: " + newDlcUrl);
-    } else {
-        q->emit log("Key 'DLCLocation' not found.");
-        
-        QRegularExpression mayhemRegex("<key>MayhemServerURL</key>\\s*<string>(.*?)</string>", QRegularExpression::DotMatchesEverythingOption);
-        QRegularExpressionMatch mayhemMatch = mayhemRegex.match(content);
-        if (mayhemMatch.hasMatch()) {
-            QString insertText = mayhemMatch.captured(0) + 
-                QString("\n\t<key>DLCLocation</key>\n\t<string>%1</string>").arg(newDlcUrl);
-            content.replace(mayhemMatch.captured(0), insertText);
-            q->emit log("Added DLCLocation: " + newDlcUrl);
-        }
-    }
+void IPAPatcher::setReproducible(bool reproducible)
+{
+    d->reproducible = reproducible;
+}
 
-    file.seek(0);
-    file.write(content.toUtf8());
-    file.resize(file.pos());
-    file.close();
+void IPAPatcher::cancel()
+{
+    d->cancelled = true;
+}
 
-    return true;
+qint64 IPAPatcher::peakToolMemory() const
+{
+    return d->peakToolMemory;
 }
 
-bool IPAPatcherPrivate::updateBinary(const QString& binaryPath) {
-    q->emit log("Updating binary file...");
+QString IPAPatcherPrivate::tempZipPath() const
+{
+    // the shared temp directory is only safe while one IPA is processed at a time
+    return workspace == "." ? QDir::temp().filePath("temp_ipa.zip") : workPath("temp_ipa.zip");
+}
 
-    QFile file(binaryPath);
-    if (!file.open(QIODevice::ReadWrite)) {
-        q->emit error("Failed to open binary file: " + binaryPath);
+bool IPAPatcherPrivate::checkCancelled()
+{
+    if (!cancelled) {
         return false;
     }
-
-    QByteArray content = file.readAll();
-    
-    q->emit log("\n=== Binary Patching Summary ===");
-    q->emit log("Binary file: " + binaryPath);
-    q->emit log("File size: " + QString::number(content.size()) + " bytes");
-    
-    QList<QByteArray> oldUrls = {
-        "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/",
-        "https://syn-dir.sn.eamobile.com"
-    };
-    
-    QString newDlcUrl = dlcServerUrl.trimmed();
-    if (newDlcUrl.endsWith('/')) {
-        newDlcUrl.chop(1);
-    }
-    newDlcUrl += "/static/";
-    
-    QString newGameUrl = gameServerUrl.trimmed();
-    
-    QList<QByteArray> newUrls = {
-        newDlcUrl.toUtf8(),
-        newGameUrl.toUtf8()
-    };
-    
-    //binary replacements
-    for (int i = 0; i < oldUrls.size(); i++) {
-        QByteArray oldUrlBytes = oldUrls[i];
-        QByteArray newUrlBytes = newUrls[i];
-        
-        q->emit log(QString("\nURL %1:").arg(i + 1));
-        q->emit log("  Old URL: " + QString::fromUtf8(oldUrlBytes));
-        q->emit log("  Old URL length: " + QString::number(oldUrlBytes.length()) + " bytes");
-        q->emit log("  New URL: " + QString::fromUtf8(newUrlBytes));
-        q->emit log("  New URL length: " + QString::number(newUrlBytes.length()) + " bytes");
-        
-        // Check URL lengths and pad if necessary
-        if (newUrlBytes.length() < oldUrlBytes.length()) {
-            q->emit log("  Padding new URL with '/' characters");
-            // Pad the new URL with '/' to match length (like in Python)
-            while (newUrlBytes.length() < oldUrlBytes.length()) {
-                newUrlBytes.append('/');
-            }
-            q->emit log("  Padded URL: " + QString::fromUtf8(newUrlBytes));
-            q->emit log("  Final URL length: " + QString::number(newUrlBytes.length()) + " bytes");
-        } else if (newUrlBytes.length() > oldUrlBytes.length()) {
-            q->emit log("  ERROR: New URL is longer than old URL by " + 
-                      QString::number(newUrlBytes.length() - oldUrlBytes.length()) + " bytes");
-            q->emit error("New URL is too long: " + QString::fromUtf8(newUrlBytes));
-            file.close();
-            return false;
-        }
-        
-        if (content.contains(oldUrlBytes)) {
-            content.replace(oldUrlBytes, newUrlBytes);
-            q->emit log("  Successfully replaced URL in binary");
-        } else {
-            q->emit log("  URL not found in binary");
-        }
-    }
-    
-    file.seek(0);
-    file.write(content);
-    file.resize(file.pos());
-    file.close();
-    
-    q->emit log("Binary file updated successfully");
+    q->emit log("Patching cancelled");
+    q->emit error("Patching cancelled");
     return true;
 }
 
-bool IPAPatcherPrivate::decompileApp(const QString& inputFile)
+bool IPAPatcher::preflight(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl, bool listSites)
 {
-    q->emit log("Decompiling IPA...");
-    
-    QDir dir("decipa");
-    if (dir.exists()) {
-        dir.removeRecursively();
-    }
-    QDir().mkdir("decipa");
-
-    QString tempZipPath = QDir::temp().filePath("temp_ipa.zip");
-    q->emit log("Creating temporary zip at: " + tempZipPath);
-    
-    if (QFile::exists(tempZipPath)) {
-        QFile::remove(tempZipPath);
+    Recipe recipe;
+    QString recipeSource;
+    QString recipeError;
+    if (!Recipe::load(recipe, &recipeSource, &recipeError) ||
+        !d->recipe.compile(recipe, "ipa", CompiledRecipe::variables(gameServerUrl, dlcServerUrl), &recipeError)) {
+        emit log("ERROR: " + recipeError);
+        emit error(recipeError);
+        return false;
     }
+    emit log("Using patch recipe: " + recipeSource);
 
-    if (!QFile::copy(inputFile, tempZipPath)) {
-        q->emit error("Failed to create temporary zip file");
+    emit log("Scanning IPA for patch sites...");
+    CensusReport report = Census::scan(ipaPath, d->recipe.patterns());
+    if (!report.success) {
+        emit log("ERROR: " + report.errorMessage);
+        emit error("Could not scan IPA: " + report.errorMessage);
         return false;
     }
 
-    QProcess process;
-    process.setWorkingDirectory(QDir::currentPath());
-    process.setProgram("powershell");
-    process.setArguments(QStringList() 
-        << "-NoProfile"
-        << "-Command"
-        << QString("$ErrorActionPreference = 'Stop'; Expand-Archive -LiteralPath '%1' -DestinationPath decipa -Force")
-            .arg(QDir::toNativeSeparators(tempZipPath))
-    );
-
-    q->emit log("\nExecuting command: " + process.program() + " " + process.arguments().join(" "));
-    process.setProcessChannelMode(QProcess::MergedChannels);
-    process.start();
+    emit log(report.summary());
+    if (listSites) {
+        for (const auto& site : report.sites) {
+            emit log("  " + site.toString());
+        }
+    }
 
-    if (!process.waitForStarted(30000)) {
-        q->emit error("Failed to start IPA decompilation");
-        QFile::remove(tempZipPath);
-        return false;
+    d->entryHashes = report.entryHashes;
+    d->siteDatabase.recordCensus(report);
+    if (!d->siteDatabase.save()) {
+        emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
     }
 
-    while (process.state() != QProcess::NotRunning) {
-        if (process.waitForReadyRead(1000)) {
-            QString output = QString::fromUtf8(process.readAll()).trimmed();
-            if (!output.isEmpty()) {
-                q->emit log(output);
-            }
+    QStringList problems = Census::checkReplacements(report, d->recipe.inPlaceReplacements());
+    if (!problems.isEmpty()) {
+        for (const auto& problem : problems) {
+            emit log("ERROR: " + problem);
         }
+        emit error("New URL is too long: " + problems.first());
+        return false;
     }
+    return true;
+}
 
-    process.waitForFinished();
+bool IPAPatcherPrivate::decompileApp(const QString& inputFile)
+{
+    q->emit log("Decompiling IPA...");
     
-    QFile::remove(tempZipPath);
+    WorkspaceCollector::instance().discard(workPath("decipa"));
+    QDir().mkpath(workPath("decipa"));
+
+    QElapsedTimer timer;
+    timer.start();
+    int reported = 0;
+    utils::zip::ExtractStats stats;
+    const bool extracted = utils::zip::extractAll(
+        QDir::toNativeSeparators(inputFile).toStdString(),
+        QDir::toNativeSeparators(workPath("decipa")).toStdString(),
+        0, &stats,
+        [&](uint64_t done, uint64_t total) {
+            const int percent = total > 0 ? static_cast<int>(done * 100 / total) : 100;
+            if (percent >= reported + 25) {
+                reported = percent - percent % 25;
+                q->emit log(QString("Extracted %1%").arg(reported));
+            }
+            return !cancelled;
+        });
 
-    if (process.exitCode() != 0) {
+    if (cancelled) {
+        return !checkCancelled();
+    }
+    if (!extracted) {
         q->emit error("IPA decompilation failed");
         return false;
     }
 
+    q->emit log(QString("Extracted %1 files into %2 directories, %3 MiB in %4 ms")
+        .arg(stats.files)
+        .arg(stats.directories)
+        .arg(stats.bytes / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(timer.elapsed()));
     q->emit log("IPA decompiled successfully");
     return true;
 }
@@ -282,106 +235,228 @@ bool IPAPatcherPrivate::recompileApp(const QString& inputFile)
 {
     q->emit log("Recompiling IPA...");
 
-    QFileInfo fi(inputFile);
-    QString outputName = fi.baseName() + "-patched.ipa";
+    const QString outputName = outputPath(inputFile);
 
-    QString tempZipPath = QDir::temp().filePath("temp_ipa.zip");
+    QString tempZipPath = this->tempZipPath();
     
     if (QFile::exists(tempZipPath)) {
         QFile::remove(tempZipPath);
     }
+    QDir().mkpath(QFileInfo(outputName).absolutePath());
     if (QFile::exists(outputName)) {
         QFile::remove(outputName);
     }
 
-    QProcess process;
-    process.setWorkingDirectory(QDir::currentPath());
-    process.setProgram("powershell");
-    process.setArguments(QStringList() 
-        << "-NoProfile"
-        << "-Command"
-        << QString("$ErrorActionPreference = 'Stop'; Compress-Archive -Path 'decipa/*' -DestinationPath '%1' -Force; Move-Item -Path '%1' -Destination '%2' -Force")
-            .arg(QDir::toNativeSeparators(tempZipPath))
-            .arg(QDir::toNativeSeparators(outputName))
-    );
-
-    q->emit log("\nExecuting command: " + process.program() + " " + process.arguments().join(" "));
-    process.setProcessChannelMode(QProcess::MergedChannels);
-    process.start();
-
-    if (!process.waitForStarted(30000)) {
-        q->emit error("Failed to start IPA recompilation");
+    utils::DeflateOptions options;
+    options.level = compressionLevel;
+    options.backend = compressionBackend.toStdString();
+    if (reproducible && options.backend != "builtin") {
+        q->emit log("Reproducible build: packing with builtin instead of " + compressionBackend);
+        options.backend = "builtin";
+    }
+    if (!utils::findDeflateBackend(options.backend)) {
+        q->emit error("Unknown compression backend: " + compressionBackend);
         return false;
     }
-
-    while (process.state() != QProcess::NotRunning) {
-        if (process.waitForReadyRead(1000)) {
-            QString output = QString::fromUtf8(process.readAll()).trimmed();
-            if (!output.isEmpty()) {
-                q->emit log(output);
+    q->emit log(QString("Packing with %1 at level %2 on %3 threads")
+        .arg(QString::fromStdString(options.backend))
+        .arg(compressionLevel)
+        .arg(std::thread::hardware_concurrency()));
+
+    QElapsedTimer timer;
+    timer.start();
+    int reported = 0;
+    utils::zip::PackStats stats;
+    std::string packError;
+    const bool packed = utils::zip::packDirectory(
+        QDir::toNativeSeparators(workPath("decipa")).toStdString(),
+        QDir::toNativeSeparators(tempZipPath).toStdString(),
+        options, &stats,
+        [&](uint64_t done, uint64_t total) {
+            const int percent = total > 0 ? static_cast<int>(done * 100 / total) : 100;
+            if (percent >= reported + 25) {
+                reported = percent - percent % 25;
+                q->emit log(QString("Packed %1%").arg(reported));
             }
-        }
-    }
-
-    process.waitForFinished();
-    
-    QFile::remove(tempZipPath);
+            return !cancelled;
+        }, &packError);
 
-    if (process.exitCode() != 0) {
-        q->emit error("IPA recompilation failed");
+    if (cancelled) {
+        QFile::remove(tempZipPath);
+        return !checkCancelled();
+    }
+    utils::CopyMethod method;
+    if (!packed || !utils::moveFile(QDir::toNativeSeparators(tempZipPath).toStdWString(), QDir::toNativeSeparators(outputName).toStdWString(), &method)) {
+        QFile::remove(tempZipPath);
+        q->emit error(packed ? QString("IPA recompilation failed") : "IPA recompilation failed: " + QString::fromStdString(packError));
         return false;
     }
+    if (method != utils::CopyMethod::Renamed) {
+        q->emit log(QString("Patched IPA moved to %1 by %2").arg(outputName, utils::toString(method)));
+    }
 
+    q->emit log(QString("Packed %1 files, %2 MiB into %3 MiB in %4 ms")
+        .arg(stats.files)
+        .arg(stats.inputBytes / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(stats.outputBytes / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(timer.elapsed()));
     q->emit log("IPA recompiled successfully");
     return true;
 }
 
-bool IPAPatcherPrivate::replaceUrls(const QString& gameServerUrl, const QString& dlcServerUrl)
+QString IPAPatcherPrivate::findAppBundle()
 {
-    this->gameServerUrl = gameServerUrl;
-    this->dlcServerUrl = dlcServerUrl;
-
-    QDirIterator it("decipa", QDir::Dirs | QDir::NoDotAndDotDot);
     QString payloadPath;
-    while (it.hasNext()) {
-        QString dirPath = it.next();
-        if (dirPath.endsWith("Payload", Qt::CaseInsensitive)) {
-            payloadPath = dirPath;
+    for (const auto& entry : QDir(workPath("decipa")).entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (entry.compare("Payload", Qt::CaseInsensitive) == 0) {
+            payloadPath = workPath("decipa") + "/" + entry;
             break;
         }
     }
 
     if (payloadPath.isEmpty()) {
         q->emit error("Payload directory not found in IPA");
+        return QString();
+    }
+
+    const QStringList apps = QDir(payloadPath).entryList({"*.app"}, QDir::Dirs | QDir::NoDotAndDotDot);
+    if (apps.isEmpty()) {
+        q->emit error(".app directory not found in IPA");
+        return QString();
+    }
+    return payloadPath + "/" + apps.first();
+}
+
+bool IPAPatcherPrivate::thinApp()
+{
+    if (archFilter.isEmpty()) {
+        return true;
+    }
+
+    PruneResult result = thinMachOs(workPath("decipa"), archFilter);
+    if (!result.success) {
+        q->emit log("ERROR: " + result.errorMessage);
+        q->emit error(result.errorMessage);
         return false;
     }
+    for (const auto& removed : result.removed) {
+        q->emit log("Thinned " + removed);
+    }
+    // the census hashes describe the universal binaries, the thin ones are looked up afresh
+    for (const auto& member : result.thinned) {
+        entryHashes.remove(member);
+    }
+    q->emit log(QString("Kept architectures %1, %2 MB removed")
+        .arg(archFilter.archs().join(", "))
+        .arg(result.bytesSaved / (1024 * 1024)));
+    return true;
+}
 
-    QDirIterator appIt(payloadPath, QDir::Dirs | QDir::NoDotAndDotDot);
-    QString appPath;
-    while (appIt.hasNext()) {
-        QString dirPath = appIt.next();
-        if (dirPath.endsWith(".app", Qt::CaseInsensitive)) {
-            appPath = dirPath;
-            break;
+bool IPAPatcherPrivate::replaceUrls(const QString& appPath)
+{
+    q->emit log("\n=== URL Replacement Summary ===");
+    q->emit log("App bundle: " + appPath);
+    for (const auto& target : recipe.targets()) {
+        q->emit log("  " + target.id + ": " + QString::fromUtf8(target.match) + " -> " +
+                    QString::fromUtf8(recipe.replacement(target.id)));
+    }
+
+    // one parallel walk of the whole bundle, frameworks and extensions included: every Mach-O and
+    // plist goes to the passes that want it
+    PassManager passes;
+    passes.addPass(std::make_unique<PlistPass>(recipe));
+    passes.addPass(std::make_unique<NativePatchPass>("in-place", QStringList{"macho", "plist"}, recipe,
+                                                     siteDatabase, entryHashes));
+    PassManagerResult result = passes.run(workPath("decipa"));
+
+    for (const auto& line : result.log) {
+        q->emit log(line);
+    }
+    // one line per member that was changed or failed, whichever bundle it sits in
+    QMap<QString, int> patchedByKind;
+    QSet<QString> bundles;
+    q->emit log("\n=== Patched Members ===");
+    for (const auto& member : result.members) {
+        if (member.changedBy.isEmpty() && member.errors.isEmpty()) {
+            continue;
         }
+        if (!member.changedBy.isEmpty()) {
+            patchedByKind[member.kind]++;
+            bundles.insert(bundleOf(member.memberPath));
+        }
+        q->emit log(QString("  %1 [%2]: %3 (%4 ms)")
+            .arg(member.memberPath, member.kind.isEmpty() ? QString("?") : member.kind,
+                 member.errors.isEmpty() ? member.changedBy.join(", ") : "FAILED")
+            .arg(member.elapsedMs));
     }
 
-    if (appPath.isEmpty()) {
-        q->emit error(".app directory not found in IPA");
+    if (!siteDatabase.save()) {
+        q->emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
+    }
+    if (!result.success) {
+        for (const auto& problem : result.errors) {
+            q->emit log("ERROR: " + problem);
+        }
+        q->emit error("Failed to patch IPA: " + result.errors.first());
         return false;
     }
-
-    QString plistPath = appPath + "/Info.plist";
-    if (!updatePlist(plistPath)) {
+    // a plist that already has every value is left untouched, so look for it among the members
+    const bool plistFound = std::any_of(result.members.begin(), result.members.end(),
+        [&](const PassMemberReport& member) { return recipe.selectsPlist(member.memberPath); });
+    if (!plistFound) {
+        q->emit error("Info.plist not found in " + appPath);
         return false;
     }
 
-    QFileInfo appInfo(appPath);
-    QString binaryPath = appPath + "/" + appInfo.baseName();
-    if (!updateBinary(binaryPath)) {
+    q->emit log(QString("Visited %1 files, patched %2 plist and %3 Mach-O files in %4 bundles in %5 ms")
+        .arg(result.filesVisited)
+        .arg(patchedByKind.value("plist"))
+        .arg(patchedByKind.value("macho"))
+        .arg(bundles.size())
+        .arg(result.elapsedMs));
+    return true;
+}
+
+bool IPAPatcherPrivate::verifyApp(const QString& inputFile)
+{
+    const QString artifact = outputPath(inputFile);
+    q->emit log("Verifying " + artifact + "...");
+    const VerificationReport report = Verifier::verify(artifact, "ipa", Verifier::originalUrls(recipe));
+    for (const auto& leftover : report.leftovers) {
+        q->emit log("Original URL left: " + leftover);
+    }
+    for (const auto& member : report.corruptMembers) {
+        q->emit log("Corrupt member: " + member);
+    }
+    for (const auto& problem : report.signatureProblems) {
+        q->emit log("Signature problem: " + problem);
+    }
+    if (!report.success) {
+        QFile::remove(Verifier::manifestPath(artifact));
+        q->emit error("Verification failed: " + report.errorMessage);
         return false;
     }
-
+    q->emit log(report.summary() + QString(" (%1 ms)").arg(report.elapsedMs));
+
+    QJsonObject build;
+    build["source"] = QFileInfo(inputFile).fileName();
+    build["gameServerUrl"] = gameServerUrl;
+    build["dlcServerUrl"] = dlcServerUrl;
+    build["recipe"] = QString::fromLatin1(recipe.fingerprint());
+    build["archs"] = QJsonArray::fromStringList(archFilter.archs());
+    build["reproducible"] = reproducible;
+    const ArtifactInfo info = Probe::read(inputFile);
+    if (info.success) {
+        build["identifier"] = info.identifier;
+        build["versionName"] = info.versionName;
+        build["versionCode"] = info.versionCode;
+    }
+    QString errorMessage;
+    if (!Verifier::writeManifest(report, build, &errorMessage)) {
+        q->emit error(errorMessage);
+        return false;
+    }
+    q->emit log("Manifest written to " + Verifier::manifestPath(artifact));
     return true;
 }
 
@@ -396,60 +471,35 @@ bool IPAPatcherPrivate::patchIPA(const QString& ipaPath, const QString& gameServ
     q->emit log("Game Server: " + gameServerUrl);
     q->emit log("DLC Server: " + dlcServerUrl);
 
-    q->emit progressUpdated(10, "Decompiling IPA...");
-    if (!decompileApp(ipaPath)) {
+    q->emit progressUpdated(5, "Scanning IPA...");
+    if (!q->preflight(ipaPath, gameServerUrl, dlcServerUrl)) {
         return false;
     }
 
-
-    QDirIterator it("decipa", QDir::Dirs | QDir::NoDotAndDotDot);
-    QString payloadPath;
-    while (it.hasNext()) {
-        QString dirPath = it.next();
-        if (dirPath.endsWith("Payload", Qt::CaseInsensitive)) {
-            payloadPath = dirPath;
-            break;
-        }
-    }
-
-    if (payloadPath.isEmpty()) {
-        q->emit error("Payload directory not found in IPA");
+    if (checkCancelled()) {
         return false;
     }
 
-    QDirIterator appIt(payloadPath, QDir::Dirs | QDir::NoDotAndDotDot);
-    QString appPath;
-    while (appIt.hasNext()) {
-        QString dirPath = appIt.next();
-        if (dirPath.endsWith(".app", Qt::CaseInsensitive)) {
-            appPath = dirPath;
-            break;
-        }
+    q->emit progressUpdated(10, "Decompiling IPA...");
+    if (!decompileApp(ipaPath)) {
+        return false;
     }
 
+    QString appPath = findAppBundle();
     if (appPath.isEmpty()) {
-        q->emit error(".app directory not found in IPA");
         return false;
     }
 
-    q->emit progressUpdated(40, "Updating Info.plist...");
-    QString plistPath = appPath + "/Info.plist";
-    if (!QFile::exists(plistPath)) {
-        q->emit error("Info.plist not found at: " + plistPath);
-        return false;
-    }
-    if (!updatePlist(plistPath)) {
+    if (checkCancelled()) {
         return false;
     }
 
-    q->emit progressUpdated(60, "Updating binary...");
-    QFileInfo appInfo(appPath);
-    QString binaryPath = appPath + "/" + appInfo.baseName();
-    if (!QFile::exists(binaryPath)) {
-        q->emit error("Binary not found at: " + binaryPath);
+    q->emit progressUpdated(40, "Patching app bundle...");
+    if (!thinApp() || !replaceUrls(appPath)) {
         return false;
     }
-    if (!updateBinary(binaryPath)) {
+
+    if (checkCancelled()) {
         return false;
     }
 
@@ -458,14 +508,39 @@ bool IPAPatcherPrivate::patchIPA(const QString& ipaPath, const QString& gameServ
         return false;
     }
 
+    q->emit progressUpdated(95, "Verifying IPA...");
+    if (!verifyApp(ipaPath)) {
+        return false;
+    }
+
     q->emit progressUpdated(100, "IPA patching completed successfully!");
     q->emit log("IPA patching completed successfully");
     return true;
 }
 
-void IPAPatcher::patchIPA(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+bool IPAPatcher::prepareIPA(const QString& ipaPath)
+{
+    emit log("Preparing " + ipaPath + " ahead of any patch request...");
+    emit progressUpdated(10, "Scanning IPA...");
+    const CensusReport report = Census::scan(ipaPath);
+    if (!report.success) {
+        emit log("ERROR: " + report.errorMessage);
+        emit error("Could not scan IPA: " + report.errorMessage);
+        emit progressUpdated(100, "Failed to prepare IPA");
+        return false;
+    }
+    emit log(report.summary());
+    d->siteDatabase.recordCensus(report);
+    if (!d->siteDatabase.save()) {
+        emit log("WARNING: Could not save patch-site database to " + PatchSiteDatabase::defaultPath());
+    }
+    emit progressUpdated(100, "IPA prepared");
+    return true;
+}
+
+bool IPAPatcher::patchIPA(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl)
 {
-    d->patchIPA(ipaPath, gameServerUrl, dlcServerUrl);
+    return d->patchIPA(ipaPath, gameServerUrl, dlcServerUrl);
 }
 
 } 
@@ -15,7 +15,31 @@ public:
     virtual ~IPAPatcher();
 
     bool checkDependencies();
-    void patchIPA(const QString& ipaPath,
+    // Directory holding decipa and the temporary archive, the current directory by default
+    void setWorkspace(const QString& dir);
+    // Where the patched artifact and its manifest go, <name>-patched.<suffix> in the working
+    // directory by default; jobs that may run side by side need their own
+    void setOutputPath(const QString& path);
+    // Architectures to keep ("arm64", "armv7"); universal Mach-O binaries are thinned to them
+    void setArchFilter(const QStringList& archs);
+    // Deflate level (0 stores, 9 smallest) and backend used to pack the patched IPA
+    void setCompression(int level, const QString& backend = "builtin");
+    // Byte-identical output for identical inputs; packing always uses the built-in deflate then,
+    // whose output does not depend on a library version
+    void setReproducible(bool reproducible);
+    // Safe from any thread, stops the running tool and fails the patch at the next stage
+    void cancel();
+    // Largest resident size seen for external tools; IPA patching runs none, so always 0
+    qint64 peakToolMemory() const;
+    // Census of the IPA and length check of the planned replacements, before extracting
+    bool preflight(const QString& ipaPath,
+        const QString& gameServerUrl,
+        const QString& dlcServerUrl,
+        bool listSites = false);
+    // The work every target shares: census and patch-site indexing. The extracted tree is not
+    // kept, extraction is native and cheap next to an APK decode
+    bool prepareIPA(const QString& ipaPath);
+    bool patchIPA(const QString& ipaPath,
         const QString& gameServerUrl = QString(),
         const QString& dlcServerUrl = QString());
 
@@ -0,0 +1,11 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher::KnownUrls {
+    // Endpoints baked into the stock game builds
+    inline const QByteArray dlc = "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/";
+    inline const QByteArray gameServer = "https://prod.simpsons-ea.com";
+    inline const QByteArray director = "https://syn-dir.sn.eamobile.com";
+
+    inline QList<QByteArray> all() { return {dlc, gameServer, director}; }
+}
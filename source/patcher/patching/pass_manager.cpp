@@ -0,0 +1,314 @@
+#include "std_include.hpp"
+#include "pass_manager.hpp"
+#include "census.hpp"
+
+namespace Patcher {
+
+void PassManager::addPass(std::unique_ptr<PatchPass> pass)
+{
+    passes_.push_back(std::move(pass));
+}
+
+QString PassManager::sniffFile(const QString& path, const QString& memberPath)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    const QByteArray head = file.read(64);
+    return Census::sniffKind(memberPath, reinterpret_cast<const uint8_t*>(head.constData()),
+                             static_cast<size_t>(head.size()));
+}
+
+PassManager::FileReport PassManager::processFile(const QDir& rootDir, const QString& path) const
+{
+    FileReport report;
+    PassFile file;
+    file.path = path;
+    file.memberPath = rootDir.relativeFilePath(path);
+    report.member.memberPath = file.memberPath;
+
+    std::vector<const PatchPass*> interested;
+    bool needsKind = false;
+    for (const auto& pass : passes_) {
+        if (pass->wantsPath(file.memberPath)) {
+            interested.push_back(pass.get());
+            needsKind = needsKind || !pass->kinds().isEmpty();
+        }
+    }
+    if (interested.empty()) {
+        return report;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (needsKind) {
+        file.kind = sniffFile(file.path, file.memberPath);
+    }
+    report.member.kind = file.kind;
+
+    for (const auto* pass : interested) {
+        const QStringList kinds = pass->kinds();
+        if (!kinds.isEmpty() && !kinds.contains(file.kind)) {
+            continue;
+        }
+        report.dispatched = true;
+
+        PassOutcome outcome = pass->run(file);
+        report.log.append(outcome.log);
+        if (!outcome.success) {
+            report.member.errors.append(pass->name() + ": " + outcome.errorMessage);
+        }
+        if (outcome.changed) {
+            report.member.changedBy.append(pass->name());
+        }
+    }
+    report.member.elapsedMs = timer.elapsed();
+    return report;
+}
+
+PassManagerResult PassManager::run(const QString& root, int threadCount) const
+{
+    PassManagerResult result;
+    QElapsedTimer timer;
+    timer.start();
+
+    const QDir rootDir(root);
+    QStringList files;
+    QDirIterator it(root, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        files.append(it.next());
+    }
+    result.filesVisited = static_cast<int>(files.size());
+
+    // per file slots keep the log in walk order whatever thread handled the file
+    std::vector<QStringList> logs(files.size());
+    std::vector<std::optional<PassMemberReport>> members(files.size());
+    std::mutex mutex;
+    std::atomic<qsizetype> next{0};
+    std::atomic<int> dispatched{0};
+
+    auto worker = [&]() {
+        for (qsizetype i = next++; i < files.size(); i = next++) {
+            FileReport report = processFile(rootDir, files[i]);
+            if (!report.dispatched) {
+                continue;
+            }
+            dispatched++;
+            logs[i] = report.log;
+            if (!report.member.changedBy.isEmpty()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto& name : report.member.changedBy) {
+                    result.changed[name]++;
+                }
+            }
+            members[i] = std::move(report.member);
+        }
+    };
+
+    if (threadCount <= 0) {
+        threadCount = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threadCount = std::clamp(threadCount, 1, qMax(1, static_cast<int>(files.size())));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < logs.size(); i++) {
+        result.log.append(logs[i]);
+        if (members[i]) {
+            result.errors.append(members[i]->errors);
+            result.members.append(*members[i]);
+        }
+    }
+    result.success = result.errors.isEmpty();
+    result.filesDispatched = dispatched;
+    result.elapsedMs = timer.elapsed();
+    return result;
+}
+
+PassStream::PassStream(const PassManager& manager, const QString& root,
+                       std::function<bool(const QString&)> early, int threadCount)
+    : manager_(manager)
+    , rootDir_(root)
+    , early_(std::move(early))
+    , threadCount_(threadCount > 0 ? threadCount : qMax(1, static_cast<int>(std::thread::hardware_concurrency())))
+{
+}
+
+PassStream::~PassStream()
+{
+    stop();
+}
+
+PassStream::Stamp PassStream::stampOf(const QString& path)
+{
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        return Stamp();
+    }
+    return {info.size(), info.lastModified().toMSecsSinceEpoch()};
+}
+
+void PassStream::start()
+{
+    timer_.start();
+    scanning_ = true;
+    for (int i = 0; i < threadCount_; i++) {
+        workers_.emplace_back([this]() { work(); });
+    }
+    scanner_ = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (scanning_) {
+            lock.unlock();
+            scan(false);
+            lock.lock();
+            wake_.wait_for(lock, std::chrono::milliseconds(1000), [this]() { return !scanning_; });
+        }
+    });
+}
+
+void PassStream::scan(bool final)
+{
+    QStringList found;
+    QDirIterator it(rootDir_.path(), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        found.append(it.next());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& path : found) {
+        if (queued_.contains(path)) {
+            continue;
+        }
+        const Stamp stamp = stampOf(path);
+        auto handled = handledStamps_.constFind(path);
+        if (handled != handledStamps_.constEnd() && *handled == stamp) {
+            continue;
+        }
+
+        if (!final) {
+            // a file is only taken once it looked the same on two consecutive scans
+            if (early_ && !early_(rootDir_.relativeFilePath(path))) {
+                continue;
+            }
+            auto pending = pendingStamps_.find(path);
+            if (pending == pendingStamps_.end() || !(*pending == stamp)) {
+                pendingStamps_.insert(path, stamp);
+                continue;
+            }
+            earlyFiles_++;
+        }
+        pendingStamps_.remove(path);
+        queued_.insert(path);
+        queue_.push_back(path);
+    }
+    wake_.notify_all();
+}
+
+void PassStream::work()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this]() { return !queue_.empty() || draining_; });
+        if (queue_.empty()) {
+            return;
+        }
+        const QString path = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+
+        PassManager::FileReport report = manager_.processFile(rootDir_, path);
+        const Stamp stamp = stampOf(path);
+
+        lock.lock();
+        queued_.remove(path);
+        handledStamps_.insert(path, stamp);
+        if (report.dispatched) {
+            // a file handled twice keeps the changes of both runs
+            PassManager::FileReport& merged = reports_[path];
+            merged.dispatched = true;
+            merged.log.append(report.log);
+            merged.member.memberPath = report.member.memberPath;
+            merged.member.kind = report.member.kind;
+            merged.member.errors.append(report.member.errors);
+            merged.member.elapsedMs += report.member.elapsedMs;
+            for (const auto& name : report.member.changedBy) {
+                if (!merged.member.changedBy.contains(name)) {
+                    merged.member.changedBy.append(name);
+                }
+            }
+        }
+    }
+}
+
+void PassStream::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        scanning_ = false;
+        draining_ = true;
+    }
+    wake_.notify_all();
+    if (scanner_.joinable()) {
+        scanner_.join();
+    }
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+PassManagerResult PassStream::finish()
+{
+    if (!timer_.isValid()) {
+        timer_.start();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        scanning_ = false;
+    }
+    wake_.notify_all();
+    if (scanner_.joinable()) {
+        scanner_.join();
+    }
+    if (workers_.empty()) {
+        for (int i = 0; i < threadCount_; i++) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    // the producer is done: take every file not handled yet, or changed after it was
+    scan(true);
+    stop();
+
+    PassManagerResult result;
+    int visited = 0;
+    QDirIterator it(rootDir_.path(), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        visited++;
+    }
+    result.filesVisited = visited;
+    for (auto it = reports_.begin(); it != reports_.end(); ++it) {
+        result.filesDispatched++;
+        result.log.append(it->log);
+        result.errors.append(it->member.errors);
+        result.members.append(it->member);
+        for (const auto& name : it->member.changedBy) {
+            result.changed[name]++;
+        }
+    }
+    if (earlyFiles_ > 0) {
+        result.log.append(QString("%1 files were handled while the tree was still being written").arg(earlyFiles_));
+    }
+    result.success = result.errors.isEmpty();
+    result.elapsedMs = timer_.elapsed();
+    return result;
+}
+
+}
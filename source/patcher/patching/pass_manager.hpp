@@ -0,0 +1,128 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+struct PassFile {
+    QString path;
+    // relative to the artifact root, '/' separated
+    QString memberPath;
+    // census kind, empty when unknown or when no interested pass asked for it
+    QString kind;
+};
+
+struct PassOutcome {
+    bool success = true;
+    bool changed = false;
+    QString errorMessage;
+    QStringList log;
+};
+
+// One patch step. Passes only declare what they are interested in, the manager owns the walk.
+class PatchPass {
+public:
+    virtual ~PatchPass() = default;
+
+    virtual QString name() const = 0;
+    // File kinds the pass handles, empty for any
+    virtual QStringList kinds() const { return {}; }
+    // Path-only filter, checked before the file is opened
+    virtual bool wantsPath(const QString& memberPath) const = 0;
+    // Runs on a worker thread; passes interested in the same file run on it in registration order
+    virtual PassOutcome run(const PassFile& file) const = 0;
+};
+
+// What the passes did to one file
+struct PassMemberReport {
+    QString memberPath;
+    QString kind;
+    // names of the passes that changed the file, in the order they ran
+    QStringList changedBy;
+    QStringList errors;
+    qint64 elapsedMs = 0;
+};
+
+struct PassManagerResult {
+    bool success = true;
+    int filesVisited = 0;
+    int filesDispatched = 0;
+    qint64 elapsedMs = 0;
+    // files changed per pass name
+    QMap<QString, int> changed;
+    // every dispatched file, in walk order
+    QList<PassMemberReport> members;
+    QStringList log;
+    QStringList errors;
+};
+
+class PassManager {
+public:
+    void addPass(std::unique_ptr<PatchPass> pass);
+
+    // Walks root once and hands every file to each interested pass, files in parallel
+    PassManagerResult run(const QString& root, int threadCount = 0) const;
+
+    static QString sniffFile(const QString& path, const QString& memberPath);
+
+private:
+    friend class PassStream;
+
+    struct FileReport {
+        bool dispatched = false;
+        QStringList log;
+        PassMemberReport member;
+    };
+
+    FileReport processFile(const QDir& rootDir, const QString& path) const;
+
+    std::vector<std::unique_ptr<PatchPass>> passes_;
+};
+
+// Runs the passes of a manager over a tree another process is still writing. Files are picked
+// up once their size and time stamp stopped changing; finish() then does a catch-up pass over
+// everything not handled yet or touched again since, so the result matches a plain run().
+class PassStream {
+public:
+    // early limits what may be handled before finish(), by member path; empty for everything
+    PassStream(const PassManager& manager, const QString& root,
+               std::function<bool(const QString&)> early = {}, int threadCount = 0);
+    ~PassStream();
+
+    void start();
+    PassManagerResult finish();
+
+private:
+    struct Stamp {
+        qint64 size = -1;
+        qint64 modified = 0;
+
+        bool operator==(const Stamp& other) const { return size == other.size && modified == other.modified; }
+    };
+
+    static Stamp stampOf(const QString& path);
+    void scan(bool final);
+    void work();
+    void stop();
+
+    const PassManager& manager_;
+    QDir rootDir_;
+    std::function<bool(const QString&)> early_;
+    int threadCount_;
+    QElapsedTimer timer_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<QString> queue_;
+    bool scanning_ = false;
+    bool draining_ = false;
+    // last stamp seen while waiting to settle, and the stamp a handled file was left with
+    QHash<QString, Stamp> pendingStamps_;
+    QHash<QString, Stamp> handledStamps_;
+    QSet<QString> queued_;
+    QMap<QString, PassManager::FileReport> reports_;
+    int earlyFiles_ = 0;
+    std::thread scanner_;
+    std::vector<std::thread> workers_;
+};
+
+}
@@ -0,0 +1,148 @@
+#include "std_include.hpp"
+#include "patch_passes.hpp"
+#include "axml.hpp"
+
+namespace Patcher {
+
+namespace {
+
+void describe(const RecipeApplyResult& applied, const PassFile& file, PassOutcome& outcome)
+{
+    outcome.success = applied.success;
+    outcome.errorMessage = applied.errorMessage;
+    outcome.changed = applied.total() > 0;
+    for (auto it = applied.replaced.begin(); it != applied.replaced.end(); ++it) {
+        outcome.log.append(QString("Replaced %1 x%2 in %3%4")
+            .arg(it.key())
+            .arg(it.value())
+            .arg(file.memberPath)
+            .arg(applied.fromDatabase ? " (known offsets)" : ""));
+    }
+}
+
+}
+
+bool TextRewritePass::wantsPath(const QString& memberPath) const
+{
+    return recipe_.selects(memberPath, TargetSet::Rewrite);
+}
+
+PassOutcome TextRewritePass::run(const PassFile& file) const
+{
+    PassOutcome outcome;
+    // compiled resources are ResourcePoolPass's, a byte-level rewrite would break their pools
+    if (file.kind == "axml" || file.kind == "arsc") {
+        return outcome;
+    }
+    describe(recipe_.applyToFile(file.path, file.memberPath, file.kind, TargetSet::Rewrite), file, outcome);
+    return outcome;
+}
+
+bool ResourcePoolPass::wantsPath(const QString& memberPath) const
+{
+    // only what can be compiled, so smali never gets sniffed on its account
+    return (memberPath.endsWith(".xml") || memberPath.endsWith(".arsc")) && recipe_.selects(memberPath, TargetSet::Rewrite);
+}
+
+PassOutcome ResourcePoolPass::run(const PassFile& file) const
+{
+    PassOutcome outcome;
+
+    QFile member(file.path);
+    if (!member.open(QIODevice::ReadOnly)) {
+        outcome.success = false;
+        outcome.errorMessage = "Failed to open " + file.memberPath;
+        return outcome;
+    }
+    std::string document = member.readAll().toStdString();
+    member.close();
+
+    RecipeApplyResult applied;
+    const bool rewritten = utils::axml::rewriteStringPools(document, [&](std::vector<std::string>& strings) {
+        const RecipeApplyResult pool = recipe_.applyToStrings(file.memberPath, file.kind, strings, TargetSet::Rewrite);
+        for (auto it = pool.replaced.begin(); it != pool.replaced.end(); ++it) {
+            applied.replaced[it.key()] += it.value();
+        }
+        return pool.total() > 0;
+    });
+    if (!rewritten) {
+        outcome.success = false;
+        outcome.errorMessage = "Could not rewrite the string pool of " + file.memberPath;
+        return outcome;
+    }
+    if (applied.total() == 0) {
+        return outcome;
+    }
+
+    if (!member.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        member.write(document.data(), static_cast<qint64>(document.size())) != static_cast<qint64>(document.size())) {
+        outcome.success = false;
+        outcome.errorMessage = "Failed to write " + file.memberPath;
+        return outcome;
+    }
+    describe(applied, file, outcome);
+    return outcome;
+}
+
+bool NativePatchPass::wantsPath(const QString& memberPath) const
+{
+    return recipe_.selects(memberPath, TargetSet::InPlace);
+}
+
+PassOutcome NativePatchPass::run(const PassFile& file) const
+{
+    PassOutcome outcome;
+    // plists are small and Info.plist is edited by the key rules first, recorded offsets would never be reused
+    PatchSiteDatabase* database = file.kind == "plist" ? nullptr : &database_;
+    describe(recipe_.applyToFile(file.path, file.memberPath, file.kind, TargetSet::InPlace, database, knownHashes_),
+             file, outcome);
+    return outcome;
+}
+
+bool PlistPass::wantsPath(const QString& memberPath) const
+{
+    return recipe_.selectsPlist(memberPath);
+}
+
+PassOutcome PlistPass::run(const PassFile& file) const
+{
+    PassOutcome outcome;
+
+    QFile plist(file.path);
+    if (!plist.open(QIODevice::ReadOnly)) {
+        outcome.success = false;
+        outcome.errorMessage = "Failed to open " + file.memberPath;
+        return outcome;
+    }
+    const QByteArray original = plist.readAll();
+    plist.close();
+
+    // binary plists, the norm in shipped IPAs, are not text and are edited object by object
+    QByteArray content;
+    if (original.startsWith("bplist")) {
+        std::string binary = original.toStdString();
+        if (!recipe_.applyPlistRules(file.memberPath, binary, outcome.log)) {
+            outcome.success = false;
+            outcome.errorMessage = "Failed to parse binary plist " + file.memberPath;
+            return outcome;
+        }
+        content = QByteArray::fromStdString(binary);
+    } else {
+        QString text = QString::fromUtf8(original);
+        outcome.log = recipe_.applyPlistRules(file.memberPath, text);
+        content = text.toUtf8();
+    }
+    if (content == original) {
+        return outcome;
+    }
+
+    if (!plist.open(QIODevice::WriteOnly | QIODevice::Truncate) || plist.write(content) != content.size()) {
+        outcome.success = false;
+        outcome.errorMessage = "Failed to write " + file.memberPath;
+        return outcome;
+    }
+    outcome.changed = true;
+    return outcome;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "std_include.hpp"
+#include "pass_manager.hpp"
+#include "recipe.hpp"
+
+namespace Patcher {
+
+// Free-length URL rewrite of the recipe's text targets
+class TextRewritePass : public PatchPass {
+public:
+    explicit TextRewritePass(const CompiledRecipe& recipe) : recipe_(recipe) {}
+
+    QString name() const override { return "text"; }
+    bool wantsPath(const QString& memberPath) const override;
+    PassOutcome run(const PassFile& file) const override;
+
+private:
+    const CompiledRecipe& recipe_;
+};
+
+// URL rewrite inside the string pools of binary XML and resources.arsc, so resources left
+// compiled by the decode are patched without an aapt2 rebuild
+class ResourcePoolPass : public PatchPass {
+public:
+    explicit ResourcePoolPass(const CompiledRecipe& recipe) : recipe_(recipe) {}
+
+    QString name() const override { return "resources"; }
+    QStringList kinds() const override { return {"axml", "arsc"}; }
+    bool wantsPath(const QString& memberPath) const override;
+    PassOutcome run(const PassFile& file) const override;
+
+private:
+    const CompiledRecipe& recipe_;
+};
+
+// Same-length patch through the patch-site database, for native binaries and for plists, whose binary
+// form has offset tables a longer string would break
+class NativePatchPass : public PatchPass {
+public:
+    NativePatchPass(const QString& name, const QStringList& kinds, const CompiledRecipe& recipe,
+                    PatchSiteDatabase& database, const QMap<QString, QByteArray>& knownHashes)
+        : name_(name), kinds_(kinds), recipe_(recipe), database_(database), knownHashes_(knownHashes) {}
+
+    QString name() const override { return name_; }
+    QStringList kinds() const override { return kinds_; }
+    bool wantsPath(const QString& memberPath) const override;
+    PassOutcome run(const PassFile& file) const override;
+
+private:
+    QString name_;
+    QStringList kinds_;
+    const CompiledRecipe& recipe_;
+    PatchSiteDatabase& database_;
+    const QMap<QString, QByteArray>& knownHashes_;
+};
+
+// Key updates of property lists, XML or binary
+class PlistPass : public PatchPass {
+public:
+    explicit PlistPass(const CompiledRecipe& recipe) : recipe_(recipe) {}
+
+    QString name() const override { return "plist"; }
+    bool wantsPath(const QString& memberPath) const override;
+    PassOutcome run(const PassFile& file) const override;
+
+private:
+    const CompiledRecipe& recipe_;
+};
+
+}
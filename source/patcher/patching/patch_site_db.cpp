@@ -0,0 +1,211 @@
+#include "std_include.hpp"
+#include "patch_site_db.hpp"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QSaveFile>
+
+namespace Patcher {
+
+PatchSiteDatabase::PatchSiteDatabase(const QString& path)
+    : path_(path)
+{
+}
+
+QString PatchSiteDatabase::defaultPath()
+{
+    return "cache/patch_sites.json";
+}
+
+PatchSiteDatabase& PatchSiteDatabase::shared()
+{
+    static PatchSiteDatabase* database = [] {
+        auto* instance = new PatchSiteDatabase();
+        instance->load();
+        return instance;
+    }();
+    return *database;
+}
+
+QString PatchSiteDatabase::key(const QString& entryPath, const QByteArray& sha256)
+{
+    return entryPath + "|" + QString::fromLatin1(sha256);
+}
+
+bool PatchSiteDatabase::load()
+{
+    QMutexLocker locker(&mutex_);
+    sites_.clear();
+    dirty_ = false;
+
+    QFile file(path_);
+    if (!file.exists()) {
+        return true;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    QJsonObject entries = root["entries"].toObject();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        QList<KnownSite> sites;
+        for (const auto& value : it.value().toArray()) {
+            QJsonObject obj = value.toObject();
+            KnownSite site;
+            site.pattern = obj["url"].toString().toUtf8();
+            site.offset = static_cast<qint64>(obj["offset"].toDouble());
+            sites.append(site);
+        }
+        sites_.insert(it.key(), sites);
+    }
+    return true;
+}
+
+bool PatchSiteDatabase::save()
+{
+    QMutexLocker locker(&mutex_);
+    if (!dirty_) {
+        return true;
+    }
+
+    QJsonObject entries;
+    for (auto it = sites_.begin(); it != sites_.end(); ++it) {
+        QJsonArray sites;
+        for (const auto& site : it.value()) {
+            QJsonObject obj;
+            obj["url"] = QString::fromUtf8(site.pattern);
+            obj["offset"] = site.offset;
+            sites.append(obj);
+        }
+        entries[it.key()] = sites;
+    }
+
+    QJsonObject root;
+    root["version"] = 1;
+    root["entries"] = entries;
+
+    QDir().mkpath(QFileInfo(path_).absolutePath());
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+bool PatchSiteDatabase::lookup(const QString& entryPath, const QByteArray& sha256, QList<KnownSite>& sites) const
+{
+    QMutexLocker locker(&mutex_);
+    auto it = sites_.constFind(key(entryPath, sha256));
+    if (it == sites_.constEnd()) {
+        return false;
+    }
+    sites = it.value();
+    return true;
+}
+
+void PatchSiteDatabase::record(const QString& entryPath, const QByteArray& sha256, const QList<KnownSite>& sites)
+{
+    QMutexLocker locker(&mutex_);
+    sites_.insert(key(entryPath, sha256), sites);
+    dirty_ = true;
+}
+
+void PatchSiteDatabase::recordCensus(const CensusReport& report)
+{
+    QMap<QString, QList<KnownSite>> byEntry;
+    for (auto it = report.entryHashes.begin(); it != report.entryHashes.end(); ++it) {
+        byEntry.insert(it.key(), {});
+    }
+    for (const auto& site : report.sites) {
+        if (site.encoding == "utf-8" && byEntry.contains(site.entry)) {
+            byEntry[site.entry].append({site.pattern, site.offset});
+        }
+    }
+    for (auto it = byEntry.begin(); it != byEntry.end(); ++it) {
+        record(it.key(), report.entryHashes.value(it.key()), it.value());
+    }
+}
+
+InPlacePatchResult patchInPlace(PatchSiteDatabase& database, const QString& filePath, const QString& entryPath,
+                                const QByteArray& knownSha256, const QList<QPair<QByteArray, QByteArray>>& replacements)
+{
+    InPlacePatchResult result;
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadWrite)) {
+        result.errorMessage = "Could not open " + filePath;
+        return result;
+    }
+
+    QByteArray sha256 = knownSha256;
+    if (sha256.isEmpty()) {
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        hash.addData(&file);
+        sha256 = hash.result().toHex();
+    }
+
+    QMap<QByteArray, QByteArray> wanted;
+    for (const auto& replacement : replacements) {
+        wanted.insert(replacement.first, replacement.second);
+    }
+
+    // trust recorded offsets only if every one of them still holds its original bytes
+    QList<KnownSite> sites;
+    bool known = database.lookup(entryPath, sha256, sites);
+    if (known) {
+        for (const auto& site : sites) {
+            if (!file.seek(site.offset) || file.read(site.pattern.size()) != site.pattern) {
+                known = false;
+                break;
+            }
+        }
+    }
+
+    if (!known) {
+        sites.clear();
+        file.seek(0);
+        QByteArray content = file.readAll();
+        sha256 = QCryptographicHash::hash(content, QCryptographicHash::Sha256).toHex();
+        // record every known URL, not only the ones this run replaces, so the entry stays complete
+        QList<QByteArray> patterns = KnownUrls::all();
+        for (const auto& replacement : replacements) {
+            if (!patterns.contains(replacement.first)) {
+                patterns.append(replacement.first);
+            }
+        }
+        for (const auto& pattern : patterns) {
+            for (qsizetype offset = content.indexOf(pattern); offset >= 0;
+                 offset = content.indexOf(pattern, offset + pattern.size())) {
+                sites.append({pattern, offset});
+            }
+        }
+        database.record(entryPath, sha256, sites);
+    }
+
+    for (const auto& site : sites) {
+        auto it = wanted.constFind(site.pattern);
+        if (it == wanted.constEnd()) {
+            continue;
+        }
+        if (it.value().size() != site.pattern.size()) {
+            result.errorMessage = "Replacement for " + QString::fromUtf8(site.pattern) + " does not match its length";
+            return result;
+        }
+        if (!file.seek(site.offset) || file.write(it.value()) != it.value().size()) {
+            result.errorMessage = "Failed to write " + filePath;
+            return result;
+        }
+        result.sitesPatched++;
+        result.patchedByPattern[site.pattern]++;
+    }
+
+    result.success = true;
+    result.fromDatabase = known;
+    return result;
+}
+
+}
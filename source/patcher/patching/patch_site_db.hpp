@@ -0,0 +1,52 @@
+#pragma once
+#include "std_include.hpp"
+#include "census.hpp"
+
+namespace Patcher {
+
+struct KnownSite {
+    QByteArray pattern;
+    qint64 offset = 0;
+};
+
+// Patch-site offsets of the native binaries of builds we have already seen, keyed by the
+// member path inside the artifact and the SHA-256 of its contents.
+class PatchSiteDatabase {
+public:
+    explicit PatchSiteDatabase(const QString& path = defaultPath());
+
+    static QString defaultPath();
+    // Process-wide instance on the default path, loaded on first use and shared by concurrent jobs
+    static PatchSiteDatabase& shared();
+
+    bool load();
+    bool save();
+
+    bool lookup(const QString& entryPath, const QByteArray& sha256, QList<KnownSite>& sites) const;
+    void record(const QString& entryPath, const QByteArray& sha256, const QList<KnownSite>& sites);
+    // Takes the in-place sites of every native binary the census hashed, including those without any
+    void recordCensus(const CensusReport& report);
+
+private:
+    static QString key(const QString& entryPath, const QByteArray& sha256);
+
+    QString path_;
+    QHash<QString, QList<KnownSite>> sites_;
+    bool dirty_ = false;
+    mutable QMutex mutex_;
+};
+
+struct InPlacePatchResult {
+    bool success = false;
+    bool fromDatabase = false;
+    int sitesPatched = 0;
+    QMap<QByteArray, int> patchedByPattern;
+    QString errorMessage;
+};
+
+// Rewrites every occurrence of each pattern with its same-length replacement. Known builds
+// are patched by seeking to the recorded offsets, unknown ones are searched once and recorded.
+InPlacePatchResult patchInPlace(PatchSiteDatabase& database, const QString& filePath, const QString& entryPath,
+                                const QByteArray& knownSha256, const QList<QPair<QByteArray, QByteArray>>& replacements);
+
+}
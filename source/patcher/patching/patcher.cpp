@@ -2,16 +2,71 @@
 #include "patcher.hpp"
 #include "apk_patcher.hpp"
 #include "ipa_patcher.hpp"
+#include "admission.hpp"
+#include "probe.hpp"
+#include "checkpoint.hpp"
+#include "utils.hpp"
+#include <QtCore/QWaitCondition>
 
 namespace Patcher {
 
+QString toString(JobState state)
+{
+    switch (state) {
+    case JobState::Queued:
+        return "queued";
+    case JobState::Running:
+        return "running";
+    case JobState::Succeeded:
+        return "succeeded";
+    case JobState::Failed:
+        return "failed";
+    case JobState::Cancelled:
+        return "cancelled";
+    }
+    return QString();
+}
+
+int JobPriority::fromName(const QString& name)
+{
+    if (name == "hotfix") {
+        return Hotfix;
+    }
+    if (name == "bulk") {
+        return Bulk;
+    }
+    return Normal;
+}
+
 class AppPatcherPrivate {
 public:
     AppPatcher* q;
     APKPatcher* apkPatcher;
     IPAPatcher* ipaPatcher;
 
-    explicit AppPatcherPrivate(AppPatcher* patcher) 
+    QThreadPool pool;
+    int maxConcurrentJobs = qMax(1, QThread::idealThreadCount() / 2);
+    // copied into every job as it is queued, the workers only read the copy
+    JobSettings settings;
+    QString outputRoot;
+    int nextJobId = 1;
+    int runningJobs = 0;
+    QMap<int, PatchJob> jobs;
+    QList<int> pending;
+    AdmissionController admission;
+    ResourceEstimate reserved;
+
+    // touched from the worker threads
+    QMutex mutex;
+    QMap<int, std::function<void()>> cancelRunning;
+    QSet<int> cancelRequested;
+    // workspace -> whether the job holding it only prepares
+    QMap<QString, bool> activeWorkspaces;
+    QWaitCondition workspaceReleased;
+    // path|size|mtime -> content hash, so each build is read once for its workspace name
+    QHash<QString, QByteArray> contentHashes;
+
+    explicit AppPatcherPrivate(AppPatcher* patcher)
         : q(patcher)
         , apkPatcher(new APKPatcher(patcher))
         , ipaPatcher(new IPAPatcher(patcher))
@@ -29,14 +84,309 @@ public:
                         q, &AppPatcher::error);
         QObject::connect(ipaPatcher, &IPAPatcher::log,
                         q, &AppPatcher::log);
+
+        pool.setMaxThreadCount(maxConcurrentJobs);
+        WorkspaceCollector::instance().sweep(settings.workspaceRoot, settings.workspacePolicy);
     }
 
     ~AppPatcherPrivate() {
         delete apkPatcher;
         delete ipaPatcher;
     }
+
+    int enqueue(PatchJob job);
+    QString outputFor(const PatchJob& job) const;
+    void setState(int jobId, JobState state);
+    void dispatch();
+    int nextAdmissible();
+    QByteArray contentHash(const QString& path);
+    QString claimWorkspace(const PatchJob& job);
+    void runJob(const PatchJob& job);
+    void finishJob(int jobId, bool success, const QString& errorMessage, const ResourceEstimate& observed);
+
+    template <typename T>
+    void forwardSignals(T& patcher, int jobId, QString& errorMessage);
 };
 
+template <typename T>
+void AppPatcherPrivate::forwardSignals(T& patcher, int jobId, QString& errorMessage)
+{
+    // the patcher lives on the worker thread, q as context makes these queued
+    QObject::connect(&patcher, &T::progressUpdated, q, [this, jobId](int progress, const QString& status) {
+        if (!jobs.contains(jobId)) {
+            return;
+        }
+        jobs[jobId].progress = progress;
+        jobs[jobId].status = status;
+        emit q->progressUpdated(progress, status);
+        emit q->jobProgress(jobId, progress, status);
+    });
+    QObject::connect(&patcher, &T::log, q, [this, jobId](const QString& message) {
+        emit q->log(message);
+        emit q->jobLog(jobId, message);
+    });
+    QObject::connect(&patcher, &T::error, q, [this](const QString& message) {
+        emit q->error(message);
+    });
+    QObject::connect(&patcher, &T::error, [&errorMessage](const QString& message) {
+        errorMessage = message;
+    });
+}
+
+int AppPatcherPrivate::enqueue(PatchJob job)
+{
+    job.id = nextJobId++;
+    job.queuedAt = QDateTime::currentDateTime();
+    job.status = "Queued";
+    job.settings = settings;
+    const ResourceEstimate estimate = admission.estimate(job.path);
+    job.estimatedMemory = estimate.memoryBytes;
+    job.estimatedDisk = estimate.diskBytes;
+    if (!job.prepareOnly) {
+        job.output = outputFor(job);
+    }
+    const ArtifactInfo info = Probe::read(job.path);
+    if (info.success) {
+        job.identifier = info.identifier;
+        job.version = info.version();
+        emit q->log(info.summary());
+    }
+
+    jobs.insert(job.id, job);
+    pending.append(job.id);
+    emit q->jobStateChanged(job.id, JobState::Queued);
+    dispatch();
+    return job.id;
+}
+
+QString AppPatcherPrivate::outputFor(const PatchJob& job) const
+{
+    const QString ownFolder = QString("%1/%2").arg(job.id).arg(job.outputName());
+    if (!outputRoot.isEmpty()) {
+        return QDir(outputRoot).absoluteFilePath(ownFolder);
+    }
+    // the working directory as before, unless an unfinished job already writes the same name there
+    const QString path = QDir::current().absoluteFilePath(job.outputName());
+    for (const auto& other : jobs) {
+        if (!other.isFinished() && other.output == path) {
+            return QDir("outputs").absoluteFilePath(ownFolder);
+        }
+    }
+    return path;
+}
+
+void AppPatcherPrivate::setState(int jobId, JobState state)
+{
+    PatchJob& job = jobs[jobId];
+    job.state = state;
+    if (state == JobState::Running) {
+        job.startedAt = QDateTime::currentDateTime();
+    } else if (job.isFinished()) {
+        job.finishedAt = QDateTime::currentDateTime();
+    }
+    emit q->jobStateChanged(jobId, state);
+}
+
+void AppPatcherPrivate::dispatch()
+{
+    if (runningJobs == 0) {
+        admission.refreshDiskBaseline();
+    }
+
+    while (runningJobs < maxConcurrentJobs && !pending.isEmpty()) {
+        const int index = nextAdmissible();
+        if (index < 0) {
+            break;
+        }
+        const int jobId = pending.takeAt(index);
+
+        PatchJob& queued = jobs[jobId];
+        reserved += {queued.estimatedMemory, queued.estimatedDisk};
+        runningJobs++;
+        setState(jobId, JobState::Running);
+        const PatchJob job = queued;
+        pool.start([this, job]() { runJob(job); });
+    }
+}
+
+int AppPatcherPrivate::nextAdmissible()
+{
+    // highest priority first, oldest first within a priority
+    QList<int> order;
+    for (int i = 0; i < pending.size(); i++) {
+        order.append(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return jobs[pending[a]].priority > jobs[pending[b]].priority;
+    });
+
+    for (int i = 0; i < order.size(); i++) {
+        PatchJob& job = jobs[pending[order[i]]];
+        const QString waitingFor = admission.checkAdmission({job.estimatedMemory, job.estimatedDisk}, reserved);
+        if (waitingFor.isEmpty()) {
+            return order[i];
+        }
+
+        if (runningJobs == 0) {
+            // nothing would ever free up, so a job bigger than the whole budget runs alone
+            emit q->log(QString("Job %1 may not fit the resource budget, running it on its own").arg(job.id));
+            return order[i];
+        }
+
+        if (job.status != waitingFor) {
+            job.status = waitingFor;
+            emit q->jobProgress(job.id, job.progress, waitingFor);
+        }
+
+        // smaller jobs may fill the gap, unless the blocked one has already waited too long
+        if (i == 0 && job.queuedAt.secsTo(QDateTime::currentDateTime()) > 300) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+QByteArray AppPatcherPrivate::contentHash(const QString& path)
+{
+    const QFileInfo info(path);
+    const QString identity = QString("%1|%2|%3").arg(info.absoluteFilePath()).arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch());
+    {
+        QMutexLocker locker(&mutex);
+        if (contentHashes.contains(identity)) {
+            return contentHashes.value(identity);
+        }
+    }
+    const QByteArray hash = Checkpoint::hashFile(path);
+    if (!hash.isEmpty()) {
+        QMutexLocker locker(&mutex);
+        contentHashes.insert(identity, hash);
+    }
+    return hash;
+}
+
+QString AppPatcherPrivate::claimWorkspace(const PatchJob& job)
+{
+    // APK workspaces are named after the contents, so they outlive a failed job and serve every
+    // copy of the build: an upload, an inbox file or the same file anywhere else
+    QString name = QString("job-%1").arg(job.id);
+    if (!job.isIpa()) {
+        const QByteArray hash = contentHash(job.path);
+        if (!hash.isEmpty()) {
+            name = "apk-" + QString::fromLatin1(hash.left(16));
+        }
+    }
+
+    QString workspace = QDir(job.settings.workspaceRoot).absoluteFilePath(name);
+    QMutexLocker locker(&mutex);
+    // a build still being prepared is waited for, the patch then resumes from its checkpoint
+    if (activeWorkspaces.value(workspace, false)) {
+        QMetaObject::invokeMethod(q, [this, jobId = job.id]() {
+            const QString status = "Waiting for the build to be prepared";
+            jobs[jobId].status = status;
+            emit q->jobProgress(jobId, 0, status);
+        }, Qt::QueuedConnection);
+    }
+    while (activeWorkspaces.value(workspace, false) && !cancelRequested.contains(job.id)) {
+        workspaceReleased.wait(&mutex);
+    }
+    if (activeWorkspaces.contains(workspace)) {
+        // the same build is already being patched, possibly for other URLs
+        workspace = QDir(job.settings.workspaceRoot).absoluteFilePath(QString("job-%1").arg(job.id));
+    }
+    if (workspace.endsWith(QString("job-%1").arg(job.id))) {
+        WorkspaceCollector::instance().discard(workspace);
+    }
+    activeWorkspaces.insert(workspace, job.prepareOnly);
+    WorkspaceCollector::instance().pin(workspace);
+    return workspace;
+}
+
+void AppPatcherPrivate::runJob(const PatchJob& job)
+{
+    const JobSettings& settings = job.settings;
+    const QString workspace = claimWorkspace(job);
+    QDir().mkpath(workspace);
+
+    bool success = false;
+    QString errorMessage;
+    ResourceEstimate observed;
+
+    auto run = [&](auto& patcher, auto patch, auto prepare) {
+        patcher.setWorkspace(workspace);
+        patcher.setOutputPath(job.output);
+        patcher.setArchFilter(settings.archFilter);
+        forwardSignals(patcher, job.id, errorMessage);
+        {
+            QMutexLocker locker(&mutex);
+            cancelRunning.insert(job.id, [&patcher]() { patcher.cancel(); });
+            if (cancelRequested.contains(job.id)) {
+                patcher.cancel();
+            }
+        }
+        success = job.prepareOnly ? (patcher.*prepare)(job.path) : (patcher.*patch)(job.path, job.gameServerUrl, job.dlcServerUrl);
+        observed.memoryBytes = patcher.peakToolMemory();
+        observed.diskBytes = static_cast<qint64>(utils::directorySize(workspace.toStdString()));
+        QMutexLocker locker(&mutex);
+        cancelRunning.remove(job.id);
+    };
+
+    if (job.isIpa()) {
+        IPAPatcher patcher;
+        patcher.setCompression(settings.compressionLevel, settings.compressionBackend);
+        patcher.setReproducible(settings.reproducible);
+        run(patcher, &IPAPatcher::patchIPA, &IPAPatcher::prepareIPA);
+    } else {
+        APKPatcher patcher;
+        patcher.setExtractNativeLibs(settings.extractNativeLibs);
+        patcher.setReproducible(settings.reproducible);
+        run(patcher, &APKPatcher::patchAPK, &APKPatcher::prepareAPK);
+    }
+
+    // a failed APK job keeps its workspace, a retry of the same file resumes from its checkpoint
+    const bool resumable = QFileInfo(workspace).fileName().startsWith("apk-");
+    // retired in the background, the job is done as soon as its output is
+    if (!resumable || (success && !settings.keepWorkspaces && !job.prepareOnly)) {
+        WorkspaceCollector::instance().discard(workspace);
+    }
+    {
+        QMutexLocker locker(&mutex);
+        activeWorkspaces.remove(workspace);
+        workspaceReleased.wakeAll();
+    }
+    WorkspaceCollector::instance().unpin(workspace);
+    // kept workspaces add up, the sweep holds them to the policy
+    WorkspaceCollector::instance().sweep(settings.workspaceRoot, settings.workspacePolicy);
+    QMetaObject::invokeMethod(q, [this, jobId = job.id, success, errorMessage, observed]() {
+        finishJob(jobId, success, errorMessage, observed);
+    }, Qt::QueuedConnection);
+}
+
+void AppPatcherPrivate::finishJob(int jobId, bool success, const QString& errorMessage, const ResourceEstimate& observed)
+{
+    bool cancelled = false;
+    {
+        QMutexLocker locker(&mutex);
+        // a cancel that arrives after the patcher succeeded came too late, the artifact is complete
+        cancelled = cancelRequested.remove(jobId) && !success;
+    }
+
+    PatchJob& job = jobs[jobId];
+    runningJobs--;
+    reserved += {-job.estimatedMemory, -job.estimatedDisk};
+    job.peakMemory = observed.memoryBytes;
+    job.peakDisk = observed.diskBytes;
+    // partial runs would teach the estimates to be too small
+    if (success && !cancelled && !job.prepareOnly) {
+        admission.recordRun(job.path, QFileInfo(job.path).size(), observed);
+    }
+
+    job.errorMessage = errorMessage;
+    setState(jobId, cancelled ? JobState::Cancelled : (success ? JobState::Succeeded : JobState::Failed));
+    emit q->jobFinished(jobId, success && !cancelled);
+    dispatch();
+}
+
 AppPatcher::AppPatcher(QObject* parent)
     : QObject(parent)
     , d(new AppPatcherPrivate(this))
@@ -45,23 +395,224 @@ AppPatcher::AppPatcher(QObject* parent)
 
 AppPatcher::~AppPatcher()
 {
+    cancelAll();
+    d->pool.waitForDone();
     delete d;
 }
 
 bool AppPatcher::checkDependencies()
 {
-    return d->apkPatcher->checkDependencies() && 
+    return d->apkPatcher->checkDependencies() &&
            d->ipaPatcher->checkDependencies();
 }
 
-void AppPatcher::patchAPK(const QString& apkPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+bool AppPatcher::dryRun(const QString& path, const QString& gameServerUrl, const QString& dlcServerUrl)
 {
-    d->apkPatcher->patchAPK(apkPath, gameServerUrl, dlcServerUrl);
+    emit progressUpdated(0, "Scanning " + QFileInfo(path).fileName() + "...");
+    bool ok = false;
+    if (QFileInfo(path).suffix().compare("ipa", Qt::CaseInsensitive) == 0) {
+        ok = d->ipaPatcher->preflight(path, gameServerUrl, dlcServerUrl, true);
+    } else {
+        ok = d->apkPatcher->preflight(path, gameServerUrl, dlcServerUrl, true);
+    }
+    emit progressUpdated(100, ok ? "Dry run passed" : "Dry run found problems");
+    return ok;
+}
+
+int AppPatcher::enqueue(const QString& path, const QString& gameServerUrl, const QString& dlcServerUrl, int priority)
+{
+    PatchJob job;
+    job.path = path;
+    job.gameServerUrl = gameServerUrl;
+    job.dlcServerUrl = dlcServerUrl;
+    job.priority = priority;
+    return d->enqueue(job);
+}
+
+int AppPatcher::prepare(const QString& path)
+{
+    PatchJob job;
+    job.path = path;
+    job.priority = JobPriority::Prepare;
+    job.prepareOnly = true;
+    return d->enqueue(job);
+}
+
+int AppPatcher::patchAPK(const QString& apkPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+{
+    return enqueue(apkPath, gameServerUrl, dlcServerUrl);
+}
+
+int AppPatcher::patchIPA(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+{
+    return enqueue(ipaPath, gameServerUrl, dlcServerUrl);
+}
+
+bool AppPatcher::cancel(int jobId)
+{
+    if (!d->jobs.contains(jobId) || d->jobs[jobId].isFinished()) {
+        return false;
+    }
+
+    if (d->pending.removeOne(jobId)) {
+        d->setState(jobId, JobState::Cancelled);
+        emit jobFinished(jobId, false);
+        return true;
+    }
+
+    QMutexLocker locker(&d->mutex);
+    d->cancelRequested.insert(jobId);
+    if (d->cancelRunning.contains(jobId)) {
+        d->cancelRunning[jobId]();
+    }
+    // a job waiting for a workspace stops waiting
+    d->workspaceReleased.wakeAll();
+    return true;
+}
+
+void AppPatcher::cancelAll()
+{
+    const QList<int> ids = d->jobs.keys();
+    for (int jobId : ids) {
+        cancel(jobId);
+    }
+}
+
+void AppPatcher::setMaxConcurrentJobs(int count)
+{
+    d->maxConcurrentJobs = qMax(1, count);
+    d->pool.setMaxThreadCount(d->maxConcurrentJobs);
+    d->dispatch();
+}
+
+int AppPatcher::maxConcurrentJobs() const
+{
+    return d->maxConcurrentJobs;
+}
+
+void AppPatcher::setArchFilter(const QStringList& archs)
+{
+    d->settings.archFilter = archs;
+}
+
+void AppPatcher::setExtractNativeLibs(bool extract)
+{
+    d->settings.extractNativeLibs = extract;
+}
+
+void AppPatcher::setCompression(int level, const QString& backend)
+{
+    d->settings.compressionLevel = level;
+    d->settings.compressionBackend = backend;
+}
+
+void AppPatcher::setReproducible(bool reproducible)
+{
+    d->settings.reproducible = reproducible;
+}
+
+void AppPatcher::setKeepWorkspaces(bool keep)
+{
+    d->settings.keepWorkspaces = keep;
+}
+
+void AppPatcher::setWorkspaceRoot(const QString& dir)
+{
+    d->settings.workspaceRoot = dir;
+    WorkspaceCollector::instance().sweep(dir, d->settings.workspacePolicy);
+}
+
+void AppPatcher::setOutputRoot(const QString& dir)
+{
+    d->outputRoot = dir;
 }
 
-void AppPatcher::patchIPA(const QString& ipaPath, const QString& gameServerUrl, const QString& dlcServerUrl)
+void AppPatcher::setWorkspacePolicy(const WorkspacePolicy& policy)
 {
-    d->ipaPatcher->patchIPA(ipaPath, gameServerUrl, dlcServerUrl);
+    d->settings.workspacePolicy = policy;
+    WorkspaceCollector::instance().sweep(d->settings.workspaceRoot, policy);
 }
 
-} 
+void AppPatcher::setResourceBudget(qint64 memoryBytes, qint64 diskBytes)
+{
+    d->admission.setBudget(memoryBytes, diskBytes);
+    d->dispatch();
+}
+
+PatchJob AppPatcher::job(int jobId) const
+{
+    return d->jobs.value(jobId);
+}
+
+QList<PatchJob> AppPatcher::jobs() const
+{
+    return d->jobs.values();
+}
+
+QList<PatchJob> AppPatcher::pruneFinished(int keep)
+{
+    QList<int> finished;
+    for (const auto& job : d->jobs) {
+        if (job.isFinished()) {
+            finished.append(job.id);
+        }
+    }
+    QList<PatchJob> pruned;
+    for (qsizetype i = 0; i < finished.size() - qMax(0, keep); i++) {
+        pruned.append(d->jobs.take(finished[i]));
+    }
+    return pruned;
+}
+
+bool AppPatcher::isIdle() const
+{
+    return d->pending.isEmpty() && d->runningJobs == 0;
+}
+
+bool AppPatcher::waitForJob(int jobId, int timeoutMs)
+{
+    if (!d->jobs.contains(jobId)) {
+        return false;
+    }
+
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    QObject::connect(this, &AppPatcher::jobFinished, &loop, [&](int finished) {
+        if (finished == jobId) {
+            loop.quit();
+        }
+    });
+
+    if (!d->jobs[jobId].isFinished()) {
+        if (timeoutMs >= 0) {
+            timer.start(timeoutMs);
+        }
+        loop.exec();
+    }
+    return d->jobs[jobId].isFinished();
+}
+
+bool AppPatcher::waitForIdle(int timeoutMs)
+{
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    QObject::connect(this, &AppPatcher::jobFinished, &loop, [&]() {
+        if (isIdle()) {
+            loop.quit();
+        }
+    });
+
+    if (!isIdle()) {
+        if (timeoutMs >= 0) {
+            timer.start(timeoutMs);
+        }
+        loop.exec();
+    }
+    return isIdle();
+}
+
+}
@@ -1,10 +1,81 @@
 #pragma once
 #include "std_include.hpp"
+#include "workspace_gc.hpp"
 
 namespace Patcher {
 
 class AppPatcherPrivate;
 
+enum class JobState {
+    Queued,
+    Running,
+    Succeeded,
+    Failed,
+    Cancelled,
+};
+
+namespace JobPriority {
+    constexpr int Bulk = -10;
+    constexpr int Normal = 0;
+    constexpr int Hotfix = 10;
+    // speculative preparation, never ahead of a real request
+    constexpr int Prepare = -20;
+
+    // "bulk", "normal" or "hotfix", anything else is Normal
+    int fromName(const QString& name);
+}
+
+// Settings of the AppPatcher a job was queued with, copied into it so the workers never read
+// the ones the caller keeps changing
+struct JobSettings {
+    bool extractNativeLibs = true;
+    int compressionLevel = 6;
+    QString compressionBackend = "builtin";
+    bool reproducible = false;
+    bool keepWorkspaces = false;
+    QString workspaceRoot = "workspaces";
+    WorkspacePolicy workspacePolicy;
+    QStringList archFilter;
+};
+
+struct PatchJob {
+    int id = 0;
+    QString path;
+    QString gameServerUrl;
+    QString dlcServerUrl;
+    int priority = JobPriority::Normal;
+    // only the target-independent stages, see AppPatcher::prepare
+    bool prepareOnly = false;
+    // absolute path the job writes its artifact to, set when the job is queued
+    QString output;
+    JobSettings settings;
+    // read from the archive when the job is queued, empty if the probe failed
+    QString identifier;
+    QString version;
+    JobState state = JobState::Queued;
+    int progress = 0;
+    QString status;
+    QString errorMessage;
+    QDateTime queuedAt;
+    QDateTime startedAt;
+    QDateTime finishedAt;
+    // admission estimate, and what the job actually used once it finished
+    qint64 estimatedMemory = 0;
+    qint64 estimatedDisk = 0;
+    qint64 peakMemory = 0;
+    qint64 peakDisk = 0;
+
+    bool isIpa() const { return QFileInfo(path).suffix().compare("ipa", Qt::CaseInsensitive) == 0; }
+    QString outputName() const { return QFileInfo(path).baseName() + (isIpa() ? "-patched.ipa" : "-patched.apk"); }
+    // where the patchers leave the result, outputName() in the working directory for a job never queued
+    QString outputPath() const { return output.isEmpty() ? outputName() : output; }
+    bool isFinished() const { return state != JobState::Queued && state != JobState::Running; }
+};
+
+QString toString(JobState state);
+
+// Queues APK and IPA jobs and runs them on a bounded pool, highest priority first.
+// Every job gets its own workspace, so jobs never share tappedout or decipa.
 class AppPatcher : public QObject {
     Q_OBJECT
 
@@ -13,21 +84,79 @@ public:
     virtual ~AppPatcher();
 
     bool checkDependencies();
-    void patchAPK(const QString& apkPath,
+    // Lists every patch site and checks the URL lengths without decoding anything
+    bool dryRun(const QString& path,
         const QString& gameServerUrl = QString(),
         const QString& dlcServerUrl = QString());
-    void patchIPA(const QString& ipaPath,
+
+    // The job type follows the file suffix, returns the job id
+    int enqueue(const QString& path,
+        const QString& gameServerUrl,
+        const QString& dlcServerUrl,
+        int priority = JobPriority::Normal);
+    int patchAPK(const QString& apkPath,
+        const QString& gameServerUrl = QString(),
+        const QString& dlcServerUrl = QString());
+    int patchIPA(const QString& ipaPath,
         const QString& gameServerUrl = QString(),
         const QString& dlcServerUrl = QString());
 
+    // Runs the census, patch-site indexing and, for APKs, the decode of a new build, so a
+    // later patch of the same file only has the per-target stages left; returns the job id
+    int prepare(const QString& path);
+
+    bool cancel(int jobId);
+    void cancelAll();
+
+    void setMaxConcurrentJobs(int count);
+    int maxConcurrentJobs() const;
+    // Jobs only start while the estimated memory and scratch disk of the running ones fit;
+    // 0 derives the budget from the machine
+    void setResourceBudget(qint64 memoryBytes, qint64 diskBytes);
+    // Architectures outputs keep, for jobs queued afterwards; empty keeps every ABI and slice
+    void setArchFilter(const QStringList& archs);
+    // Applies to APK jobs queued afterwards, see APKPatcher::setExtractNativeLibs
+    void setExtractNativeLibs(bool extract);
+    // Applies to IPA jobs queued afterwards, see IPAPatcher::setCompression
+    void setCompression(int level, const QString& backend);
+    // Jobs queued afterwards produce byte-identical output for identical inputs
+    void setReproducible(bool reproducible);
+    // Successful APK jobs keep their decoded workspace, so the same file with the same URLs
+    // only has to be signed again; a long-running patcher turns this on
+    void setKeepWorkspaces(bool keep);
+    // Directory the job workspaces are created in, "workspaces" by default; patchers sharing a
+    // working directory need their own, job ids are only unique within one AppPatcher
+    void setWorkspaceRoot(const QString& dir);
+    // Limits on the workspaces left in the root, checked in the background after every job
+    void setWorkspacePolicy(const WorkspacePolicy& policy);
+    // Jobs queued afterwards write to <dir>/<job id>/, so none replaces another's artifact; empty
+    // (the default) keeps the working directory for every job that has the name to itself
+    void setOutputRoot(const QString& dir);
+
+    PatchJob job(int jobId) const;
+    QList<PatchJob> jobs() const;
+    // Forgets all but the keep most recent finished jobs, returns the ones forgotten
+    QList<PatchJob> pruneFinished(int keep);
+    bool isIdle() const;
+    // Spin a local event loop until the job or every job is finished, false on timeout
+    bool waitForJob(int jobId, int timeoutMs = -1);
+    bool waitForIdle(int timeoutMs = -1);
+
 signals:
     void progressUpdated(int progress, const QString& status);
     void error(const QString& message);
     void log(const QString& message);
 
+    void jobStateChanged(int jobId, Patcher::JobState state);
+    void jobProgress(int jobId, int progress, const QString& status);
+    void jobLog(int jobId, const QString& message);
+    void jobFinished(int jobId, bool success);
+
 private:
     AppPatcherPrivate* d;
     Q_DISABLE_COPY(AppPatcher)
 };
 
 } 
+
+Q_DECLARE_METATYPE(Patcher::JobState)
@@ -0,0 +1,174 @@
+#include "std_include.hpp"
+#include "probe.hpp"
+#include "zip.hpp"
+#include "axml.hpp"
+#include "plist.hpp"
+#include "macho.hpp"
+
+namespace Patcher {
+
+namespace {
+
+constexpr uint32_t kVersionCodeId = 0x0101021b;
+constexpr uint32_t kVersionNameId = 0x0101021c;
+constexpr uint32_t kNameId = 0x01010003;
+constexpr uint32_t kValueId = 0x01010024;
+constexpr uint32_t kMinSdkVersionId = 0x0101020c;
+// enough for the header of a thin binary and any universal slice table
+constexpr size_t kMachOHeaderBytes = 4096;
+
+QString attribute(const utils::axml::Element& element, const char* name, uint32_t resourceId)
+{
+    const utils::axml::Attribute* found = element.find(name, resourceId);
+    return found ? QString::fromStdString(found->value) : QString();
+}
+
+bool probeApk(const utils::zip::Reader& reader, ArtifactInfo& info)
+{
+    const utils::zip::Entry* manifest = reader.find("AndroidManifest.xml");
+    std::string data;
+    if (!manifest || !reader.read(*manifest, data)) {
+        info.errorMessage = "No readable AndroidManifest.xml";
+        return false;
+    }
+    std::vector<utils::axml::Element> elements;
+    if (!utils::axml::parse(data, elements) || elements.empty() || elements.front().name != "manifest") {
+        info.errorMessage = "AndroidManifest.xml is not binary XML";
+        return false;
+    }
+
+    const utils::axml::Element& root = elements.front();
+    info.identifier = attribute(root, "package", 0);
+    info.versionCode = attribute(root, "versionCode", kVersionCodeId);
+    info.versionName = attribute(root, "versionName", kVersionNameId);
+    for (const auto& element : elements) {
+        if (element.name == "uses-sdk" && info.minimumOs.isEmpty()) {
+            info.minimumOs = attribute(element, "minSdkVersion", kMinSdkVersionId);
+        } else if (element.name == "meta-data" && attribute(element, "name", kNameId) == "android.app.lib_name") {
+            info.executable = "lib" + attribute(element, "value", kValueId) + ".so";
+        }
+    }
+
+    QSet<QString> abis;
+    for (const auto& entry : reader.entries()) {
+        const QString name = QString::fromStdString(entry.name);
+        const QStringList parts = name.split('/');
+        if (parts.size() == 3 && parts[0] == "lib" && parts[2].endsWith(".so")) {
+            abis.insert(parts[1]);
+        }
+    }
+    info.abis = QStringList(abis.begin(), abis.end());
+    info.abis.sort();
+    return true;
+}
+
+bool probeIpa(const utils::zip::Reader& reader, ArtifactInfo& info)
+{
+    // Payload/<name>.app/Info.plist, the bundles nested inside carry their own
+    const utils::zip::Entry* plistEntry = nullptr;
+    QString appDir;
+    for (const auto& entry : reader.entries()) {
+        const QStringList parts = QString::fromStdString(entry.name).split('/');
+        if (parts.size() == 3 && parts[0] == "Payload" && parts[1].endsWith(".app") && parts[2] == "Info.plist") {
+            plistEntry = &entry;
+            appDir = parts[0] + "/" + parts[1] + "/";
+            break;
+        }
+    }
+    std::string data;
+    if (!plistEntry || !reader.read(*plistEntry, data)) {
+        info.errorMessage = "No readable Payload/*.app/Info.plist";
+        return false;
+    }
+    utils::plist::Dictionary plist;
+    if (!utils::plist::readDictionary(data, plist)) {
+        info.errorMessage = "Info.plist could not be parsed";
+        return false;
+    }
+
+    auto value = [&plist](const char* key) { return QString::fromStdString(utils::plist::value(plist, key)); };
+    info.identifier = value("CFBundleIdentifier");
+    info.versionName = value("CFBundleShortVersionString");
+    info.versionCode = value("CFBundleVersion");
+    info.executable = value("CFBundleExecutable");
+    info.minimumOs = value("MinimumOSVersion");
+
+    // only the header is inflated, the executable itself can be hundreds of MB
+    const utils::zip::Entry* executable = info.executable.isEmpty() ? nullptr
+        : reader.find((appDir + info.executable).toStdString());
+    if (executable) {
+        std::vector<uint8_t> header;
+        reader.read(*executable, [&header](const uint8_t* chunk, size_t size) {
+            header.insert(header.end(), chunk, chunk + std::min(size, kMachOHeaderBytes - header.size()));
+            return header.size() < kMachOHeaderBytes;
+        });
+        for (const auto& arch : utils::macho::archsOf(header.data(), header.size())) {
+            info.abis.append(QString::fromStdString(arch));
+        }
+    }
+    return true;
+}
+
+}
+
+QString ArtifactInfo::version() const
+{
+    if (versionCode.isEmpty() || versionCode == versionName) {
+        return versionName;
+    }
+    return versionName.isEmpty() ? versionCode : QString("%1 (%2)").arg(versionName, versionCode);
+}
+
+QString ArtifactInfo::summary() const
+{
+    if (!success) {
+        return "Could not probe " + QFileInfo(artifactPath).fileName() + ": " + errorMessage;
+    }
+    return QString("%1 %2%3, %4 (%5 ms)")
+        .arg(identifier, version())
+        .arg(executable.isEmpty() ? QString() : ", " + executable)
+        .arg(abis.isEmpty() ? QString("no native code") : abis.join(", "))
+        .arg(elapsedMs);
+}
+
+QJsonObject ArtifactInfo::toJson() const
+{
+    QJsonObject obj;
+    obj["artifact"] = artifactPath;
+    obj["success"] = success;
+    if (!errorMessage.isEmpty()) {
+        obj["error"] = errorMessage;
+    }
+    obj["platform"] = platform;
+    obj["identifier"] = identifier;
+    obj["versionName"] = versionName;
+    obj["versionCode"] = versionCode;
+    obj["executable"] = executable;
+    obj["minimumOs"] = minimumOs;
+    obj["abis"] = QJsonArray::fromStringList(abis);
+    obj["elapsedMs"] = elapsedMs;
+    return obj;
+}
+
+ArtifactInfo Probe::read(const QString& artifactPath)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    ArtifactInfo info;
+    info.artifactPath = artifactPath;
+    info.platform = QFileInfo(artifactPath).suffix().toLower();
+
+    utils::zip::Reader reader;
+    if (!reader.open(QDir::toNativeSeparators(artifactPath).toStdString())) {
+        info.errorMessage = "Could not open " + artifactPath + " as a ZIP archive";
+    } else if (info.platform == "ipa") {
+        info.success = probeIpa(reader, info);
+    } else {
+        info.success = probeApk(reader, info);
+    }
+    info.elapsedMs = timer.elapsed();
+    return info;
+}
+
+}
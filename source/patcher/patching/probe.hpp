@@ -0,0 +1,39 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+struct ArtifactInfo {
+    QString artifactPath;
+    bool success = false;
+    QString errorMessage;
+    // "apk" or "ipa"
+    QString platform;
+    // package name or bundle id
+    QString identifier;
+    // versionName / CFBundleShortVersionString and versionCode / CFBundleVersion
+    QString versionName;
+    QString versionCode;
+    // CFBundleExecutable, or for APKs the library a NativeActivity loads
+    QString executable;
+    // minSdkVersion or MinimumOSVersion
+    QString minimumOs;
+    // Android ABIs under lib/, or the Mach-O slices of the executable
+    QStringList abis;
+    qint64 elapsedMs = 0;
+
+    // "4.69.0 (4690)"
+    QString version() const;
+    QString summary() const;
+    QJsonObject toJson() const;
+};
+
+// Reads an APK's AndroidManifest.xml or an IPA's Info.plist straight from the ZIP, along with
+// the ABIs, without decoding or extracting anything. Takes milliseconds, so jobs can be routed
+// and cache keys chosen before any heavy work starts.
+class Probe {
+public:
+    static ArtifactInfo read(const QString& artifactPath);
+};
+
+}
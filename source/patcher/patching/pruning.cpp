@@ -0,0 +1,124 @@
+#include "std_include.hpp"
+#include "pruning.hpp"
+#include "macho.hpp"
+#include "utils.hpp"
+
+namespace Patcher {
+
+namespace {
+
+const QMap<QString, QString> kAbiArchs = {
+    {"arm64-v8a", "arm64"},
+    {"armeabi-v7a", "armv7"},
+    {"armeabi", "arm"},
+    {"x86", "i386"},
+    {"x86_64", "x86_64"},
+};
+
+}
+
+ArchFilter::ArchFilter(const QStringList& names)
+{
+    for (const auto& name : names) {
+        const QString arch = normalize(name);
+        if (!arch.isEmpty() && !archs_.contains(arch)) {
+            archs_.append(arch);
+        }
+    }
+}
+
+QString ArchFilter::normalize(const QString& name)
+{
+    const QString trimmed = name.trimmed().toLower();
+    return kAbiArchs.value(trimmed, trimmed);
+}
+
+bool ArchFilter::keepsAbi(const QString& abi) const
+{
+    return isEmpty() || archs_.contains(normalize(abi));
+}
+
+bool ArchFilter::keepsArch(const QString& arch) const
+{
+    return isEmpty() || archs_.contains(arch);
+}
+
+PruneResult pruneAbis(const QString& root, const ArchFilter& filter)
+{
+    PruneResult result;
+    if (filter.isEmpty()) {
+        return result;
+    }
+
+    QDir libDir(QDir(root).filePath("lib"));
+    const QStringList abis = libDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    QStringList dropped;
+    for (const auto& abi : abis) {
+        if (!filter.keepsAbi(abi)) {
+            dropped.append(abi);
+        }
+    }
+    // an APK with none of the wanted ABIs would no longer install anywhere
+    if (!abis.isEmpty() && dropped.size() == abis.size()) {
+        result.success = false;
+        result.errorMessage = "None of the APK's ABIs (" + abis.join(", ") + ") is kept by " + filter.archs().join(", ");
+        return result;
+    }
+
+    for (const auto& abi : dropped) {
+        QDir dir(libDir.filePath(abi));
+        result.bytesSaved += static_cast<qint64>(utils::directorySize(dir.absolutePath().toStdString()));
+        if (!dir.removeRecursively()) {
+            result.success = false;
+            result.errorMessage = "Failed to remove lib/" + abi;
+            return result;
+        }
+        result.removed.append("lib/" + abi);
+    }
+    return result;
+}
+
+PruneResult thinMachOs(const QString& root, const ArchFilter& filter)
+{
+    PruneResult result;
+    if (filter.isEmpty()) {
+        return result;
+    }
+
+    std::vector<std::string> keep;
+    for (const auto& arch : filter.archs()) {
+        keep.push_back(arch.toStdString());
+    }
+
+    const QDir rootDir(root);
+    QDirIterator it(root, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        const std::string nativePath = QDir::toNativeSeparators(path).toStdString();
+        const qint64 before = it.fileInfo().size();
+
+        std::vector<std::string> removed;
+        switch (utils::macho::thin(nativePath, keep, &removed)) {
+        case utils::macho::ThinResult::Thinned: {
+            QStringList archs;
+            for (const auto& arch : removed) {
+                archs.append(QString::fromStdString(arch));
+            }
+            result.thinned.append(rootDir.relativeFilePath(path));
+            result.removed.append(rootDir.relativeFilePath(path) + " (" + archs.join(", ") + ")");
+            result.bytesSaved += before - QFileInfo(path).size();
+            break;
+        }
+        case utils::macho::ThinResult::Failed:
+            result.success = false;
+            result.errorMessage = "Failed to thin " + rootDir.relativeFilePath(path);
+            return result;
+        default:
+            // thin binaries and ones without a wanted slice stay as they are
+            break;
+        }
+    }
+    return result;
+}
+
+}
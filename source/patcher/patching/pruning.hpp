@@ -0,0 +1,38 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+// Architectures an output keeps. Names are Mach-O ones ("arm64", "armv7"); Android ABI names
+// ("arm64-v8a", "armeabi-v7a") are accepted and mapped, so one list serves both platforms.
+class ArchFilter {
+public:
+    ArchFilter() = default;
+    explicit ArchFilter(const QStringList& names);
+
+    bool isEmpty() const { return archs_.isEmpty(); }
+    QStringList archs() const { return archs_; }
+    bool keepsAbi(const QString& abi) const;
+    bool keepsArch(const QString& arch) const;
+
+    static QString normalize(const QString& name);
+
+private:
+    QStringList archs_;
+};
+
+struct PruneResult {
+    bool success = true;
+    QString errorMessage;
+    // lib/<abi> directories or member paths, relative to the root
+    QStringList removed;
+    QStringList thinned;
+    qint64 bytesSaved = 0;
+};
+
+// Removes lib/<abi> of every ABI the filter drops from a decoded APK
+PruneResult pruneAbis(const QString& root, const ArchFilter& filter);
+// Thins every universal Mach-O below root to the kept architectures
+PruneResult thinMachOs(const QString& root, const ArchFilter& filter);
+
+}
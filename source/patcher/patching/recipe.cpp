@@ -0,0 +1,669 @@
+#include "std_include.hpp"
+#include "recipe.hpp"
+#include "census.hpp"
+#include "plist.hpp"
+#include <QtCore/QCryptographicHash>
+
+namespace Patcher {
+
+namespace {
+
+// The endpoints of the stock builds, also what recipes/tsto.json starts from
+const char* kBuiltinRecipe = R"json({
+    "format": 1,
+    "name": "tsto",
+    "targets": [
+        {
+            "id": "dlc-native",
+            "platforms": ["apk"],
+            "match": "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/",
+            "replace": "${dlcServerUrl}/static/",
+            "files": ["*.so"],
+            "inPlace": true,
+            "padding": "dot-slash"
+        },
+        {
+            "id": "game-server",
+            "platforms": ["apk"],
+            "match": "https://prod.simpsons-ea.com",
+            "replace": "${gameServerUrl}",
+            "files": ["*.xml", "*.smali", "*.txt", "resources.arsc"]
+        },
+        {
+            "id": "director",
+            "platforms": ["apk"],
+            "match": "https://syn-dir.sn.eamobile.com",
+            "replace": "${gameServerUrl}",
+            "files": ["*.xml", "*.smali", "*.txt", "resources.arsc"]
+        },
+        {
+            "id": "dlc-executable",
+            "platforms": ["ipa"],
+            "match": "http://oct2018-4-35-0-uam5h44a.tstodlc.eamobile.com/netstorage/gameasset/direct/simpsons/",
+            "replace": "${dlcServerUrl}/static/",
+            "files": ["Payload/*.app/**"],
+            "kinds": ["macho", "plist"],
+            "inPlace": true,
+            "padding": "slash"
+        },
+        {
+            "id": "director-executable",
+            "platforms": ["ipa"],
+            "match": "https://syn-dir.sn.eamobile.com",
+            "replace": "${gameServerUrl}",
+            "files": ["Payload/*.app/**"],
+            "kinds": ["macho", "plist"],
+            "inPlace": true,
+            "padding": "slash"
+        }
+    ],
+    "plist": [
+        {
+            "platforms": ["ipa"],
+            "file": "Payload/*.app/Info.plist",
+            "key": "MayhemServerURL",
+            "value": "${gameServerUrl}",
+            "insertAfter": "CFBundleVersion"
+        },
+        {
+            "platforms": ["ipa"],
+            "file": "Payload/*.app/Info.plist",
+            "key": "DLCLocation",
+            "value": "${dlcServerUrl}/static/",
+            "insertAfter": "MayhemServerURL"
+        }
+    ]
+})json";
+
+const QStringList kEncodings = {"utf-8", "utf-16le"};
+const QStringList kPaddings = {"none", "dot-slash", "slash", "nul"};
+
+QStringList toStringList(const QJsonValue& value)
+{
+    QStringList list;
+    for (const auto& item : value.toArray()) {
+        list.append(item.toString());
+    }
+    return list;
+}
+
+QByteArray encode(const QByteArray& utf8, const QString& encoding)
+{
+    if (encoding != "utf-16le") {
+        return utf8;
+    }
+    QString text = QString::fromUtf8(utf8);
+    return QByteArray(reinterpret_cast<const char*>(text.utf16()), text.size() * 2);
+}
+
+QByteArray pad(QByteArray bytes, int length, const QString& padding)
+{
+    if (padding == "dot-slash") {
+        while (bytes.size() < length - 1) {
+            bytes.append("./");
+        }
+        if (bytes.size() < length) {
+            bytes.append('/');
+        }
+    } else if (padding == "slash") {
+        while (bytes.size() < length) {
+            bytes.append('/');
+        }
+    } else if (padding == "nul") {
+        while (bytes.size() < length) {
+            bytes.append('\0');
+        }
+    }
+    return bytes;
+}
+
+QString expand(QString text, const QMap<QString, QString>& variables)
+{
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        text.replace("${" + it.key() + "}", it.value());
+    }
+    return text;
+}
+
+QPair<QRegularExpression, bool> compileGlob(const QString& glob)
+{
+    // '*' stays within one folder, "**" crosses them
+    QStringList parts;
+    for (const auto& part : glob.split("**")) {
+        parts.append(QRegularExpression::wildcardToRegularExpression(part, QRegularExpression::UnanchoredWildcardConversion));
+    }
+    return {QRegularExpression(QRegularExpression::anchoredPattern(parts.join(".*"))), !glob.contains('/')};
+}
+
+bool appliesTo(const QStringList& platforms, const QString& platform)
+{
+    return platforms.isEmpty() || platforms.contains(platform);
+}
+
+}
+
+bool Recipe::fromJson(const QByteArray& json, QString* errorMessage)
+{
+    auto fail = [&](const QString& message) {
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+    if (parseError.error != QJsonParseError::NoError) {
+        return fail("Invalid recipe JSON: " + parseError.errorString());
+    }
+
+    QJsonObject root = document.object();
+    format = root["format"].toInt(0);
+    if (format < 1 || format > kFormatVersion) {
+        return fail(QString("Unsupported recipe format %1 (this build reads up to %2)").arg(format).arg(kFormatVersion));
+    }
+    name = root["name"].toString();
+
+    targets.clear();
+    for (const auto& value : root["targets"].toArray()) {
+        QJsonObject obj = value.toObject();
+        RecipeTarget target;
+        target.id = obj["id"].toString();
+        target.match = obj["match"].toString().toUtf8();
+        target.replacement = obj["replace"].toString();
+        target.platforms = toStringList(obj["platforms"]);
+        target.files = toStringList(obj["files"]);
+        target.kinds = toStringList(obj["kinds"]);
+        target.encoding = obj["encoding"].toString("utf-8");
+        target.inPlace = obj["inPlace"].toBool(false);
+        target.padding = obj["padding"].toString("none");
+
+        if (target.id.isEmpty() || target.match.isEmpty()) {
+            return fail("Recipe target without id or match");
+        }
+        if (!kEncodings.contains(target.encoding)) {
+            return fail("Unknown encoding '" + target.encoding + "' in target " + target.id);
+        }
+        if (!kPaddings.contains(target.padding)) {
+            return fail("Unknown padding '" + target.padding + "' in target " + target.id);
+        }
+        targets.append(target);
+    }
+
+    plistRules.clear();
+    for (const auto& value : root["plist"].toArray()) {
+        QJsonObject obj = value.toObject();
+        PlistRule rule;
+        rule.platforms = toStringList(obj["platforms"]);
+        rule.file = obj["file"].toString();
+        rule.key = obj["key"].toString();
+        rule.value = obj["value"].toString();
+        rule.insertAfter = obj["insertAfter"].toString();
+        if (rule.file.isEmpty() || rule.key.isEmpty()) {
+            return fail("Plist rule without file or key");
+        }
+        plistRules.append(rule);
+    }
+    return true;
+}
+
+QByteArray Recipe::builtinJson()
+{
+    return QByteArray(kBuiltinRecipe);
+}
+
+Recipe Recipe::builtin()
+{
+    Recipe recipe;
+    recipe.fromJson(builtinJson());
+    return recipe;
+}
+
+QStringList Recipe::searchPaths()
+{
+    return {"recipes/tsto.json", "build/recipes/tsto.json"};
+}
+
+bool Recipe::load(Recipe& recipe, QString* source, QString* errorMessage)
+{
+    for (const auto& path : searchPaths()) {
+        QFile file(path);
+        if (!file.exists()) {
+            continue;
+        }
+        if (!file.open(QIODevice::ReadOnly)) {
+            if (errorMessage) {
+                *errorMessage = "Could not read recipe " + path;
+            }
+            return false;
+        }
+        if (source) {
+            *source = path;
+        }
+        QString message;
+        if (!recipe.fromJson(file.readAll(), &message)) {
+            if (errorMessage) {
+                *errorMessage = path + ": " + message;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    if (source) {
+        *source = "built-in";
+    }
+    recipe = builtin();
+    return true;
+}
+
+int RecipeApplyResult::total() const
+{
+    int count = 0;
+    for (int value : replaced) {
+        count += value;
+    }
+    return count;
+}
+
+QMap<QString, QString> CompiledRecipe::variables(const QString& gameServerUrl, const QString& dlcServerUrl)
+{
+    QString game = gameServerUrl.trimmed();
+    if (game.endsWith('/')) {
+        game.chop(1);
+    }
+    QString dlc = dlcServerUrl.trimmed();
+    if (dlc.endsWith('/')) {
+        dlc.chop(1);
+    }
+    return {{"gameServerUrl", game}, {"dlcServerUrl", dlc}};
+}
+
+bool CompiledRecipe::compile(const Recipe& recipe, const QString& platform,
+                             const QMap<QString, QString>& variables, QString* errorMessage)
+{
+    targets_.clear();
+    replacements_.clear();
+    unpaddedReplacements_.clear();
+    encodedMatches_.clear();
+    encodedReplacements_.clear();
+    globs_.clear();
+    plistRules_.clear();
+    plistGlobs_.clear();
+    patternTargets_.clear();
+
+    auto matcher = std::make_shared<utils::PatternMatcher>();
+    QMap<QByteArray, int> patternIndex;
+
+    for (const auto& target : recipe.targets) {
+        if (!appliesTo(target.platforms, platform)) {
+            continue;
+        }
+
+        const QByteArray unpadded = expand(target.replacement, variables).toUtf8();
+        QByteArray replacement = unpadded;
+        if (target.inPlace) {
+            if (replacement.size() > target.match.size()) {
+                if (errorMessage) {
+                    *errorMessage = QString("Replacement for %1 is %2 bytes too long: %3")
+                        .arg(target.id)
+                        .arg(replacement.size() - target.match.size())
+                        .arg(QString::fromUtf8(replacement));
+                }
+                return false;
+            }
+            replacement = pad(replacement, target.match.size(), target.padding);
+            if (replacement.size() != target.match.size()) {
+                if (errorMessage) {
+                    *errorMessage = QString("Replacement for %1 is shorter than the original and padding is off")
+                        .arg(target.id);
+                }
+                return false;
+            }
+        }
+
+        const QByteArray encodedMatch = encode(target.match, target.encoding);
+        int index = patternIndex.value(encodedMatch, -1);
+        if (index < 0) {
+            index = static_cast<int>(matcher->addPattern(encodedMatch.toStdString()));
+            patternIndex.insert(encodedMatch, index);
+            patternTargets_.append(QList<int>());
+        }
+        patternTargets_[index].append(static_cast<int>(targets_.size()));
+
+        QList<QPair<QRegularExpression, bool>> globs;
+        for (const auto& glob : target.files) {
+            globs.append(compileGlob(glob));
+        }
+
+        targets_.append(target);
+        replacements_.append(replacement);
+        unpaddedReplacements_.append(unpadded);
+        encodedMatches_.append(encodedMatch);
+        encodedReplacements_.append(encode(replacement, target.encoding));
+        globs_.append(globs);
+    }
+    matcher->compile();
+    matcher_ = matcher;
+
+    for (auto rule : recipe.plistRules) {
+        if (!appliesTo(rule.platforms, platform)) {
+            continue;
+        }
+        rule.value = expand(rule.value, variables);
+        plistRules_.append(rule);
+        plistGlobs_.append(compileGlob(rule.file));
+    }
+    return true;
+}
+
+QByteArray CompiledRecipe::replacement(const QString& targetId) const
+{
+    for (int i = 0; i < targets_.size(); i++) {
+        if (targets_[i].id == targetId) {
+            return replacements_[i];
+        }
+    }
+    return QByteArray();
+}
+
+QByteArray CompiledRecipe::fingerprint() const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    for (int i = 0; i < targets_.size(); i++) {
+        const RecipeTarget& target = targets_[i];
+        hash.addData(QStringList({target.id, target.files.join(','), target.kinds.join(','),
+                                  target.encoding, target.padding}).join('|').toUtf8());
+        hash.addData(encodedMatches_[i]);
+        hash.addData(encodedReplacements_[i]);
+        hash.addData(target.inPlace ? "1" : "0");
+    }
+    for (const auto& rule : plistRules_) {
+        hash.addData(QStringList({rule.file, rule.key, rule.value, rule.insertAfter}).join('|').toUtf8());
+    }
+    return hash.result().toHex();
+}
+
+QList<QByteArray> CompiledRecipe::patterns() const
+{
+    QList<QByteArray> result;
+    for (const auto& target : targets_) {
+        if (!result.contains(target.match)) {
+            result.append(target.match);
+        }
+    }
+    return result;
+}
+
+QMap<QByteArray, QByteArray> CompiledRecipe::inPlaceReplacements() const
+{
+    QMap<QByteArray, QByteArray> result;
+    for (int i = 0; i < targets_.size(); i++) {
+        if (targets_[i].inPlace && targets_[i].encoding == "utf-8") {
+            result.insert(targets_[i].match, unpaddedReplacements_[i]);
+        }
+    }
+    return result;
+}
+
+bool CompiledRecipe::globMatches(const QRegularExpression& glob, bool fileNameOnly, const QString& memberPath)
+{
+    const QString subject = fileNameOnly ? memberPath.section('/', -1) : memberPath;
+    return glob.match(subject).hasMatch();
+}
+
+bool CompiledRecipe::inSet(int target, TargetSet set) const
+{
+    switch (set) {
+    case TargetSet::Rewrite:
+        return !targets_[target].inPlace;
+    case TargetSet::InPlace:
+        return targets_[target].inPlace;
+    default:
+        return true;
+    }
+}
+
+bool CompiledRecipe::selects(const QString& memberPath, TargetSet set) const
+{
+    for (int i = 0; i < targets_.size(); i++) {
+        if (!inSet(i, set)) {
+            continue;
+        }
+        if (globs_[i].isEmpty()) {
+            return true;
+        }
+        for (const auto& glob : globs_[i]) {
+            if (globMatches(glob.first, glob.second, memberPath)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CompiledRecipe::selectsPlist(const QString& memberPath) const
+{
+    for (const auto& glob : plistGlobs_) {
+        if (globMatches(glob.first, glob.second, memberPath)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QList<int> CompiledRecipe::selectedTargets(const QString& memberPath, const QString& kind, TargetSet set) const
+{
+    QList<int> selected;
+    for (int i = 0; i < targets_.size(); i++) {
+        if (!inSet(i, set)) {
+            continue;
+        }
+        bool pathMatches = globs_[i].isEmpty();
+        for (const auto& glob : globs_[i]) {
+            if (globMatches(glob.first, glob.second, memberPath)) {
+                pathMatches = true;
+                break;
+            }
+        }
+        if (pathMatches && (targets_[i].kinds.isEmpty() || targets_[i].kinds.contains(kind))) {
+            selected.append(i);
+        }
+    }
+    return selected;
+}
+
+void CompiledRecipe::replaceMatches(const QList<int>& selected, QByteArray& content, RecipeApplyResult& result) const
+{
+    // earliest match wins, overlapping ones are dropped
+    auto matches = matcher_->findAll(content.constData(), static_cast<size_t>(content.size()));
+    std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+
+    QByteArray output;
+    qsizetype copied = 0;
+    bool replaced = false;
+    for (const auto& match : matches) {
+        const qsizetype offset = static_cast<qsizetype>(match.second);
+        if (offset < copied) {
+            continue;
+        }
+        int target = -1;
+        for (int candidate : patternTargets_[static_cast<int>(match.first)]) {
+            if (selected.contains(candidate)) {
+                target = candidate;
+                break;
+            }
+        }
+        if (target < 0) {
+            continue;
+        }
+
+        if (output.isEmpty()) {
+            output.reserve(content.size());
+        }
+        output.append(content.constData() + copied, offset - copied);
+        output.append(encodedReplacements_[target]);
+        copied = offset + encodedMatches_[target].size();
+        result.replaced[targets_[target].id]++;
+        replaced = true;
+    }
+
+    if (replaced) {
+        output.append(content.constData() + copied, content.size() - copied);
+        content = output;
+    }
+}
+
+RecipeApplyResult CompiledRecipe::applyToData(const QString& memberPath, const QString& kind, QByteArray& content,
+                                              TargetSet set) const
+{
+    RecipeApplyResult result;
+    const QList<int> selected = selectedTargets(memberPath, kind, set);
+    if (!selected.isEmpty()) {
+        replaceMatches(selected, content, result);
+    }
+    return result;
+}
+
+RecipeApplyResult CompiledRecipe::applyToStrings(const QString& memberPath, const QString& kind,
+                                                 std::vector<std::string>& strings, TargetSet set) const
+{
+    RecipeApplyResult result;
+    // pool strings come decoded, whatever encoding the pool itself uses
+    QList<int> selected = selectedTargets(memberPath, kind, set);
+    selected.removeIf([this](int target) { return targets_[target].encoding != "utf-8"; });
+    if (selected.isEmpty()) {
+        return result;
+    }
+    for (std::string& value : strings) {
+        QByteArray content = QByteArray::fromRawData(value.data(), static_cast<qsizetype>(value.size()));
+        const int before = result.total();
+        replaceMatches(selected, content, result);
+        if (result.total() != before) {
+            value.assign(content.constData(), static_cast<size_t>(content.size()));
+        }
+    }
+    return result;
+}
+
+RecipeApplyResult CompiledRecipe::applyToFile(const QString& filePath, const QString& memberPath, const QString& kind,
+                                              TargetSet set, PatchSiteDatabase* database,
+                                              const QMap<QString, QByteArray>& knownHashes) const
+{
+    RecipeApplyResult result;
+    const QList<int> selected = selectedTargets(memberPath, kind, set);
+    if (selected.isEmpty()) {
+        return result;
+    }
+
+    bool allInPlace = true;
+    for (int target : selected) {
+        allInPlace = allInPlace && targets_[target].inPlace;
+    }
+
+    // fixed-size binaries go through the patch-site database and only the replaced bytes are written
+    if (allInPlace && database) {
+        QList<QPair<QByteArray, QByteArray>> replacements;
+        for (int target : selected) {
+            replacements.append({encodedMatches_[target], encodedReplacements_[target]});
+        }
+        InPlacePatchResult patched = patchInPlace(*database, filePath, memberPath, knownHashes.value(memberPath), replacements);
+        result.success = patched.success;
+        result.errorMessage = patched.errorMessage;
+        result.fromDatabase = patched.fromDatabase;
+        for (int target : selected) {
+            int count = patched.patchedByPattern.value(encodedMatches_[target]);
+            if (count > 0) {
+                result.replaced[targets_[target].id] += count;
+            }
+        }
+        return result;
+    }
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.success = false;
+        result.errorMessage = "Could not open file: " + filePath;
+        return result;
+    }
+    QByteArray content = file.readAll();
+    file.close();
+    result = applyToData(memberPath, kind, content, set);
+    if (result.replaced.isEmpty()) {
+        return result;
+    }
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(content) != content.size()) {
+        result.success = false;
+        result.errorMessage = "Failed to write " + filePath;
+    }
+    return result;
+}
+
+QStringList CompiledRecipe::applyPlistRules(const QString& memberPath, QString& content) const
+{
+    QStringList messages;
+    for (int i = 0; i < plistRules_.size(); i++) {
+        if (!globMatches(plistGlobs_[i].first, plistGlobs_[i].second, memberPath)) {
+            continue;
+        }
+
+        const PlistRule& rule = plistRules_[i];
+        const QString value = rule.value.toHtmlEscaped();
+        QRegularExpression keyRegex("<key>" + QRegularExpression::escape(rule.key) + "</key>\\s*<string>(.*?)</string>",
+                                    QRegularExpression::DotMatchesEverythingOption);
+        QRegularExpressionMatch keyMatch = keyRegex.match(content);
+
+        if (keyMatch.hasMatch()) {
+            content.replace(keyMatch.capturedStart(0), keyMatch.capturedLength(0),
+                QString("<key>%1</key><string>%2</string>").arg(rule.key, value));
+            messages.append("Updated " + rule.key + ": " + rule.value);
+            continue;
+        }
+
+        messages.append("Key '" + rule.key + "' not found.");
+        if (rule.insertAfter.isEmpty()) {
+            continue;
+        }
+
+        QRegularExpression anchorRegex("<key>" + QRegularExpression::escape(rule.insertAfter) + "</key>\\s*<string>(.*?)</string>",
+                                       QRegularExpression::DotMatchesEverythingOption);
+        QRegularExpressionMatch anchorMatch = anchorRegex.match(content);
+        if (anchorMatch.hasMatch()) {
+            content.insert(anchorMatch.capturedEnd(0),
+                QString("\n\t<key>%1</key>\n\t<string>%2</string>").arg(rule.key, value));
+            messages.append("Added " + rule.key + ": " + rule.value);
+        }
+    }
+    return messages;
+}
+
+bool CompiledRecipe::applyPlistRules(const QString& memberPath, std::string& binary, QStringList& messages) const
+{
+    std::vector<utils::plist::StringEdit> edits;
+    for (int i = 0; i < plistRules_.size(); i++) {
+        if (globMatches(plistGlobs_[i].first, plistGlobs_[i].second, memberPath)) {
+            const PlistRule& rule = plistRules_[i];
+            edits.push_back({rule.key.toStdString(), rule.value.toStdString(), rule.insertAfter.toStdString()});
+        }
+    }
+    if (!utils::plist::setStrings(binary, edits)) {
+        return false;
+    }
+
+    for (const auto& edit : edits) {
+        const QString key = QString::fromStdString(edit.key);
+        const QString value = QString::fromStdString(edit.value);
+        if (edit.result == utils::plist::StringEdit::Updated) {
+            messages.append("Updated " + key + ": " + value);
+            continue;
+        }
+        messages.append("Key '" + key + "' not found.");
+        if (edit.result == utils::plist::StringEdit::Added) {
+            messages.append("Added " + key + ": " + value);
+        }
+    }
+    return true;
+}
+
+}
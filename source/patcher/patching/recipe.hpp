@@ -0,0 +1,126 @@
+#pragma once
+#include "std_include.hpp"
+#include "patch_site_db.hpp"
+#include "pattern_matcher.hpp"
+
+namespace Patcher {
+
+struct RecipeTarget {
+    QString id;
+    QByteArray match;
+    // ${gameServerUrl} and ${dlcServerUrl} are expanded when the recipe is compiled
+    QString replacement;
+    // "apk" and/or "ipa", empty for both
+    QStringList platforms;
+    // globs on the member path, "**" crossing folders; a glob without '/' is matched against the file name only
+    QStringList files;
+    // census kinds the member must have, empty for any
+    QStringList kinds;
+    QString encoding = "utf-8";
+    // in-place targets keep the member size and pad the replacement, the others rewrite freely
+    bool inPlace = false;
+    QString padding = "none";
+};
+
+struct PlistRule {
+    QStringList platforms;
+    QString file;
+    QString key;
+    QString value;
+    // key after which the entry is inserted when the plist does not have it yet
+    QString insertAfter;
+};
+
+// Declarative description of what gets patched, loaded from recipes/<name>.json when present
+struct Recipe {
+    static constexpr int kFormatVersion = 1;
+
+    int format = kFormatVersion;
+    QString name;
+    QList<RecipeTarget> targets;
+    QList<PlistRule> plistRules;
+
+    bool fromJson(const QByteArray& json, QString* errorMessage = nullptr);
+
+    static QByteArray builtinJson();
+    static Recipe builtin();
+    // First recipe found on the search paths, the built-in one otherwise. Fails on a broken file.
+    static bool load(Recipe& recipe, QString* source = nullptr, QString* errorMessage = nullptr);
+    static QStringList searchPaths();
+};
+
+struct RecipeApplyResult {
+    bool success = true;
+    QString errorMessage;
+    bool fromDatabase = false;
+    // occurrences replaced per target id
+    QMap<QString, int> replaced;
+
+    int total() const;
+};
+
+enum class TargetSet {
+    All,
+    Rewrite,
+    InPlace,
+};
+
+// A recipe bound to one platform and one set of URLs. Every target is folded into a single
+// automaton, so a member is read and matched once whatever the number of rules.
+class CompiledRecipe {
+public:
+    bool compile(const Recipe& recipe, const QString& platform,
+                 const QMap<QString, QString>& variables, QString* errorMessage = nullptr);
+
+    static QMap<QString, QString> variables(const QString& gameServerUrl, const QString& dlcServerUrl);
+
+    const QList<RecipeTarget>& targets() const { return targets_; }
+    const QList<PlistRule>& plistRules() const { return plistRules_; }
+    // Final UTF-8 replacement of a target, padded for in-place ones
+    QByteArray replacement(const QString& targetId) const;
+    // Every pattern as plain UTF-8, as the census expects them
+    QList<QByteArray> patterns() const;
+    // Unpadded UTF-8 replacement of every in-place target, for the census length check
+    QMap<QByteArray, QByteArray> inPlaceReplacements() const;
+    // Hash of every rule with its expanded replacement; equal fingerprints rewrite identically
+    QByteArray fingerprint() const;
+
+    // Whether any target of the set could apply to the member, judging by its path only
+    bool selects(const QString& memberPath, TargetSet set = TargetSet::All) const;
+    bool selectsPlist(const QString& memberPath) const;
+
+    // Applies the selected targets of the set in one pass over the member; in-place targets go
+    // through the patch-site database when one is given and every selected target is in place
+    RecipeApplyResult applyToFile(const QString& filePath, const QString& memberPath, const QString& kind,
+                                  TargetSet set = TargetSet::All, PatchSiteDatabase* database = nullptr,
+                                  const QMap<QString, QByteArray>& knownHashes = {}) const;
+    RecipeApplyResult applyToData(const QString& memberPath, const QString& kind, QByteArray& content,
+                                  TargetSet set = TargetSet::All) const;
+    // Same as applyToData on each string of a pool separately, the member's targets resolved once
+    RecipeApplyResult applyToStrings(const QString& memberPath, const QString& kind, std::vector<std::string>& strings,
+                                     TargetSet set = TargetSet::All) const;
+    // Sets or inserts every plist rule selecting the member, returns one log line per rule
+    QStringList applyPlistRules(const QString& memberPath, QString& content) const;
+    // Same on a binary plist, false when it cannot be parsed
+    bool applyPlistRules(const QString& memberPath, std::string& binary, QStringList& messages) const;
+
+private:
+    QList<int> selectedTargets(const QString& memberPath, const QString& kind, TargetSet set) const;
+    bool inSet(int target, TargetSet set) const;
+    void replaceMatches(const QList<int>& selected, QByteArray& content, RecipeApplyResult& result) const;
+    static bool globMatches(const QRegularExpression& glob, bool fileNameOnly, const QString& memberPath);
+
+    QList<RecipeTarget> targets_;
+    QList<QByteArray> replacements_;
+    QList<QByteArray> unpaddedReplacements_;
+    QList<QByteArray> encodedMatches_;
+    QList<QByteArray> encodedReplacements_;
+    QList<QList<QPair<QRegularExpression, bool>>> globs_;
+    QList<PlistRule> plistRules_;
+    QList<QPair<QRegularExpression, bool>> plistGlobs_;
+    // pattern index of the matcher -> targets sharing that byte sequence
+    QList<QList<int>> patternTargets_;
+    std::shared_ptr<utils::PatternMatcher> matcher_;
+};
+
+}
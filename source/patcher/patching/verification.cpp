@@ -0,0 +1,499 @@
+#include "std_include.hpp"
+#include "verification.hpp"
+#include "census.hpp"
+#include "recipe.hpp"
+#include "zip.hpp"
+#include "pattern_matcher.hpp"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QSaveFile>
+
+namespace Patcher {
+
+namespace {
+
+// past this many, leftovers are only counted
+constexpr int kMaxListedLeftovers = 100;
+// an APK signing block is a few KiB; anything larger is not collected
+constexpr qsizetype kMaxSigningBlock = 16 * 1024 * 1024;
+const QByteArray kSigningBlockMagic("APK Sig Block 42");
+
+const QMap<quint32, QString> kSigningSchemes = {
+    {0x7109871a, "v2"},
+    {0xf05368c0, "v3"},
+    {0x1b93ad61, "v3.1"},
+};
+
+quint64 readLe64(const char* p)
+{
+    quint64 value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return value;
+}
+
+bool isSignatureFile(const QString& name)
+{
+    if (!name.startsWith("META-INF/") || name.indexOf('/', 9) >= 0) {
+        return false;
+    }
+    const QString file = name.mid(9).toUpper();
+    return file == "MANIFEST.MF" || file.startsWith("SIG-") || file.endsWith(".SF") ||
+           file.endsWith(".RSA") || file.endsWith(".DSA") || file.endsWith(".EC");
+}
+
+QCryptographicHash::Algorithm digestAlgorithm(const QString& name, bool* known)
+{
+    const QString upper = name.toUpper();
+    *known = true;
+    if (upper == "SHA1" || upper == "SHA-1") return QCryptographicHash::Sha1;
+    if (upper == "SHA-256") return QCryptographicHash::Sha256;
+    if (upper == "SHA-384") return QCryptographicHash::Sha384;
+    if (upper == "SHA-512") return QCryptographicHash::Sha512;
+    *known = false;
+    return QCryptographicHash::Sha256;
+}
+
+// JAR manifest sections: "Name: value" lines, continuation lines start with a space
+QList<QMap<QString, QString>> parseManifest(const QByteArray& content)
+{
+    QList<QMap<QString, QString>> sections;
+    QMap<QString, QString> section;
+    QString lastKey;
+    for (QByteArray line : content.split('\n')) {
+        if (line.endsWith('\r')) {
+            line.chop(1);
+        }
+        if (line.isEmpty()) {
+            if (!section.isEmpty()) {
+                sections.append(section);
+                section.clear();
+            }
+            lastKey.clear();
+            continue;
+        }
+        if (line.startsWith(' ') && !lastKey.isEmpty()) {
+            section[lastKey] += QString::fromUtf8(line.mid(1));
+            continue;
+        }
+        const int colon = line.indexOf(": ");
+        if (colon > 0) {
+            lastKey = QString::fromUtf8(line.left(colon));
+            section[lastKey] = QString::fromUtf8(line.mid(colon + 2));
+        }
+    }
+    if (!section.isEmpty()) {
+        sections.append(section);
+    }
+    return sections;
+}
+
+// Digest attributes of a section, algorithm name -> base64 value
+QMap<QString, QString> digestsOf(const QMap<QString, QString>& section, const QString& suffix)
+{
+    QMap<QString, QString> digests;
+    for (auto it = section.begin(); it != section.end(); ++it) {
+        if (it.key().endsWith(suffix, Qt::CaseInsensitive)) {
+            digests.insert(it.key().chopped(suffix.size()), it.value());
+        }
+    }
+    return digests;
+}
+
+class V1Check {
+public:
+    void begin(const QString& name)
+    {
+        name_ = name;
+        hashes_.clear();
+        content_.clear();
+        directory_ = name.endsWith('/');
+        keepContent_ = name == "META-INF/MANIFEST.MF" || (isSignatureFile(name) && name.endsWith(".SF", Qt::CaseInsensitive));
+        if (directory_ || isSignatureFile(name)) {
+            return;
+        }
+        // until the manifest is read every common algorithm is computed; it is the first entry in practice
+        const QList<QString> algorithms = algorithms_.isEmpty() ? QList<QString>{"SHA-256", "SHA1"} : algorithms_;
+        for (const auto& algorithm : algorithms) {
+            bool known = false;
+            const auto id = digestAlgorithm(algorithm, &known);
+            if (known) {
+                hashes_.append({algorithm, std::make_shared<QCryptographicHash>(id)});
+            }
+        }
+    }
+
+    void add(const uint8_t* data, size_t size)
+    {
+        const QByteArrayView view(reinterpret_cast<const char*>(data), static_cast<qsizetype>(size));
+        for (auto& hash : hashes_) {
+            hash.second->addData(view);
+        }
+        if (keepContent_) {
+            content_.append(view);
+        }
+    }
+
+    void end()
+    {
+        if (directory_) {
+            return;
+        }
+        if (name_ == "META-INF/MANIFEST.MF") {
+            manifest_ = content_;
+            const auto sections = parseManifest(manifest_);
+            for (int i = 1; i < sections.size(); i++) {
+                const QString name = sections[i].value("Name");
+                const auto digests = digestsOf(sections[i], "-Digest");
+                if (!name.isEmpty() && !digests.isEmpty()) {
+                    listed_.insert(name, digests);
+                    for (const auto& algorithm : digests.keys()) {
+                        if (!algorithms_.contains(algorithm)) {
+                            algorithms_.append(algorithm);
+                        }
+                    }
+                }
+            }
+        } else if (keepContent_) {
+            signatureFiles_.insert(name_, content_);
+        } else if (isSignatureFile(name_)) {
+            blocks_.insert(QFileInfo(name_).completeBaseName().toUpper());
+        } else {
+            QMap<QString, QString> computed;
+            for (const auto& hash : hashes_) {
+                computed.insert(hash.first, QString::fromLatin1(hash.second->result().toBase64()));
+            }
+            computed_.insert(name_, computed);
+        }
+        content_.clear();
+    }
+
+    bool present() const { return !manifest_.isEmpty() || !signatureFiles_.isEmpty(); }
+
+    QStringList problems(int* verified) const
+    {
+        QStringList problems;
+        if (manifest_.isEmpty()) {
+            problems.append("v1: META-INF/MANIFEST.MF is missing");
+            return problems;
+        }
+        if (signatureFiles_.isEmpty()) {
+            problems.append("v1: no signature file (.SF) in META-INF");
+        }
+
+        for (auto it = computed_.begin(); it != computed_.end(); ++it) {
+            const auto listed = listed_.constFind(it.key());
+            if (listed == listed_.constEnd()) {
+                problems.append("v1: " + it.key() + " is not covered by the manifest");
+                continue;
+            }
+            bool checked = false;
+            for (auto digest = listed->begin(); digest != listed->end(); ++digest) {
+                if (!it->contains(digest.key())) {
+                    continue;
+                }
+                checked = true;
+                if (it->value(digest.key()) != digest.value()) {
+                    problems.append("v1: digest mismatch for " + it.key());
+                }
+            }
+            if (checked) {
+                (*verified)++;
+            } else {
+                problems.append("v1: no supported digest for " + it.key());
+            }
+        }
+        for (auto it = listed_.begin(); it != listed_.end(); ++it) {
+            if (!computed_.contains(it.key())) {
+                problems.append("v1: " + it.key() + " is listed in the manifest but missing");
+            }
+        }
+
+        for (auto it = signatureFiles_.begin(); it != signatureFiles_.end(); ++it) {
+            if (!blocks_.contains(QFileInfo(it.key()).completeBaseName().toUpper())) {
+                problems.append("v1: " + it.key() + " has no signature block");
+            }
+            const auto sections = parseManifest(it.value());
+            const auto digests = sections.isEmpty() ? QMap<QString, QString>() : digestsOf(sections.first(), "-Digest-Manifest");
+            for (auto digest = digests.begin(); digest != digests.end(); ++digest) {
+                bool known = false;
+                const auto id = digestAlgorithm(digest.key(), &known);
+                if (known && QString::fromLatin1(QCryptographicHash::hash(manifest_, id).toBase64()) != digest.value()) {
+                    problems.append("v1: " + it.key() + " does not match the manifest");
+                }
+            }
+        }
+        return problems;
+    }
+
+private:
+    QString name_;
+    bool directory_ = false;
+    bool keepContent_ = false;
+    QByteArray content_;
+    QList<QPair<QString, std::shared_ptr<QCryptographicHash>>> hashes_;
+    QList<QString> algorithms_;
+    QByteArray manifest_;
+    QMap<QString, QByteArray> signatureFiles_;
+    QSet<QString> blocks_;
+    QMap<QString, QMap<QString, QString>> listed_;
+    QMap<QString, QMap<QString, QString>> computed_;
+};
+
+// Ids of the APK signing block pairs, from the bytes between the last entry and the central directory
+QStringList signingBlockSchemes(const QByteArray& tail, QStringList& problems)
+{
+    QStringList schemes;
+    if (tail.size() < 32 || !tail.endsWith(kSigningBlockMagic)) {
+        return schemes;
+    }
+    const quint64 blockSize = readLe64(tail.constData() + tail.size() - 24);
+    if (blockSize + 8 > static_cast<quint64>(tail.size()) || blockSize < 24) {
+        problems.append("APK signing block has an invalid size");
+        return schemes;
+    }
+    const qsizetype start = tail.size() - static_cast<qsizetype>(blockSize) - 8;
+    if (readLe64(tail.constData() + start) != blockSize) {
+        problems.append("APK signing block sizes disagree");
+        return schemes;
+    }
+
+    qsizetype pos = start + 8;
+    const qsizetype end = tail.size() - 24;
+    while (pos + 12 <= end) {
+        const quint64 length = readLe64(tail.constData() + pos);
+        if (length < 4 || length > static_cast<quint64>(end - pos - 8)) {
+            problems.append("APK signing block has a malformed entry");
+            break;
+        }
+        const quint32 id = static_cast<quint32>(readLe64(tail.constData() + pos + 8) & 0xFFFFFFFFu);
+        if (kSigningSchemes.contains(id)) {
+            schemes.append(kSigningSchemes.value(id));
+            // a scheme block is a length-prefixed list of signers, it must hold at least one
+            if (length < 8 || (readLe64(tail.constData() + pos + 12) & 0xFFFFFFFFu) == 0) {
+                problems.append(kSigningSchemes.value(id) + ": no signer");
+            }
+        }
+        pos += 8 + static_cast<qsizetype>(length);
+    }
+    return schemes;
+}
+
+}
+
+QString VerificationReport::summary() const
+{
+    return QString("%1: %2 bytes, sha256 %3, %4 members, %5 leftover URLs, signatures: %6")
+        .arg(QFileInfo(artifactPath).fileName())
+        .arg(size)
+        .arg(QString::fromLatin1(sha256))
+        .arg(members)
+        .arg(leftovers.size())
+        .arg(signatureSchemes.isEmpty() ? QString("none") : signatureSchemes.join(", "));
+}
+
+QJsonObject VerificationReport::toJson() const
+{
+    QJsonObject signature;
+    signature["schemes"] = QJsonArray::fromStringList(signatureSchemes);
+    signature["v1Digests"] = v1Digests;
+    if (!signatureProblems.isEmpty()) {
+        signature["problems"] = QJsonArray::fromStringList(signatureProblems);
+    }
+
+    QJsonObject obj;
+    obj["artifact"] = QFileInfo(artifactPath).fileName();
+    obj["platform"] = platform;
+    obj["verified"] = success;
+    if (!errorMessage.isEmpty()) {
+        obj["error"] = errorMessage;
+    }
+    obj["size"] = size;
+    obj["sha256"] = QString::fromLatin1(sha256);
+    obj["members"] = members;
+    obj["uncompressedBytes"] = uncompressedBytes;
+    obj["signature"] = signature;
+    if (!leftovers.isEmpty()) {
+        obj["leftovers"] = QJsonArray::fromStringList(leftovers);
+    }
+    if (!corruptMembers.isEmpty()) {
+        obj["corruptMembers"] = QJsonArray::fromStringList(corruptMembers);
+    }
+    return obj;
+}
+
+QList<QByteArray> Verifier::originalUrls(const CompiledRecipe& recipe)
+{
+    QList<QByteArray> urls;
+    for (const auto& pattern : recipe.patterns()) {
+        bool kept = true;
+        for (const auto& target : recipe.targets()) {
+            if (recipe.replacement(target.id).contains(pattern)) {
+                kept = false;
+                break;
+            }
+        }
+        if (kept) {
+            urls.append(pattern);
+        }
+    }
+    return urls;
+}
+
+VerificationReport Verifier::verify(const QString& artifactPath, const QString& platform,
+                                    const QList<QByteArray>& originalUrls)
+{
+    VerificationReport report;
+    report.artifactPath = artifactPath;
+    report.platform = platform;
+    QElapsedTimer timer;
+    timer.start();
+
+    utils::zip::Reader reader;
+    if (!reader.open(QDir::toNativeSeparators(artifactPath).toStdString())) {
+        report.errorMessage = "Not a readable ZIP archive: " + artifactPath;
+        return report;
+    }
+
+    utils::PatternMatcher matcher;
+    QList<QPair<QByteArray, QString>> patternInfo;
+    for (const auto& url : originalUrls) {
+        matcher.addPattern(url.toStdString());
+        patternInfo.append({url, "utf-8"});
+        matcher.addPattern(Census::toUtf16Le(url).toStdString());
+        patternInfo.append({url, "utf-16le"});
+    }
+    matcher.compile();
+
+    const bool isApk = platform == "apk";
+    const quint64 centralDirectory = reader.centralDirectoryOffset();
+    QCryptographicHash fileHash(QCryptographicHash::Sha256);
+    V1Check v1;
+    QByteArray tail;
+    QString member;
+    QSet<QString> memberLeftovers;
+    int leftoverCount = 0;
+    int32_t state = 0;
+    uint64_t position = 0;
+
+    utils::zip::ScanSink sink;
+    sink.file = [&](const uint8_t* data, size_t size) {
+        fileHash.addData(QByteArrayView(reinterpret_cast<const char*>(data), static_cast<qsizetype>(size)));
+        report.size += static_cast<qint64>(size);
+        return true;
+    };
+    sink.other = [&](uint64_t offset, const uint8_t* data, size_t size) {
+        // only what follows the last entry can be a signing block
+        if (isApk && offset < centralDirectory && tail.size() < kMaxSigningBlock) {
+            const size_t before = static_cast<size_t>(std::min<uint64_t>(size, centralDirectory - offset));
+            tail.append(reinterpret_cast<const char*>(data), static_cast<qsizetype>(before));
+        }
+        return true;
+    };
+    sink.beginEntry = [&](const utils::zip::Entry& entry) {
+        member = QString::fromStdString(entry.name);
+        memberLeftovers.clear();
+        state = 0;
+        position = 0;
+        tail.clear();
+        if (isApk) {
+            v1.begin(member);
+        }
+        return true;
+    };
+    sink.entryData = [&](const uint8_t* data, size_t size) {
+        state = matcher.feed(state, data, size, position, [&](size_t pattern, uint64_t) {
+            const auto& info = patternInfo[static_cast<int>(pattern)];
+            const QString leftover = QString("%1: %2 (%3)").arg(member, QString::fromUtf8(info.first), info.second);
+            if (!memberLeftovers.contains(leftover)) {
+                memberLeftovers.insert(leftover);
+                if (++leftoverCount <= kMaxListedLeftovers) {
+                    report.leftovers.append(leftover);
+                }
+            }
+        });
+        position += size;
+        if (isApk) {
+            v1.add(data, size);
+        }
+        return true;
+    };
+    sink.endEntry = [&](const utils::zip::Entry& entry, bool intact) {
+        if (!entry.isDirectory()) {
+            report.members++;
+        }
+        report.uncompressedBytes += static_cast<qint64>(position);
+        if (!intact) {
+            report.corruptMembers.append(member);
+        }
+        if (isApk) {
+            v1.end();
+        }
+        return true;
+    };
+
+    if (!reader.scan(sink)) {
+        report.errorMessage = "Could not read " + artifactPath;
+        return report;
+    }
+    report.sha256 = fileHash.result().toHex();
+
+    if (leftoverCount > kMaxListedLeftovers) {
+        report.leftovers.append(QString("... and %1 more").arg(leftoverCount - kMaxListedLeftovers));
+    }
+    if (isApk) {
+        if (v1.present()) {
+            report.signatureSchemes.append("v1");
+            report.signatureProblems.append(v1.problems(&report.v1Digests));
+        }
+        report.signatureSchemes.append(signingBlockSchemes(tail, report.signatureProblems));
+        if (report.signatureSchemes.isEmpty()) {
+            report.signatureProblems.append("APK is not signed");
+        }
+    }
+
+    QStringList failures;
+    if (!report.leftovers.isEmpty()) {
+        failures.append(QString("%1 original URLs remain").arg(leftoverCount));
+    }
+    if (!report.corruptMembers.isEmpty()) {
+        failures.append(QString("%1 corrupt members").arg(report.corruptMembers.size()));
+    }
+    if (!report.signatureProblems.isEmpty()) {
+        failures.append(QString("%1 signature problems").arg(report.signatureProblems.size()));
+    }
+    report.errorMessage = failures.join(", ");
+    report.success = failures.isEmpty();
+    report.elapsedMs = timer.elapsed();
+    return report;
+}
+
+QString Verifier::manifestPath(const QString& artifactPath)
+{
+    return artifactPath + ".manifest.json";
+}
+
+bool Verifier::writeManifest(const VerificationReport& report, const QJsonObject& build, QString* errorMessage)
+{
+    QJsonObject root = report.toJson();
+    root.remove("error");
+    root["build"] = build;
+
+    QSaveFile file(manifestPath(report.artifactPath));
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorMessage) {
+            *errorMessage = "Could not write " + file.fileName();
+        }
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    if (!file.commit()) {
+        if (errorMessage) {
+            *errorMessage = "Could not write " + file.fileName();
+        }
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+class CompiledRecipe;
+
+struct VerificationReport {
+    QString artifactPath;
+    QString platform;
+    bool success = false;
+    QString errorMessage;
+    qint64 size = 0;
+    // hex SHA-256 of the whole artifact
+    QByteArray sha256;
+    int members = 0;
+    qint64 uncompressedBytes = 0;
+    qint64 elapsedMs = 0;
+    // "member: url (encoding)" for every original URL still present
+    QStringList leftovers;
+    QStringList corruptMembers;
+    // signature schemes found (v1, v2, v3, v3.1) and everything about them that did not check out
+    QStringList signatureSchemes;
+    int v1Digests = 0;
+    QStringList signatureProblems;
+
+    QString summary() const;
+    QJsonObject toJson() const;
+};
+
+// Gate run on a finished artifact. The file is read exactly once: the same pass hashes it,
+// inflates every member to look for the original URLs and checks the APK signatures.
+class Verifier {
+public:
+    static VerificationReport verify(const QString& artifactPath, const QString& platform,
+                                     const QList<QByteArray>& originalUrls);
+    // The recipe's patterns, minus any its replacements still contain
+    static QList<QByteArray> originalUrls(const CompiledRecipe& recipe);
+
+    // <artifact>.manifest.json for the distribution side; build is copied in as it is
+    static bool writeManifest(const VerificationReport& report, const QJsonObject& build, QString* errorMessage = nullptr);
+    static QString manifestPath(const QString& artifactPath);
+};
+
+}
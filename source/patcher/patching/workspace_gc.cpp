@@ -0,0 +1,186 @@
+#include "std_include.hpp"
+#include "workspace_gc.hpp"
+#include "utils.hpp"
+
+namespace Patcher {
+
+namespace {
+
+QString normalized(const QString& path)
+{
+    return QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+}
+
+QString trashDirOf(const QString& path)
+{
+    return QFileInfo(path).dir().absoluteFilePath(".trash");
+}
+
+// a checkpoint is rewritten on every stage, the directory itself only changes when entries come and go
+QDateTime lastUsed(const QString& workspace)
+{
+    const QFileInfo checkpoint(QDir(workspace).filePath("checkpoint.json"));
+    const QDateTime modified = QFileInfo(workspace).lastModified();
+    return checkpoint.exists() ? std::max(modified, checkpoint.lastModified()) : modified;
+}
+
+}
+
+WorkspaceCollector& WorkspaceCollector::instance()
+{
+    // never destroyed, a delete still running when the process exits is finished by the next sweep
+    static WorkspaceCollector* collector = new WorkspaceCollector;
+    return *collector;
+}
+
+WorkspaceCollector::WorkspaceCollector()
+    : pool_(new QThreadPool)
+{
+    pool_->setMaxThreadCount(1);
+    pool_->setThreadPriority(QThread::LowestPriority);
+}
+
+bool WorkspaceCollector::retire(const QString& path)
+{
+    QMutexLocker locker(&mutex_);
+    return retireLocked(normalized(path));
+}
+
+void WorkspaceCollector::discard(const QString& path)
+{
+    if (!QFileInfo::exists(path) || retire(path)) {
+        return;
+    }
+    QDir(path).removeRecursively();
+}
+
+bool WorkspaceCollector::retireLocked(const QString& path)
+{
+    if (!QFileInfo(path).isDir()) {
+        return !QFileInfo::exists(path);
+    }
+    // next to the directory, so the rename stays on its volume
+    const QString trashDir = trashDirOf(path);
+    if (!QDir().mkpath(trashDir)) {
+        return false;
+    }
+    const QString target = QDir(trashDir).absoluteFilePath(QString("%1.%2.%3")
+        .arg(QFileInfo(path).fileName()).arg(QDateTime::currentMSecsSinceEpoch()).arg(++serial_));
+    if (!QDir().rename(path, target)) {
+        return false;
+    }
+    pool_->start([this, trashDir]() { collect(trashDir); });
+    return true;
+}
+
+void WorkspaceCollector::pin(const QString& path)
+{
+    QMutexLocker locker(&mutex_);
+    pinned_.insert(normalized(path));
+}
+
+void WorkspaceCollector::unpin(const QString& path)
+{
+    QMutexLocker locker(&mutex_);
+    pinned_.remove(normalized(path));
+}
+
+void WorkspaceCollector::sweep(const QString& root, const WorkspacePolicy& policy)
+{
+    const QString dir = normalized(root);
+    {
+        QMutexLocker locker(&mutex_);
+        if (queuedSweeps_.contains(dir)) {
+            return;
+        }
+        queuedSweeps_.insert(dir);
+    }
+    pool_->start([this, dir, policy]() {
+        {
+            QMutexLocker locker(&mutex_);
+            queuedSweeps_.remove(dir);
+        }
+        runSweep(dir, policy);
+    });
+}
+
+bool WorkspaceCollector::waitForDone(int timeoutMs)
+{
+    return pool_->waitForDone(timeoutMs);
+}
+
+void WorkspaceCollector::collect(const QString& trashDir)
+{
+    QDir trash(trashDir);
+    for (const QString& entry : trash.entryList(QDir::Dirs | QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot)) {
+        const QString path = trash.absoluteFilePath(entry);
+        if (QFileInfo(path).isDir()) {
+            QDir(path).removeRecursively();
+        } else {
+            QFile::remove(path);
+        }
+    }
+    // only succeeds once it is empty, a retire racing with this recreates it
+    QDir().rmdir(trashDir);
+}
+
+void WorkspaceCollector::runSweep(const QString& root, const WorkspacePolicy& policy)
+{
+    QDir dir(root);
+    if (!dir.exists()) {
+        return;
+    }
+    collect(dir.absoluteFilePath(".trash"));
+
+    struct Resumable {
+        QString path;
+        QDateTime lastUsed;
+        qint64 size = 0;
+    };
+    const QDateTime now = QDateTime::currentDateTime();
+    QStringList expired;
+    QList<Resumable> resumable;
+    for (const QFileInfo& info : dir.entryInfoList({"apk-*", "job-*"}, QDir::Dirs | QDir::NoDotAndDotDot)) {
+        const QString path = normalized(info.absoluteFilePath());
+        if (info.fileName().startsWith("job-")) {
+            if (info.lastModified().secsTo(now) > policy.orphanAgeHours * 3600LL) {
+                expired.append(path);
+            }
+            continue;
+        }
+        const QDateTime used = lastUsed(path);
+        if (used.daysTo(now) > policy.maxAgeDays) {
+            expired.append(path);
+        } else {
+            resumable.append({path, used, 0});
+        }
+    }
+
+    if (policy.budgetBytes > 0) {
+        std::sort(resumable.begin(), resumable.end(), [](const Resumable& a, const Resumable& b) {
+            return a.lastUsed > b.lastUsed;
+        });
+        qint64 total = 0;
+        for (Resumable& workspace : resumable) {
+            workspace.size = static_cast<qint64>(utils::directorySize(workspace.path.toStdString()));
+            total += workspace.size;
+            if (total > policy.budgetBytes) {
+                expired.append(workspace.path);
+            }
+        }
+    }
+
+    bool retired = false;
+    for (const QString& path : expired) {
+        QMutexLocker locker(&mutex_);
+        if (!pinned_.contains(path)) {
+            retired = retireLocked(path) || retired;
+        }
+    }
+    // already on the collector thread, the queued collect would find nothing left
+    if (retired) {
+        collect(dir.absoluteFilePath(".trash"));
+    }
+}
+
+}
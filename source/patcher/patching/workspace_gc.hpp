@@ -0,0 +1,53 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+
+// What a sweep of a workspace root keeps
+struct WorkspacePolicy {
+    // resumable apk-* workspaces together, the least recently used go first; 0 for no limit
+    qint64 budgetBytes = 20LL * 1024 * 1024 * 1024;
+    // resumable workspaces unused for longer are retired
+    int maxAgeDays = 7;
+    // job-* workspaces are never reused, one this old was left by a crashed run
+    int orphanAgeHours = 6;
+};
+
+// Retires directories by renaming them into a .trash folder next to them, which is instant, and
+// deletes them on a single lowest-priority thread. Trash left by a crashed process is found
+// again by the next sweep of the same root.
+class WorkspaceCollector {
+public:
+    static WorkspaceCollector& instance();
+
+    // false if the directory could not be moved, it is then left in place
+    bool retire(const QString& path);
+    // Retires the directory, or removes it right away if it can't be moved
+    void discard(const QString& path);
+
+    // Pinned workspaces are in use, sweeps leave them alone
+    void pin(const QString& path);
+    void unpin(const QString& path);
+
+    // Queues a pass over a workspace root: leftover trash, orphaned job workspaces and resumable
+    // ones that are too old or over the budget. A pass already queued for the root covers it.
+    void sweep(const QString& root, const WorkspacePolicy& policy = WorkspacePolicy());
+
+    bool waitForDone(int timeoutMs = -1);
+
+private:
+    WorkspaceCollector();
+    Q_DISABLE_COPY(WorkspaceCollector)
+
+    bool retireLocked(const QString& path);
+    void collect(const QString& trashDir);
+    void runSweep(const QString& root, const WorkspacePolicy& policy);
+
+    QThreadPool* pool_;
+    QMutex mutex_;
+    QSet<QString> pinned_;
+    QSet<QString> queuedSweeps_;
+    quint64 serial_ = 0;
+};
+
+}
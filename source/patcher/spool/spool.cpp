@@ -0,0 +1,484 @@
+#include "std_include.hpp"
+#include "spool.hpp"
+#include "patching/patcher.hpp"
+#include "patching/verification.hpp"
+#include "utils.hpp"
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QSaveFile>
+
+namespace Spool {
+
+namespace {
+
+constexpr int leaseSeconds = 60;
+constexpr int heartbeatMs = 15 * 1000;
+constexpr int pollMs = 2000;
+// a job that killed this many nodes is not handed to another one
+constexpr int maxAttempts = 3;
+
+const QStringList directories = {"inputs", "incoming", "claimed", "done", "failed", "nodes"};
+
+bool readJson(const QString& path, QJsonObject& object)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    object = document.object();
+    return document.isObject();
+}
+
+bool writeJson(const QString& path, const QJsonObject& object)
+{
+    // QSaveFile renames into place, readers never see half a file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(QJsonDocument(object).toJson());
+    return file.commit();
+}
+
+bool touch(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::ExistingOnly)) {
+        return false;
+    }
+    return file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+}
+
+bool moveInto(const QString& from, const QString& to)
+{
+    QFile::remove(to);
+    return utils::moveFile(QDir::toNativeSeparators(from).toStdWString(), QDir::toNativeSeparators(to).toStdWString());
+}
+
+bool copyInto(const QString& from, const QString& to)
+{
+    return utils::copyFile(QDir::toNativeSeparators(from).toStdWString(),
+                           QDir::toNativeSeparators(to).toStdWString()) != utils::CopyMethod::Failed;
+}
+
+}
+
+QJsonObject SpoolJob::toJson() const
+{
+    QJsonObject object;
+    object["name"] = name;
+    object["input"] = input;
+    object["originalName"] = originalName;
+    object["gameServerUrl"] = gameServerUrl;
+    object["dlcServerUrl"] = dlcServerUrl;
+    object["priority"] = priority;
+    object["attempts"] = attempts;
+    object["submittedAt"] = submittedAt.toString(Qt::ISODate);
+    if (!node.isEmpty()) {
+        object["node"] = node;
+        object["claimedAt"] = claimedAt.toString(Qt::ISODate);
+    }
+    return object;
+}
+
+SpoolJob SpoolJob::fromJson(const QJsonObject& object)
+{
+    SpoolJob job;
+    job.name = object["name"].toString();
+    job.input = object["input"].toString();
+    job.originalName = object["originalName"].toString();
+    job.gameServerUrl = object["gameServerUrl"].toString();
+    job.dlcServerUrl = object["dlcServerUrl"].toString();
+    job.priority = object["priority"].toInt();
+    job.attempts = object["attempts"].toInt();
+    job.node = object["node"].toString();
+    job.submittedAt = QDateTime::fromString(object["submittedAt"].toString(), Qt::ISODate);
+    job.claimedAt = QDateTime::fromString(object["claimedAt"].toString(), Qt::ISODate);
+    return job;
+}
+
+Spool::Spool(const QString& root)
+    : root_(root)
+{
+}
+
+bool Spool::init(QString* errorMessage)
+{
+    for (const auto& directory : directories) {
+        if (!root_.mkpath(directory)) {
+            if (errorMessage) {
+                *errorMessage = "Could not create " + root_.absoluteFilePath(directory);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+QString Spool::nodeId()
+{
+    return QSysInfo::machineHostName() + "-" + QString::number(QCoreApplication::applicationPid());
+}
+
+QString Spool::claimPath(const SpoolJob& job) const
+{
+    return root_.absoluteFilePath("claimed/" + job.name + "@" + job.node + ".json");
+}
+
+QString Spool::submit(const QString& artifactPath, const QString& gameServerUrl, const QString& dlcServerUrl,
+                      int priority, QString* errorMessage)
+{
+    SpoolJob job;
+    job.name = QDateTime::currentDateTimeUtc().toString("yyyyMMdd-HHmmsszzz") + "-" +
+               QString::number(QRandomGenerator::global()->generate(), 16);
+    // every job gets its own copy, so its workspace and output never collide with another's
+    job.input = "inputs/" + job.name + "." + QFileInfo(artifactPath).suffix().toLower();
+    job.originalName = QFileInfo(artifactPath).fileName();
+    job.gameServerUrl = gameServerUrl;
+    job.dlcServerUrl = dlcServerUrl;
+    job.priority = priority;
+    job.submittedAt = QDateTime::currentDateTimeUtc();
+
+    if (utils::copyFile(QDir::toNativeSeparators(artifactPath).toStdWString(),
+                        QDir::toNativeSeparators(inputPath(job)).toStdWString()) == utils::CopyMethod::Failed) {
+        if (errorMessage) {
+            *errorMessage = "Could not copy " + artifactPath + " into " + root();
+        }
+        return QString();
+    }
+    if (!writeJson(root_.absoluteFilePath("incoming/" + job.name + ".json"), job.toJson())) {
+        QFile::remove(inputPath(job));
+        if (errorMessage) {
+            *errorMessage = "Could not write the job into " + root_.absoluteFilePath("incoming");
+        }
+        return QString();
+    }
+    return job.name;
+}
+
+std::optional<SpoolJob> Spool::claim(const QString& node)
+{
+    QList<SpoolJob> waiting;
+    for (const QFileInfo& info : QDir(root_.absoluteFilePath("incoming")).entryInfoList({"*.json"}, QDir::Files)) {
+        QJsonObject object;
+        if (readJson(info.absoluteFilePath(), object)) {
+            waiting.append(SpoolJob::fromJson(object));
+        }
+    }
+    std::stable_sort(waiting.begin(), waiting.end(), [](const SpoolJob& a, const SpoolJob& b) {
+        return a.priority != b.priority ? a.priority > b.priority : a.name < b.name;
+    });
+
+    for (SpoolJob job : waiting) {
+        const QString incoming = root_.absoluteFilePath("incoming/" + job.name + ".json");
+        // reclaimed after it had already been published, the node died before cleaning up
+        if (QFile::exists(resultPath(job.name))) {
+            QFile::remove(incoming);
+            continue;
+        }
+
+        // the rename keeps the old modification time, a fresh one keeps it from looking expired
+        touch(incoming);
+        job.node = node;
+        if (!QFile::rename(incoming, claimPath(job))) {
+            continue;
+        }
+
+        job.attempts++;
+        job.claimedAt = QDateTime::currentDateTimeUtc();
+        writeJson(claimPath(job), job.toJson());
+        return job;
+    }
+    return std::nullopt;
+}
+
+bool Spool::renew(const SpoolJob& job) const
+{
+    return touch(claimPath(job));
+}
+
+int Spool::reclaimExpired(int leaseSeconds)
+{
+    int reclaimed = 0;
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    for (const QFileInfo& info : QDir(root_.absoluteFilePath("claimed")).entryInfoList({"*.json"}, QDir::Files)) {
+        if (info.lastModified().toUTC().secsTo(now) < leaseSeconds) {
+            continue;
+        }
+        const QString name = info.completeBaseName().section('@', 0, 0);
+        if (QFile::rename(info.absoluteFilePath(), root_.absoluteFilePath("incoming/" + name + ".json"))) {
+            reclaimed++;
+        }
+    }
+    return reclaimed;
+}
+
+bool Spool::publish(const SpoolJob& job, const QString& artifactPath, const QJsonObject& stats, QString* errorMessage)
+{
+    // a node that lost its lease after the last heartbeat must not touch the reclaimed job's input
+    if (!renew(job)) {
+        if (errorMessage) {
+            *errorMessage = "Lease lost to another node, results not published";
+        }
+        return false;
+    }
+
+    const QString dir = root_.absoluteFilePath("done/" + job.name);
+    const QString artifact = QDir(dir).filePath(QFileInfo(job.originalName).completeBaseName() + "-patched." +
+                                                QFileInfo(artifactPath).suffix());
+    if (!root_.mkpath("done/" + job.name) || !moveInto(artifactPath, artifact) ||
+        !moveInto(Patcher::Verifier::manifestPath(artifactPath), Patcher::Verifier::manifestPath(artifact))) {
+        if (errorMessage) {
+            *errorMessage = "Could not move the results into " + dir;
+        }
+        return false;
+    }
+
+    QJsonObject result = job.toJson();
+    for (auto it = stats.begin(); it != stats.end(); ++it) {
+        result[it.key()] = it.value();
+    }
+    result["artifact"] = QFileInfo(artifact).fileName();
+    // result.json marks the job done, so it goes last
+    if (!writeJson(resultPath(job.name), result)) {
+        if (errorMessage) {
+            *errorMessage = "Could not write " + resultPath(job.name);
+        }
+        return false;
+    }
+
+    QFile::remove(claimPath(job));
+    QFile::remove(inputPath(job));
+    return true;
+}
+
+bool Spool::fail(const SpoolJob& job, const QString& errorMessage, const QJsonObject& stats)
+{
+    // a reclaimed job may be running on another node by now
+    if (!renew(job)) {
+        return false;
+    }
+
+    QJsonObject result = job.toJson();
+    for (auto it = stats.begin(); it != stats.end(); ++it) {
+        result[it.key()] = it.value();
+    }
+    result["error"] = errorMessage;
+    if (!writeJson(failurePath(job.name), result)) {
+        return false;
+    }
+    // the input stays, for a retry
+    QFile::remove(claimPath(job));
+    return true;
+}
+
+bool Spool::writeNodeStatus(const QString& node, const QJsonObject& status) const
+{
+    return writeJson(root_.absoluteFilePath("nodes/" + node + ".json"), status);
+}
+
+bool Spool::isNodeAlive(const QString& node) const
+{
+    if (!QDir(root_.absoluteFilePath("claimed")).entryList({"*@" + node + ".json"}, QDir::Files).isEmpty()) {
+        return true;
+    }
+    const QFileInfo status(root_.absoluteFilePath("nodes/" + node + ".json"));
+    return status.exists() && status.lastModified().toUTC().secsTo(QDateTime::currentDateTimeUtc()) < leaseSeconds;
+}
+
+int runWorker(Patcher::AppPatcher& patcher, const QString& root, bool drain, QTextStream& out)
+{
+    Spool spool(root);
+    QString errorMessage;
+    if (!spool.init(&errorMessage)) {
+        out << "ERROR: " << errorMessage << Qt::endl;
+        return 1;
+    }
+
+    const QString node = Spool::nodeId();
+    // nodes on one machine share the working directory, but never a workspace
+    patcher.setWorkspaceRoot(QDir("workspaces").absoluteFilePath(node));
+
+    // a node that died leaves its root behind, and no sweep of its own reaches it again
+    auto sweepDeadNodes = [&]() {
+        const QString host = QSysInfo::machineHostName() + "-";
+        for (const QFileInfo& info : QDir("workspaces").entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+            const QString name = info.fileName();
+            bool isPid = false;
+            name.mid(host.size()).toLongLong(&isPid);
+            if (name.startsWith(host) && isPid && name != node && !spool.isNodeAlive(name)) {
+                Patcher::WorkspaceCollector::instance().discard(info.absoluteFilePath());
+            }
+        }
+    };
+
+    QMap<int, SpoolJob> running;
+    QSet<int> lost;
+    int succeeded = 0;
+    int failed = 0;
+    const QDateTime startedAt = QDateTime::currentDateTimeUtc();
+
+    auto reportStatus = [&]() {
+        QJsonArray jobs;
+        for (const auto& job : running) {
+            jobs.append(job.name);
+        }
+        QJsonObject status;
+        status["node"] = node;
+        status["startedAt"] = startedAt.toString(Qt::ISODate);
+        status["heartbeat"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+        status["running"] = jobs;
+        status["succeeded"] = succeeded;
+        status["failed"] = failed;
+        spool.writeNodeStatus(node, status);
+    };
+
+    auto fill = [&]() {
+        const int reclaimed = spool.reclaimExpired(leaseSeconds);
+        if (reclaimed > 0) {
+            out << "Reclaimed " << reclaimed << " job(s) from nodes whose lease expired" << Qt::endl;
+        }
+
+        while (running.size() < patcher.maxConcurrentJobs()) {
+            std::optional<SpoolJob> job = spool.claim(node);
+            if (!job) {
+                break;
+            }
+            if (job->attempts > maxAttempts) {
+                out << "[" << job->name << "] failed: gave up after " << maxAttempts << " attempts" << Qt::endl;
+                spool.fail(*job, QString("Gave up after %1 attempts").arg(maxAttempts));
+                failed++;
+                continue;
+            }
+            const int jobId = patcher.enqueue(spool.inputPath(*job), job->gameServerUrl, job->dlcServerUrl, job->priority);
+            running.insert(jobId, *job);
+            out << "[" << job->name << "] claimed " << job->originalName << ", attempt " << job->attempts << Qt::endl;
+        }
+        reportStatus();
+
+        if (drain && running.isEmpty()) {
+            QTimer::singleShot(0, QCoreApplication::instance(), &QCoreApplication::quit);
+        }
+    };
+
+    QObject::connect(&patcher, &Patcher::AppPatcher::jobFinished, [&](int jobId, bool success) {
+        const SpoolJob job = running.take(jobId);
+        if (lost.remove(jobId)) {
+            // another node has it by now
+            fill();
+            return;
+        }
+
+        const Patcher::PatchJob patchJob = patcher.job(jobId);
+        QJsonObject stats;
+        stats["node"] = node;
+        stats["elapsedMs"] = patchJob.startedAt.msecsTo(patchJob.finishedAt);
+        stats["peakMemory"] = patchJob.peakMemory;
+        stats["peakDisk"] = patchJob.peakDisk;
+
+        QString publishError;
+        if (success && spool.publish(job, patchJob.outputPath(), stats, &publishError)) {
+            succeeded++;
+            out << "[" << job.name << "] succeeded in " << stats["elapsedMs"].toInteger() << " ms" << Qt::endl;
+        } else if (success && !spool.renew(job)) {
+            // reclaimed between the last heartbeat and the publish, the other node reports it
+            out << "[" << job.name << "] " << publishError << Qt::endl;
+        } else {
+            const QString message = success ? publishError : patchJob.errorMessage;
+            if (spool.fail(job, message, stats)) {
+                failed++;
+                out << "[" << job.name << "] failed: " << message << Qt::endl;
+            } else {
+                out << "[" << job.name << "] failed: " << message << ", but the lease was lost, the failure is not recorded" << Qt::endl;
+            }
+        }
+        fill();
+    });
+
+    QTimer heartbeat;
+    QObject::connect(&heartbeat, &QTimer::timeout, [&]() {
+        for (auto it = running.begin(); it != running.end(); ++it) {
+            if (!lost.contains(it.key()) && !spool.renew(it.value())) {
+                out << "[" << it.value().name << "] lease lost, cancelling" << Qt::endl;
+                lost.insert(it.key());
+                patcher.cancel(it.key());
+            }
+        }
+        reportStatus();
+        sweepDeadNodes();
+    });
+    heartbeat.start(heartbeatMs);
+    sweepDeadNodes();
+
+    QTimer poll;
+    QObject::connect(&poll, &QTimer::timeout, fill);
+    poll.start(pollMs);
+
+    out << "Node " << node << " working on " << spool.root() << ", " << patcher.maxConcurrentJobs() << " job(s) at a time" << Qt::endl;
+    fill();
+    const int result = QCoreApplication::exec();
+    out << succeeded << " succeeded, " << failed << " failed" << Qt::endl;
+    return result != 0 ? result : (failed == 0 ? 0 : 1);
+}
+
+int runSubmit(const QString& root, const QStringList& files, int priority,
+              const QString& gameServerUrl, const QString& dlcServerUrl, QTextStream& out)
+{
+    if (files.isEmpty()) {
+        out << "ERROR: --patch needs at least one APK or IPA" << Qt::endl;
+        return 1;
+    }
+
+    Spool spool(root);
+    QString errorMessage;
+    if (!spool.init(&errorMessage)) {
+        out << "ERROR: " << errorMessage << Qt::endl;
+        return 1;
+    }
+
+    QMap<QString, QString> pending;
+    int failed = 0;
+    for (const auto& file : files) {
+        const QString name = spool.submit(file, gameServerUrl, dlcServerUrl, priority, &errorMessage);
+        if (name.isEmpty()) {
+            out << "ERROR: " << file << ": " << errorMessage << Qt::endl;
+            failed++;
+            continue;
+        }
+        pending.insert(name, file);
+        out << "[" << name << "] submitted: " << file << Qt::endl;
+    }
+    out << "Waiting for the nodes working on " << spool.root() << " (--spool-worker)..." << Qt::endl;
+
+    while (!pending.isEmpty()) {
+        QThread::msleep(1000);
+        for (auto it = pending.begin(); it != pending.end();) {
+            QJsonObject result;
+            if (readJson(spool.resultPath(it.key()), result)) {
+                const QString artifact = QFileInfo(spool.resultPath(it.key())).dir().filePath(result["artifact"].toString());
+                const QString saved = QFileInfo(it.value()).completeBaseName() + "-patched." + QFileInfo(artifact).suffix();
+                QFile::remove(saved);
+                QFile::remove(Patcher::Verifier::manifestPath(saved));
+                // reflinked or copied in the kernel where the file system allows, artifacts run to GBs
+                if (!copyInto(artifact, saved) || !copyInto(Patcher::Verifier::manifestPath(artifact), Patcher::Verifier::manifestPath(saved))) {
+                    out << "[" << it.key() << "] succeeded on " << result["node"].toString() << ", but could not copy " << artifact << Qt::endl;
+                    failed++;
+                } else {
+                    out << "[" << it.key() << "] succeeded on " << result["node"].toString() << ": " << saved << Qt::endl;
+                }
+                it = pending.erase(it);
+            } else if (readJson(spool.failurePath(it.key()), result)) {
+                out << "[" << it.key() << "] failed: " << it.value() << " (" << result["error"].toString() << ")" << Qt::endl;
+                failed++;
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    out << (files.size() - failed) << " succeeded, " << failed << " failed" << Qt::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "std_include.hpp"
+
+namespace Patcher {
+class AppPatcher;
+}
+
+namespace Spool {
+
+struct SpoolJob {
+    QString name;
+    // relative to the spool root, nodes may mount it elsewhere
+    QString input;
+    QString originalName;
+    QString gameServerUrl;
+    QString dlcServerUrl;
+    int priority = 0;
+    int attempts = 0;
+    QString node;
+    QDateTime submittedAt;
+    QDateTime claimedAt;
+
+    QJsonObject toJson() const;
+    static SpoolJob fromJson(const QJsonObject& object);
+};
+
+// Job distribution through a directory every build node can reach, without any service.
+// A job moves between directories by rename, which only one node can win:
+//
+//   inputs/<job>.apk|ipa          the artifact, copied in at submission
+//   incoming/<job>.json           waiting
+//   claimed/<job>@<node>.json     taken; its modification time is the node's lease
+//   done/<job>/                   patched artifact, manifest and result.json
+//   failed/<job>.json             the request with its error; moving it back to incoming retries it
+//   nodes/<node>.json             what each node is doing
+class Spool {
+public:
+    explicit Spool(const QString& root);
+
+    bool init(QString* errorMessage = nullptr);
+    QString root() const { return root_.absolutePath(); }
+
+    // Returns the job name, empty on failure
+    QString submit(const QString& artifactPath, const QString& gameServerUrl, const QString& dlcServerUrl,
+                   int priority, QString* errorMessage = nullptr);
+
+    // Highest priority, then oldest, first
+    std::optional<SpoolJob> claim(const QString& node);
+    // Heartbeat, false once the lease has been lost to a reclaim
+    bool renew(const SpoolJob& job) const;
+    // Puts jobs whose lease has not been renewed for leaseSeconds back into incoming
+    int reclaimExpired(int leaseSeconds);
+
+    // Moves the results into done/ once the lease is renewed, fails without touching anything
+    // when it has been lost
+    bool publish(const SpoolJob& job, const QString& artifactPath, const QJsonObject& stats, QString* errorMessage = nullptr);
+    // Moves the job into failed/, under the same lease check as publish
+    bool fail(const SpoolJob& job, const QString& errorMessage, const QJsonObject& stats = QJsonObject());
+    bool writeNodeStatus(const QString& node, const QJsonObject& status) const;
+    // While it holds a lease or has reported itself within the lease time
+    bool isNodeAlive(const QString& node) const;
+
+    QString inputPath(const SpoolJob& job) const { return root_.absoluteFilePath(job.input); }
+    QString resultPath(const QString& name) const { return root_.absoluteFilePath("done/" + name + "/result.json"); }
+    QString failurePath(const QString& name) const { return root_.absoluteFilePath("failed/" + name + ".json"); }
+
+    // host-pid, unique across the nodes sharing a spool
+    static QString nodeId();
+
+private:
+    QString claimPath(const SpoolJob& job) const;
+
+    QDir root_;
+};
+
+// Headless node: claims jobs while the patcher has free slots and publishes what it finishes.
+// With drain it exits once nothing is left to claim, otherwise it keeps polling.
+int runWorker(Patcher::AppPatcher& patcher, const QString& root, bool drain, QTextStream& out);
+
+// Submits the files and waits for their results, which are saved into the working directory
+int runSubmit(const QString& root, const QStringList& files, int priority,
+              const QString& gameServerUrl, const QString& dlcServerUrl, QTextStream& out);
+
+}
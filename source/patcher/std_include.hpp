@@ -59,7 +59,9 @@
 #include <atomic>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <queue>
+#include <deque>
 #include <regex>
 #include <chrono>
 #include <thread>
@@ -112,6 +114,12 @@
 #include <QtCore/QWaitCondition>
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QDateTime>
+#include <QtCore/QTextStream>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QThreadPool>
+#include <QtCore/QEventLoop>
+#include <QtCore/QTimer>
 
 
 
@@ -0,0 +1,481 @@
+#include "axml.hpp"
+#include <algorithm>
+#include <cstdio>
+
+namespace utils::axml {
+    namespace {
+        constexpr uint16_t kStringPoolType = 0x0001;
+        constexpr uint16_t kTableType = 0x0002;
+        constexpr uint16_t kXmlType = 0x0003;
+        constexpr uint16_t kXmlStartElementType = 0x0102;
+        constexpr uint16_t kXmlEndElementType = 0x0103;
+        constexpr uint16_t kXmlResourceMapType = 0x0180;
+        constexpr uint32_t kSortedFlag = 1 << 0;
+        constexpr uint32_t kUtf8Flag = 1 << 8;
+        constexpr uint32_t kNoEntry = 0xFFFFFFFF;
+
+        uint16_t get16(const uint8_t* p) {
+            return static_cast<uint16_t>(p[0] | (p[1] << 8));
+        }
+
+        uint32_t get32(const uint8_t* p) {
+            return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                   (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+        }
+
+        void put16(std::string& out, uint16_t v) {
+            out.push_back(static_cast<char>(v & 0xFF));
+            out.push_back(static_cast<char>(v >> 8));
+        }
+
+        void set32(std::string& out, size_t offset, uint32_t v) {
+            for (int i = 0; i < 4; i++) {
+                out[offset + i] = static_cast<char>((v >> (i * 8)) & 0xFF);
+            }
+        }
+
+        // lenient, a malformed sequence becomes U+FFFD
+        std::u16string toUtf16(const std::string& in) {
+            std::u16string out;
+            out.reserve(in.size());
+            for (size_t i = 0; i < in.size();) {
+                const uint8_t lead = static_cast<uint8_t>(in[i]);
+                const int extra = lead < 0x80 ? 0
+                                : (lead >> 5) == 0x6 ? 1
+                                : (lead >> 4) == 0xE ? 2
+                                : (lead >> 3) == 0x1E ? 3 : -1;
+                if (extra < 0 || i + extra >= in.size()) {
+                    out.push_back(0xFFFD);
+                    i++;
+                    continue;
+                }
+                uint32_t c = extra == 0 ? lead : lead & (0x3F >> extra);
+                for (int k = 1; k <= extra; k++) {
+                    c = (c << 6) | (static_cast<uint8_t>(in[i + k]) & 0x3F);
+                }
+                i += extra + 1;
+                if (c >= 0x10000) {
+                    c -= 0x10000;
+                    out.push_back(static_cast<char16_t>(0xD800 + (c >> 10)));
+                    out.push_back(static_cast<char16_t>(0xDC00 + (c & 0x3FF)));
+                } else {
+                    out.push_back(static_cast<char16_t>(c));
+                }
+            }
+            return out;
+        }
+
+        void put32(std::string& out, uint32_t v) {
+            put16(out, static_cast<uint16_t>(v & 0xFFFF));
+            put16(out, static_cast<uint16_t>(v >> 16));
+        }
+
+        // Moves a style span (inclusive UTF-16 indices) from before to after, taking the edit as one
+        // replaced run between their common prefix and suffix; false when nothing of it is left
+        bool remapSpan(const std::u16string& before, const std::u16string& after, uint32_t& first, uint32_t& last) {
+            size_t prefix = 0;
+            while (prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix]) {
+                prefix++;
+            }
+            size_t suffix = 0;
+            while (suffix < before.size() - prefix && suffix < after.size() - prefix &&
+                   before[before.size() - 1 - suffix] == after[after.size() - 1 - suffix]) {
+                suffix++;
+            }
+            const int64_t oldEnd = static_cast<int64_t>(before.size() - suffix);
+            const int64_t newEnd = static_cast<int64_t>(after.size() - suffix);
+            auto map = [&](int64_t index, bool isLast) {
+                if (index < static_cast<int64_t>(prefix)) {
+                    return index;
+                }
+                if (index >= oldEnd) {
+                    return index - oldEnd + newEnd;
+                }
+                // inside the replaced run, the span now covers the replacement
+                return isLast ? newEnd - 1 : static_cast<int64_t>(prefix);
+            };
+            const int64_t newFirst = map(first, false);
+            const int64_t newLast = std::min<int64_t>(map(last, true), static_cast<int64_t>(after.size()) - 1);
+            if (newFirst < 0 || newFirst > newLast) {
+                return false;
+            }
+            first = static_cast<uint32_t>(newFirst);
+            last = static_cast<uint32_t>(newLast);
+            return true;
+        }
+
+        // 1 byte below 0x80, otherwise 2 with the high bit set; limited to 0x7FFF
+        bool putUtf8Length(std::string& out, size_t length) {
+            if (length > 0x7FFF) {
+                return false;
+            }
+            if (length > 0x7F) {
+                out.push_back(static_cast<char>(0x80 | (length >> 8)));
+            }
+            out.push_back(static_cast<char>(length & 0xFF));
+            return true;
+        }
+
+        void appendUtf8(std::string& out, uint32_t c) {
+            if (c < 0x80) {
+                out.push_back(static_cast<char>(c));
+            } else if (c < 0x800) {
+                out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+                out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+            } else if (c < 0x10000) {
+                out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+            } else {
+                out.push_back(static_cast<char>(0xF0 | (c >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+            }
+        }
+
+        // UTF-8 pools store the UTF-16 length and then the byte length, each 1 or 2 bytes
+        bool readUtf8(const uint8_t* p, const uint8_t* end, std::string& out) {
+            for (int i = 0; i < 2; i++) {
+                if (p >= end) {
+                    return false;
+                }
+                size_t length = *p++;
+                if (length & 0x80) {
+                    if (p >= end) {
+                        return false;
+                    }
+                    length = ((length & 0x7F) << 8) | *p++;
+                }
+                if (i == 1) {
+                    if (length > static_cast<size_t>(end - p)) {
+                        return false;
+                    }
+                    out.assign(reinterpret_cast<const char*>(p), length);
+                }
+            }
+            return true;
+        }
+
+        // UTF-16 pools store the length in units, in 1 or 2 words
+        bool readUtf16(const uint8_t* p, const uint8_t* end, std::string& out) {
+            if (end - p < 2) {
+                return false;
+            }
+            size_t length = get16(p);
+            p += 2;
+            if (length & 0x8000) {
+                if (end - p < 2) {
+                    return false;
+                }
+                length = ((length & 0x7FFF) << 16) | get16(p);
+                p += 2;
+            }
+            if (length * 2 > static_cast<size_t>(end - p)) {
+                return false;
+            }
+            out.clear();
+            for (size_t i = 0; i < length; i++) {
+                uint32_t c = get16(p + i * 2);
+                if (c >= 0xD800 && c < 0xDC00 && i + 1 < length) {
+                    const uint32_t low = get16(p + (i + 1) * 2);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                        i++;
+                    }
+                }
+                appendUtf8(out, c);
+            }
+            return true;
+        }
+
+        std::string renderValue(uint8_t type, uint32_t data) {
+            char buffer[16];
+            switch (type) {
+            case IntDec:
+                return std::to_string(static_cast<int32_t>(data));
+            case IntHex:
+                std::snprintf(buffer, sizeof(buffer), "0x%x", data);
+                return buffer;
+            case Boolean:
+                return data != 0 ? "true" : "false";
+            case Reference:
+                std::snprintf(buffer, sizeof(buffer), "@0x%08x", data);
+                return buffer;
+            default:
+                return std::to_string(data);
+            }
+        }
+    }
+
+    bool readStringPool(const uint8_t* data, size_t size, StringPool& pool) {
+        pool = StringPool();
+        if (size < 28 || get16(data) != kStringPoolType) {
+            return false;
+        }
+        const uint32_t headerSize = get16(data + 2);
+        const uint32_t chunkSize = get32(data + 4);
+        const uint32_t count = get32(data + 8);
+        const uint32_t flags = get32(data + 16);
+        const uint32_t stringsStart = get32(data + 20);
+        if (chunkSize > size || headerSize < 28 || headerSize + static_cast<uint64_t>(count) * 4 > chunkSize ||
+            stringsStart > chunkSize) {
+            return false;
+        }
+
+        pool.utf8 = (flags & kUtf8Flag) != 0;
+        pool.strings.resize(count);
+        const uint8_t* strings = data + stringsStart;
+        const uint8_t* end = data + chunkSize;
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t offset = get32(data + headerSize + i * 4);
+            if (offset >= static_cast<size_t>(end - strings)) {
+                return false;
+            }
+            const bool read = pool.utf8 ? readUtf8(strings + offset, end, pool.strings[i])
+                                        : readUtf16(strings + offset, end, pool.strings[i]);
+            if (!read) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool writeStringPool(const uint8_t* original, size_t size, const StringPool& pool, std::string& out) {
+        if (size < 28 || get16(original) != kStringPoolType) {
+            return false;
+        }
+        const uint32_t headerSize = get16(original + 2);
+        const uint32_t chunkSize = get32(original + 4);
+        const uint32_t count = get32(original + 8);
+        const uint32_t styleCount = get32(original + 12);
+        const uint32_t flags = get32(original + 16);
+        const uint32_t stylesStart = get32(original + 24);
+        const uint64_t offsetsEnd = headerSize + (static_cast<uint64_t>(count) + styleCount) * 4;
+        if (chunkSize > size || headerSize < 28 || offsetsEnd > chunkSize || pool.strings.size() != count ||
+            (styleCount > 0 && (stylesStart == 0 || stylesStart > chunkSize))) {
+            return false;
+        }
+
+        StringPool before;
+        if (styleCount > count || !readStringPool(original, size, before)) {
+            return false;
+        }
+
+        // header and both offset tables, the style offsets are filled in with the style data
+        out.assign(reinterpret_cast<const char*>(original), static_cast<size_t>(offsetsEnd));
+        std::string data;
+        for (uint32_t i = 0; i < count; i++) {
+            set32(out, headerSize + i * 4, static_cast<uint32_t>(data.size()));
+            const std::string& value = pool.strings[i];
+            const std::u16string units = toUtf16(value);
+            if (pool.utf8) {
+                if (!putUtf8Length(data, units.size()) || !putUtf8Length(data, value.size())) {
+                    return false;
+                }
+                data += value;
+                data.push_back('\0');
+            } else {
+                if (units.size() > 0x7FFFFFFF) {
+                    return false;
+                }
+                if (units.size() > 0x7FFF) {
+                    put16(data, static_cast<uint16_t>(0x8000 | (units.size() >> 16)));
+                }
+                put16(data, static_cast<uint16_t>(units.size() & 0xFFFF));
+                for (char16_t unit : units) {
+                    put16(data, static_cast<uint16_t>(unit));
+                }
+                put16(data, 0);
+            }
+        }
+        while (data.size() % 4 != 0) {
+            data.push_back('\0');
+        }
+
+        // the spans of styled strings count UTF-16 units, an edited string gets them moved along
+        std::string styles;
+        size_t stylesEnd = stylesStart;
+        for (uint32_t i = 0; i < styleCount; i++) {
+            set32(out, headerSize + (count + i) * 4, static_cast<uint32_t>(styles.size()));
+            const std::u16string oldUnits = toUtf16(before.strings[i]);
+            const std::u16string newUnits = toUtf16(pool.strings[i]);
+            size_t span = stylesStart + get32(original + headerSize + (count + i) * 4);
+            for (;; span += 12) {
+                if (span + 4 > chunkSize) {
+                    return false;
+                }
+                const uint32_t name = get32(original + span);
+                if (name == kNoEntry) {
+                    break;
+                }
+                if (span + 12 > chunkSize) {
+                    return false;
+                }
+                uint32_t first = get32(original + span + 4);
+                uint32_t last = get32(original + span + 8);
+                if (oldUnits == newUnits || remapSpan(oldUnits, newUnits, first, last)) {
+                    put32(styles, name);
+                    put32(styles, first);
+                    put32(styles, last);
+                }
+            }
+            put32(styles, kNoEntry);
+            stylesEnd = std::max(stylesEnd, span + 4);
+        }
+        if (styleCount > 0) {
+            // the closing sentinels after the last style
+            styles.append(reinterpret_cast<const char*>(original) + stylesEnd, chunkSize - stylesEnd);
+        }
+
+        const size_t stringsStart = out.size();
+        out += data;
+        const size_t newStylesStart = styleCount > 0 ? out.size() : 0;
+        out += styles;
+        set32(out, 4, static_cast<uint32_t>(out.size()));
+        // edited strings may no longer be in order
+        set32(out, 16, flags & ~kSortedFlag);
+        set32(out, 20, static_cast<uint32_t>(stringsStart));
+        set32(out, 24, static_cast<uint32_t>(newStylesStart));
+        return true;
+    }
+
+    bool rewriteStringPools(std::string& document, const std::function<bool(std::vector<std::string>& strings)>& edit) {
+        const auto* data = reinterpret_cast<const uint8_t*>(document.data());
+        if (document.size() < 8 || (get16(data) != kXmlType && get16(data) != kTableType)) {
+            return false;
+        }
+        const uint32_t documentSize = get32(data + 4);
+        if (documentSize > document.size()) {
+            return false;
+        }
+
+        std::string rebuilt;
+        rebuilt.reserve(document.size());
+        rebuilt.append(document, 0, get16(data + 2));
+        size_t offset = rebuilt.size();
+        while (offset + 8 <= documentSize) {
+            const uint8_t* chunk = data + offset;
+            const uint32_t chunkSize = get32(chunk + 4);
+            if (chunkSize < 8 || chunkSize > documentSize - offset) {
+                return false;
+            }
+            StringPool pool;
+            if (get16(chunk) == kStringPoolType) {
+                if (!readStringPool(chunk, chunkSize, pool)) {
+                    return false;
+                }
+                const size_t count = pool.strings.size();
+                if (edit(pool.strings)) {
+                    std::string written;
+                    if (pool.strings.size() != count || !writeStringPool(chunk, chunkSize, pool, written)) {
+                        return false;
+                    }
+                    rebuilt += written;
+                    offset += chunkSize;
+                    continue;
+                }
+            }
+            rebuilt.append(document, offset, chunkSize);
+            offset += chunkSize;
+        }
+        if (offset != documentSize) {
+            return false;
+        }
+        // anything trailing the document is kept, as the platform ignores it too
+        rebuilt.append(document, documentSize, std::string::npos);
+        set32(rebuilt, 4, static_cast<uint32_t>(rebuilt.size() - (document.size() - documentSize)));
+        document.swap(rebuilt);
+        return true;
+    }
+
+    const Attribute* Element::find(const std::string& attributeName, uint32_t resourceId) const {
+        if (resourceId != 0) {
+            for (const auto& attribute : attributes) {
+                if (attribute.resourceId == resourceId) {
+                    return &attribute;
+                }
+            }
+        }
+        for (const auto& attribute : attributes) {
+            if (attribute.name == attributeName) {
+                return &attribute;
+            }
+        }
+        return nullptr;
+    }
+
+    bool parse(const std::string& document, std::vector<Element>& elements) {
+        elements.clear();
+        const auto* data = reinterpret_cast<const uint8_t*>(document.data());
+        const size_t size = document.size();
+        if (size < 8 || get16(data) != kXmlType) {
+            return false;
+        }
+
+        StringPool pool;
+        std::vector<uint32_t> resourceIds;
+        auto string = [&](uint32_t index) {
+            return index < pool.strings.size() ? pool.strings[index] : std::string();
+        };
+
+        int depth = 0;
+        size_t offset = get16(data + 2);
+        while (offset + 8 <= size) {
+            const uint8_t* chunk = data + offset;
+            const uint16_t type = get16(chunk);
+            const uint16_t headerSize = get16(chunk + 2);
+            const uint32_t chunkSize = get32(chunk + 4);
+            if (chunkSize < 8 || chunkSize > size - offset) {
+                return false;
+            }
+
+            if (type == kStringPoolType) {
+                if (!readStringPool(chunk, chunkSize, pool)) {
+                    return false;
+                }
+            } else if (type == kXmlResourceMapType) {
+                for (uint32_t i = headerSize; i + 4 <= chunkSize; i += 4) {
+                    resourceIds.push_back(get32(chunk + i));
+                }
+            } else if (type == kXmlStartElementType) {
+                // node header (line, comment), then ns, name and the attribute layout
+                if (chunkSize < headerSize + 20u) {
+                    return false;
+                }
+                const uint8_t* ext = chunk + headerSize;
+                Element element;
+                element.name = string(get32(ext + 4));
+                element.depth = depth++;
+                const uint16_t attributeStart = get16(ext + 8);
+                const uint16_t attributeSize = get16(ext + 10);
+                const uint16_t attributeCount = get16(ext + 12);
+                if (attributeSize < 20 ||
+                    headerSize + attributeStart + static_cast<uint64_t>(attributeSize) * attributeCount > chunkSize) {
+                    return false;
+                }
+                for (uint16_t i = 0; i < attributeCount; i++) {
+                    const uint8_t* raw = ext + attributeStart + i * attributeSize;
+                    Attribute attribute;
+                    const uint32_t ns = get32(raw);
+                    const uint32_t name = get32(raw + 4);
+                    if (ns != kNoEntry) {
+                        attribute.ns = string(ns);
+                    }
+                    attribute.name = string(name);
+                    attribute.resourceId = name < resourceIds.size() ? resourceIds[name] : 0;
+                    attribute.type = raw[15];
+                    attribute.data = get32(raw + 16);
+                    attribute.value = attribute.type == String ? string(attribute.data)
+                                                               : renderValue(attribute.type, attribute.data);
+                    element.attributes.push_back(std::move(attribute));
+                }
+                elements.push_back(std::move(element));
+            } else if (type == kXmlEndElementType) {
+                depth--;
+            }
+            offset += chunkSize;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Android binary XML (AXML), the compiled form of AndroidManifest.xml and res/**/*.xml
+namespace utils::axml {
+    enum ValueType : uint8_t {
+        Reference = 0x01,
+        String = 0x03,
+        Float = 0x04,
+        IntDec = 0x10,
+        IntHex = 0x11,
+        Boolean = 0x12,
+    };
+
+    // ResStringPool, the string table of binary XML and resources.arsc; strings are kept as UTF-8
+    struct StringPool {
+        bool utf8 = false;
+        std::vector<std::string> strings;
+    };
+
+    bool readStringPool(const uint8_t* data, size_t size, StringPool& pool);
+    // Re-encodes a pool chunk with new strings in the original's encoding; the header and the
+    // string order are kept, so every index into the pool stays valid. Style spans of an edited
+    // string are moved with the text around the edit, the ones left with nothing are dropped.
+    bool writeStringPool(const uint8_t* original, size_t size, const StringPool& pool, std::string& out);
+
+    // Rebuilds each string pool at the top level of a binary XML document or resources.arsc that
+    // edit changes (it returns true then, keeping the count), and fixes the enclosing chunk size.
+    // Package-level pools of resources.arsc hold type and key names, not values, and are left alone.
+    bool rewriteStringPools(std::string& document, const std::function<bool(std::vector<std::string>& strings)>& edit);
+
+    struct Attribute {
+        std::string ns;
+        // may be empty in obfuscated manifests, resourceId still names the attribute
+        std::string name;
+        uint32_t resourceId = 0;
+        uint8_t type = 0;
+        uint32_t data = 0;
+        // the string itself, or the typed value as text ("123", "true", "@0x7f0b0001")
+        std::string value;
+    };
+
+    struct Element {
+        std::string name;
+        int depth = 0;
+        std::vector<Attribute> attributes;
+
+        // by resource id when given, the name is only a fallback
+        const Attribute* find(const std::string& name, uint32_t resourceId = 0) const;
+    };
+
+    // Start tags of the document in order, with their depth
+    bool parse(const std::string& data, std::vector<Element>& elements);
+}
@@ -0,0 +1,665 @@
+#include "deflate.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <queue>
+#include <thread>
+
+#ifdef UTILS_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace utils {
+    namespace {
+        constexpr size_t kWindowSize = 32768;
+        constexpr int kMinMatch = 3;
+        constexpr int kMaxMatch = 258;
+        constexpr size_t kMaxBlockTokens = 1 << 15;
+        constexpr int kEndOfBlock = 256;
+
+        constexpr std::array<uint16_t, 29> kLengthBase = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        constexpr std::array<uint8_t, 29> kLengthExtra = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        constexpr std::array<uint16_t, 30> kDistBase = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        constexpr std::array<uint8_t, 30> kDistExtra = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        constexpr std::array<uint8_t, 19> kCodeLengthOrder = {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        struct LevelParams {
+            int maxChain;
+            int niceLength;
+            bool lazy;
+        };
+
+        constexpr std::array<LevelParams, 10> kLevels = {{
+            {0, 0, false},
+            {4, 16, false},
+            {8, 32, false},
+            {16, 32, false},
+            {16, 64, true},
+            {32, 128, true},
+            {128, 128, true},
+            {256, 258, true},
+            {1024, 258, true},
+            {4096, 258, true},
+        }};
+
+        struct Tables {
+            std::array<uint8_t, kMaxMatch + 1> lengthCode{};
+            std::array<uint8_t, kWindowSize + 1> distCode{};
+        };
+
+        const Tables& tables() {
+            static const Tables t = [] {
+                Tables tables;
+                for (int code = 0; code < 29; code++) {
+                    const int end = code + 1 < 29 ? kLengthBase[code + 1] : kMaxMatch + 1;
+                    for (int length = kLengthBase[code]; length < end && length <= kMaxMatch; length++) {
+                        tables.lengthCode[length] = static_cast<uint8_t>(code);
+                    }
+                }
+                // 258 has a code of its own rather than being the top of code 27
+                tables.lengthCode[kMaxMatch] = 28;
+                for (int code = 0; code < 30; code++) {
+                    const size_t end = code + 1 < 30 ? kDistBase[code + 1] : kWindowSize + 1;
+                    for (size_t dist = kDistBase[code]; dist < end; dist++) {
+                        tables.distCode[dist] = static_cast<uint8_t>(code);
+                    }
+                }
+                return tables;
+            }();
+            return t;
+        }
+
+        class BitWriter {
+        public:
+            explicit BitWriter(std::string& out) : out_(out) {}
+
+            void put(uint32_t bits, int count) {
+                buffer_ |= static_cast<uint64_t>(bits) << count_;
+                count_ += count;
+                while (count_ >= 8) {
+                    out_.push_back(static_cast<char>(buffer_ & 0xFF));
+                    buffer_ >>= 8;
+                    count_ -= 8;
+                }
+            }
+
+            void alignToByte() {
+                if (count_ > 0) {
+                    put(0, 8 - count_);
+                }
+            }
+
+        private:
+            std::string& out_;
+            uint64_t buffer_ = 0;
+            int count_ = 0;
+        };
+
+        struct Token {
+            // literal byte, or match length when dist is not 0
+            uint16_t value;
+            uint16_t dist;
+        };
+
+        struct Code {
+            uint16_t bits = 0;
+            uint8_t length = 0;
+        };
+
+        uint32_t reverseBits(uint32_t code, int length) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++) {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            return reversed;
+        }
+
+        // Huffman code lengths no longer than limit, most frequent symbols getting the shortest
+        void buildLengths(const uint32_t* freq, int count, int limit, uint8_t* lengths) {
+            std::fill(lengths, lengths + count, 0);
+            std::vector<int> used;
+            for (int i = 0; i < count; i++) {
+                if (freq[i] > 0) {
+                    used.push_back(i);
+                }
+            }
+            if (used.empty()) {
+                return;
+            }
+            if (used.size() == 1) {
+                // a complete code needs two symbols, the spare one is never emitted
+                lengths[used[0]] = 1;
+                lengths[used[0] == 0 ? 1 : 0] = 1;
+                return;
+            }
+
+            // plain Huffman tree first, depths only
+            struct Node {
+                uint64_t freq;
+                int parent;
+            };
+            std::vector<Node> nodes;
+            using Item = std::pair<uint64_t, int>;
+            std::priority_queue<Item, std::vector<Item>, std::greater<Item>> heap;
+            for (int symbol : used) {
+                nodes.push_back({freq[symbol], -1});
+                heap.push({freq[symbol], static_cast<int>(nodes.size()) - 1});
+            }
+            while (heap.size() > 1) {
+                const Item a = heap.top();
+                heap.pop();
+                const Item b = heap.top();
+                heap.pop();
+                nodes.push_back({a.first + b.first, -1});
+                const int parent = static_cast<int>(nodes.size()) - 1;
+                nodes[a.second].parent = parent;
+                nodes[b.second].parent = parent;
+                heap.push({a.first + b.first, parent});
+            }
+
+            std::vector<int> blCount(64, 0);
+            int maxDepth = 0;
+            for (size_t i = 0; i < used.size(); i++) {
+                int depth = 0;
+                for (int n = static_cast<int>(i); nodes[n].parent >= 0; n = nodes[n].parent) {
+                    depth++;
+                }
+                blCount[depth]++;
+                maxDepth = std::max(maxDepth, depth);
+            }
+
+            // fold deeper leaves into the limit and repair the Kraft sum, as zlib and miniz do
+            if (maxDepth > limit) {
+                for (int i = limit + 1; i <= maxDepth; i++) {
+                    blCount[limit] += blCount[i];
+                    blCount[i] = 0;
+                }
+                uint64_t total = 0;
+                for (int i = 1; i <= limit; i++) {
+                    total += static_cast<uint64_t>(blCount[i]) << (limit - i);
+                }
+                while (total != (uint64_t(1) << limit)) {
+                    blCount[limit]--;
+                    for (int i = limit - 1; i > 0; i--) {
+                        if (blCount[i] > 0) {
+                            blCount[i]--;
+                            blCount[i + 1] += 2;
+                            break;
+                        }
+                    }
+                    total--;
+                }
+            }
+
+            std::stable_sort(used.begin(), used.end(), [freq](int a, int b) { return freq[a] > freq[b]; });
+            size_t next = 0;
+            for (int length = 1; length <= limit; length++) {
+                for (int n = 0; n < blCount[length]; n++) {
+                    lengths[used[next++]] = static_cast<uint8_t>(length);
+                }
+            }
+        }
+
+        void buildCodes(const uint8_t* lengths, int count, Code* codes) {
+            std::array<uint16_t, 16> blCount{};
+            for (int i = 0; i < count; i++) {
+                blCount[lengths[i]]++;
+            }
+            blCount[0] = 0;
+            std::array<uint32_t, 16> nextCode{};
+            uint32_t code = 0;
+            for (int bits = 1; bits < 16; bits++) {
+                code = (code + blCount[bits - 1]) << 1;
+                nextCode[bits] = code;
+            }
+            for (int i = 0; i < count; i++) {
+                codes[i].length = lengths[i];
+                if (lengths[i] > 0) {
+                    codes[i].bits = static_cast<uint16_t>(reverseBits(nextCode[lengths[i]]++, lengths[i]));
+                }
+            }
+        }
+
+        void fixedLengths(uint8_t* litLengths, uint8_t* distLengths) {
+            for (int i = 0; i < 288; i++) {
+                litLengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+            }
+            std::fill(distLengths, distLengths + 30, 5);
+        }
+
+        class Encoder {
+        public:
+            Encoder(const uint8_t* dictionary, size_t dictionarySize, const uint8_t* data, size_t size, int level)
+                : params_(kLevels[std::clamp(level, 0, 9)]) {
+                dictionarySize = std::min(dictionarySize, kWindowSize);
+                buffer_.reserve(dictionarySize + size);
+                buffer_.insert(buffer_.end(), dictionary + 0, dictionary + dictionarySize);
+                buffer_.insert(buffer_.end(), data, data + size);
+                start_ = dictionarySize;
+            }
+
+            void encode(std::string& out, bool last) {
+                BitWriter writer(out);
+                const size_t end = buffer_.size();
+
+                if (params_.maxChain == 0 || end == start_) {
+                    writeStored(writer, start_, end, last);
+                    return;
+                }
+
+                head_.assign(1 << 15, -1);
+                prev_.assign(end, -1);
+                inserted_ = 0;
+
+                std::vector<Token> tokens;
+                tokens.reserve(kMaxBlockTokens);
+                size_t blockStart = start_;
+                size_t pos = start_;
+                while (pos < end) {
+                    int length = 0;
+                    int dist = 0;
+                    findMatch(pos, length, dist);
+
+                    if (params_.lazy && length >= kMinMatch && length < params_.niceLength && pos + 1 < end) {
+                        int nextLength = 0;
+                        int nextDist = 0;
+                        findMatch(pos + 1, nextLength, nextDist);
+                        if (nextLength > length) {
+                            length = 0;
+                        }
+                    }
+
+                    if (length >= kMinMatch) {
+                        tokens.push_back({static_cast<uint16_t>(length), static_cast<uint16_t>(dist)});
+                        pos += length;
+                    } else {
+                        tokens.push_back({buffer_[pos], 0});
+                        pos++;
+                    }
+
+                    if (tokens.size() >= kMaxBlockTokens) {
+                        writeBlock(writer, tokens, blockStart, pos, last && pos >= end);
+                        tokens.clear();
+                        blockStart = pos;
+                    }
+                }
+                if (!tokens.empty()) {
+                    writeBlock(writer, tokens, blockStart, pos, last);
+                }
+
+                if (!last) {
+                    writeSyncFlush(writer);
+                }
+                writer.alignToByte();
+            }
+
+        private:
+            uint32_t hashAt(size_t pos) const {
+                return ((buffer_[pos] << 10) ^ (buffer_[pos + 1] << 5) ^ buffer_[pos + 2]) & 0x7FFF;
+            }
+
+            void insertUpTo(size_t pos) {
+                const size_t limit = std::min(pos, buffer_.size() >= 2 ? buffer_.size() - 2 : 0);
+                for (; inserted_ < limit; inserted_++) {
+                    const uint32_t hash = hashAt(inserted_);
+                    prev_[inserted_] = head_[hash];
+                    head_[hash] = static_cast<int32_t>(inserted_);
+                }
+            }
+
+            void findMatch(size_t pos, int& bestLength, int& bestDist) {
+                bestLength = 0;
+                bestDist = 0;
+                insertUpTo(pos);
+                if (pos + kMinMatch > buffer_.size()) {
+                    return;
+                }
+
+                const int maxLength = static_cast<int>(std::min<size_t>(kMaxMatch, buffer_.size() - pos));
+                const uint8_t* current = &buffer_[pos];
+                int chain = params_.maxChain;
+                for (int32_t candidate = head_[hashAt(pos)]; candidate >= 0 && chain-- > 0;
+                     candidate = prev_[candidate]) {
+                    const size_t dist = pos - static_cast<size_t>(candidate);
+                    if (dist > kWindowSize) {
+                        break;
+                    }
+                    const uint8_t* match = &buffer_[candidate];
+                    if (bestLength > 0 && match[bestLength] != current[bestLength]) {
+                        continue;
+                    }
+                    int length = 0;
+                    while (length < maxLength && match[length] == current[length]) {
+                        length++;
+                    }
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDist = static_cast<int>(dist);
+                        if (length >= params_.niceLength || length == maxLength) {
+                            break;
+                        }
+                    }
+                }
+                if (bestLength < kMinMatch) {
+                    bestLength = 0;
+                }
+            }
+
+            void writeStored(BitWriter& writer, size_t from, size_t to, bool last) {
+                do {
+                    const size_t chunk = std::min<size_t>(to - from, 0xFFFF);
+                    const bool final = last && from + chunk >= to;
+                    writer.put(final ? 1 : 0, 1);
+                    writer.put(0, 2);
+                    writer.alignToByte();
+                    writer.put(static_cast<uint32_t>(chunk), 16);
+                    writer.put(static_cast<uint32_t>(~chunk & 0xFFFF), 16);
+                    for (size_t i = 0; i < chunk; i++) {
+                        writer.put(buffer_[from + i], 8);
+                    }
+                    from += chunk;
+                } while (from < to);
+            }
+
+            void writeSyncFlush(BitWriter& writer) {
+                writer.put(0, 1);
+                writer.put(0, 2);
+                writer.alignToByte();
+                writer.put(0x0000, 16);
+                writer.put(0xFFFF, 16);
+            }
+
+            void writeBlock(BitWriter& writer, const std::vector<Token>& tokens, size_t from, size_t to, bool last) {
+                const Tables& t = tables();
+                std::array<uint32_t, 286> litFreq{};
+                std::array<uint32_t, 30> distFreq{};
+                uint64_t extraBits = 0;
+                for (const auto& token : tokens) {
+                    if (token.dist == 0) {
+                        litFreq[token.value]++;
+                    } else {
+                        const int lengthCode = t.lengthCode[token.value];
+                        const int distCode = t.distCode[token.dist];
+                        litFreq[257 + lengthCode]++;
+                        distFreq[distCode]++;
+                        extraBits += kLengthExtra[lengthCode] + kDistExtra[distCode];
+                    }
+                }
+                litFreq[kEndOfBlock] = 1;
+
+                std::array<uint8_t, 288> litLengths{};
+                std::array<uint8_t, 30> distLengths{};
+                buildLengths(litFreq.data(), 286, 15, litLengths.data());
+                buildLengths(distFreq.data(), 30, 15, distLengths.data());
+
+                // code length sequence of the dynamic header, run-length coded
+                int litCount = 286;
+                while (litCount > 257 && litLengths[litCount - 1] == 0) {
+                    litCount--;
+                }
+                int distCount = 30;
+                while (distCount > 1 && distLengths[distCount - 1] == 0) {
+                    distCount--;
+                }
+                std::vector<uint8_t> sequence(litLengths.begin(), litLengths.begin() + litCount);
+                sequence.insert(sequence.end(), distLengths.begin(), distLengths.begin() + distCount);
+
+                struct Run {
+                    uint8_t symbol;
+                    uint8_t extra;
+                };
+                std::vector<Run> runs;
+                std::array<uint32_t, 19> clFreq{};
+                for (size_t i = 0; i < sequence.size();) {
+                    const uint8_t value = sequence[i];
+                    size_t run = 1;
+                    while (i + run < sequence.size() && sequence[i + run] == value) {
+                        run++;
+                    }
+                    i += run;
+                    if (value == 0) {
+                        while (run >= 11) {
+                            const size_t n = std::min<size_t>(run, 138);
+                            runs.push_back({18, static_cast<uint8_t>(n - 11)});
+                            run -= n;
+                        }
+                        if (run >= 3) {
+                            runs.push_back({17, static_cast<uint8_t>(run - 3)});
+                            run = 0;
+                        }
+                    } else {
+                        runs.push_back({value, 0});
+                        run--;
+                        while (run >= 3) {
+                            const size_t n = std::min<size_t>(run, 6);
+                            runs.push_back({16, static_cast<uint8_t>(n - 3)});
+                            run -= n;
+                        }
+                    }
+                    for (; run > 0; run--) {
+                        runs.push_back({value, 0});
+                    }
+                }
+                for (const auto& run : runs) {
+                    clFreq[run.symbol]++;
+                }
+                std::array<uint8_t, 19> clLengths{};
+                buildLengths(clFreq.data(), 19, 7, clLengths.data());
+                int clCount = 19;
+                while (clCount > 4 && clLengths[kCodeLengthOrder[clCount - 1]] == 0) {
+                    clCount--;
+                }
+
+                uint64_t dynamicBits = 5 + 5 + 4 + 3 * static_cast<uint64_t>(clCount) + extraBits;
+                for (const auto& run : runs) {
+                    dynamicBits += clLengths[run.symbol] + (run.symbol == 16 ? 2 : run.symbol == 17 ? 3 : run.symbol == 18 ? 7 : 0);
+                }
+                std::array<uint8_t, 288> fixedLit{};
+                std::array<uint8_t, 30> fixedDist{};
+                fixedLengths(fixedLit.data(), fixedDist.data());
+                uint64_t fixedBits = extraBits;
+                for (int i = 0; i < 286; i++) {
+                    dynamicBits += static_cast<uint64_t>(litFreq[i]) * litLengths[i];
+                    fixedBits += static_cast<uint64_t>(litFreq[i]) * fixedLit[i];
+                }
+                for (int i = 0; i < 30; i++) {
+                    dynamicBits += static_cast<uint64_t>(distFreq[i]) * distLengths[i];
+                    fixedBits += static_cast<uint64_t>(distFreq[i]) * fixedDist[i];
+                }
+                const uint64_t storedBits = (to - from) * 8 + ((to - from) / 0xFFFF + 1) * 40;
+
+                if (storedBits < std::min(dynamicBits, fixedBits)) {
+                    writeStored(writer, from, to, last);
+                    return;
+                }
+
+                writer.put(last ? 1 : 0, 1);
+                const bool dynamic = dynamicBits < fixedBits;
+                std::array<Code, 288> litCodes{};
+                std::array<Code, 30> distCodes{};
+                if (dynamic) {
+                    writer.put(2, 2);
+                    writer.put(static_cast<uint32_t>(litCount - 257), 5);
+                    writer.put(static_cast<uint32_t>(distCount - 1), 5);
+                    writer.put(static_cast<uint32_t>(clCount - 4), 4);
+                    for (int i = 0; i < clCount; i++) {
+                        writer.put(clLengths[kCodeLengthOrder[i]], 3);
+                    }
+                    std::array<Code, 19> clCodes{};
+                    buildCodes(clLengths.data(), 19, clCodes.data());
+                    for (const auto& run : runs) {
+                        writer.put(clCodes[run.symbol].bits, clCodes[run.symbol].length);
+                        if (run.symbol == 16) {
+                            writer.put(run.extra, 2);
+                        } else if (run.symbol == 17) {
+                            writer.put(run.extra, 3);
+                        } else if (run.symbol == 18) {
+                            writer.put(run.extra, 7);
+                        }
+                    }
+                    buildCodes(litLengths.data(), 288, litCodes.data());
+                    buildCodes(distLengths.data(), 30, distCodes.data());
+                } else {
+                    writer.put(1, 2);
+                    buildCodes(fixedLit.data(), 288, litCodes.data());
+                    buildCodes(fixedDist.data(), 30, distCodes.data());
+                }
+
+                for (const auto& token : tokens) {
+                    if (token.dist == 0) {
+                        writer.put(litCodes[token.value].bits, litCodes[token.value].length);
+                        continue;
+                    }
+                    const int lengthCode = t.lengthCode[token.value];
+                    const int distCode = t.distCode[token.dist];
+                    writer.put(litCodes[257 + lengthCode].bits, litCodes[257 + lengthCode].length);
+                    writer.put(token.value - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+                    writer.put(distCodes[distCode].bits, distCodes[distCode].length);
+                    writer.put(token.dist - kDistBase[distCode], kDistExtra[distCode]);
+                }
+                writer.put(litCodes[kEndOfBlock].bits, litCodes[kEndOfBlock].length);
+            }
+
+            LevelParams params_;
+            std::vector<uint8_t> buffer_;
+            size_t start_ = 0;
+            std::vector<int32_t> head_;
+            std::vector<int32_t> prev_;
+            size_t inserted_ = 0;
+        };
+
+        class BuiltinBackend : public DeflateBackend {
+        public:
+            std::string name() const override { return "builtin"; }
+
+            bool compress(const uint8_t* dictionary, size_t dictionarySize, const uint8_t* data, size_t size,
+                          int level, bool last, std::string& out) const override {
+                Encoder encoder(dictionary, dictionarySize, data, size, level);
+                encoder.encode(out, last);
+                return true;
+            }
+        };
+
+#ifdef UTILS_WITH_ZLIB
+        // zlib, or zlib-ng built in compatibility mode
+        class ZlibBackend : public DeflateBackend {
+        public:
+            std::string name() const override { return "zlib"; }
+
+            bool compress(const uint8_t* dictionary, size_t dictionarySize, const uint8_t* data, size_t size,
+                          int level, bool last, std::string& out) const override {
+                z_stream stream{};
+                if (deflateInit2(&stream, std::clamp(level, 0, 9), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    return false;
+                }
+                if (dictionarySize > 0) {
+                    dictionarySize = std::min(dictionarySize, kWindowSize);
+                    deflateSetDictionary(&stream, dictionary + 0, static_cast<uInt>(dictionarySize));
+                }
+
+                const size_t offset = out.size();
+                out.resize(offset + deflateBound(&stream, static_cast<uLong>(size)) + 16);
+                stream.next_in = const_cast<Bytef*>(data);
+                stream.avail_in = static_cast<uInt>(size);
+                stream.next_out = reinterpret_cast<Bytef*>(&out[offset]);
+                stream.avail_out = static_cast<uInt>(out.size() - offset);
+                const int result = ::deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+                out.resize(out.size() - stream.avail_out);
+                deflateEnd(&stream);
+                return last ? result == Z_STREAM_END : result == Z_OK;
+            }
+        };
+#endif
+
+        const std::vector<const DeflateBackend*>& backends() {
+            static const BuiltinBackend builtin;
+#ifdef UTILS_WITH_ZLIB
+            static const ZlibBackend zlib;
+            static const std::vector<const DeflateBackend*> list = {&builtin, &zlib};
+#else
+            static const std::vector<const DeflateBackend*> list = {&builtin};
+#endif
+            return list;
+        }
+    }
+
+    std::vector<std::string> deflateBackends() {
+        std::vector<std::string> names;
+        for (const auto* backend : backends()) {
+            names.push_back(backend->name());
+        }
+        return names;
+    }
+
+    const DeflateBackend* findDeflateBackend(const std::string& name) {
+        for (const auto* backend : backends()) {
+            if (backend->name() == name) {
+                return backend;
+            }
+        }
+        return nullptr;
+    }
+
+    bool deflate(const void* data, size_t size, std::string& out, const DeflateOptions& options) {
+        const DeflateBackend* backend = findDeflateBackend(options.backend);
+        if (!backend) {
+            return false;
+        }
+
+        const auto* input = static_cast<const uint8_t*>(data);
+        const size_t blockSize = std::max<size_t>(options.blockSize, kWindowSize);
+        const size_t blockCount = std::max<size_t>(1, (size + blockSize - 1) / blockSize);
+        if (blockCount == 1) {
+            return backend->compress(input, 0, input, size, options.level, true, out);
+        }
+
+        // pigz style: blocks compressed apart, each primed with the 32 KiB before it
+        std::vector<std::string> pieces(blockCount);
+        std::atomic<size_t> next{0};
+        std::atomic<bool> ok{true};
+        auto worker = [&]() {
+            for (size_t i = next++; i < blockCount && ok; i = next++) {
+                const size_t start = i * blockSize;
+                const size_t length = std::min(blockSize, size - start);
+                const size_t history = std::min(start, kWindowSize);
+                if (!backend->compress(input + start - history, history, input + start, length, options.level,
+                                       i + 1 == blockCount, pieces[i])) {
+                    ok = false;
+                }
+            }
+        };
+
+        unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::min<size_t>(threads, blockCount));
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        if (!ok) {
+            return false;
+        }
+
+        size_t total = 0;
+        for (const auto& piece : pieces) {
+            total += piece.size();
+        }
+        out.reserve(out.size() + total);
+        for (const auto& piece : pieces) {
+            out += piece;
+        }
+        return true;
+    }
+}
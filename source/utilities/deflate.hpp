@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+    struct DeflateOptions {
+        std::string backend = "builtin";
+        // 0 stores, 1 is the fastest, 9 the smallest
+        int level = 6;
+        // input compressed as one unit; each unit still sees the 32 KiB before it as history
+        size_t blockSize = 128 * 1024;
+        // 0 for every core
+        unsigned threads = 0;
+    };
+
+    class DeflateBackend {
+    public:
+        virtual ~DeflateBackend() = default;
+
+        virtual std::string name() const = 0;
+        // Appends raw DEFLATE blocks for data to out. Matches may reach back into dictionary, the
+        // input just before data. Unless last, the output ends on a byte boundary after an empty
+        // stored block (a sync flush), so pieces compressed apart concatenate into one stream.
+        virtual bool compress(const uint8_t* dictionary, size_t dictionarySize, const uint8_t* data, size_t size,
+                              int level, bool last, std::string& out) const = 0;
+    };
+
+    // Backends compiled in; "builtin" is always there
+    std::vector<std::string> deflateBackends();
+    const DeflateBackend* findDeflateBackend(const std::string& name);
+
+    // Raw DEFLATE stream (RFC 1951) of data; inputs larger than a block are compressed in parallel
+    bool deflate(const void* data, size_t size, std::string& out, const DeflateOptions& options = {});
+}
@@ -0,0 +1,407 @@
+#include "inflate.hpp"
+#include <cstring>
+#include <vector>
+
+namespace utils {
+    namespace {
+        constexpr int kMaxBits = 15;
+        constexpr int kFastBits = 10;
+        constexpr size_t kWindowSize = 32768;
+        constexpr size_t kOutputChunk = 65536;
+        constexpr size_t kInputChunk = 65536;
+
+        constexpr uint16_t kLengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        constexpr uint8_t kLengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        constexpr uint16_t kDistBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+            8193, 12289, 16385, 24577};
+        constexpr uint8_t kDistExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        constexpr uint8_t kCodeLengthOrder[19] = {
+            16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        // Canonical Huffman code with a direct lookup table for the short codes
+        struct Huffman {
+            uint16_t count[kMaxBits + 1] = {};
+            uint16_t symbol[288] = {};
+            // low 4 bits hold the code length, 0 means the code is longer than kFastBits
+            uint16_t fast[1 << kFastBits] = {};
+
+            bool build(const uint8_t* lengths, int n) {
+                std::memset(count, 0, sizeof(count));
+                for (int i = 0; i < n; i++) {
+                    count[lengths[i]]++;
+                }
+                if (count[0] == n) {
+                    std::memset(fast, 0, sizeof(fast));
+                    return true;
+                }
+
+                int left = 1;
+                for (int len = 1; len <= kMaxBits; len++) {
+                    left <<= 1;
+                    left -= count[len];
+                    if (left < 0) {
+                        return false;
+                    }
+                }
+
+                uint16_t offs[kMaxBits + 1] = {};
+                for (int len = 1; len < kMaxBits; len++) {
+                    offs[len + 1] = offs[len] + count[len];
+                }
+                for (int i = 0; i < n; i++) {
+                    if (lengths[i]) {
+                        symbol[offs[lengths[i]]++] = static_cast<uint16_t>(i);
+                    }
+                }
+
+                std::memset(fast, 0, sizeof(fast));
+                uint32_t code = 0;
+                int index = 0;
+                for (int len = 1; len <= kMaxBits; len++) {
+                    for (int k = 0; k < count[len]; k++, index++, code++) {
+                        if (len > kFastBits) {
+                            continue;
+                        }
+                        uint32_t reversed = 0;
+                        for (int b = 0; b < len; b++) {
+                            reversed |= ((code >> b) & 1) << (len - 1 - b);
+                        }
+                        for (uint32_t fill = reversed; fill < (1u << kFastBits); fill += 1u << len) {
+                            fast[fill] = static_cast<uint16_t>((symbol[index] << 4) | len);
+                        }
+                    }
+                    code <<= 1;
+                }
+                return true;
+            }
+        };
+
+        class Decoder {
+        public:
+            Decoder(const InflateReadFn& read, const InflateWriteFn& write)
+                : read_(read), write_(write), input_(kInputChunk), output_(kWindowSize + kOutputChunk) {}
+
+            bool run() {
+                int last = 0;
+                do {
+                    if (!need(3)) {
+                        return false;
+                    }
+                    last = static_cast<int>(take(1));
+                    int type = static_cast<int>(take(2));
+                    bool ok = false;
+                    switch (type) {
+                    case 0: ok = storedBlock(); break;
+                    case 1: ok = fixedBlock(); break;
+                    case 2: ok = dynamicBlock(); break;
+                    default: return false;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                } while (!last);
+                return flush(outPos_);
+            }
+
+        private:
+            int nextByte() {
+                if (inPos_ == inSize_) {
+                    if (inputDone_) {
+                        return -1;
+                    }
+                    inSize_ = read_(input_.data(), input_.size());
+                    inPos_ = 0;
+                    if (inSize_ == 0) {
+                        inputDone_ = true;
+                        return -1;
+                    }
+                }
+                return input_[inPos_++];
+            }
+
+            bool need(int bits) {
+                while (bitCount_ < bits) {
+                    int byte = nextByte();
+                    if (byte < 0) {
+                        return false;
+                    }
+                    bitBuffer_ |= static_cast<uint64_t>(byte) << bitCount_;
+                    bitCount_ += 8;
+                }
+                return true;
+            }
+
+            // Loads as many bits as available up to the requested amount without failing at end of input
+            void prefetch(int bits) {
+                while (bitCount_ < bits) {
+                    int byte = nextByte();
+                    if (byte < 0) {
+                        return;
+                    }
+                    bitBuffer_ |= static_cast<uint64_t>(byte) << bitCount_;
+                    bitCount_ += 8;
+                }
+            }
+
+            uint32_t take(int bits) {
+                uint32_t v = static_cast<uint32_t>(bitBuffer_ & ((1ull << bits) - 1));
+                bitBuffer_ >>= bits;
+                bitCount_ -= bits;
+                return v;
+            }
+
+            int decode(const Huffman& h) {
+                prefetch(kFastBits);
+                if (bitCount_ >= kFastBits) {
+                    uint16_t entry = h.fast[bitBuffer_ & ((1u << kFastBits) - 1)];
+                    if (entry) {
+                        take(entry & 0xF);
+                        return entry >> 4;
+                    }
+                }
+
+                int code = 0, first = 0, index = 0;
+                for (int len = 1; len <= kMaxBits; len++) {
+                    if (!need(1)) {
+                        return -1;
+                    }
+                    code |= static_cast<int>(take(1));
+                    int count = h.count[len];
+                    if (code - count < first) {
+                        return h.symbol[index + (code - first)];
+                    }
+                    index += count;
+                    first += count;
+                    first <<= 1;
+                    code <<= 1;
+                }
+                return -1;
+            }
+
+            bool flush(size_t upTo) {
+                if (upTo > flushed_) {
+                    if (!write_(output_.data() + flushed_, upTo - flushed_)) {
+                        return false;
+                    }
+                    flushed_ = upTo;
+                }
+                return true;
+            }
+
+            // Keeps the last 32 KiB as history once the output buffer is full
+            bool makeRoom() {
+                if (outPos_ < output_.size()) {
+                    return true;
+                }
+                if (!flush(outPos_)) {
+                    return false;
+                }
+                std::memmove(output_.data(), output_.data() + outPos_ - kWindowSize, kWindowSize);
+                outPos_ = kWindowSize;
+                flushed_ = kWindowSize;
+                return true;
+            }
+
+            bool storedBlock() {
+                take(bitCount_ % 8);
+                if (!need(32)) {
+                    return false;
+                }
+                uint32_t len = take(16);
+                uint32_t nlen = take(16);
+                if (len != (~nlen & 0xFFFF)) {
+                    return false;
+                }
+                while (len--) {
+                    int byte;
+                    if (bitCount_ >= 8) {
+                        byte = static_cast<int>(take(8));
+                    } else {
+                        byte = nextByte();
+                        if (byte < 0) {
+                            return false;
+                        }
+                    }
+                    if (!makeRoom()) {
+                        return false;
+                    }
+                    output_[outPos_++] = static_cast<uint8_t>(byte);
+                }
+                return true;
+            }
+
+            bool codes(const Huffman& lengthCode, const Huffman& distCode) {
+                for (;;) {
+                    int sym = decode(lengthCode);
+                    if (sym < 0) {
+                        return false;
+                    }
+                    if (sym < 256) {
+                        if (!makeRoom()) {
+                            return false;
+                        }
+                        output_[outPos_++] = static_cast<uint8_t>(sym);
+                        continue;
+                    }
+                    if (sym == 256) {
+                        return true;
+                    }
+
+                    sym -= 257;
+                    if (sym >= 29 || !need(kLengthExtra[sym])) {
+                        return false;
+                    }
+                    size_t len = kLengthBase[sym] + take(kLengthExtra[sym]);
+
+                    int distSym = decode(distCode);
+                    if (distSym < 0 || distSym >= 30 || !need(kDistExtra[distSym])) {
+                        return false;
+                    }
+                    size_t dist = kDistBase[distSym] + take(kDistExtra[distSym]);
+                    if (dist > outPos_) {
+                        return false;
+                    }
+
+                    while (len--) {
+                        if (!makeRoom()) {
+                            return false;
+                        }
+                        output_[outPos_] = output_[outPos_ - dist];
+                        outPos_++;
+                    }
+                }
+            }
+
+            bool fixedBlock() {
+                static const Huffman* tables = [] {
+                    static Huffman fixed[2];
+                    uint8_t lengths[288];
+                    for (int i = 0; i < 144; i++) lengths[i] = 8;
+                    for (int i = 144; i < 256; i++) lengths[i] = 9;
+                    for (int i = 256; i < 280; i++) lengths[i] = 7;
+                    for (int i = 280; i < 288; i++) lengths[i] = 8;
+                    fixed[0].build(lengths, 288);
+                    for (int i = 0; i < 30; i++) lengths[i] = 5;
+                    fixed[1].build(lengths, 30);
+                    return fixed;
+                }();
+                return codes(tables[0], tables[1]);
+            }
+
+            bool dynamicBlock() {
+                if (!need(14)) {
+                    return false;
+                }
+                int nlen = static_cast<int>(take(5)) + 257;
+                int ndist = static_cast<int>(take(5)) + 1;
+                int ncode = static_cast<int>(take(4)) + 4;
+                if (nlen > 286 || ndist > 30) {
+                    return false;
+                }
+
+                uint8_t lengths[320] = {};
+                for (int i = 0; i < ncode; i++) {
+                    if (!need(3)) {
+                        return false;
+                    }
+                    lengths[kCodeLengthOrder[i]] = static_cast<uint8_t>(take(3));
+                }
+
+                Huffman lengthCode;
+                if (!lengthCode.build(lengths, 19)) {
+                    return false;
+                }
+
+                std::memset(lengths, 0, sizeof(lengths));
+                int index = 0;
+                while (index < nlen + ndist) {
+                    int sym = decode(lengthCode);
+                    if (sym < 0) {
+                        return false;
+                    }
+                    if (sym < 16) {
+                        lengths[index++] = static_cast<uint8_t>(sym);
+                        continue;
+                    }
+
+                    uint8_t repeatValue = 0;
+                    int repeat = 0;
+                    if (sym == 16) {
+                        if (index == 0 || !need(2)) {
+                            return false;
+                        }
+                        repeatValue = lengths[index - 1];
+                        repeat = 3 + static_cast<int>(take(2));
+                    } else if (sym == 17) {
+                        if (!need(3)) {
+                            return false;
+                        }
+                        repeat = 3 + static_cast<int>(take(3));
+                    } else {
+                        if (!need(7)) {
+                            return false;
+                        }
+                        repeat = 11 + static_cast<int>(take(7));
+                    }
+                    if (index + repeat > nlen + ndist) {
+                        return false;
+                    }
+                    while (repeat--) {
+                        lengths[index++] = repeatValue;
+                    }
+                }
+
+                if (lengths[256] == 0) {
+                    return false;
+                }
+
+                Huffman literalCode, distCode;
+                if (!literalCode.build(lengths, nlen) || !distCode.build(lengths + nlen, ndist)) {
+                    return false;
+                }
+                return codes(literalCode, distCode);
+            }
+
+            const InflateReadFn& read_;
+            const InflateWriteFn& write_;
+            std::vector<uint8_t> input_;
+            size_t inPos_ = 0;
+            size_t inSize_ = 0;
+            bool inputDone_ = false;
+            uint64_t bitBuffer_ = 0;
+            int bitCount_ = 0;
+            std::vector<uint8_t> output_;
+            size_t outPos_ = 0;
+            size_t flushed_ = 0;
+        };
+    }
+
+    bool inflate(const InflateReadFn& read, const InflateWriteFn& write) {
+        Decoder decoder(read, write);
+        return decoder.run();
+    }
+
+    bool inflate(const void* data, size_t size, std::string& out) {
+        const auto* p = static_cast<const uint8_t*>(data);
+        size_t pos = 0;
+        return inflate(
+            [&](uint8_t* buffer, size_t n) {
+                size_t chunk = std::min(n, size - pos);
+                std::memcpy(buffer, p + pos, chunk);
+                pos += chunk;
+                return chunk;
+            },
+            [&](const uint8_t* chunk, size_t n) {
+                out.append(reinterpret_cast<const char*>(chunk), n);
+                return true;
+            });
+    }
+}
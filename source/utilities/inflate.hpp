@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace utils {
+    // Pulls up to size bytes of compressed input, returns 0 at end of input
+    using InflateReadFn = std::function<size_t(uint8_t* buffer, size_t size)>;
+    // Receives decoded output in chunks, return false to stop early
+    using InflateWriteFn = std::function<bool(const uint8_t* data, size_t size)>;
+
+    // Decodes a raw DEFLATE stream (RFC 1951) with bounded memory
+    bool inflate(const InflateReadFn& read, const InflateWriteFn& write);
+    bool inflate(const void* data, size_t size, std::string& out);
+}
@@ -0,0 +1,232 @@
+#include "macho.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace utils::macho {
+    namespace {
+        constexpr uint32_t kFatMagic = 0xCAFEBABE;
+        constexpr uint32_t kFatMagic64 = 0xCAFEBABF;
+        // MH_MAGIC / MH_MAGIC_64 read big endian from a little endian file
+        constexpr uint32_t kThinMagicLe = 0xCEFAEDFE;
+        constexpr uint32_t kThinMagic64Le = 0xCFFAEDFE;
+        constexpr uint32_t kCpuArch64 = 0x01000000;
+        constexpr uint32_t kCpuTypeX86 = 7;
+        constexpr uint32_t kCpuTypeArm = 12;
+        // Java class files share the fat magic, their version number is always far above this
+        constexpr uint32_t kMaxSlices = 30;
+        constexpr size_t kCopyChunk = 1 << 20;
+
+        uint32_t getBe32(const uint8_t* p) {
+            return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                   (static_cast<uint32_t>(p[2]) << 8) | p[3];
+        }
+
+        uint32_t getLe32(const uint8_t* p) {
+            return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                   (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+        }
+
+        uint64_t getBe64(const uint8_t* p) {
+            return (static_cast<uint64_t>(getBe32(p)) << 32) | getBe32(p + 4);
+        }
+
+        void putBe32(std::string& out, uint32_t v) {
+            out.push_back(static_cast<char>(v >> 24));
+            out.push_back(static_cast<char>((v >> 16) & 0xFF));
+            out.push_back(static_cast<char>((v >> 8) & 0xFF));
+            out.push_back(static_cast<char>(v & 0xFF));
+        }
+
+        void putBe64(std::string& out, uint64_t v) {
+            putBe32(out, static_cast<uint32_t>(v >> 32));
+            putBe32(out, static_cast<uint32_t>(v & 0xFFFFFFFF));
+        }
+
+        bool copyRange(std::ifstream& in, std::ofstream& out, uint64_t offset, uint64_t size) {
+            in.clear();
+            in.seekg(static_cast<std::streamoff>(offset));
+            std::vector<char> buffer(kCopyChunk);
+            while (size > 0) {
+                const size_t chunk = static_cast<size_t>(std::min<uint64_t>(size, buffer.size()));
+                in.read(buffer.data(), static_cast<std::streamsize>(chunk));
+                if (static_cast<size_t>(in.gcount()) != chunk) {
+                    return false;
+                }
+                out.write(buffer.data(), static_cast<std::streamsize>(chunk));
+                size -= chunk;
+            }
+            return out.good();
+        }
+    }
+
+    std::string Slice::archName() const {
+        const uint32_t subtype = cpuSubtype & 0x00FFFFFF;
+        switch (cpuType) {
+        case kCpuTypeX86:
+            return "i386";
+        case kCpuTypeX86 | kCpuArch64:
+            return "x86_64";
+        case kCpuTypeArm:
+            return subtype == 11 ? "armv7s" : (subtype == 9 ? "armv7" : "arm");
+        case kCpuTypeArm | kCpuArch64:
+            return subtype == 2 ? "arm64e" : "arm64";
+        default:
+            return "cpu" + std::to_string(cpuType);
+        }
+    }
+
+    bool readSlices(const std::string& path, std::vector<Slice>& slices) {
+        slices.clear();
+        std::ifstream in(path, std::ios::binary);
+        uint8_t header[8];
+        if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+            return false;
+        }
+
+        const uint32_t magic = getBe32(header);
+        const uint32_t count = getBe32(header + 4);
+        if ((magic != kFatMagic && magic != kFatMagic64) || count == 0 || count > kMaxSlices) {
+            return false;
+        }
+
+        const size_t archSize = magic == kFatMagic64 ? 32 : 20;
+        std::vector<uint8_t> table(archSize * count);
+        if (!in.read(reinterpret_cast<char*>(table.data()), static_cast<std::streamsize>(table.size()))) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint8_t* arch = &table[i * archSize];
+            Slice slice;
+            slice.cpuType = getBe32(arch);
+            slice.cpuSubtype = getBe32(arch + 4);
+            if (magic == kFatMagic64) {
+                slice.offset = getBe64(arch + 8);
+                slice.size = getBe64(arch + 16);
+                slice.align = getBe32(arch + 24);
+            } else {
+                slice.offset = getBe32(arch + 8);
+                slice.size = getBe32(arch + 12);
+                slice.align = getBe32(arch + 16);
+            }
+            slices.push_back(slice);
+        }
+        return true;
+    }
+
+    std::vector<std::string> archsOf(const uint8_t* data, size_t size) {
+        std::vector<std::string> archs;
+        if (size < 12) {
+            return archs;
+        }
+        const uint32_t magic = getBe32(data);
+        if (magic == kFatMagic || magic == kFatMagic64) {
+            const uint32_t count = getBe32(data + 4);
+            const size_t archSize = magic == kFatMagic64 ? 32 : 20;
+            if (count == 0 || count > kMaxSlices || 8 + count * archSize > size) {
+                return archs;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                Slice slice;
+                slice.cpuType = getBe32(data + 8 + i * archSize);
+                slice.cpuSubtype = getBe32(data + 12 + i * archSize);
+                archs.push_back(slice.archName());
+            }
+            return archs;
+        }
+        // thin binaries are in the target's byte order, little endian for every Apple CPU since PowerPC
+        if (magic == kThinMagicLe || magic == kThinMagic64Le) {
+            Slice slice;
+            slice.cpuType = getLe32(data + 4);
+            slice.cpuSubtype = getLe32(data + 8);
+            archs.push_back(slice.archName());
+        }
+        return archs;
+    }
+
+    ThinResult thin(const std::string& path, const std::vector<std::string>& keep, std::vector<std::string>* removed) {
+        std::vector<Slice> slices;
+        if (!readSlices(path, slices)) {
+            return ThinResult::NotFat;
+        }
+
+        std::vector<Slice> kept;
+        for (const auto& slice : slices) {
+            if (std::find(keep.begin(), keep.end(), slice.archName()) != keep.end()) {
+                kept.push_back(slice);
+            } else if (removed) {
+                removed->push_back(slice.archName());
+            }
+        }
+        if (kept.empty()) {
+            return ThinResult::NoMatch;
+        }
+        if (kept.size() == slices.size()) {
+            return ThinResult::Unchanged;
+        }
+
+        std::ifstream in(path, std::ios::binary);
+        const std::string tempPath = path + ".thin";
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!in || !out) {
+            return ThinResult::Failed;
+        }
+
+        bool ok = true;
+        if (kept.size() == 1) {
+            ok = copyRange(in, out, kept.front().offset, kept.front().size);
+        } else {
+            // a smaller universal binary, slices packed again at their own alignment
+            const bool wide = std::any_of(kept.begin(), kept.end(), [](const Slice& slice) {
+                return slice.offset + slice.size > 0xFFFFFFFFu;
+            });
+            uint64_t offset = 8 + kept.size() * (wide ? 32 : 20);
+            std::vector<uint64_t> offsets;
+            for (const auto& slice : kept) {
+                const uint64_t alignment = uint64_t(1) << std::min<uint32_t>(slice.align, 20);
+                offset = (offset + alignment - 1) / alignment * alignment;
+                offsets.push_back(offset);
+                offset += slice.size;
+            }
+
+            std::string header;
+            putBe32(header, wide ? kFatMagic64 : kFatMagic);
+            putBe32(header, static_cast<uint32_t>(kept.size()));
+            for (size_t i = 0; i < kept.size(); i++) {
+                putBe32(header, kept[i].cpuType);
+                putBe32(header, kept[i].cpuSubtype);
+                if (wide) {
+                    putBe64(header, offsets[i]);
+                    putBe64(header, kept[i].size);
+                    putBe32(header, kept[i].align);
+                    putBe32(header, 0);
+                } else {
+                    putBe32(header, static_cast<uint32_t>(offsets[i]));
+                    putBe32(header, static_cast<uint32_t>(kept[i].size));
+                    putBe32(header, kept[i].align);
+                }
+            }
+            out.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+            uint64_t written = header.size();
+            for (size_t i = 0; i < kept.size() && ok; i++) {
+                const std::string padding(static_cast<size_t>(offsets[i] - written), '\0');
+                out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+                ok = copyRange(in, out, kept[i].offset, kept[i].size);
+                written = offsets[i] + kept[i].size;
+            }
+        }
+
+        in.close();
+        out.close();
+        std::error_code ec;
+        if (!ok || !out) {
+            std::filesystem::remove(tempPath, ec);
+            return ThinResult::Failed;
+        }
+        // keeps the executable bit of the original
+        std::filesystem::permissions(tempPath, std::filesystem::status(path, ec).permissions(), ec);
+        std::filesystem::rename(tempPath, path, ec);
+        return ec ? ThinResult::Failed : ThinResult::Thinned;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils::macho {
+    struct Slice {
+        uint32_t cpuType = 0;
+        uint32_t cpuSubtype = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        // power of two
+        uint32_t align = 0;
+
+        std::string archName() const;
+    };
+
+    enum class ThinResult {
+        NotFat,
+        Unchanged,
+        Thinned,
+        // none of the slices is wanted, the file is left alone
+        NoMatch,
+        Failed,
+    };
+
+    // Slices of a universal binary, false when the file is not one
+    bool readSlices(const std::string& path, std::vector<Slice>& slices);
+
+    // Architectures of a thin or universal binary from the start of the file, 4 KiB holds any
+    // slice table; empty when it is not a Mach-O
+    std::vector<std::string> archsOf(const uint8_t* data, size_t size);
+
+    // Drops every slice whose architecture is not in keep ("arm64", "armv7", ...). A single slice
+    // left is written as a plain thin binary, several as a smaller universal binary.
+    ThinResult thin(const std::string& path, const std::vector<std::string>& keep,
+                    std::vector<std::string>* removed = nullptr);
+}
@@ -0,0 +1,87 @@
+#include "pattern_matcher.hpp"
+#include <queue>
+
+namespace utils {
+    size_t PatternMatcher::addPattern(const std::string& bytes) {
+        patterns_.push_back(bytes);
+        compiled_ = false;
+        return patterns_.size() - 1;
+    }
+
+    void PatternMatcher::compile() {
+        // trie first, -1 marks a missing edge until the failure links fill it in
+        transitions_.assign(256, -1);
+        outputs_.assign(1, {});
+        for (size_t p = 0; p < patterns_.size(); p++) {
+            int32_t node = 0;
+            for (unsigned char c : patterns_[p]) {
+                int32_t& next = transitions_[static_cast<size_t>(node) * 256 + c];
+                if (next < 0) {
+                    next = static_cast<int32_t>(outputs_.size());
+                    outputs_.emplace_back();
+                    transitions_.resize(transitions_.size() + 256, -1);
+                }
+                node = transitions_[static_cast<size_t>(node) * 256 + c];
+            }
+            if (!patterns_[p].empty()) {
+                outputs_[node].push_back(p);
+            }
+        }
+
+        std::vector<int32_t> fail(outputs_.size(), 0);
+        std::queue<int32_t> queue;
+        for (int c = 0; c < 256; c++) {
+            int32_t& next = transitions_[c];
+            if (next < 0) {
+                next = 0;
+            } else {
+                queue.push(next);
+            }
+        }
+
+        while (!queue.empty()) {
+            const int32_t node = queue.front();
+            queue.pop();
+            const auto& inherited = outputs_[fail[node]];
+            outputs_[node].insert(outputs_[node].end(), inherited.begin(), inherited.end());
+
+            for (int c = 0; c < 256; c++) {
+                int32_t& next = transitions_[static_cast<size_t>(node) * 256 + c];
+                const int32_t viaFail = transitions_[static_cast<size_t>(fail[node]) * 256 + c];
+                if (next < 0) {
+                    next = viaFail;
+                } else {
+                    fail[next] = viaFail;
+                    queue.push(next);
+                }
+            }
+        }
+        compiled_ = true;
+    }
+
+    int32_t PatternMatcher::feed(int32_t state, const uint8_t* data, size_t size, uint64_t baseOffset, const MatchFn& onMatch) const {
+        if (!compiled_) {
+            return state;
+        }
+        const int32_t* table = transitions_.data();
+        for (size_t i = 0; i < size; i++) {
+            state = table[static_cast<size_t>(state) * 256 + data[i]];
+            const auto& matches = outputs_[state];
+            if (!matches.empty()) {
+                const uint64_t end = baseOffset + i + 1;
+                for (size_t p : matches) {
+                    onMatch(p, end - patterns_[p].size());
+                }
+            }
+        }
+        return state;
+    }
+
+    std::vector<std::pair<size_t, uint64_t>> PatternMatcher::findAll(const void* data, size_t size) const {
+        std::vector<std::pair<size_t, uint64_t>> found;
+        feed(0, static_cast<const uint8_t*>(data), size, 0, [&found](size_t pattern, uint64_t offset) {
+            found.emplace_back(pattern, offset);
+        });
+        return found;
+    }
+}
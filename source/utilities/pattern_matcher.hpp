@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace utils {
+    // Aho-Corasick automaton over raw bytes. Once compiled it is immutable, the scan state
+    // lives with the caller so one matcher can be fed from several threads and across chunks.
+    class PatternMatcher {
+    public:
+        using MatchFn = std::function<void(size_t pattern, uint64_t offset)>;
+
+        size_t addPattern(const std::string& bytes);
+        void compile();
+
+        size_t patternCount() const { return patterns_.size(); }
+        const std::string& pattern(size_t index) const { return patterns_[index]; }
+
+        // Feeds a chunk starting at baseOffset of the stream and returns the state for the
+        // next chunk, start a stream with state 0. Offsets reported are of the first byte.
+        int32_t feed(int32_t state, const uint8_t* data, size_t size, uint64_t baseOffset, const MatchFn& onMatch) const;
+
+        std::vector<std::pair<size_t, uint64_t>> findAll(const void* data, size_t size) const;
+
+    private:
+        std::vector<std::string> patterns_;
+        std::vector<int32_t> transitions_;
+        std::vector<std::vector<size_t>> outputs_;
+        bool compiled_ = false;
+    };
+}
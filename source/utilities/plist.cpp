@@ -0,0 +1,631 @@
+#include "plist.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+
+namespace utils::plist {
+    namespace {
+        constexpr size_t kTrailerSize = 32;
+        constexpr size_t kMaxDepth = 64;
+
+        class Binary {
+        public:
+            explicit Binary(const std::string& data)
+                : data_(reinterpret_cast<const uint8_t*>(data.data())), size_(data.size()) {}
+
+            bool readTop(Dictionary& dictionary) {
+                uint64_t top = 0;
+                if (!readTrailer(top)) {
+                    return false;
+                }
+
+                size_t pos = 0;
+                uint64_t count = 0;
+                if (!object(top, pos) || (data_[pos] >> 4) != 0xD || !readCount(pos, count) ||
+                    count > (size_ - pos) / (2 * refSize_)) {
+                    return false;
+                }
+                for (uint64_t i = 0; i < count; i++) {
+                    const std::optional<std::string> key = scalar(get(data_ + pos + i * refSize_, refSize_));
+                    if (!key) {
+                        continue;
+                    }
+                    const uint64_t valueRef = get(data_ + pos + (count + i) * refSize_, refSize_);
+                    std::vector<std::string> items;
+                    if (itemsOf(valueRef, items)) {
+                        dictionary[*key] = std::move(items);
+                    }
+                }
+                return true;
+            }
+
+            // out gets the rewritten file, left empty when no value changes
+            bool setStrings(std::vector<StringEdit>& edits, std::string& out) {
+                uint64_t top = 0;
+                if (!readTrailer(top)) {
+                    return false;
+                }
+                std::vector<Node> nodes(static_cast<size_t>(objectCount_));
+                for (uint64_t i = 0; i < objectCount_; i++) {
+                    if (!readNode(i, nodes[i])) {
+                        return false;
+                    }
+                }
+                Node& dict = nodes[top];
+                if (dict.type != 0xD) {
+                    return false;
+                }
+
+                struct Pair {
+                    std::optional<std::string> key;
+                    // only set for string values, the only ones the rules replace
+                    std::optional<std::string> value;
+                    uint64_t keyRef;
+                    uint64_t valueRef;
+                };
+                const size_t count = dict.refs.size() / 2;
+                std::vector<Pair> pairs;
+                for (size_t i = 0; i < count; i++) {
+                    const uint64_t valueRef = dict.refs[count + i];
+                    const bool isString = valueRef < objectCount_ &&
+                                          (nodes[valueRef].type == 0x5 || nodes[valueRef].type == 0x6);
+                    pairs.push_back({scalar(dict.refs[i]), isString ? scalar(valueRef) : std::nullopt,
+                                     dict.refs[i], valueRef});
+                }
+                auto findString = [&](const std::string& key) {
+                    return std::find_if(pairs.begin(), pairs.end(),
+                                        [&](const Pair& pair) { return pair.key == key && pair.value; });
+                };
+                auto addString = [&](const std::string& value) {
+                    nodes.push_back({0x5, encodeString(value), {}});
+                    return static_cast<uint64_t>(nodes.size() - 1);
+                };
+
+                bool modified = false;
+                for (auto& edit : edits) {
+                    edit.result = StringEdit::Missing;
+                    const auto found = findString(edit.key);
+                    if (found != pairs.end()) {
+                        edit.result = StringEdit::Updated;
+                        if (*found->value != edit.value) {
+                            found->value = edit.value;
+                            found->valueRef = addString(edit.value);
+                            modified = true;
+                        }
+                        continue;
+                    }
+                    if (edit.insertAfter.empty()) {
+                        continue;
+                    }
+                    const auto anchor = findString(edit.insertAfter);
+                    if (anchor != pairs.end()) {
+                        const uint64_t keyRef = addString(edit.key);
+                        const uint64_t valueRef = addString(edit.value);
+                        pairs.insert(anchor + 1, {edit.key, edit.value, keyRef, valueRef});
+                        edit.result = StringEdit::Added;
+                        modified = true;
+                    }
+                }
+                if (!modified) {
+                    return true;
+                }
+
+                // nodes may have moved when new strings were added
+                Node& edited = nodes[top];
+                edited.refs.clear();
+                for (const auto& pair : pairs) {
+                    edited.refs.push_back(pair.keyRef);
+                }
+                for (const auto& pair : pairs) {
+                    edited.refs.push_back(pair.valueRef);
+                }
+
+                const size_t refSize = widthFor(nodes.size());
+                std::string result(reinterpret_cast<const char*>(data_), 8);
+                std::vector<uint64_t> offsets;
+                for (const auto& node : nodes) {
+                    offsets.push_back(result.size());
+                    if (node.raw.empty()) {
+                        putCount(result, node.type, node.type == 0xD ? node.refs.size() / 2 : node.refs.size());
+                        for (const uint64_t ref : node.refs) {
+                            put(result, ref, refSize);
+                        }
+                    } else {
+                        result += node.raw;
+                    }
+                }
+                const uint64_t offsetTable = result.size();
+                const size_t offsetSize = widthFor(offsetTable);
+                for (const uint64_t offset : offsets) {
+                    put(result, offset, offsetSize);
+                }
+                // unused bytes and the sort version are kept
+                result.append(reinterpret_cast<const char*>(data_ + size_ - kTrailerSize), 6);
+                result.push_back(static_cast<char>(offsetSize));
+                result.push_back(static_cast<char>(refSize));
+                put(result, nodes.size(), 8);
+                put(result, top, 8);
+                put(result, offsetTable, 8);
+                out = std::move(result);
+                return true;
+            }
+
+        private:
+            // an object being rewritten: containers by their references, anything else by its bytes
+            struct Node {
+                uint8_t type = 0;
+                std::string raw;
+                std::vector<uint64_t> refs;
+            };
+
+            bool readTrailer(uint64_t& top) {
+                if (size_ < 8 + kTrailerSize || std::memcmp(data_, "bplist0", 7) != 0) {
+                    return false;
+                }
+                const uint8_t* trailer = data_ + size_ - kTrailerSize;
+                offsetSize_ = trailer[6];
+                refSize_ = trailer[7];
+                objectCount_ = get(trailer + 8, 8);
+                top = get(trailer + 16, 8);
+                offsetTable_ = get(trailer + 24, 8);
+                return offsetSize_ > 0 && offsetSize_ <= 8 && refSize_ > 0 && refSize_ <= 8 &&
+                       offsetTable_ <= size_ && objectCount_ <= (size_ - offsetTable_) / offsetSize_ &&
+                       top < objectCount_;
+            }
+
+            bool readNode(uint64_t ref, Node& node) const {
+                size_t pos = 0;
+                if (!object(ref, pos)) {
+                    return false;
+                }
+                const size_t start = pos;
+                const uint8_t marker = data_[pos];
+                const size_t low = marker & 0x0F;
+                node.type = marker >> 4;
+                uint64_t count = 0;
+                uint64_t length = 0;
+                switch (node.type) {
+                case 0x0:
+                    length = 1;
+                    break;
+                case 0x1:
+                case 0x2:
+                    length = 1 + (uint64_t(1) << low);
+                    break;
+                case 0x3:
+                    length = 9;
+                    break;
+                case 0x8:
+                    length = 2 + low;
+                    break;
+                case 0x4:
+                case 0x5:
+                case 0x6:
+                    if (!readCount(pos, count) || count > size_) {
+                        return false;
+                    }
+                    length = (pos - start) + count * (node.type == 0x6 ? 2 : 1);
+                    break;
+                case 0xA:
+                case 0xC:
+                case 0xD: {
+                    if (!readCount(pos, count) || count > size_) {
+                        return false;
+                    }
+                    const uint64_t refs = node.type == 0xD ? count * 2 : count;
+                    if (refs > (size_ - pos) / refSize_) {
+                        return false;
+                    }
+                    for (uint64_t i = 0; i < refs; i++) {
+                        node.refs.push_back(get(data_ + pos + i * refSize_, refSize_));
+                    }
+                    return true;
+                }
+                default:
+                    return false;
+                }
+                if (length > offsetTable_ - start) {
+                    return false;
+                }
+                node.raw.assign(reinterpret_cast<const char*>(data_ + start), static_cast<size_t>(length));
+                return true;
+            }
+
+            static size_t widthFor(uint64_t value) {
+                return value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+            }
+
+            static void put(std::string& out, uint64_t value, size_t n) {
+                for (size_t i = n; i > 0; i--) {
+                    out.push_back(static_cast<char>(value >> ((i - 1) * 8)));
+                }
+            }
+
+            static void putCount(std::string& out, uint8_t type, uint64_t count) {
+                if (count < 0x0F) {
+                    out.push_back(static_cast<char>((type << 4) | count));
+                    return;
+                }
+                const size_t width = widthFor(count);
+                out.push_back(static_cast<char>((type << 4) | 0x0F));
+                out.push_back(static_cast<char>(0x10 | (width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3)));
+                put(out, count, width);
+            }
+
+            // ASCII as is, anything else as UTF-16
+            static std::string encodeString(const std::string& value) {
+                std::string out;
+                if (std::all_of(value.begin(), value.end(), [](char c) { return (c & 0x80) == 0; })) {
+                    putCount(out, 0x5, value.size());
+                    return out + value;
+                }
+                std::vector<uint16_t> units;
+                for (size_t i = 0; i < value.size();) {
+                    const uint8_t lead = static_cast<uint8_t>(value[i]);
+                    const size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+                    uint32_t c = 0xFFFD;
+                    if (length == 1) {
+                        c = lead;
+                    } else if (length > 1 && i + length <= value.size()) {
+                        c = lead & (0x7F >> length);
+                        for (size_t k = 1; k < length; k++) {
+                            c = (c << 6) | (static_cast<uint8_t>(value[i + k]) & 0x3F);
+                        }
+                    }
+                    i += length == 0 || i + length > value.size() ? 1 : length;
+                    if (c >= 0x10000) {
+                        units.push_back(static_cast<uint16_t>(0xD800 + ((c - 0x10000) >> 10)));
+                        units.push_back(static_cast<uint16_t>(0xDC00 + ((c - 0x10000) & 0x3FF)));
+                    } else {
+                        units.push_back(static_cast<uint16_t>(c));
+                    }
+                }
+                putCount(out, 0x6, units.size());
+                for (const uint16_t unit : units) {
+                    put(out, unit, 2);
+                }
+                return out;
+            }
+
+            static uint64_t get(const uint8_t* p, size_t n) {
+                uint64_t value = 0;
+                for (size_t i = 0; i < n; i++) {
+                    value = (value << 8) | p[i];
+                }
+                return value;
+            }
+
+            // start of an object, false when the reference or its offset points outside the file
+            bool object(uint64_t ref, size_t& pos) const {
+                if (ref >= objectCount_) {
+                    return false;
+                }
+                const uint64_t offset = get(data_ + offsetTable_ + ref * offsetSize_, offsetSize_);
+                if (offset >= offsetTable_) {
+                    return false;
+                }
+                pos = static_cast<size_t>(offset);
+                return true;
+            }
+
+            // length in the marker's low nibble, or a following int object when that is 0xF
+            bool readCount(size_t& pos, uint64_t& count) const {
+                const uint8_t marker = data_[pos++];
+                count = marker & 0x0F;
+                if (count != 0x0F) {
+                    return true;
+                }
+                if (pos >= size_ || (data_[pos] >> 4) != 0x1) {
+                    return false;
+                }
+                const size_t width = size_t(1) << (data_[pos] & 0x0F);
+                if (width > 8 || pos + 1 + width > size_) {
+                    return false;
+                }
+                count = get(data_ + pos + 1, width);
+                pos += 1 + width;
+                return true;
+            }
+
+            std::optional<std::string> scalar(uint64_t ref) const {
+                size_t pos = 0;
+                if (!object(ref, pos)) {
+                    return std::nullopt;
+                }
+                const uint8_t marker = data_[pos];
+                const size_t low = marker & 0x0F;
+                char buffer[32];
+                switch (marker >> 4) {
+                case 0x0:
+                    if (marker == 0x08 || marker == 0x09) {
+                        return std::string(marker == 0x09 ? "true" : "false");
+                    }
+                    return std::nullopt;
+                case 0x1: {
+                    const size_t width = size_t(1) << low;
+                    if (width > 8 || pos + 1 + width > size_) {
+                        return std::nullopt;
+                    }
+                    const uint64_t value = get(data_ + pos + 1, width);
+                    return width == 8 ? std::to_string(static_cast<int64_t>(value)) : std::to_string(value);
+                }
+                case 0x2:
+                case 0x3: {
+                    // reals, and dates as seconds since 2001-01-01
+                    const size_t width = (marker >> 4) == 0x3 ? 8 : size_t(1) << low;
+                    if ((width != 4 && width != 8) || pos + 1 + width > size_) {
+                        return std::nullopt;
+                    }
+                    const uint64_t bits = get(data_ + pos + 1, width);
+                    double value = 0;
+                    if (width == 4) {
+                        float f;
+                        const uint32_t narrow = static_cast<uint32_t>(bits);
+                        std::memcpy(&f, &narrow, sizeof(f));
+                        value = f;
+                    } else {
+                        std::memcpy(&value, &bits, sizeof(value));
+                    }
+                    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+                    return std::string(buffer);
+                }
+                case 0x5:
+                case 0x6: {
+                    uint64_t count = 0;
+                    if (!readCount(pos, count)) {
+                        return std::nullopt;
+                    }
+                    const bool utf16 = (marker >> 4) == 0x6;
+                    if (count > (size_ - pos) / (utf16 ? 2 : 1)) {
+                        return std::nullopt;
+                    }
+                    if (!utf16) {
+                        return std::string(reinterpret_cast<const char*>(data_ + pos), static_cast<size_t>(count));
+                    }
+                    std::string out;
+                    for (uint64_t i = 0; i < count; i++) {
+                        uint32_t c = static_cast<uint32_t>(get(data_ + pos + i * 2, 2));
+                        if (c >= 0xD800 && c < 0xDC00 && i + 1 < count) {
+                            const uint32_t low16 = static_cast<uint32_t>(get(data_ + pos + (i + 1) * 2, 2));
+                            if (low16 >= 0xDC00 && low16 < 0xE000) {
+                                c = 0x10000 + ((c - 0xD800) << 10) + (low16 - 0xDC00);
+                                i++;
+                            }
+                        }
+                        appendUtf8(out, c);
+                    }
+                    return out;
+                }
+                default:
+                    return std::nullopt;
+                }
+            }
+
+            // a scalar, or the scalars of an array
+            bool itemsOf(uint64_t ref, std::vector<std::string>& items) const {
+                size_t pos = 0;
+                if (!object(ref, pos)) {
+                    return false;
+                }
+                if ((data_[pos] >> 4) != 0xA) {
+                    std::optional<std::string> value = scalar(ref);
+                    if (value) {
+                        items.push_back(std::move(*value));
+                    }
+                    return value.has_value();
+                }
+                uint64_t count = 0;
+                if (!readCount(pos, count) || count > (size_ - pos) / refSize_) {
+                    return false;
+                }
+                for (uint64_t i = 0; i < count; i++) {
+                    std::optional<std::string> value = scalar(get(data_ + pos + i * refSize_, refSize_));
+                    if (value) {
+                        items.push_back(std::move(*value));
+                    }
+                }
+                return true;
+            }
+
+            static void appendUtf8(std::string& out, uint32_t c) {
+                if (c < 0x80) {
+                    out.push_back(static_cast<char>(c));
+                } else if (c < 0x800) {
+                    out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+                    out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+                } else if (c < 0x10000) {
+                    out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+                    out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+                } else {
+                    out.push_back(static_cast<char>(0xF0 | (c >> 18)));
+                    out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+                }
+            }
+
+            const uint8_t* data_;
+            size_t size_;
+            size_t offsetSize_ = 0;
+            size_t refSize_ = 0;
+            uint64_t objectCount_ = 0;
+            uint64_t offsetTable_ = 0;
+        };
+
+        class Xml {
+        public:
+            explicit Xml(const std::string& data) : data_(data) {}
+
+            bool readTop(Dictionary& dictionary) {
+                std::string tag;
+                do {
+                    if (!nextTag(tag)) {
+                        return false;
+                    }
+                } while (tag != "dict");
+
+                while (nextTag(tag) && tag != "/dict") {
+                    if (tag != "key") {
+                        return false;
+                    }
+                    const std::string key = text();
+                    if (!nextTag(tag) || tag != "/key" || !nextTag(tag)) {
+                        return false;
+                    }
+                    std::vector<std::string> items;
+                    if (tag == "array") {
+                        while (nextTag(tag) && tag != "/array") {
+                            std::optional<std::string> item = value(tag);
+                            if (item) {
+                                items.push_back(std::move(*item));
+                            } else if (!skip(tag)) {
+                                return false;
+                            }
+                        }
+                        dictionary[key] = std::move(items);
+                    } else if (tag == "array/") {
+                        dictionary[key] = {};
+                    } else if (std::optional<std::string> item = value(tag)) {
+                        dictionary[key] = {std::move(*item)};
+                    } else if (!skip(tag)) {
+                        return false;
+                    }
+                }
+                return tag == "/dict";
+            }
+
+        private:
+            // the next tag's name with a trailing '/' when it closes itself; declarations and comments are skipped
+            bool nextTag(std::string& tag) {
+                while (true) {
+                    const size_t open = data_.find('<', pos_);
+                    if (open == std::string::npos) {
+                        return false;
+                    }
+                    if (data_.compare(open, 4, "<!--") == 0) {
+                        const size_t close = data_.find("-->", open);
+                        if (close == std::string::npos) {
+                            return false;
+                        }
+                        pos_ = close + 3;
+                        continue;
+                    }
+                    const size_t close = data_.find('>', open);
+                    if (close == std::string::npos) {
+                        return false;
+                    }
+                    pos_ = close + 1;
+                    if (data_[open + 1] == '?' || data_[open + 1] == '!') {
+                        continue;
+                    }
+                    std::string inner = data_.substr(open + 1, close - open - 1);
+                    const bool selfClosing = !inner.empty() && inner.back() == '/';
+                    if (selfClosing) {
+                        inner.pop_back();
+                    }
+                    tag = inner.substr(0, inner.find_first_of(" \t\r\n"));
+                    if (selfClosing) {
+                        tag += '/';
+                    }
+                    return true;
+                }
+            }
+
+            std::string text() const {
+                const size_t end = data_.find('<', pos_);
+                return unescape(data_.substr(pos_, end == std::string::npos ? std::string::npos : end - pos_));
+            }
+
+            // a scalar element whose start tag was just read, consumed with its end tag
+            std::optional<std::string> value(const std::string& tag) {
+                if (tag == "true/" || tag == "false/") {
+                    return tag.substr(0, tag.size() - 1);
+                }
+                if (tag == "string/") {
+                    return std::string();
+                }
+                if (tag != "string" && tag != "integer" && tag != "real" && tag != "date") {
+                    return std::nullopt;
+                }
+                std::string item = text();
+                std::string end;
+                if (!nextTag(end) || end != "/" + tag) {
+                    return std::nullopt;
+                }
+                return item;
+            }
+
+            // everything up to the end tag matching an element just opened
+            bool skip(const std::string& tag) {
+                if (!tag.empty() && tag.back() == '/') {
+                    return true;
+                }
+                size_t depth = 1;
+                std::string next;
+                while (depth > 0 && depth < kMaxDepth && nextTag(next)) {
+                    if (next == tag) {
+                        depth++;
+                    } else if (next == "/" + tag) {
+                        depth--;
+                    }
+                }
+                return depth == 0;
+            }
+
+            static std::string unescape(const std::string& in) {
+                static const std::pair<const char*, char> entities[] = {
+                    {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+                std::string out;
+                out.reserve(in.size());
+                for (size_t i = 0; i < in.size(); i++) {
+                    bool replaced = false;
+                    if (in[i] == '&') {
+                        for (const auto& [entity, c] : entities) {
+                            const size_t length = std::strlen(entity);
+                            if (in.compare(i, length, entity) == 0) {
+                                out.push_back(c);
+                                i += length - 1;
+                                replaced = true;
+                                break;
+                            }
+                        }
+                    }
+                    if (!replaced) {
+                        out.push_back(in[i]);
+                    }
+                }
+                return out;
+            }
+
+            const std::string& data_;
+            size_t pos_ = 0;
+        };
+    }
+
+    bool readDictionary(const std::string& data, Dictionary& dictionary) {
+        dictionary.clear();
+        if (data.compare(0, 7, "bplist0") == 0) {
+            return Binary(data).readTop(dictionary);
+        }
+        return Xml(data).readTop(dictionary);
+    }
+
+    std::string value(const Dictionary& dictionary, const std::string& key) {
+        const auto it = dictionary.find(key);
+        return it != dictionary.end() && !it->second.empty() ? it->second.front() : std::string();
+    }
+
+    bool setStrings(std::string& data, std::vector<StringEdit>& edits) {
+        std::string rewritten;
+        if (!Binary(data).setStrings(edits, rewritten)) {
+            return false;
+        }
+        if (!rewritten.empty()) {
+            data = std::move(rewritten);
+        }
+        return true;
+    }
+}
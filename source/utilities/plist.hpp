@@ -0,0 +1,31 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+// Property lists, XML or binary ("bplist00")
+namespace utils::plist {
+    // Top-level keys; a scalar (string, number, boolean, date) is one item, an array of scalars
+    // one item per element. Nested dictionaries and data blobs are left out.
+    using Dictionary = std::map<std::string, std::vector<std::string>>;
+
+    bool readDictionary(const std::string& data, Dictionary& dictionary);
+
+    // First item of a key, empty if absent
+    std::string value(const Dictionary& dictionary, const std::string& key);
+
+    // A string value of the top-level dictionary. A missing key is added after insertAfter when
+    // that key holds a string, as the XML plist rules do.
+    struct StringEdit {
+        enum Result { Missing, Updated, Added };
+
+        std::string key;
+        std::string value;
+        std::string insertAfter;
+        Result result = Missing;
+    };
+
+    // Applies the edits to a binary plist, every other object is kept as it is. data is only
+    // rewritten when a value actually changes; false when it cannot be parsed.
+    bool setStrings(std::string& data, std::vector<StringEdit>& edits);
+}
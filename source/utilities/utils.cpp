@@ -1,11 +1,22 @@
 #include "utils.hpp"
 #include <algorithm>
+#include <cerrno>
 #include <cstdio>
 
+#include <fstream>
+
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
 #else
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
 #endif
 
 namespace utils {
@@ -125,4 +136,251 @@ namespace utils {
         return pclose(pipe) == 0;
 #endif
     }
+
+    uint64_t peakProcessMemory(int64_t pid) {
+#ifdef _WIN32
+        HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+        if (!process) {
+            return 0;
+        }
+        PROCESS_MEMORY_COUNTERS counters = { sizeof(PROCESS_MEMORY_COUNTERS) };
+        uint64_t peak = 0;
+        if (GetProcessMemoryInfo(process, &counters, sizeof(counters))) {
+            peak = counters.PeakWorkingSetSize;
+        }
+        CloseHandle(process);
+        return peak;
+#else
+        std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("VmHWM:", 0) == 0) {
+                return std::stoull(line.substr(6)) * 1024;
+            }
+        }
+        return 0;
+#endif
+    }
+
+    uint64_t physicalMemory() {
+#ifdef _WIN32
+        MEMORYSTATUSEX status = { sizeof(MEMORYSTATUSEX) };
+        return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+        return static_cast<uint64_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<uint64_t>(sysconf(_SC_PAGE_SIZE));
+#endif
+    }
+
+    uint64_t directorySize(const std::string& path) {
+        uint64_t total = 0;
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(path, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->is_regular_file(ec)) {
+                total += it->file_size(ec);
+            }
+        }
+        return total;
+    }
+
+    PreallocatedFile::~PreallocatedFile() {
+        close();
+    }
+
+    bool PreallocatedFile::open(const std::filesystem::path& path, uint64_t size) {
+        close();
+#ifdef _WIN32
+        HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        handle_ = handle;
+        if (size > 0) {
+            // reserves the clusters without moving the end of file, nothing is zero filled
+            FILE_ALLOCATION_INFO info = {};
+            info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+            if (!SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)) &&
+                GetLastError() == ERROR_DISK_FULL) {
+                close();
+                return false;
+            }
+        }
+        return true;
+#else
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+#ifdef __linux__
+        // not posix_fallocate, glibc emulates that by writing zeroes where the file system lacks
+        // fallocate; there (EOPNOTSUPP) the file just gets the plain writes
+        if (size > 0 && fallocate(fd_, 0, 0, static_cast<off_t>(size)) != 0 && errno == ENOSPC) {
+            close();
+            return false;
+        }
+#endif
+        return true;
+#endif
+    }
+
+    bool PreallocatedFile::write(const void* data, size_t size) {
+        const auto* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+#ifdef _WIN32
+            DWORD written = 0;
+            const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+            if (!handle_ || !WriteFile(handle_, bytes, chunk, &written, nullptr) || written == 0) {
+                return false;
+            }
+#else
+            const ssize_t written = fd_ < 0 ? -1 : ::write(fd_, bytes, size);
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+#endif
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    bool PreallocatedFile::close() {
+#ifdef _WIN32
+        if (!handle_) {
+            return true;
+        }
+        const bool ok = CloseHandle(handle_) != 0;
+        handle_ = nullptr;
+        return ok;
+#else
+        if (fd_ < 0) {
+            return true;
+        }
+        const bool ok = ::close(fd_) == 0;
+        fd_ = -1;
+        return ok;
+#endif
+    }
+
+    CopyMethod copyFile(const std::filesystem::path& from, const std::filesystem::path& to) {
+#ifdef _WIN32
+        // CopyFileW stays in the kernel and clones blocks by itself on ReFS
+        return CopyFileW(from.c_str(), to.c_str(), FALSE) ? CopyMethod::Kernel : CopyMethod::Failed;
+#else
+        const int in = ::open(from.c_str(), O_RDONLY);
+        if (in < 0) {
+            return CopyMethod::Failed;
+        }
+        struct stat info = {};
+        if (fstat(in, &info) != 0) {
+            ::close(in);
+            return CopyMethod::Failed;
+        }
+        const int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, info.st_mode & 0777);
+        if (out < 0) {
+            ::close(in);
+            return CopyMethod::Failed;
+        }
+
+        CopyMethod method = CopyMethod::Failed;
+        uint64_t remaining = static_cast<uint64_t>(info.st_size);
+#ifdef __linux__
+#ifdef FICLONE
+        if (ioctl(out, FICLONE, in) == 0) {
+            method = CopyMethod::Reflink;
+            remaining = 0;
+        }
+#endif
+        // both calls move the file offsets, a method that gives up midway leaves the rest to the next
+        while (method == CopyMethod::Failed && remaining > 0) {
+            const ssize_t copied = copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(std::min<uint64_t>(remaining, 1ull << 30)), 0);
+            if (copied <= 0) {
+                break;
+            }
+            remaining -= static_cast<uint64_t>(copied);
+        }
+        while (method == CopyMethod::Failed && remaining > 0) {
+            const ssize_t copied = sendfile(out, in, nullptr, static_cast<size_t>(std::min<uint64_t>(remaining, 1ull << 30)));
+            if (copied <= 0) {
+                break;
+            }
+            remaining -= static_cast<uint64_t>(copied);
+        }
+        if (method == CopyMethod::Failed && remaining == 0) {
+            method = CopyMethod::Kernel;
+        }
+#endif
+        if (method == CopyMethod::Failed) {
+            std::vector<char> buffer(1 << 20);
+            bool ok = true;
+            for (;;) {
+                const ssize_t got = ::read(in, buffer.data(), buffer.size());
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got <= 0) {
+                    ok = got == 0;
+                    break;
+                }
+                for (ssize_t done = 0; ok && done < got;) {
+                    const ssize_t written = ::write(out, buffer.data() + done, static_cast<size_t>(got - done));
+                    if (written < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    ok = written > 0;
+                    done += written;
+                }
+                if (!ok) {
+                    break;
+                }
+            }
+            method = ok ? CopyMethod::Buffered : CopyMethod::Failed;
+        }
+
+        ::close(in);
+        if (::close(out) != 0) {
+            method = CopyMethod::Failed;
+        }
+        if (method == CopyMethod::Failed) {
+            ::unlink(to.c_str());
+        }
+        return method;
+#endif
+    }
+
+    bool moveFile(const std::filesystem::path& from, const std::filesystem::path& to, CopyMethod* method) {
+        std::error_code ec;
+        std::filesystem::rename(from, to, ec);
+        if (!ec) {
+            if (method) {
+                *method = CopyMethod::Renamed;
+            }
+            return true;
+        }
+
+        const CopyMethod copied = copyFile(from, to);
+        if (method) {
+            *method = copied;
+        }
+        return copied != CopyMethod::Failed && std::filesystem::remove(from, ec);
+    }
+
+    const char* toString(CopyMethod method) {
+        switch (method) {
+        case CopyMethod::Reflink:
+            return "reflink";
+        case CopyMethod::Kernel:
+            return "kernel copy";
+        case CopyMethod::Buffered:
+            return "buffered copy";
+        case CopyMethod::Renamed:
+            return "rename";
+        default:
+            return "failed";
+        }
+    }
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <filesystem>
@@ -13,4 +14,50 @@ namespace utils {
     std::string trimEnd(std::string str, char ch);
     
     bool runCommand(const std::string& command, std::string& output);
+
+    // Peak resident memory of a running process in bytes, 0 when it cannot be queried
+    uint64_t peakProcessMemory(int64_t pid);
+    uint64_t physicalMemory();
+    // Sum of the regular file sizes below path
+    uint64_t directorySize(const std::string& path);
+
+    enum class CopyMethod {
+        Failed,
+        // copy-on-write clone, no data is read or written (FICLONE on Btrfs/XFS)
+        Reflink,
+        // copied by the kernel without passing through user space (copy_file_range, sendfile, CopyFileW)
+        Kernel,
+        // 1 MiB read/write loop
+        Buffered,
+        // moveFile only: the rename went through, nothing was copied
+        Renamed,
+    };
+
+    // Copies a file the cheapest way the platform offers, replacing the destination; each method
+    // falls through to the next when the file systems do not support it
+    CopyMethod copyFile(const std::filesystem::path& from, const std::filesystem::path& to);
+    // Renames, or copies and removes the source when the rename crosses file systems
+    bool moveFile(const std::filesystem::path& from, const std::filesystem::path& to, CopyMethod* method = nullptr);
+    const char* toString(CopyMethod method);
+
+    // Output file with its final size reserved on open (fallocate, the NTFS allocation size), so
+    // it is laid out in one piece and a full disk fails up front rather than halfway through
+    class PreallocatedFile {
+    public:
+        PreallocatedFile() = default;
+        ~PreallocatedFile();
+        PreallocatedFile(const PreallocatedFile&) = delete;
+        PreallocatedFile& operator=(const PreallocatedFile&) = delete;
+
+        bool open(const std::filesystem::path& path, uint64_t size);
+        bool write(const void* data, size_t size);
+        bool close();
+
+    private:
+#ifdef _WIN32
+        void* handle_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
 }
@@ -0,0 +1,969 @@
+#include "zip.hpp"
+#include "utils.hpp"
+#include "inflate.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace utils::zip {
+    namespace {
+        constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+        constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+        constexpr uint32_t kEndOfCentralDirSignature = 0x06054b50;
+        constexpr uint32_t kZip64EndOfCentralDirSignature = 0x06064b50;
+        constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+        constexpr size_t kReadChunk = 1 << 16;
+        // uncompressed bytes packDirectory keeps in flight ahead of the writer
+        constexpr uint64_t kPackWindow = 256ull << 20;
+
+        // 1980-01-01 00:00, the earliest date a DOS timestamp can hold
+        constexpr uint16_t kDefaultDosDate = (1 << 5) | 1;
+
+        // extra field Android tools use to pad local headers: alignment, then zeroes
+        constexpr uint16_t kAlignmentExtraId = 0xD935;
+        // general purpose flag: sizes and CRC follow the data instead of the local header
+        constexpr uint16_t kDataDescriptorFlag = 0x0008;
+        // general purpose flag: the name is UTF-8, readers assume CP437 without it
+        constexpr uint16_t kUtf8NameFlag = 0x0800;
+        // MS-DOS directory attribute, in the low byte of the external attributes
+        constexpr uint32_t kDosDirectoryAttribute = 0x10;
+
+        bool isAscii(const std::string& text) {
+            return std::all_of(text.begin(), text.end(), [](char c) { return static_cast<unsigned char>(c) < 0x80; });
+        }
+
+        const std::array<uint32_t, 256>& crcTable() {
+            static const std::array<uint32_t, 256> table = [] {
+                std::array<uint32_t, 256> t{};
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[i] = c;
+                }
+                return t;
+            }();
+            return table;
+        }
+
+        void put16(std::string& out, uint16_t v) {
+            out.push_back(static_cast<char>(v & 0xFF));
+            out.push_back(static_cast<char>(v >> 8));
+        }
+
+        void put32(std::string& out, uint32_t v) {
+            put16(out, static_cast<uint16_t>(v & 0xFFFF));
+            put16(out, static_cast<uint16_t>(v >> 16));
+        }
+
+        uint16_t get16(const uint8_t* p) {
+            return static_cast<uint16_t>(p[0] | (p[1] << 8));
+        }
+
+        uint32_t get32(const uint8_t* p) {
+            return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+        }
+
+        uint64_t get64(const uint8_t* p) {
+            return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+        }
+
+        bool readAt(std::ifstream& in, uint64_t offset, void* buffer, size_t size) {
+            in.clear();
+            in.seekg(static_cast<std::streamoff>(offset));
+            in.read(static_cast<char*>(buffer), static_cast<std::streamsize>(size));
+            return static_cast<size_t>(in.gcount()) == size;
+        }
+    }
+
+    uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+        const auto& table = crcTable();
+        const auto* p = static_cast<const uint8_t*>(data);
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    bool Reader::open(const std::string& path) {
+        path_ = path;
+        entries_.clear();
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        in.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+        if (fileSize < 22) {
+            return false;
+        }
+
+        // the end record sits in the last 22 bytes plus an optional comment of up to 64 KiB
+        const size_t tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize, 22 + 0xFFFF));
+        std::vector<uint8_t> tail(tailSize);
+        if (!readAt(in, fileSize - tailSize, tail.data(), tailSize)) {
+            return false;
+        }
+
+        size_t eocd = std::string::npos;
+        for (size_t i = tailSize - 22 + 1; i-- > 0;) {
+            if (get32(&tail[i]) == kEndOfCentralDirSignature) {
+                eocd = i;
+                break;
+            }
+        }
+        if (eocd == std::string::npos) {
+            return false;
+        }
+
+        uint64_t entryCount = get16(&tail[eocd + 10]);
+        uint64_t centralDirSize = get32(&tail[eocd + 12]);
+        uint64_t centralDirOffset = get32(&tail[eocd + 16]);
+
+        const uint64_t eocdOffset = fileSize - tailSize + eocd;
+        if (eocdOffset >= 20) {
+            uint8_t locator[20];
+            if (readAt(in, eocdOffset - 20, locator, sizeof(locator)) && get32(locator) == kZip64LocatorSignature) {
+                uint8_t record[56];
+                if (!readAt(in, get64(locator + 8), record, sizeof(record)) ||
+                    get32(record) != kZip64EndOfCentralDirSignature) {
+                    return false;
+                }
+                entryCount = get64(record + 32);
+                centralDirSize = get64(record + 40);
+                centralDirOffset = get64(record + 48);
+            }
+        }
+
+        if (centralDirOffset + centralDirSize > fileSize) {
+            return false;
+        }
+        centralDirectoryOffset_ = centralDirOffset;
+        std::vector<uint8_t> central(static_cast<size_t>(centralDirSize));
+        if (!readAt(in, centralDirOffset, central.data(), central.size())) {
+            return false;
+        }
+
+        entries_.reserve(static_cast<size_t>(entryCount));
+        size_t pos = 0;
+        for (uint64_t i = 0; i < entryCount; i++) {
+            if (pos + 46 > central.size() || get32(&central[pos]) != kCentralHeaderSignature) {
+                return false;
+            }
+            const uint8_t* h = &central[pos];
+            Entry entry;
+            entry.versionMadeBy = get16(h + 4);
+            entry.flags = get16(h + 8);
+            entry.method = get16(h + 10);
+            entry.dosTime = get16(h + 12);
+            entry.dosDate = get16(h + 14);
+            entry.crc32 = get32(h + 16);
+            entry.compressedSize = get32(h + 20);
+            entry.uncompressedSize = get32(h + 24);
+            const size_t nameLength = get16(h + 28);
+            const size_t extraLength = get16(h + 30);
+            const size_t commentLength = get16(h + 32);
+            entry.externalAttributes = get32(h + 38);
+            entry.localHeaderOffset = get32(h + 42);
+
+            if (pos + 46 + nameLength + extraLength + commentLength > central.size()) {
+                return false;
+            }
+            entry.name.assign(reinterpret_cast<const char*>(h + 46), nameLength);
+
+            // zip64 extra field only carries the values that overflowed, in this order
+            const uint8_t* extra = h + 46 + nameLength;
+            for (size_t e = 0; e + 4 <= extraLength;) {
+                const uint16_t id = get16(extra + e);
+                const uint16_t size = get16(extra + e + 2);
+                if (id == 0x0001) {
+                    const uint8_t* field = extra + e + 4;
+                    const uint8_t* end = field + size;
+                    if (entry.uncompressedSize == 0xFFFFFFFF && field + 8 <= end) {
+                        entry.uncompressedSize = get64(field);
+                        field += 8;
+                    }
+                    if (entry.compressedSize == 0xFFFFFFFF && field + 8 <= end) {
+                        entry.compressedSize = get64(field);
+                        field += 8;
+                    }
+                    if (entry.localHeaderOffset == 0xFFFFFFFF && field + 8 <= end) {
+                        entry.localHeaderOffset = get64(field);
+                    }
+                }
+                e += 4 + size;
+            }
+
+            entries_.push_back(std::move(entry));
+            pos += 46 + nameLength + extraLength + commentLength;
+        }
+        return true;
+    }
+
+    const Entry* Reader::find(const std::string& name) const {
+        for (const auto& entry : entries_) {
+            if (entry.name == name) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Reader::dataOffset(const Entry& entry, uint64_t& offset) const {
+        std::ifstream in(path_, std::ios::binary);
+        uint8_t header[30];
+        if (!in || !readAt(in, entry.localHeaderOffset, header, sizeof(header)) ||
+            get32(header) != kLocalHeaderSignature) {
+            return false;
+        }
+        offset = entry.localHeaderOffset + 30 + get16(header + 26) + get16(header + 28);
+        return true;
+    }
+
+    bool Reader::readRaw(const Entry& entry, const ChunkFn& sink) const {
+        uint64_t offset = 0;
+        if (!dataOffset(entry, offset)) {
+            return false;
+        }
+
+        std::ifstream in(path_, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(offset));
+        std::vector<uint8_t> buffer(kReadChunk);
+        uint64_t remaining = entry.compressedSize;
+        while (remaining > 0) {
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+            in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(chunk));
+            if (static_cast<size_t>(in.gcount()) != chunk) {
+                return false;
+            }
+            if (!sink(buffer.data(), chunk)) {
+                return false;
+            }
+            remaining -= chunk;
+        }
+        return true;
+    }
+
+    bool Reader::read(const Entry& entry, const ChunkFn& sink) const {
+        uint32_t crc = 0;
+        uint64_t produced = 0;
+        auto checked = [&](const uint8_t* data, size_t size) {
+            crc = crc32(data, size, crc);
+            produced += size;
+            return sink(data, size);
+        };
+
+        if (entry.method == Stored) {
+            if (!readRaw(entry, checked)) {
+                return false;
+            }
+        } else if (entry.method == Deflated) {
+            uint64_t offset = 0;
+            if (!dataOffset(entry, offset)) {
+                return false;
+            }
+            std::ifstream in(path_, std::ios::binary);
+            in.seekg(static_cast<std::streamoff>(offset));
+            uint64_t remaining = entry.compressedSize;
+            auto source = [&](uint8_t* buffer, size_t size) -> size_t {
+                const size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, size));
+                in.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(chunk));
+                const size_t got = static_cast<size_t>(in.gcount());
+                remaining -= got;
+                return got;
+            };
+            if (!utils::inflate(source, checked)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        return produced == entry.uncompressedSize && crc == entry.crc32;
+    }
+
+    bool Reader::scan(const ScanSink& sink) const {
+        std::ifstream in(path_, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        in.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+        in.seekg(0);
+
+        std::vector<const Entry*> order;
+        for (const auto& entry : entries_) {
+            order.push_back(&entry);
+        }
+        std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) {
+            return a->localHeaderOffset < b->localHeaderOffset;
+        });
+
+        uint64_t position = 0;
+        bool aborted = false;
+        std::vector<uint8_t> buffer(kReadChunk);
+        auto pull = [&](uint8_t* data, size_t size) -> size_t {
+            in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+            const size_t got = static_cast<size_t>(in.gcount());
+            if (got > 0 && sink.file && !sink.file(data, got)) {
+                aborted = true;
+                return 0;
+            }
+            position += got;
+            return got;
+        };
+        auto passOther = [&](uint64_t end) {
+            while (position < end) {
+                const uint64_t start = position;
+                const size_t got = pull(buffer.data(), static_cast<size_t>(std::min<uint64_t>(end - position, buffer.size())));
+                if (got == 0 || (sink.other && !sink.other(start, buffer.data(), got))) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (const Entry* entry : order) {
+            uint64_t dataStart = 0;
+            if (entry->localHeaderOffset < position || !dataOffset(*entry, dataStart) || !passOther(dataStart)) {
+                return false;
+            }
+            const uint64_t dataEnd = dataStart + entry->compressedSize;
+            if (dataEnd > fileSize || (sink.beginEntry && !sink.beginEntry(*entry))) {
+                return false;
+            }
+
+            uint32_t crc = 0;
+            uint64_t produced = 0;
+            auto deliver = [&](const uint8_t* data, size_t size) {
+                crc = crc32(data, size, crc);
+                produced += size;
+                if (sink.entryData && !sink.entryData(data, size)) {
+                    aborted = true;
+                    return false;
+                }
+                return true;
+            };
+
+            bool decoded = false;
+            if (entry->method == Deflated) {
+                auto source = [&](uint8_t* data, size_t size) -> size_t {
+                    const size_t chunk = static_cast<size_t>(std::min<uint64_t>(dataEnd - position, size));
+                    return chunk > 0 ? pull(data, chunk) : 0;
+                };
+                decoded = utils::inflate(source, deliver);
+            } else if (entry->method == Stored) {
+                decoded = true;
+                while (decoded && position < dataEnd) {
+                    const size_t got = pull(buffer.data(), static_cast<size_t>(std::min<uint64_t>(dataEnd - position, buffer.size())));
+                    decoded = got > 0 && deliver(buffer.data(), got);
+                }
+            }
+            if (aborted) {
+                return false;
+            }
+            // whatever the decoder left unread still belongs to the entry
+            while (position < dataEnd) {
+                if (pull(buffer.data(), static_cast<size_t>(std::min<uint64_t>(dataEnd - position, buffer.size()))) == 0) {
+                    return false;
+                }
+            }
+
+            const bool intact = decoded && produced == entry->uncompressedSize && crc == entry->crc32;
+            if (sink.endEntry && !sink.endEntry(*entry, intact)) {
+                return false;
+            }
+        }
+        return passOther(fileSize) && !aborted;
+    }
+
+    bool Reader::read(const Entry& entry, std::string& out) const {
+        out.clear();
+        out.reserve(static_cast<size_t>(entry.uncompressedSize));
+        return read(entry, [&out](const uint8_t* data, size_t size) {
+            out.append(reinterpret_cast<const char*>(data), size);
+            return true;
+        });
+    }
+
+    Writer::~Writer() {
+        if (out_.is_open()) {
+            close();
+        }
+    }
+
+    bool Writer::open(const std::string& path) {
+        entries_.clear();
+        offset_ = 0;
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        return out_.is_open();
+    }
+
+    bool Writer::writeLocalHeader(const Entry& entry, const std::string& extra) {
+        std::string header;
+        put32(header, kLocalHeaderSignature);
+        put16(header, 20);
+        put16(header, entry.flags);
+        put16(header, entry.method);
+        put16(header, entry.dosTime);
+        put16(header, entry.dosDate);
+        put32(header, entry.crc32);
+        put32(header, static_cast<uint32_t>(entry.compressedSize));
+        put32(header, static_cast<uint32_t>(entry.uncompressedSize));
+        put16(header, static_cast<uint16_t>(entry.name.size()));
+        put16(header, static_cast<uint16_t>(extra.size()));
+        header += entry.name;
+        header += extra;
+
+        out_.write(header.data(), header.size());
+        offset_ += header.size();
+        return out_.good();
+    }
+
+    bool Writer::addEntry(Entry entry, const void* data, size_t size) {
+        if (!out_.is_open() || size > 0xFFFFFFFFu || entry.uncompressedSize > 0xFFFFFFFFu || offset_ > 0xFFFFFFFFu) {
+            return false;
+        }
+
+        entry.dosDate = kDefaultDosDate;
+        entry.compressedSize = size;
+        entry.localHeaderOffset = offset_;
+        if (!isAscii(entry.name)) {
+            entry.flags |= kUtf8NameFlag;
+        }
+
+        if (!writeLocalHeader(entry)) {
+            return false;
+        }
+        out_.write(static_cast<const char*>(data), size);
+        offset_ += size;
+        entries_.push_back(entry);
+        return out_.good();
+    }
+
+    bool Writer::addStored(const std::string& name, const void* data, size_t size) {
+        Entry entry;
+        entry.name = name;
+        entry.method = Stored;
+        entry.crc32 = crc32(data, size);
+        entry.uncompressedSize = size;
+        return addEntry(entry, data, size);
+    }
+
+    bool Writer::addCompressed(const std::string& name, uint32_t crc, uint64_t uncompressedSize, const std::string& deflated) {
+        Entry entry;
+        entry.name = name;
+        entry.method = Deflated;
+        entry.crc32 = crc;
+        entry.uncompressedSize = uncompressedSize;
+        return addEntry(entry, deflated.data(), deflated.size());
+    }
+
+    bool Writer::addDeflated(const std::string& name, const void* data, size_t size, const DeflateOptions& options) {
+        std::string deflated;
+        if (options.level == 0 || !deflate(data, size, deflated, options) || deflated.size() >= size) {
+            return addStored(name, data, size);
+        }
+        return addCompressed(name, crc32(data, size), size, deflated);
+    }
+
+    bool Writer::addStored(const std::string& name, const std::string& data) {
+        return addStored(name, data.data(), data.size());
+    }
+
+    bool Writer::addDirectory(const std::string& name) {
+        Entry entry;
+        entry.name = name.empty() || name.back() != '/' ? name + "/" : name;
+        entry.method = Stored;
+        entry.externalAttributes = kDosDirectoryAttribute;
+        return addEntry(entry, nullptr, 0);
+    }
+
+    bool Writer::copyFrom(const Reader& reader, const Entry& source, uint32_t alignment) {
+        if (!out_.is_open() || source.compressedSize > 0xFFFFFFFFu || source.uncompressedSize > 0xFFFFFFFFu ||
+            offset_ > 0xFFFFFFFFu) {
+            return false;
+        }
+
+        Entry entry = source;
+        // sizes and CRC go in the local header, the descriptor after the data is not copied
+        entry.flags = static_cast<uint16_t>(entry.flags & ~kDataDescriptorFlag);
+        entry.localHeaderOffset = offset_;
+
+        std::string extra;
+        if (alignment > 1) {
+            const uint64_t dataStart = offset_ + 30 + entry.name.size() + 6;
+            const uint32_t padding = static_cast<uint32_t>((alignment - dataStart % alignment) % alignment);
+            put16(extra, kAlignmentExtraId);
+            put16(extra, static_cast<uint16_t>(2 + padding));
+            put16(extra, static_cast<uint16_t>(std::min<uint32_t>(alignment, 0xFFFF)));
+            extra.append(padding, '\0');
+        }
+
+        if (!writeLocalHeader(entry, extra)) {
+            return false;
+        }
+        const bool copied = reader.readRaw(source, [this](const uint8_t* data, size_t size) {
+            out_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+            offset_ += size;
+            return out_.good();
+        });
+        if (!copied) {
+            return false;
+        }
+        entries_.push_back(entry);
+        return true;
+    }
+
+    bool Writer::close() {
+        if (!out_.is_open()) {
+            return false;
+        }
+
+        const uint64_t centralDirOffset = offset_;
+        std::string central;
+        for (const auto& entry : entries_) {
+            put32(central, kCentralHeaderSignature);
+            put16(central, 20);
+            put16(central, 20);
+            put16(central, entry.flags);
+            put16(central, entry.method);
+            put16(central, entry.dosTime);
+            put16(central, entry.dosDate);
+            put32(central, entry.crc32);
+            put32(central, static_cast<uint32_t>(entry.compressedSize));
+            put32(central, static_cast<uint32_t>(entry.uncompressedSize));
+            put16(central, static_cast<uint16_t>(entry.name.size()));
+            put16(central, 0);
+            put16(central, 0);
+            put16(central, 0);
+            put16(central, 0);
+            put32(central, entry.externalAttributes);
+            put32(central, static_cast<uint32_t>(entry.localHeaderOffset));
+            central += entry.name;
+        }
+
+        const uint64_t centralDirSize = central.size();
+        if (entries_.size() > 0xFFFF || centralDirOffset > 0xFFFFFFFFu || centralDirSize > 0xFFFFFFFFu) {
+            out_.close();
+            return false;
+        }
+        put32(central, kEndOfCentralDirSignature);
+        put16(central, 0);
+        put16(central, 0);
+        put16(central, static_cast<uint16_t>(entries_.size()));
+        put16(central, static_cast<uint16_t>(entries_.size()));
+        put32(central, static_cast<uint32_t>(centralDirSize));
+        put32(central, static_cast<uint32_t>(centralDirOffset));
+        put16(central, 0);
+
+        out_.write(central.data(), central.size());
+        bool ok = out_.good();
+        out_.close();
+        return ok;
+    }
+
+    bool packDirectory(const std::string& root, const std::string& outputPath, const DeflateOptions& options,
+                       PackStats* stats, const std::function<bool(uint64_t, uint64_t)>& progress,
+                       std::string* errorMessage) {
+        namespace fs = std::filesystem;
+        auto fail = [&](const std::string& message) {
+            if (errorMessage) {
+                *errorMessage = message;
+            }
+            return false;
+        };
+        const DeflateBackend* backend = findDeflateBackend(options.backend);
+        if (!backend) {
+            return fail("unknown deflate backend " + options.backend);
+        }
+
+        std::error_code ec;
+        // files, and the empty directories that would otherwise vanish from the archive
+        std::vector<fs::path> files;
+        std::set<fs::path> emptyDirectories;
+        uint64_t totalBytes = 0;
+        for (fs::recursive_directory_iterator it(root, ec), end; it != end && !ec; it.increment(ec)) {
+            if (it->is_regular_file(ec)) {
+                files.push_back(it->path());
+                totalBytes += it->file_size(ec);
+            } else if (it->is_directory(ec) && fs::is_empty(it->path(), ec)) {
+                files.push_back(it->path());
+                emptyDirectories.insert(it->path());
+            }
+        }
+        if (ec) {
+            return fail("could not list " + root + ": " + ec.message());
+        }
+        std::sort(files.begin(), files.end());
+        // the writer has no zip64, so these would only fail once most of the work is done
+        if (files.size() > 0xFFFF) {
+            return fail(std::to_string(files.size()) + " entries, over the 65535 a zip without zip64 holds");
+        }
+        for (const auto& path : files) {
+            if (!emptyDirectories.count(path) && fs::file_size(path, ec) > 0xFFFFFFFFu) {
+                return fail(path.string() + " is over 4 GiB, which needs zip64");
+            }
+        }
+
+        struct Pending {
+            std::string name;
+            bool directory = false;
+            std::string data;
+            uint32_t crc = 0;
+            std::vector<std::string> pieces;
+            size_t remaining = 0;
+            bool failed = false;
+        };
+        struct Job {
+            Pending* file;
+            size_t block;
+        };
+
+        const size_t blockSize = std::max<size_t>(options.blockSize, 32768);
+        std::mutex mutex;
+        std::condition_variable jobReady;
+        std::condition_variable blockDone;
+        std::deque<Job> jobs;
+        bool finished = false;
+
+        auto worker = [&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                jobReady.wait(lock, [&]() { return !jobs.empty() || finished; });
+                if (jobs.empty()) {
+                    return;
+                }
+                const Job job = jobs.front();
+                jobs.pop_front();
+                lock.unlock();
+
+                // each block is primed with the 32 KiB before it, the pieces form one stream
+                Pending& file = *job.file;
+                const auto* input = reinterpret_cast<const uint8_t*>(file.data.data());
+                const size_t start = job.block * blockSize;
+                const size_t length = std::min(blockSize, file.data.size() - start);
+                const size_t history = std::min<size_t>(start, 32768);
+                const bool ok = backend->compress(input + start - history, history, input + start, length,
+                                                  options.level, job.block + 1 == file.pieces.size(),
+                                                  file.pieces[job.block]);
+
+                lock.lock();
+                file.failed = file.failed || !ok;
+                file.remaining--;
+                blockDone.notify_all();
+            }
+        };
+
+        unsigned threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for (unsigned i = 0; i < threads; i++) {
+            pool.emplace_back(worker);
+        }
+        auto stopWorkers = [&]() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+                jobs.clear();
+            }
+            jobReady.notify_all();
+            for (auto& thread : pool) {
+                thread.join();
+            }
+            pool.clear();
+        };
+
+        Writer writer;
+        if (!writer.open(outputPath)) {
+            stopWorkers();
+            return fail("could not create " + outputPath);
+        }
+
+        std::deque<std::unique_ptr<Pending>> window;
+        uint64_t inFlight = 0;
+        PackStats totals;
+        // progress returned false, not an error
+        bool aborted = false;
+        auto writeFront = [&]() {
+            Pending& file = *window.front();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                blockDone.wait(lock, [&]() { return file.remaining == 0; });
+            }
+
+            bool ok = !file.failed;
+            if (ok && file.directory) {
+                ok = writer.addDirectory(file.name);
+            } else if (ok) {
+                size_t compressedSize = 0;
+                for (const auto& piece : file.pieces) {
+                    compressedSize += piece.size();
+                }
+                if (options.level == 0 || compressedSize >= file.data.size()) {
+                    ok = writer.addStored(file.name, file.data);
+                } else {
+                    std::string deflated;
+                    deflated.reserve(compressedSize);
+                    for (const auto& piece : file.pieces) {
+                        deflated += piece;
+                    }
+                    ok = writer.addCompressed(file.name, file.crc, file.data.size(), deflated);
+                }
+            }
+            totals.files++;
+            totals.inputBytes += file.data.size();
+            inFlight -= file.data.size();
+            window.pop_front();
+            aborted = ok && progress && !progress(totals.inputBytes, totalBytes);
+            return ok && !aborted;
+        };
+
+        bool ok = true;
+        for (const auto& path : files) {
+            auto file = std::make_unique<Pending>();
+            const std::u8string name = path.lexically_relative(root).generic_u8string();
+            file->name.assign(name.begin(), name.end());
+            if (emptyDirectories.count(path)) {
+                file->directory = true;
+                window.push_back(std::move(file));
+                continue;
+            }
+            std::ifstream in(path, std::ios::binary);
+            file->data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            if (in.bad()) {
+                stopWorkers();
+                return fail("could not read " + path.string());
+            }
+            file->crc = crc32(file->data.data(), file->data.size());
+
+            const size_t blocks = options.level == 0 ? 0 : std::max<size_t>(1, (file->data.size() + blockSize - 1) / blockSize);
+            file->pieces.resize(blocks);
+            file->remaining = blocks;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t block = 0; block < blocks; block++) {
+                    jobs.push_back({file.get(), block});
+                }
+            }
+            jobReady.notify_all();
+
+            inFlight += file->data.size();
+            window.push_back(std::move(file));
+            while (ok && !window.empty() && inFlight > kPackWindow) {
+                ok = writeFront();
+            }
+            if (!ok) {
+                break;
+            }
+        }
+        while (ok && !window.empty()) {
+            ok = writeFront();
+        }
+
+        stopWorkers();
+        ok = writer.close() && ok;
+        if (!ok && !aborted) {
+            return fail(writer.bytesWritten() > 0xFFFFFFFFu || writer.entries().size() > 0xFFFF
+                            ? "the archive is over 4 GiB, which needs zip64"
+                            : "could not compress or write " + outputPath);
+        }
+        if (ok && stats) {
+            totals.outputBytes = static_cast<uint64_t>(fs::file_size(outputPath, ec));
+            *stats = totals;
+        }
+        return ok;
+    }
+
+    bool extractAll(const std::string& archivePath, const std::string& root, unsigned threads,
+                    ExtractStats* stats, const std::function<bool(uint64_t, uint64_t)>& progress) {
+        namespace fs = std::filesystem;
+        Reader reader;
+        if (!reader.open(archivePath)) {
+            return false;
+        }
+
+        const fs::path base(root);
+        std::set<fs::path> directories;
+        std::vector<std::pair<const Entry*, fs::path>> files;
+        uint64_t totalBytes = 0;
+        for (const auto& entry : reader.entries()) {
+            // names are UTF-8 in IPAs; "../" or absolute names would write outside root
+            const fs::path relative = fs::path(std::u8string(entry.name.begin(), entry.name.end())).lexically_normal();
+            if (relative.empty() || relative.has_root_path() || *relative.begin() == "..") {
+                return false;
+            }
+            if (entry.isDirectory()) {
+                directories.insert(base / relative.parent_path());
+                continue;
+            }
+            directories.insert((base / relative).parent_path());
+            files.emplace_back(&entry, base / relative);
+            totalBytes += entry.uncompressedSize;
+        }
+
+        std::error_code ec;
+        for (const auto& directory : directories) {
+            fs::create_directories(directory, ec);
+            if (ec) {
+                return false;
+            }
+        }
+
+        // the biggest entries start first so one large binary does not finish the run alone
+        std::stable_sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+            return a.first->uncompressedSize > b.first->uncompressedSize;
+        });
+
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::mutex progressMutex;
+        uint64_t extracted = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < files.size() && !failed; i = next++) {
+                const Entry& entry = *files[i].first;
+                PreallocatedFile out;
+                const bool ok = out.open(files[i].second, entry.uncompressedSize) &&
+                                reader.read(entry, [&out](const uint8_t* data, size_t size) {
+                                    return out.write(data, size);
+                                }) &&
+                                out.close();
+                if (!ok) {
+                    failed = true;
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(progressMutex);
+                extracted += entry.uncompressedSize;
+                if (progress && !progress(extracted, totalBytes)) {
+                    failed = true;
+                }
+            }
+        };
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = static_cast<unsigned>(std::clamp<size_t>(threads, 1, std::max<size_t>(1, files.size())));
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : pool) {
+            thread.join();
+        }
+
+        if (failed) {
+            return false;
+        }
+        if (stats) {
+            stats->files = files.size();
+            stats->directories = directories.size();
+            stats->bytes = extracted;
+        }
+        return true;
+    }
+
+    bool normalize(const std::string& inputPath, const std::string& outputPath, const DeflateOptions& options) {
+        Reader reader;
+        if (!reader.open(inputPath)) {
+            return false;
+        }
+
+        std::vector<const Entry*> entries;
+        for (const auto& entry : reader.entries()) {
+            entries.push_back(&entry);
+        }
+        // jar readers expect the manifest to lead
+        auto rank = [](const Entry* entry) { return entry->name == "META-INF/MANIFEST.MF" ? 0 : 1; };
+        std::sort(entries.begin(), entries.end(), [&rank](const Entry* a, const Entry* b) {
+            return rank(a) != rank(b) ? rank(a) < rank(b) : a->name < b->name;
+        });
+        const auto duplicate = std::adjacent_find(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) {
+            return a->name == b->name;
+        });
+        if (duplicate != entries.end()) {
+            return false;
+        }
+
+        Writer writer;
+        if (!writer.open(outputPath)) {
+            return false;
+        }
+        for (const Entry* entry : entries) {
+            std::string data;
+            if (!reader.read(*entry, data)) {
+                return false;
+            }
+            const bool added = entry->method == Stored
+                ? writer.addStored(entry->name, data)
+                : writer.addDeflated(entry->name, data.data(), data.size(), options);
+            if (!added) {
+                return false;
+            }
+        }
+        return writer.close();
+    }
+
+    uint32_t alignmentFor(const Entry& entry, const AlignOptions& options) {
+        if (entry.method != Stored || entry.isDirectory()) {
+            return 0;
+        }
+        const std::string& name = entry.name;
+        const bool nativeLib = name.rfind("lib/", 0) == 0 && name.size() > 3 &&
+                               name.compare(name.size() - 3, 3, ".so") == 0;
+        return nativeLib ? options.nativeLibAlignment : options.storedAlignment;
+    }
+
+    bool align(const std::string& inputPath, const std::string& outputPath, const AlignOptions& options) {
+        Reader reader;
+        if (!reader.open(inputPath)) {
+            return false;
+        }
+
+        // keep the original data order, the central directory may list entries differently
+        std::vector<const Entry*> order;
+        for (const auto& entry : reader.entries()) {
+            order.push_back(&entry);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) {
+            return a->localHeaderOffset < b->localHeaderOffset;
+        });
+
+        Writer writer;
+        if (!writer.open(outputPath)) {
+            return false;
+        }
+        for (const Entry* entry : order) {
+            if (!writer.copyFrom(reader, *entry, alignmentFor(*entry, options))) {
+                return false;
+            }
+        }
+        return writer.close();
+    }
+
+    bool isAligned(const std::string& path, const AlignOptions& options) {
+        Reader reader;
+        if (!reader.open(path)) {
+            return false;
+        }
+        for (const auto& entry : reader.entries()) {
+            const uint32_t alignment = alignmentFor(entry, options);
+            uint64_t offset = 0;
+            if (alignment > 1 && (!reader.dataOffset(entry, offset) || offset % alignment != 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
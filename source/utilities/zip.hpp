@@ -0,0 +1,156 @@
+#pragma once
+#include "deflate.hpp"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace utils::zip {
+    enum Method : uint16_t {
+        Stored = 0,
+        Deflated = 8,
+    };
+
+    struct Entry {
+        std::string name;
+        uint16_t versionMadeBy = 20;
+        uint16_t flags = 0;
+        uint16_t method = Stored;
+        uint16_t dosTime = 0;
+        uint16_t dosDate = 0;
+        uint32_t crc32 = 0;
+        uint64_t compressedSize = 0;
+        uint64_t uncompressedSize = 0;
+        uint64_t localHeaderOffset = 0;
+        uint32_t externalAttributes = 0;
+
+        bool isDirectory() const { return !name.empty() && name.back() == '/'; }
+    };
+
+    using ChunkFn = std::function<bool(const uint8_t* data, size_t size)>;
+
+    // Callbacks of Reader::scan, each one optional; returning false from any aborts the scan
+    struct ScanSink {
+        // every byte of the file, in order
+        ChunkFn file;
+        // bytes outside entry data (headers, descriptors, an APK signing block, the central directory)
+        std::function<bool(uint64_t offset, const uint8_t* data, size_t size)> other;
+        // before the data of each entry, in file order
+        std::function<bool(const Entry& entry)> beginEntry;
+        // uncompressed contents of the current entry
+        ChunkFn entryData;
+        // after each entry, intact when its size and CRC matched
+        std::function<bool(const Entry& entry, bool intact)> endEntry;
+    };
+
+    uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+    // Random access reader over the central directory, entries are streamed on demand.
+    // Every read opens its own file handle so one Reader can be shared between threads.
+    class Reader {
+    public:
+        bool open(const std::string& path);
+
+        const std::string& path() const { return path_; }
+        const std::vector<Entry>& entries() const { return entries_; }
+        const Entry* find(const std::string& name) const;
+
+        // Offset of the entry data, just past its local header
+        bool dataOffset(const Entry& entry, uint64_t& offset) const;
+        // Streams the uncompressed contents, the CRC is verified once the entry is complete
+        bool read(const Entry& entry, const ChunkFn& sink) const;
+        bool read(const Entry& entry, std::string& out) const;
+        // Streams the stored bytes exactly as they are in the archive
+        bool readRaw(const Entry& entry, const ChunkFn& sink) const;
+        // Reads the whole file once, front to back, decoding the entries on the way. A corrupt
+        // entry is reported through endEntry and does not stop the scan.
+        bool scan(const ScanSink& sink) const;
+
+        uint64_t centralDirectoryOffset() const { return centralDirectoryOffset_; }
+
+    private:
+        std::string path_;
+        std::vector<Entry> entries_;
+        uint64_t centralDirectoryOffset_ = 0;
+    };
+
+    class Writer {
+    public:
+        Writer() = default;
+        ~Writer();
+
+        bool open(const std::string& path);
+        bool addStored(const std::string& name, const void* data, size_t size);
+        bool addStored(const std::string& name, const std::string& data);
+        // An empty "name/" entry, for directories that hold nothing else
+        bool addDirectory(const std::string& name);
+        // Deflates the data, in parallel when it is large; kept stored if that is not smaller
+        bool addDeflated(const std::string& name, const void* data, size_t size, const DeflateOptions& options = {});
+        // Adds data already compressed as a raw DEFLATE stream
+        bool addCompressed(const std::string& name, uint32_t crc, uint64_t uncompressedSize, const std::string& deflated);
+        // Copies an entry as it is stored in another archive, its data starting on a multiple of alignment
+        bool copyFrom(const Reader& reader, const Entry& entry, uint32_t alignment = 0);
+        // false as well when the archive needs zip64, which is not written: over 65535 entries, or
+        // an entry or the archive over 4 GiB
+        bool close();
+
+        const std::vector<Entry>& entries() const { return entries_; }
+        uint64_t bytesWritten() const { return offset_; }
+
+    private:
+        bool writeLocalHeader(const Entry& entry, const std::string& extra = std::string());
+        bool addEntry(Entry entry, const void* data, size_t size);
+
+        std::ofstream out_;
+        std::vector<Entry> entries_;
+        uint64_t offset_ = 0;
+    };
+
+    struct AlignOptions {
+        // stored entries, so resources can be mapped straight from the archive
+        uint32_t storedAlignment = 4;
+        // stored lib/**/*.so, on page boundaries so they load without being extracted
+        uint32_t nativeLibAlignment = 16384;
+    };
+
+    struct PackStats {
+        uint64_t files = 0;
+        uint64_t inputBytes = 0;
+        uint64_t outputBytes = 0;
+    };
+
+    // Zips every file and empty directory below root, named relative to it, in sorted order. Files
+    // and the blocks of large files are compressed on every core while earlier ones are written.
+    // Each file is read whole; about 256 MiB of input is kept in flight, more while a larger file
+    // is being compressed. Without zip64, over 65535 entries or 4 GiB fails with errorMessage set.
+    // progress gets the bytes written and the total after each file, returning false aborts.
+    bool packDirectory(const std::string& root, const std::string& outputPath,
+                       const DeflateOptions& options = {}, PackStats* stats = nullptr,
+                       const std::function<bool(uint64_t, uint64_t)>& progress = {},
+                       std::string* errorMessage = nullptr);
+
+    struct ExtractStats {
+        uint64_t files = 0;
+        uint64_t directories = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Extracts the archive below root. Names are checked before anything is written, the
+    // directories are created in one pass, then entries are inflated largest first on threads
+    // (0 for every core) into preallocated files. progress is called from the workers, one at a
+    // time, with the bytes extracted and the total; returning false aborts.
+    bool extractAll(const std::string& archivePath, const std::string& root, unsigned threads = 0,
+                    ExtractStats* stats = nullptr, const std::function<bool(uint64_t, uint64_t)>& progress = {});
+
+    // Rewrites the archive so its bytes only depend on entry names and contents: the manifest
+    // first and the rest sorted by name, fixed times, no extra fields or attributes, and deflated
+    // entries recompressed with options. Stored entries stay stored.
+    bool normalize(const std::string& inputPath, const std::string& outputPath, const DeflateOptions& options = {});
+
+    uint32_t alignmentFor(const Entry& entry, const AlignOptions& options);
+    // Rewrites the archive with every stored entry aligned, as zipalign -p does. Jar signatures
+    // stay valid, APK signature scheme v2+ blocks do not and have to be applied afterwards.
+    bool align(const std::string& inputPath, const std::string& outputPath, const AlignOptions& options = {});
+    bool isAligned(const std::string& path, const AlignOptions& options = {});
+}